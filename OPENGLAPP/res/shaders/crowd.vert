@@ -0,0 +1,92 @@
+#version 430 core
+
+// Lit PBR shader for crowds, each instance is an agent posed from the baked vertex animation textures.
+
+layout (location = 0) in vec4 aPos;
+layout (location = 1) in vec4 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aTangent;
+layout (location = 6) in float aOcclusion; // Zero for meshes that weren't baked.
+
+out vec4 vPosition;
+out vec3 vNormal;
+out vec2 vTexCoords;
+out vec3 vTangent;
+out vec3 vBiTangent;
+out vec3 vViewPosition;
+out float vOcclusion; // Baked at import, see OcclusionBaker.
+
+const int kWidth = 4096; // Texels per row, as VertexAnimationTexture bakes them.
+
+layout (binding = 3) uniform sampler2D vatPositions;
+layout (binding = 4) uniform sampler2D vatNormals;
+
+struct Clip
+{
+	int firstFrame;
+	int frameCount;
+	float frameRate;
+	float duration;
+};
+layout (std430, binding = 4) readonly buffer VatClipSBO
+{
+	Clip clips[];
+};
+
+struct Agent
+{
+	mat4 transform;
+	int clip;
+	float timeOffset;
+	float speed;
+	float padding;
+};
+layout (std430, binding = 5) readonly buffer CrowdAgentSBO
+{
+	Agent agents[];
+};
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 mvp;
+uniform mat3 crowdNormalMatrix; // The model's, worked out once per draw. Agents are only uniformly scaled.
+
+uniform int vatVertexCount;
+uniform float crowdTime; // Seconds since the crowd was loaded.
+
+ivec2 Texel(int frame)
+{
+	int index = frame * vatVertexCount + gl_VertexID;
+	return ivec2(index % kWidth, index / kWidth);
+}
+
+void main()
+{
+	Agent agent = agents[gl_InstanceID];
+	Clip clip = clips[agent.clip];
+
+	// Loop the clip and blend the two frames either side, the last frame blends back into the first.
+	float frame = fract((crowdTime * agent.speed + agent.timeOffset) / max(clip.duration, 0.0001)) * clip.frameCount;
+	int frame0 = min(int(frame), clip.frameCount - 1);
+	int frame1 = (frame0 + 1) % clip.frameCount;
+	float t = frame - float(frame0);
+
+	vec4 position = vec4(mix(texelFetch(vatPositions, Texel(clip.firstFrame + frame0), 0).xyz,
+		texelFetch(vatPositions, Texel(clip.firstFrame + frame1), 0).xyz, t), 1.0);
+	vec3 normal = normalize(mix(texelFetch(vatNormals, Texel(clip.firstFrame + frame0), 0).xyz,
+		texelFetch(vatNormals, Texel(clip.firstFrame + frame1), 0).xyz, t));
+
+	// Only normals are baked, the bind tangent is bent back to right angles with the posed normal.
+	vec3 tangent = aTangent.xyz - normal * dot(normal, aTangent.xyz);
+
+	mat4 agentModel = model * agent.transform;
+	vPosition = agentModel * position;
+	vViewPosition = (view * vPosition).xyz;
+	vNormal = crowdNormalMatrix * (mat3(agent.transform) * normal);
+	vTexCoords = aTexCoords;
+	vTangent = (agentModel * vec4(tangent, 0.0)).xyz;
+	vBiTangent = cross(vNormal, vTangent) * aTangent.w;
+	vOcclusion = aOcclusion;
+
+	gl_Position = mvp * agent.transform * position;
+}
@@ -24,6 +24,14 @@ struct SpotLight
 	float outerCutoff;
 };
 
+struct Material
+{
+	vec4 Ka; // Ambient material colour
+	vec4 Kd; // Diffuse material colour
+	vec4 Ks; // Specular material colour, w is the specular power
+	ivec4 layers; // Texture array and layer of each map as (array << 16 | layer), -1 for maps bound on their own
+};
+
 // Outputs
 out vec4 fragColor;
 
@@ -34,28 +42,42 @@ in vec2 vTexCoords;
 in vec3 vTangent;
 in vec3 vBiTangent;
 in vec3 vViewPosition;
+in float vOcclusion; // Fraction of the hemisphere blocked by the mesh itself.
 
 // Uniforms
 uniform vec3 cameraPosition;
 
-uniform vec3 ambientColor;
+uniform vec3 ambientColor; // Unless there's an environment to light by.
 uniform vec3 sunlightDir;
 uniform vec3 sunlightColor;
 
-uniform float specular; // Material specular power
-uniform vec3 Ka; // Ambient material colour
-uniform vec3 Kd; // Diffuse material colour
-uniform vec3 Ks; // Specular material colour
+uniform int materialIndex; // Into MaterialSBO.
+
+layout (binding = 0) uniform sampler2D diffuseTex;
+layout (binding = 1) uniform sampler2D specularTex;
+layout (binding = 2) uniform sampler2D normalTex;
+layout (binding = 5) uniform sampler2DArray materialArrays[8]; // Small maps packed together, see TextureArrays.
+layout (binding = 13) uniform samplerCube environmentMap; // Prefiltered, rougher with each mip, see EnvironmentMap.
 
-uniform sampler2D diffuseTex;
-uniform sampler2D specularTex;
-uniform sampler2D normalTex;
+uniform bool useEnvironment = false;
+uniform vec3 environmentSH[9]; // Irradiance over pi as L2 spherical harmonics.
+uniform float environmentMaxLod;
+
+layout (binding = 14) uniform sampler3D probeVolume; // L1 spherical harmonics per probe, see ProbeVolume.
+
+uniform bool useProbes = false;
+uniform vec3 probeVolumeMin;
+uniform vec3 probeVolumeSize;
+uniform vec3 probeCounts;
+uniform float probeNormalBias; // Pushes the lookup off the surface, so probes behind it leak less.
 
 uniform int numPointLights;
 uniform int numSpotLights;
 
 uniform bool drawFog = false;
 
+uniform float lodFade = 0.0; // Fade between levels of detail, positive for the incoming level, negative for the outgoing.
+
 // Storage buffer objects.
 layout (std430, binding = 0) readonly buffer PointLightSBO
 {
@@ -67,6 +89,11 @@ layout (std430, binding = 1) readonly buffer SpotLightSBO
 	SpotLight spotLights[];
 };
 
+layout (std430, binding = 2) readonly buffer MaterialSBO
+{
+	Material materials[];
+};
+
 // Constants
 const float roughness = 0.5f; // Should probably be a parameter or uniform.
 const float reflectionCoefficient = 1.4f; // Should also probably be a parameter or uniform.
@@ -118,12 +145,73 @@ vec3 GetSpecular(vec3 direction, vec3 color, vec3 normal, vec3 view)
 	return color * (max((D*G*F) / (NdE * pi), 0.0f));
 }
 
+// Ordered dither threshold for this pixel, between 0 and 1.
+float DitherThreshold()
+{
+	const float bayer[16] = float[16](
+		0.0, 8.0, 2.0, 10.0,
+		12.0, 4.0, 14.0, 6.0,
+		3.0, 11.0, 1.0, 9.0,
+		15.0, 7.0, 13.0, 5.0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+}
+
+// Diffuse light from the environment on a surface facing the normal.
+vec3 EvaluateSH(vec3 n)
+{
+	vec3 result = environmentSH[0] * 0.282095;
+	result += environmentSH[1] * (0.488603 * n.y);
+	result += environmentSH[2] * (0.488603 * n.z);
+	result += environmentSH[3] * (0.488603 * n.x);
+	result += environmentSH[4] * (1.092548 * n.x * n.y);
+	result += environmentSH[5] * (1.092548 * n.y * n.z);
+	result += environmentSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0));
+	result += environmentSH[7] * (1.092548 * n.x * n.z);
+	result += environmentSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+	return max(result, vec3(0.0));
+}
+
+// Indirect light from the probes around a point, false outside the volume.
+bool SampleProbes(vec3 position, vec3 n, out vec3 irradiance)
+{
+	irradiance = vec3(0.0);
+	vec3 uvw = (position + n * probeNormalBias - probeVolumeMin) / probeVolumeSize;
+	if (any(lessThan(uvw, vec3(0.0))) || any(greaterThan(uvw, vec3(1.0))))
+		return false;
+
+	// Between the centres of the outer probes' texels, the red, green and blue blocks stacked along z.
+	vec3 texel = (uvw * (probeCounts - 1.0) + 0.5) / probeCounts;
+	texel.z /= 3.0;
+	vec4 basis = vec4(0.282095, 0.488603 * n.y, 0.488603 * n.z, 0.488603 * n.x);
+	irradiance.r = dot(texture(probeVolume, texel), basis);
+	irradiance.g = dot(texture(probeVolume, texel + vec3(0.0, 0.0, 1.0 / 3.0)), basis);
+	irradiance.b = dot(texture(probeVolume, texel + vec3(0.0, 0.0, 2.0 / 3.0)), basis);
+	irradiance = max(irradiance, vec3(0.0));
+	return true;
+}
+
+// A material map from wherever it is, its own unit or a layer of one of the arrays. Every fragment of a draw takes the
+// same branch and array, they come from the draw's material.
+vec4 SampleMap(sampler2D map, int slot)
+{
+	if (slot < 0)
+		return texture(map, vTexCoords);
+	return texture(materialArrays[slot >> 16], vec3(vTexCoords, slot & 0xFFFF));
+}
+
 void main()
 {
+	// The incoming level keeps the pixels under the fade and the outgoing one keeps the rest, so they never overlap.
+	if (lodFade != 0.0 && ((DitherThreshold() < abs(lodFade)) != (lodFade > 0.0)))
+		discard;
+
 	// Sample textuers.
-	vec3 diffSample = texture(diffuseTex, vTexCoords).rgb;
-	vec3 specSample = texture(specularTex, vTexCoords).rgb;
-	vec3 normSample = texture(normalTex, vTexCoords).rgb;
+	ivec4 layers = materials[materialIndex].layers;
+	vec3 diffSample = SampleMap(diffuseTex, layers.x).rgb;
+	vec3 specSample = SampleMap(specularTex, layers.y).rgb;
+	vec2 normXY = SampleMap(normalTex, layers.z).rg * 2 - 1; // Normal maps only keep two channels, rebuild the third.
+	vec3 normSample = vec3(normXY, sqrt(max(1 - dot(normXY, normXY), 0)));
 
 	// Make sure these are actually normalized.
 	vec3 N = normalize(vNormal);
@@ -133,7 +221,7 @@ void main()
 
 	mat3 TBN = mat3(T,B,N);
 
-	N = TBN * (normSample * 2 - 1); // Modify normals by normal map & tangents.
+	N = TBN * normSample; // Modify normals by normal map & tangents.
 
 	vec3 V = normalize(cameraPosition - vPosition.xyz); // Calculate view vector.
 
@@ -178,10 +266,26 @@ void main()
 		specularTotal += GetSpecular(direction, color, N, V);
 	}
 
+	// Light from the environment, the mip to read matches the roughness it was prefiltered for. Baked occlusion
+	// shades it where the mesh blocks its own view of the surroundings, direct light is left alone.
+	float visibility = 1.0 - vOcclusion;
+	vec3 ambientLight = ambientColor;
+	if (useEnvironment)
+	{
+		ambientLight = EvaluateSH(N);
+		specularTotal += textureLod(environmentMap, reflect(-V, N), roughness * environmentMaxLod).rgb * visibility;
+	}
+
+	// Baked indirect light takes over wherever there are probes, it already has the sky in it.
+	vec3 probeLight;
+	if (useProbes && SampleProbes(vPosition.xyz, N, probeLight))
+		ambientLight = probeLight;
+
 	// Apply shading, textures, and material properties.
-	vec3 ambient = ambientColor * Ka * diffSample;
-	vec3 diffuse = Kd * diffuseTotal * diffSample;
-	vec3 specular = Ks * specularTotal * specSample;
+	Material material = materials[materialIndex];
+	vec3 ambient = ambientLight * visibility * material.Ka.rgb * diffSample;
+	vec3 diffuse = material.Kd.rgb * diffuseTotal * diffSample;
+	vec3 specular = material.Ks.rgb * specularTotal * specSample;
 	vec3 result = ambient + diffuse + specular;
 
 	// Mix shading result with fog effect.
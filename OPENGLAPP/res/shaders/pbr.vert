@@ -6,6 +6,7 @@ layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec4 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec4 aTangent;
+layout (location = 6) in float aOcclusion; // Zero for meshes that weren't baked.
 
 out vec4 vPosition;
 out vec3 vNormal;
@@ -13,6 +14,7 @@ out vec2 vTexCoords;
 out vec3 vTangent;
 out vec3 vBiTangent;
 out vec3 vViewPosition;
+out float vOcclusion; // Baked at import, see OcclusionBaker.
 
 uniform mat4 model;
 uniform mat4 view;
@@ -26,6 +28,7 @@ void main()
 	vTexCoords = aTexCoords;
 	vTangent = (model * vec4(aTangent.xyz, 0.0)).xyz;
 	vBiTangent = cross(vNormal, vTangent) * aTangent.w;
+	vOcclusion = aOcclusion;
 
 	gl_Position = mvp * aPos;
 }
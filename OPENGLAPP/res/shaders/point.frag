@@ -0,0 +1,15 @@
+#version 430 core
+
+in vec3 vColor;
+
+out vec4 fragColor;
+
+void main()
+{
+	// Round splats out of the square points.
+	vec2 offset = gl_PointCoord * 2.0 - 1.0;
+	if (dot(offset, offset) > 1.0)
+		discard;
+
+	fragColor = vec4(vColor, 1.0);
+}
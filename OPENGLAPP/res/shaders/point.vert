@@ -0,0 +1,37 @@
+#version 430 core
+
+// Point cloud splats. Each is sized to cover the gap to its neighbours, from the spacing of the octree node it's in.
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aColor;
+layout (location = 2) in vec4 aNormal; // Zero if the scan didn't have normals.
+
+out vec3 vColor;
+
+uniform mat4 model;
+uniform mat4 mvp;
+
+uniform vec3 sunlightDir;
+uniform vec3 sunlightColor;
+uniform vec3 ambientColor;
+
+uniform vec3 nodeCenter;
+uniform float octantSpacing[8]; // Finer where the node's children are drawn too.
+uniform float pixelsPerUnit; // Screen size of a unit at a depth of one, including the point size scale.
+uniform float maxPointSize;
+
+void main()
+{
+	gl_Position = mvp * vec4(aPos, 1.0);
+
+	ivec3 side = ivec3(greaterThanEqual(aPos, nodeCenter));
+	float spacing = octantSpacing[side.x + side.y * 2 + side.z * 4];
+	gl_PointSize = clamp(spacing * pixelsPerUnit / max(gl_Position.w, 1e-4), 1.0, maxPointSize);
+
+	vColor = aColor.rgb;
+	if (dot(aNormal.xyz, aNormal.xyz) > 0.25)
+	{
+		vec3 N = normalize(mat3(model) * aNormal.xyz);
+		vColor *= ambientColor + sunlightColor * max(dot(N, normalize(sunlightDir)), 0.0);
+	}
+}
@@ -24,6 +24,14 @@ struct SpotLight
 	float outerCutoff;
 };
 
+struct Material
+{
+	vec4 Ka; // Ambient material colour
+	vec4 Kd; // Diffuse material colour
+	vec4 Ks; // Specular material colour, w is the specular power
+	ivec4 layers; // Texture array and layer of each map as (array << 16 | layer), -1 for maps bound on their own
+};
+
 // Outputs
 out vec4 fragColor;
 
@@ -42,14 +50,12 @@ uniform vec3 ambientColor;
 uniform vec3 sunlightDir;
 uniform vec3 sunlightColor;
 
-uniform float specular; // Material specular power
-uniform vec3 Ka; // Ambient material colour
-uniform vec3 Kd; // Diffuse material colour
-uniform vec3 Ks; // Specular material colour
+uniform int materialIndex; // Into MaterialSBO.
 
-uniform sampler2D diffuseTex;
-uniform sampler2D specularTex;
-uniform sampler2D normalTex;
+layout (binding = 0) uniform sampler2D diffuseTex;
+layout (binding = 1) uniform sampler2D specularTex;
+layout (binding = 2) uniform sampler2D normalTex;
+layout (binding = 5) uniform sampler2DArray materialArrays[8]; // Small maps packed together, see TextureArrays.
 
 uniform int numPointLights;
 uniform int numSpotLights;
@@ -67,6 +73,11 @@ layout (std430, binding = 1) readonly buffer SpotLightSBO
 	SpotLight spotLights[];
 };
 
+layout (std430, binding = 2) readonly buffer MaterialSBO
+{
+	Material materials[];
+};
+
 vec3 GetDiffuse(vec3 direction, vec3 color, vec3 normal, vec3 view)
 {
 	return color * max(0, dot(normal, -direction)); // Basic phong-lambert diffuse calculation.
@@ -76,16 +87,27 @@ vec3 GetSpecular(vec3 direction, vec3 color, vec3 normal, vec3 view)
 {
 	// Phong-specular calculation.
 	vec3 R = reflect(direction, normal);
-	float specularTerm = pow(max(0, dot(R, view)), specular);
+	float specularTerm = pow(max(0, dot(R, view)), materials[materialIndex].Ks.w);
 	return specularTerm * color;
 }
 
+// A material map from wherever it is, its own unit or a layer of one of the arrays. Every fragment of a draw takes the
+// same branch and array, they come from the draw's material.
+vec4 SampleMap(sampler2D map, int slot)
+{
+	if (slot < 0)
+		return texture(map, vTexCoords);
+	return texture(materialArrays[slot >> 16], vec3(vTexCoords, slot & 0xFFFF));
+}
+
 void main()
 {
 	// Sample textuers.
-	vec3 diffSample = texture(diffuseTex, vTexCoords).rgb;
-	vec3 specSample = texture(specularTex, vTexCoords).rgb;
-	vec3 normSample = texture(normalTex, vTexCoords).rgb;
+	ivec4 layers = materials[materialIndex].layers;
+	vec3 diffSample = SampleMap(diffuseTex, layers.x).rgb;
+	vec3 specSample = SampleMap(specularTex, layers.y).rgb;
+	vec2 normXY = SampleMap(normalTex, layers.z).rg * 2 - 1; // Normal maps only keep two channels, rebuild the third.
+	vec3 normSample = vec3(normXY, sqrt(max(1 - dot(normXY, normXY), 0)));
 
 	// Make sure these are actually normalized.
 	vec3 N = normalize(vNormal);
@@ -95,7 +117,7 @@ void main()
 
 	mat3 TBN = mat3(T,B,N);
 
-	N = TBN * (normSample * 2 - 1); // Modify normals by normal map & tangents.
+	N = TBN * normSample; // Modify normals by normal map & tangents.
 
 	vec3 V = normalize(cameraPosition - vPosition.xyz); // Calculate view vector.
 
@@ -141,9 +163,10 @@ void main()
 	}
 
 	// Apply shading, textures, and material properties.
-	vec3 ambient = ambientColor * Ka * diffSample;
-	vec3 diffuse = Kd * diffuseTotal * diffSample;
-	vec3 specular = Ks * specularTotal * specSample;
+	Material material = materials[materialIndex];
+	vec3 ambient = ambientColor * material.Ka.rgb * diffSample;
+	vec3 diffuse = material.Kd.rgb * diffuseTotal * diffSample;
+	vec3 specular = material.Ks.rgb * specularTotal * specSample;
 	vec3 result = ambient + diffuse + specular;
 
 	// Mix shading result with fog effect.
@@ -0,0 +1,57 @@
+#version 430 core
+
+// Lit PBR shader for skinned meshes, blends each vertex by up to four bones.
+
+layout (location = 0) in vec4 aPos;
+layout (location = 1) in vec4 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aTangent;
+layout (location = 4) in uvec4 aBoneIndices;
+layout (location = 5) in vec4 aBoneWeights;
+layout (location = 6) in float aOcclusion; // Zero for meshes that weren't baked.
+
+out vec4 vPosition;
+out vec3 vNormal;
+out vec2 vTexCoords;
+out vec3 vTangent;
+out vec3 vBiTangent;
+out vec3 vViewPosition;
+out float vOcclusion; // Baked at import, see OcclusionBaker.
+
+// Every animated instance's bones back to back.
+layout (std430, binding = 3) readonly buffer BonePaletteSBO
+{
+	mat4 bones[];
+};
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 mvp;
+
+uniform int boneOffset; // This instance's first bone, negative if the vertices were already skinned on the CPU.
+
+void main()
+{
+	mat4 skin = mat4(1.0);
+	if (boneOffset >= 0)
+	{
+		skin = bones[boneOffset + aBoneIndices.x] * aBoneWeights.x +
+			bones[boneOffset + aBoneIndices.y] * aBoneWeights.y +
+			bones[boneOffset + aBoneIndices.z] * aBoneWeights.z +
+			bones[boneOffset + aBoneIndices.w] * aBoneWeights.w;
+	}
+
+	vec4 position = skin * aPos;
+	vec3 normal = mat3(skin) * aNormal.xyz;
+	vec3 tangent = mat3(skin) * aTangent.xyz;
+
+	vPosition = model * position;
+	vViewPosition = (view * vPosition).xyz;
+	vNormal = mat3(transpose(inverse(model))) * normal;
+	vTexCoords = aTexCoords;
+	vTangent = (model * vec4(tangent, 0.0)).xyz;
+	vBiTangent = cross(vNormal, vTangent) * aTangent.w;
+	vOcclusion = aOcclusion;
+
+	gl_Position = mvp * position;
+}
@@ -22,7 +22,7 @@ void main()
 {
 	vPosition = model * aPos;
 	vViewPosition = (view * vPosition).xyz;
-	vNormal = (model * aNormal).xyz;
+	vNormal = (model * vec4(aNormal.xyz, 0.0)).xyz; // w holds baked occlusion.
 	vTexCoords = aTexCoords;
 	vTangent = (model * vec4(aTangent.xyz, 0.0)).xyz;
 	vBiTangent = cross(vNormal, vTangent) * aTangent.w;
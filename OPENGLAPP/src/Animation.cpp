@@ -0,0 +1,160 @@
+#include "Animation.h"
+
+#include "SkinnedMesh.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glad.h>
+
+namespace
+{
+	const size_t kAnimatorsPerTask = 16; // Fewer than this and a task costs more to hand out than to run.
+	const size_t kMinCapacity = 256; // Bones.
+}
+
+int Skeleton::FindJoint(const std::string &name) const
+{
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		if (names[i] == name)
+			return (int)i;
+	}
+	return -1;
+}
+
+Animator::Animator(SkinnedMesh *mesh)
+	: m_mesh(mesh)
+{
+	const Skeleton &skeleton = m_mesh->GetSkeleton();
+	m_translations = skeleton.bindTranslations;
+	m_rotations = skeleton.bindRotations;
+	m_scales = skeleton.bindScales;
+
+	if (!m_mesh->GetClips().empty())
+		SetClip(0);
+}
+
+unsigned int Animator::GetBoneCount() const
+{
+	return m_mesh->GetSkeleton().GetBoneCount();
+}
+
+void Animator::SetClip(int clip)
+{
+	const std::vector<CompressedClip> &clips = m_mesh->GetClips();
+	m_clip = (clip >= 0 && clip < (int)clips.size()) ? clip : -1;
+	m_time = 0.0f;
+	m_cursors.assign(m_clip >= 0 ? clips[m_clip].GetTrackCount() * 3 : 0, 0);
+}
+
+void Animator::Evaluate(float dt, glm::mat4 *palette)
+{
+	const Skeleton &skeleton = m_mesh->GetSkeleton();
+	unsigned int jointCount = skeleton.GetJointCount();
+
+	// Start from the bind pose, joints the clip doesn't key stay there.
+	std::copy(skeleton.bindTranslations.begin(), skeleton.bindTranslations.end(), m_translations.begin());
+	std::copy(skeleton.bindRotations.begin(), skeleton.bindRotations.end(), m_rotations.begin());
+	std::copy(skeleton.bindScales.begin(), skeleton.bindScales.end(), m_scales.begin());
+
+	if (m_clip >= 0)
+	{
+		const CompressedClip &clip = m_mesh->GetClips()[m_clip];
+		float duration = clip.GetDuration();
+		if (!m_paused)
+			m_time += dt * m_speed;
+		if (duration <= 0.0f)
+			m_time = 0.0f;
+		else if (m_looping)
+			m_time -= std::floor(m_time / duration) * duration;
+		else
+			m_time = glm::clamp(m_time, 0.0f, duration);
+
+		clip.Sample(m_time, m_cursors.data(), m_translations.data(), m_rotations.data(), m_scales.data());
+	}
+
+	// Local to model space. Parents come first, so each joint's parent is already done.
+	thread_local std::vector<glm::mat4> world;
+	world.resize(jointCount);
+	for (unsigned int i = 0; i < jointCount; i++)
+	{
+		glm::mat4 local = glm::mat4_cast(m_rotations[i]);
+		local[0] *= m_scales[i].x;
+		local[1] *= m_scales[i].y;
+		local[2] *= m_scales[i].z;
+		local[3] = glm::vec4(m_translations[i], 1.0f);
+
+		int parent = skeleton.parents[i];
+		world[i] = parent >= 0 ? world[parent] * local : local;
+	}
+
+	unsigned int boneCount = skeleton.GetBoneCount();
+	for (unsigned int i = 0; i < boneCount; i++)
+		palette[i] = world[skeleton.boneJoints[i]] * skeleton.inverseBindMatrices[i];
+}
+
+void Animator::Bind(aie::ShaderProgram *shader)
+{
+	m_mesh->SetPose(this);
+
+	// The CPU path hands the shader vertices that are already skinned, a negative offset tells it to leave them be.
+	int location = shader->getCachedUniform("boneOffset");
+	if (location >= 0)
+		shader->bindUniform(location, m_mesh->IsGpuSkinning() ? (int)m_paletteOffset : -1);
+}
+
+AnimationSystem::AnimationSystem()
+{ }
+AnimationSystem::~AnimationSystem()
+{
+	glDeleteBuffers(1, &m_buffer);
+}
+
+void AnimationSystem::Add(Animator *animator)
+{
+	m_animators.push_back(animator);
+}
+
+void AnimationSystem::Remove(Animator *animator)
+{
+	m_animators.erase(std::remove(m_animators.begin(), m_animators.end(), animator), m_animators.end());
+}
+
+void AnimationSystem::Update(float dt)
+{
+	// Lay the palettes out back to back, each animator writes straight into its own range.
+	size_t boneCount = 0;
+	for (Animator *animator : m_animators)
+	{
+		animator->m_paletteOffset = (unsigned int)boneCount;
+		boneCount += animator->GetBoneCount();
+	}
+	m_palette.resize(boneCount);
+	for (Animator *animator : m_animators)
+		animator->m_palette = m_palette.data() + animator->m_paletteOffset;
+
+	ThreadPool::Get().ParallelFor(m_animators.size(), kAnimatorsPerTask, [this, dt](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			m_animators[i]->Evaluate(dt, m_palette.data() + m_animators[i]->m_paletteOffset);
+	});
+
+	if (boneCount == 0)
+		return;
+
+	if (boneCount > m_capacity)
+	{
+		glDeleteBuffers(1, &m_buffer);
+		m_capacity = std::max(kMinCapacity, boneCount * 2);
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(m_capacity * sizeof(glm::mat4)), nullptr, GL_DYNAMIC_DRAW);
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kBoneBinding, m_buffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr)(boneCount * sizeof(glm::mat4)), m_palette.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
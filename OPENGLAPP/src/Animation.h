@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Common.h"
+
+namespace aie
+{
+	class ShaderProgram;
+}
+
+class SkinnedMesh;
+
+// Joint hierarchy of a skinned model. Parents always come before their children, so poses resolve in one pass.
+struct Skeleton
+{
+	std::vector<std::string> names;
+	std::vector<int> parents; // -1 for the root.
+
+	// Bind pose relative to the parent, stored across so a pose can start as a straight copy of it.
+	std::vector<glm::vec3> bindTranslations;
+	std::vector<glm::quat> bindRotations;
+	std::vector<glm::vec3> bindScales;
+
+	// The joints the vertices are skinned to, in the order their bone indices count them.
+	std::vector<unsigned int> boneJoints;
+	std::vector<glm::mat4> inverseBindMatrices; // Mesh space to the bone's space in the bind pose.
+
+	unsigned int GetJointCount() const { return (unsigned int)parents.size(); }
+	unsigned int GetBoneCount() const { return (unsigned int)boneJoints.size(); }
+	int FindJoint(const std::string &name) const; // -1 if there's no joint by that name.
+};
+
+// Keyframes for one joint. Exporters often key each channel at different times, so they keep their own.
+struct AnimationTrack
+{
+	unsigned int joint;
+	std::vector<float> translationTimes; // Seconds.
+	std::vector<glm::vec3> translations;
+	std::vector<float> rotationTimes;
+	std::vector<glm::quat> rotations;
+	std::vector<float> scaleTimes;
+	std::vector<glm::vec3> scales;
+};
+
+// A clip as it's imported, compressed into a CompressedClip before anything plays it.
+struct AnimationClip
+{
+	std::string name;
+	float duration = 0.0f; // Seconds.
+	std::vector<AnimationTrack> tracks; // Joints without one hold their bind pose.
+};
+
+// Plays a skinned mesh's clips for one instance. Each track remembers the key it was last sampled at, so a frame only
+// steps forward from there instead of searching the whole track again.
+class Animator
+{
+public:
+	explicit Animator(SkinnedMesh *mesh); // The mesh has to outlive the animator.
+
+	void SetClip(int clip); // -1 holds the bind pose.
+	int GetClip() const { return m_clip; }
+	float &GetTime() { return m_time; } // Seconds into the clip.
+	float &GetSpeed() { return m_speed; }
+	bool &GetLooping() { return m_looping; }
+	bool &GetPaused() { return m_paused; }
+
+	SkinnedMesh *GetMesh() const { return m_mesh; }
+	unsigned int GetBoneCount() const;
+	unsigned int GetPaletteOffset() const { return m_paletteOffset; }
+	const glm::mat4 *GetPalette() const { return m_palette; } // Written by the last AnimationSystem::Update.
+
+	// Advances the clip and writes a skinning matrix per bone into palette. Only touches this animator's state, so any
+	// number can be evaluated at once.
+	void Evaluate(float dt, glm::mat4 *palette);
+
+	// Points the shader and mesh at this animator's pose, call before drawing the mesh.
+	void Bind(aie::ShaderProgram *shader);
+
+private:
+	friend class AnimationSystem;
+
+	SkinnedMesh *m_mesh;
+	int m_clip = -1;
+	float m_time = 0.0f;
+	float m_speed = 1.0f;
+	bool m_looping = true;
+	bool m_paused = false;
+
+	// Local pose, across rather than a transform per joint so sampling writes each channel in a tight loop.
+	std::vector<glm::vec3> m_translations;
+	std::vector<glm::quat> m_rotations;
+	std::vector<glm::vec3> m_scales;
+	std::vector<unsigned int> m_cursors; // Three per track, the key each channel was last sampled after.
+
+	unsigned int m_paletteOffset = 0; // In bones, into the system's storage buffer.
+	const glm::mat4 *m_palette = nullptr;
+
+};
+
+// Evaluates every animator in a scene across the thread pool, a batch of them per task, and uploads all the bone
+// palettes to one storage buffer for the skinned shader. Main thread only.
+class AnimationSystem
+{
+public:
+	static const unsigned int kBoneBinding = 3; // BonePaletteSBO in the skinned shader.
+
+public:
+	AnimationSystem();
+	~AnimationSystem();
+
+	void Add(Animator *animator);
+	void Remove(Animator *animator);
+
+	void Update(float dt);
+
+	unsigned int GetAnimatorCount() const { return (unsigned int)m_animators.size(); }
+	unsigned int GetBoneCount() const { return (unsigned int)m_palette.size(); }
+
+private:
+	std::vector<Animator *> m_animators;
+	std::vector<glm::mat4> m_palette; // Every animator's bones back to back.
+	unsigned int m_buffer = 0;
+	size_t m_capacity = 0; // In bones.
+
+};
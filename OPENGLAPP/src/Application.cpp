@@ -1,5 +1,7 @@
 #include "Application.h"
 
+#include "UploadThread.h"
+
 #define GLFW_INCLUDE_NONE 
 #include <GLFW/glfw3.h>
 #include <glad.h>
@@ -51,6 +53,8 @@ bool Application::Run() // Basically does everything.
 	}
 	std::cout << "OpenGL " << GLVersion.major << "." << GLVersion.minor << std::endl;
 
+	UploadThread::Get().Start(s_glfwStuff.window); // Big uploads go through here from now on, if it can.
+
 	// Setup input/window callbacks.
 	glfwSetWindowSizeCallback(s_glfwStuff.window, &WindowResizeCallback);
 	glfwSetCursorPosCallback(s_glfwStuff.window, &MousePositionCallback);
@@ -91,6 +95,7 @@ bool Application::Run() // Basically does everything.
 	
 	// Call application shutdown.
 	if (!Shutdown()) { std::cout << "Error occured whilst shutting down application!" << std::endl; return false; }
+	UploadThread::Get().Stop();
 
 	// Destroy GLFW.
 	glfwDestroyWindow(s_glfwStuff.window);
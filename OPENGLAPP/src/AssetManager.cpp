@@ -0,0 +1,254 @@
+#include "AssetManager.h"
+
+#include "Texture.h"
+#include "GltfModel.h"
+#include "ClusterMesh.h"
+#include "MtlLoader.h"
+#include "TextureStreamer.h"
+#include "TextureResidency.h"
+#include "TextureArrays.h"
+#include "SamplerCache.h"
+
+#include <algorithm>
+#include <filesystem>
+
+namespace
+{
+	const unsigned int kMissingSize = 8;
+
+	// Same spelling of a path always finds the same asset, "./res/a.png" and "res/a.png" included.
+	std::string MakeKey(const std::string &filePath)
+	{
+		return std::filesystem::path(filePath).lexically_normal().generic_string();
+	}
+
+	// glTF files have a loader of their own that uploads their buffers as they are.
+	bool IsGltf(const std::string &filePath)
+	{
+		std::string extension = std::filesystem::path(filePath).extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		return extension == ".gltf" || extension == ".glb";
+	}
+
+	// A file loaded for different usages is compressed differently, so each is an asset of its own.
+	std::string MakeTextureKey(const std::string &filePath, aie::Texture::Usage usage)
+	{
+		switch (usage)
+		{
+		case aie::Texture::NORMAL_MAP: return MakeKey(filePath) + "|normal";
+		case aie::Texture::LINEAR: return MakeKey(filePath) + "|linear";
+		default: return MakeKey(filePath);
+		}
+	}
+
+	// Texture containers are loaded as they are, they don't go through the texture cache.
+	bool IsContainer(const std::string &filePath)
+	{
+		std::string extension = std::filesystem::path(filePath).extension().string();
+		return extension == ".ktx" || extension == ".KTX";
+	}
+
+	// Drops the entry if the asset has already been freed.
+	template<typename Asset>
+	std::shared_ptr<Asset> Find(std::unordered_map<std::string, std::weak_ptr<Asset>> &cache, const std::string &key)
+	{
+		auto it = cache.find(key);
+		if (it == cache.end())
+			return nullptr;
+
+		std::shared_ptr<Asset> asset = it->second.lock();
+		if (!asset)
+			cache.erase(it);
+		return asset;
+	}
+}
+
+AssetManager &AssetManager::Get()
+{
+	static AssetManager manager;
+	return manager;
+}
+
+std::shared_ptr<Mesh> AssetManager::GetMesh(const std::string &filePath, const MeshOptions &options)
+{
+	std::string key = MakeKey(filePath) + "|tangents=" + std::to_string((int)options.tangentMode) + (options.progressive ? "|progressive" : "");
+	if (std::shared_ptr<Mesh> mesh = Find(m_meshes, key))
+		return mesh;
+
+	std::shared_ptr<Mesh> mesh;
+	if (IsGltf(filePath))
+		mesh = std::make_shared<GltfModel>();
+	else if (Mesh::IsStreamedScan(filePath.c_str())) // Too big to read back for meshlets and levels of detail.
+		mesh = std::make_shared<ClusterMesh>();
+	else
+		mesh = std::make_shared<Mesh>();
+	mesh->SetTangentMode(options.tangentMode);
+	mesh->SetProgressive(options.progressive);
+	mesh->InitializeFromFile(filePath.c_str());
+	m_meshes[key] = mesh;
+	return mesh;
+}
+
+std::shared_ptr<Mesh> AssetManager::GetPrimitive(Mesh::PrimitiveID type)
+{
+	std::string key = "primitive|" + std::to_string((int)type) + "|segments=" + std::to_string(Mesh::kPrimitiveSegments);
+	if (std::shared_ptr<Mesh> mesh = Find(m_meshes, key))
+		return mesh;
+
+	std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+	mesh->InitializePrimitive(type);
+	m_meshes[key] = mesh;
+	return mesh;
+}
+
+std::shared_ptr<aie::Texture> AssetManager::GetTexture(const std::string &filePath, aie::Texture::Usage usage)
+{
+	std::string key = MakeTextureKey(filePath, usage);
+	if (std::shared_ptr<aie::Texture> texture = Find(m_textures, key))
+		return texture;
+
+	// Failures aren't remembered, the file may turn up later.
+	std::shared_ptr<aie::Texture> texture = std::make_shared<aie::Texture>();
+	if (!texture->load(filePath.c_str(), usage))
+		return nullptr;
+	if (!IsContainer(filePath))
+		TextureResidency::Get().Track(texture, TextureCache::GetCachePath(filePath, usage));
+	m_textures[key] = texture;
+	return texture;
+}
+
+std::shared_ptr<aie::Texture> AssetManager::GetTextureAsync(const std::string &filePath, aie::Texture::Usage usage)
+{
+	std::string key = MakeTextureKey(filePath, usage);
+	if (std::shared_ptr<aie::Texture> texture = Find(m_textures, key))
+		return texture;
+
+	// Containers are already in the GPU's formats, there's nothing worth decoding off the main thread.
+	if (IsContainer(filePath))
+		return GetTexture(filePath, usage);
+
+	std::error_code error;
+	if (!std::filesystem::exists(filePath, error))
+		return nullptr;
+
+	std::shared_ptr<aie::Texture> texture = std::make_shared<aie::Texture>();
+	TextureStreamer::Get().Request(texture, filePath, usage);
+	TextureResidency::Get().Track(texture, TextureCache::GetCachePath(filePath, usage));
+	m_textures[key] = texture;
+	return texture;
+}
+
+std::shared_ptr<const MaterialLibrary> AssetManager::GetMaterialLibrary(const std::string &filePath)
+{
+	std::string key = MakeKey(filePath);
+	if (std::shared_ptr<const MaterialLibrary> library = Find(m_materialLibraries, key))
+		return library;
+
+	std::shared_ptr<const MaterialLibrary> library = LoadMaterialLibrary(filePath);
+	m_materialLibraries[key] = library;
+	return library;
+}
+
+std::shared_ptr<MaterialLibrary> AssetManager::LoadMaterialLibrary(const std::string &filePath)
+{
+	std::shared_ptr<MaterialLibrary> library = std::make_shared<MaterialLibrary>();
+
+	std::vector<MtlLoader::MaterialDefinition> definitions;
+	if (!MtlLoader::Load(filePath.c_str(), definitions))
+		std::cout << "WARNING: " << "Couldn't open material " << filePath << std::endl;
+
+	auto loadMap = [this, &library](const std::string &path, aie::Texture::Usage usage = aie::Texture::COLOUR) -> const aie::Texture *
+	{
+		std::shared_ptr<aie::Texture> texture = path.empty() ? nullptr : GetTextureAsync(path, usage);
+		if (!texture)
+			return nullptr;
+		library->textures.push_back(texture);
+		return texture.get();
+	};
+
+	library->materials.reserve(definitions.size());
+	for (const MtlLoader::MaterialDefinition &definition : definitions)
+	{
+		Material material;
+		material.specular = definition.specular;
+		material.Ka = definition.Ka;
+		material.Kd = definition.Kd;
+		material.Ks = definition.Ks;
+
+		// Missing maps share the global fallbacks, as do maps still streaming in until they arrive. A flat normal rather than an unbound slot, which
+		// samples black and bends every normal away from the surface.
+		material.mapKd = loadMap(definition.mapKd);
+		material.mapKs = loadMap(definition.mapKs, aie::Texture::LINEAR);
+		material.mapBump = loadMap(definition.mapBump, aie::Texture::NORMAL_MAP);
+		if (material.mapKd == nullptr) material.mapKd = GetMissingTexture();
+		if (material.mapKs == nullptr) material.mapKs = GetBlackTexture();
+		if (material.mapBump == nullptr) material.mapBump = GetFlatNormalTexture();
+
+		library->materials.push_back(std::move(material));
+		library->names.push_back(definition.name);
+	}
+	return library;
+}
+
+const aie::Texture *AssetManager::GetWhiteTexture()
+{
+	static const unsigned char white[] = { 0xFF, 0xFF, 0xFF, 0xFF };
+	return GetFallback(m_white, 1, 1, white);
+}
+
+const aie::Texture *AssetManager::GetBlackTexture()
+{
+	static const unsigned char black[] = { 0x00, 0x00, 0x00, 0xFF };
+	return GetFallback(m_black, 1, 1, black);
+}
+
+const aie::Texture *AssetManager::GetFlatNormalTexture()
+{
+	static const unsigned char flatNormal[] = { 0x7F, 0x7F, 0xFF, 0xFF };
+	return GetFallback(m_flatNormal, 1, 1, flatNormal);
+}
+
+const aie::Texture *AssetManager::GetMissingTexture()
+{
+	static unsigned char checker[kMissingSize * kMissingSize * 4];
+	if (!m_missing)
+	{
+		for (unsigned int y = 0; y < kMissingSize; y++)
+		{
+			for (unsigned int x = 0; x < kMissingSize; x++)
+			{
+				// funny css missing texture pattern
+				unsigned char *pixel = checker + (y * kMissingSize + x) * 4;
+				bool pink = (x + y) % 2 == 0;
+				pixel[0] = pink ? 0xFF : 0x00;
+				pixel[1] = 0x00;
+				pixel[2] = pink ? 0xFF : 0x00;
+				pixel[3] = 0xFF;
+			}
+		}
+	}
+	return GetFallback(m_missing, kMissingSize, kMissingSize, checker);
+}
+
+const aie::Texture *AssetManager::GetFallback(std::unique_ptr<aie::Texture> &texture, unsigned int width, unsigned int height, const unsigned char *pattern)
+{
+	if (!texture)
+	{
+		texture = std::make_unique<aie::Texture>();
+		texture->create(width, height, aie::Texture::RGBA, const_cast<unsigned char *>(pattern));
+	}
+	return texture.get();
+}
+
+void AssetManager::Release()
+{
+	m_white.reset();
+	m_black.reset();
+	m_flatNormal.reset();
+	m_missing.reset();
+	Material::ReleaseBuffer();
+	TextureStreamer::Get().Release();
+	TextureResidency::Get().Release();
+	TextureArrays::Get().Release();
+	SamplerCache::Get().Release();
+}
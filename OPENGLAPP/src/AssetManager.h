@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "Material.h"
+#include "Texture.h"
+
+#include <memory>
+#include <unordered_map>
+
+// Loads each asset once and hands out shared handles to it, keyed by its path and the options it was loaded with.
+// The manager itself only keeps weak references, so an asset is freed as soon as the last handle to it goes.
+// Main thread only, everything here touches GL.
+class AssetManager
+{
+public:
+	struct MeshOptions
+	{
+		Mesh::TangentMode tangentMode = Mesh::TANGENT_FAST;
+		bool progressive = false;
+	};
+
+public:
+	static AssetManager &Get(); // Shared manager, created on first use.
+
+	std::shared_ptr<Mesh> GetMesh(const std::string &filePath) { return GetMesh(filePath, MeshOptions()); }
+	std::shared_ptr<Mesh> GetMesh(const std::string &filePath, const MeshOptions &options);
+	std::shared_ptr<Mesh> GetPrimitive(Mesh::PrimitiveID type); // Every primitive of a type and tessellation is the same mesh.
+	// Normal maps are compressed for two channels rather than colour, so they're cached apart from the same file used
+	// as colour. Null if it can't be loaded.
+	std::shared_ptr<aie::Texture> GetTexture(const std::string &filePath, aie::Texture::Usage usage = aie::Texture::COLOUR);
+	// Hands the texture back straight away and streams it in over the next frames, its handle stays zero until then.
+	// Null if the file doesn't exist.
+	std::shared_ptr<aie::Texture> GetTextureAsync(const std::string &filePath, aie::Texture::Usage usage = aie::Texture::COLOUR);
+	std::shared_ptr<const MaterialLibrary> GetMaterialLibrary(const std::string &filePath); // Every material in an .mtl file.
+
+	// 1x1 textures shared by every material missing a map, created on first use.
+	const aie::Texture *GetWhiteTexture();
+	const aie::Texture *GetBlackTexture();
+	const aie::Texture *GetFlatNormalTexture();
+	const aie::Texture *GetMissingTexture(); // Pink and black checker, so a missing diffuse map stands out.
+
+	void Release(); // Frees the fallback textures and material buffer, call before the GL context goes.
+
+private:
+	std::shared_ptr<MaterialLibrary> LoadMaterialLibrary(const std::string &filePath);
+	const aie::Texture *GetFallback(std::unique_ptr<aie::Texture> &texture, unsigned int width, unsigned int height, const unsigned char *pattern);
+
+private:
+	std::unordered_map<std::string, std::weak_ptr<Mesh>> m_meshes;
+	std::unordered_map<std::string, std::weak_ptr<aie::Texture>> m_textures;
+	std::unordered_map<std::string, std::weak_ptr<const MaterialLibrary>> m_materialLibraries;
+
+	std::unique_ptr<aie::Texture> m_white;
+	std::unique_ptr<aie::Texture> m_black;
+	std::unique_ptr<aie::Texture> m_flatNormal;
+	std::unique_ptr<aie::Texture> m_missing;
+
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Meshlet.h"
+
+#include <cstdint>
+
+// Layout of a cooked cluster DAG (.cdag), written by ClusterDagBuilder and streamed by ClusterMesh. The file is the
+// header, then the cluster, group, parent and page tables, then the page data. Only the page data is streamed, the
+// tables stay in memory.
+
+const uint32_t kClusterDagMagic = 0x47414443; // "CDAG"
+const uint32_t kClusterDagVersion = 1;
+const uint32_t kClusterDagNone = 0xFFFFFFFF;
+
+struct ClusterDagHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t clusterCount;
+	uint32_t groupCount;
+	uint32_t parentCount;
+	uint32_t pageCount; // Page 0 holds the coarsest clusters and is always resident, page g + 1 belongs to group g.
+	uint32_t maxPageVertices; // Largest of the streamed pages, sizes the slots they're loaded into.
+	uint32_t maxPageIndices;
+	uint64_t triangleCount; // At full detail.
+	glm::vec3 boundsCenter;
+	float boundsRadius;
+};
+
+// Neighbouring clusters simplified together. Drawing either the clusters a group was built from or the coarser
+// ones it was simplified into is a single choice, and the group's border was locked while simplifying, so any
+// cut made of those choices is watertight.
+struct ClusterDagGroup
+{
+	glm::vec3 center; // Encloses the bounds of every group below it, so the projected error only grows going up.
+	float radius;
+	float error; // Simplification error, including everything below it.
+	uint32_t page; // Holds the clusters the group was built from.
+	uint32_t firstParent; // Groups that simplify this one's clusters further, in the parent table.
+	uint32_t parentCount;
+};
+
+struct ClusterDagCluster
+{
+	Meshlet bounds; // Local space. firstIndex and triangleCount are relative to the page's indices.
+	uint32_t firstVertex; // Relative to the page.
+	uint32_t vertexCount;
+	uint32_t producer; // Group it was simplified from, kClusterDagNone at full detail.
+	uint32_t consumer; // Group it's simplified further in, kClusterDagNone for the coarsest clusters.
+};
+
+struct ClusterDagPage
+{
+	uint64_t offset; // Into the file. Vertices come first, then one byte per index relative to its cluster's first vertex.
+	uint32_t firstCluster; // Clusters are stored in page order.
+	uint32_t clusterCount;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+};
@@ -0,0 +1,522 @@
+#include "ClusterDagBuilder.h"
+
+#include "ClusterDag.h"
+#include "MeshletBuilder.h"
+#include "MeshSimplifier.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <numeric>
+#include <fstream>
+#include <iostream>
+#include <tuple>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const float kMinReduction = 0.85f; // Groups that can't get below this fraction of their triangles stop simplifying.
+	const unsigned int kClusterTriangles = 128;
+	const unsigned int kClusterVertices = 255; // Indices are stored as bytes. Clusters go through MDI rather than mesh shaders, so they can be fatter than meshlets.
+	const unsigned int kGroupTriangles = ClusterDagBuilder::kGroupSize * kClusterTriangles;
+	const unsigned int kMaxLevels = 64;
+	const size_t kPageAlignment = 16;
+
+	struct BuildCluster
+	{
+		std::vector<unsigned int> indices; // Into the full vertex array.
+		std::vector<unsigned int> vertices; // Sorted unique indices, filled in when laying out pages.
+		Meshlet bounds;
+		glm::vec3 lodCenter; // Bounds and error of the group it was simplified from, or its own at full detail.
+		float lodRadius;
+		float lodError;
+		uint32_t producer = kClusterDagNone;
+		uint32_t consumer = kClusterDagNone;
+	};
+
+	struct BuildGroup
+	{
+		glm::vec3 center;
+		float radius;
+		float error;
+		unsigned int level;
+		std::vector<unsigned int> children; // Clusters it was built from.
+		std::vector<unsigned int> parents;
+	};
+
+	// Grows a sphere to take in another one. Not the tightest fit but it always contains both.
+	void MergeSphere(glm::vec3 &center, float &radius, const glm::vec3 &otherCenter, float otherRadius)
+	{
+		glm::vec3 offset = otherCenter - center;
+		float distance = glm::length(offset);
+		if (distance + otherRadius <= radius)
+			return;
+		if (distance + radius <= otherRadius)
+		{
+			center = otherCenter;
+			radius = otherRadius;
+			return;
+		}
+
+		float newRadius = (radius + distance + otherRadius) * 0.5f;
+		center += offset * ((newRadius - radius) / distance);
+		radius = newRadius;
+	}
+
+	// Splits triangles into clusters. localToGlobal maps the indices back to the full vertex array, null if they already are.
+	void Split(const Mesh::Vertex *vertices, unsigned int vertexCount, std::vector<unsigned int> &indices, const unsigned int *localToGlobal, std::vector<BuildCluster> &clusters)
+	{
+		std::vector<Meshlet> meshlets;
+		MeshletBuilder::Build(vertices, vertexCount, indices.data(), indices.size(), meshlets, kClusterVertices, kClusterTriangles);
+		for (const Meshlet &meshlet : meshlets)
+		{
+			BuildCluster cluster;
+			cluster.bounds = meshlet;
+			cluster.indices.resize((size_t)meshlet.triangleCount * 3);
+			for (size_t i = 0; i < cluster.indices.size(); i++)
+			{
+				unsigned int index = indices[meshlet.firstIndex + i];
+				cluster.indices[i] = localToGlobal != nullptr ? localToGlobal[index] : index;
+			}
+			clusters.push_back(std::move(cluster));
+		}
+	}
+
+	template<typename T>
+	void WriteArray(std::ofstream &file, const std::vector<T> &values)
+	{
+		if (!values.empty())
+			file.write((const char *)values.data(), (std::streamsize)(values.size() * sizeof(T)));
+	}
+}
+
+bool ClusterDagBuilder::Build(const Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount, const char *outputPath)
+{
+	indexCount -= indexCount % 3;
+	if (vertexCount == 0 || indexCount == 0)
+		return false;
+
+	// First vertex at each position, so vertices split on a seam still count as one when locking group borders.
+	std::vector<unsigned int> canonical(vertexCount);
+	{
+		std::vector<unsigned int> order(vertexCount);
+		std::iota(order.begin(), order.end(), 0u);
+		auto key = [vertices](unsigned int v) { return std::make_tuple(vertices[v].position.x, vertices[v].position.y, vertices[v].position.z, v); };
+		std::sort(order.begin(), order.end(), [&key](unsigned int a, unsigned int b) { return key(a) < key(b); });
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			unsigned int v = order[i];
+			bool samePosition = i > 0 && glm::vec3(vertices[order[i - 1]].position) == glm::vec3(vertices[v].position);
+			canonical[v] = samePosition ? canonical[order[i - 1]] : v;
+		}
+	}
+
+	// Full detail clusters.
+	std::vector<BuildCluster> clusters;
+	{
+		std::vector<unsigned int> fullIndices(indices, indices + indexCount);
+		Split(vertices, vertexCount, fullIndices, nullptr, clusters);
+	}
+	for (BuildCluster &cluster : clusters)
+	{
+		cluster.lodCenter = cluster.bounds.center;
+		cluster.lodRadius = cluster.bounds.radius;
+		cluster.lodError = 0.0f;
+	}
+
+	std::vector<BuildGroup> groups;
+	std::vector<unsigned int> current(clusters.size());
+	std::iota(current.begin(), current.end(), 0u);
+
+	std::vector<uint32_t> owner(vertexCount);
+	std::vector<unsigned char> shared(vertexCount);
+	std::vector<unsigned char> frozen(vertexCount, 0); // Borders of clusters that stopped simplifying, locked from then on.
+	for (unsigned int level = 0; current.size() > 1 && level < kMaxLevels; level++)
+	{
+		// Clusters that share positions, weighted by how many.
+		std::vector<std::pair<unsigned int, unsigned int>> positionClusters;
+		std::vector<unsigned int> scratch;
+		for (unsigned int i = 0; i < (unsigned int)current.size(); i++)
+		{
+			scratch.clear();
+			for (unsigned int index : clusters[current[i]].indices)
+				scratch.push_back(canonical[index]);
+			std::sort(scratch.begin(), scratch.end());
+			scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+			for (unsigned int position : scratch)
+				positionClusters.push_back({ position, i });
+		}
+		std::sort(positionClusters.begin(), positionClusters.end());
+
+		std::vector<uint64_t> links;
+		for (size_t runStart = 0, runEnd = 0; runStart < positionClusters.size(); runStart = runEnd)
+		{
+			while (runEnd < positionClusters.size() && positionClusters[runEnd].first == positionClusters[runStart].first)
+				runEnd++;
+			for (size_t a = runStart; a < runEnd; a++)
+			{
+				for (size_t b = runStart; b < runEnd; b++)
+				{
+					if (a != b)
+						links.push_back(((uint64_t)positionClusters[a].second << 32) | positionClusters[b].second);
+				}
+			}
+		}
+		std::sort(links.begin(), links.end());
+
+		std::vector<unsigned int> neighbourOffsets(current.size() + 1, 0);
+		std::vector<std::pair<unsigned int, unsigned int>> neighbours; // Cluster and shared position count.
+		for (size_t i = 0; i < links.size(); i++)
+		{
+			if (i > 0 && links[i] == links[i - 1])
+			{
+				neighbours.back().second++;
+				continue;
+			}
+			neighbourOffsets[(links[i] >> 32) + 1]++;
+			neighbours.push_back({ (unsigned int)links[i], 1 });
+		}
+		for (size_t i = 0; i < current.size(); i++)
+			neighbourOffsets[i + 1] += neighbourOffsets[i];
+
+		// Group greedily, each time taking whichever ungrouped neighbour shares the most with the group so far. Groups
+		// are sized by triangles, the meshlet builder leaves the odd scrap of a few triangles that shouldn't count.
+		auto triangles = [&](unsigned int i) { return (unsigned int)clusters[current[i]].indices.size() / 3; };
+		std::vector<std::vector<unsigned int>> levelGroups;
+		std::vector<unsigned int> groupTriangles;
+		std::vector<uint32_t> groupOf(current.size(), kClusterDagNone);
+		std::vector<std::pair<unsigned int, unsigned int>> candidates;
+		for (unsigned int seed = 0; seed < (unsigned int)current.size(); seed++)
+		{
+			if (groupOf[seed] != kClusterDagNone)
+				continue;
+
+			uint32_t groupIndex = (uint32_t)levelGroups.size();
+			std::vector<unsigned int> members(1, seed);
+			unsigned int memberTriangles = triangles(seed);
+			groupOf[seed] = groupIndex;
+			while (memberTriangles < kGroupTriangles)
+			{
+				candidates.clear();
+				for (unsigned int member : members)
+				{
+					for (unsigned int n = neighbourOffsets[member]; n < neighbourOffsets[member + 1]; n++)
+					{
+						if (groupOf[neighbours[n].first] != kClusterDagNone)
+							continue;
+						auto found = std::find_if(candidates.begin(), candidates.end(), [&](const std::pair<unsigned int, unsigned int> &c) { return c.first == neighbours[n].first; });
+						if (found != candidates.end())
+							found->second += neighbours[n].second;
+						else
+							candidates.push_back(neighbours[n]);
+					}
+				}
+				if (candidates.empty())
+					break;
+
+				auto best = std::max_element(candidates.begin(), candidates.end(), [](const std::pair<unsigned int, unsigned int> &a, const std::pair<unsigned int, unsigned int> &b) { return a.second < b.second; });
+				members.push_back(best->first);
+				memberTriangles += triangles(best->first);
+				groupOf[best->first] = groupIndex;
+			}
+			levelGroups.push_back(std::move(members));
+			groupTriangles.push_back(memberTriangles);
+		}
+
+		// Groups that ran out of neighbours early are mostly border and barely simplify, fold them into whichever
+		// neighbouring group they share the most with.
+		for (uint32_t g = 0; g < (uint32_t)levelGroups.size(); g++)
+		{
+			if (groupTriangles[g] >= kGroupTriangles / 4)
+				continue;
+
+			candidates.clear();
+			for (unsigned int member : levelGroups[g])
+			{
+				for (unsigned int n = neighbourOffsets[member]; n < neighbourOffsets[member + 1]; n++)
+				{
+					uint32_t other = groupOf[neighbours[n].first];
+					if (other == g)
+						continue;
+					auto found = std::find_if(candidates.begin(), candidates.end(), [&](const std::pair<unsigned int, unsigned int> &c) { return c.first == other; });
+					if (found != candidates.end())
+						found->second += neighbours[n].second;
+					else
+						candidates.push_back({ other, neighbours[n].second });
+				}
+			}
+			if (candidates.empty())
+				continue;
+
+			uint32_t target = std::max_element(candidates.begin(), candidates.end(), [](const std::pair<unsigned int, unsigned int> &a, const std::pair<unsigned int, unsigned int> &b) { return a.second < b.second; })->first;
+			for (unsigned int member : levelGroups[g])
+				groupOf[member] = target;
+			levelGroups[target].insert(levelGroups[target].end(), levelGroups[g].begin(), levelGroups[g].end());
+			groupTriangles[target] += groupTriangles[g];
+			levelGroups[g].clear();
+			groupTriangles[g] = 0;
+		}
+		levelGroups.erase(std::remove_if(levelGroups.begin(), levelGroups.end(), [](const std::vector<unsigned int> &members) { return members.empty(); }), levelGroups.end());
+
+		// Positions used by more than one group are on a group border.
+		std::fill(owner.begin(), owner.end(), kClusterDagNone);
+		std::fill(shared.begin(), shared.end(), 0);
+		for (uint32_t g = 0; g < (uint32_t)levelGroups.size(); g++)
+		{
+			for (unsigned int member : levelGroups[g])
+			{
+				for (unsigned int index : clusters[current[member]].indices)
+				{
+					unsigned int position = canonical[index];
+					if (owner[position] == kClusterDagNone)
+						owner[position] = g;
+					else if (owner[position] != g)
+						shared[position] = 1;
+				}
+			}
+		}
+
+		// Simplify each group to half with its border locked, then split it back into clusters.
+		struct GroupResult
+		{
+			std::vector<BuildCluster> clusters;
+			float error = 0.0f;
+			bool simplified = false;
+		};
+		std::vector<GroupResult> results(levelGroups.size());
+		ThreadPool::Get().ParallelFor(levelGroups.size(), 1, [&](size_t begin, size_t end)
+		{
+			std::vector<unsigned int> groupIndices, localToGlobal, simplified;
+			std::vector<Mesh::Vertex> localVertices;
+			std::vector<unsigned char> locked;
+			for (size_t g = begin; g < end; g++)
+			{
+				groupIndices.clear();
+				for (unsigned int member : levelGroups[g])
+				{
+					const std::vector<unsigned int> &memberIndices = clusters[current[member]].indices;
+					groupIndices.insert(groupIndices.end(), memberIndices.begin(), memberIndices.end());
+				}
+
+				// Work on just the group's vertices, the simplifier keeps per vertex state.
+				localToGlobal = groupIndices;
+				std::sort(localToGlobal.begin(), localToGlobal.end());
+				localToGlobal.erase(std::unique(localToGlobal.begin(), localToGlobal.end()), localToGlobal.end());
+				for (unsigned int &index : groupIndices)
+					index = (unsigned int)(std::lower_bound(localToGlobal.begin(), localToGlobal.end(), index) - localToGlobal.begin());
+
+				localVertices.resize(localToGlobal.size());
+				locked.resize(localToGlobal.size());
+				for (size_t v = 0; v < localToGlobal.size(); v++)
+				{
+					unsigned int position = canonical[localToGlobal[v]];
+					localVertices[v] = vertices[localToGlobal[v]];
+					locked[v] = shared[position] | frozen[position];
+				}
+
+				size_t target = (groupIndices.size() / 6) * 3;
+				float error = MeshSimplifier::Simplify(localVertices.data(), (unsigned int)localVertices.size(), groupIndices.data(), groupIndices.size(),
+					target, FLT_MAX, simplified, 1.0f, locked.data());
+				if (simplified.empty() || simplified.size() > groupIndices.size() * kMinReduction)
+					continue;
+
+				Split(localVertices.data(), (unsigned int)localVertices.size(), simplified, localToGlobal.data(), results[g].clusters);
+				results[g].error = error;
+				results[g].simplified = true;
+			}
+		});
+
+		// Link the new clusters into the graph.
+		std::vector<unsigned int> next;
+		for (size_t g = 0; g < levelGroups.size(); g++)
+		{
+			GroupResult &result = results[g];
+			if (!result.simplified) // Stuck, these become some of the coarsest clusters.
+			{
+				for (unsigned int member : levelGroups[g])
+				{
+					for (unsigned int index : clusters[current[member]].indices)
+						frozen[canonical[index]] = 1;
+				}
+				continue;
+			}
+
+			BuildGroup group;
+			group.level = level;
+			const BuildCluster &first = clusters[current[levelGroups[g][0]]];
+			group.center = first.lodCenter;
+			group.radius = first.lodRadius;
+			float childError = 0.0f;
+			for (unsigned int member : levelGroups[g])
+			{
+				BuildCluster &child = clusters[current[member]];
+				MergeSphere(group.center, group.radius, child.lodCenter, child.lodRadius);
+				childError = std::max(childError, child.lodError);
+				child.consumer = (uint32_t)groups.size();
+				group.children.push_back(current[member]);
+			}
+			group.error = childError + result.error;
+
+			for (BuildCluster &cluster : result.clusters)
+			{
+				cluster.producer = (uint32_t)groups.size();
+				cluster.lodCenter = group.center;
+				cluster.lodRadius = group.radius;
+				cluster.lodError = group.error;
+				next.push_back((unsigned int)clusters.size());
+				clusters.push_back(std::move(cluster));
+			}
+			groups.push_back(std::move(group));
+		}
+		current.swap(next);
+	}
+
+	// Groups go coarsest first so a single pass can check a group's parents before the group itself.
+	std::vector<uint32_t> groupOrder(groups.size());
+	std::iota(groupOrder.begin(), groupOrder.end(), 0u);
+	std::stable_sort(groupOrder.begin(), groupOrder.end(), [&groups](uint32_t a, uint32_t b) { return groups[a].level > groups[b].level; });
+	std::vector<uint32_t> groupRemap(groups.size());
+	for (uint32_t i = 0; i < (uint32_t)groupOrder.size(); i++)
+		groupRemap[groupOrder[i]] = i;
+
+	for (BuildCluster &cluster : clusters)
+	{
+		if (cluster.producer != kClusterDagNone)
+			cluster.producer = groupRemap[cluster.producer];
+		if (cluster.consumer != kClusterDagNone)
+			cluster.consumer = groupRemap[cluster.consumer];
+		if (cluster.producer != kClusterDagNone && cluster.consumer != kClusterDagNone)
+			groups[groupOrder[cluster.producer]].parents.push_back(cluster.consumer);
+	}
+
+	// Page 0 holds the clusters nothing simplifies further, every other page the clusters one group was built from.
+	std::vector<std::vector<unsigned int>> pageClusters(groups.size() + 1);
+	for (unsigned int c = 0; c < (unsigned int)clusters.size(); c++)
+	{
+		uint32_t consumer = clusters[c].consumer;
+		pageClusters[consumer == kClusterDagNone ? 0 : consumer + 1].push_back(c);
+	}
+
+	ClusterDagHeader header = {};
+	header.magic = kClusterDagMagic;
+	header.version = kClusterDagVersion;
+	header.clusterCount = (uint32_t)clusters.size();
+	header.groupCount = (uint32_t)groups.size();
+	header.pageCount = (uint32_t)pageClusters.size();
+	header.triangleCount = indexCount / 3;
+
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		minimum = glm::min(minimum, glm::vec3(vertices[v].position));
+		maximum = glm::max(maximum, glm::vec3(vertices[v].position));
+	}
+	header.boundsCenter = (minimum + maximum) * 0.5f;
+	header.boundsRadius = glm::length(maximum - minimum) * 0.5f;
+
+	std::vector<ClusterDagGroup> groupRecords(groups.size());
+	std::vector<uint32_t> parentRecords;
+	for (uint32_t i = 0; i < (uint32_t)groups.size(); i++)
+	{
+		BuildGroup &group = groups[groupOrder[i]];
+		std::sort(group.parents.begin(), group.parents.end());
+		group.parents.erase(std::unique(group.parents.begin(), group.parents.end()), group.parents.end());
+
+		ClusterDagGroup &record = groupRecords[i];
+		record.center = group.center;
+		record.radius = group.radius;
+		record.error = group.error;
+		record.page = i + 1;
+		record.firstParent = (uint32_t)parentRecords.size();
+		record.parentCount = (uint32_t)group.parents.size();
+		parentRecords.insert(parentRecords.end(), group.parents.begin(), group.parents.end());
+	}
+	header.parentCount = (uint32_t)parentRecords.size();
+
+	// Lay the pages out after the tables.
+	uint64_t offset = sizeof(ClusterDagHeader) + clusters.size() * sizeof(ClusterDagCluster) + groupRecords.size() * sizeof(ClusterDagGroup) +
+		parentRecords.size() * sizeof(uint32_t) + pageClusters.size() * sizeof(ClusterDagPage);
+	offset = (offset + kPageAlignment - 1) & ~(uint64_t)(kPageAlignment - 1);
+
+	std::vector<ClusterDagCluster> clusterRecords;
+	std::vector<ClusterDagPage> pageRecords(pageClusters.size());
+	clusterRecords.reserve(clusters.size());
+	for (size_t p = 0; p < pageClusters.size(); p++)
+	{
+		ClusterDagPage &page = pageRecords[p];
+		page.offset = offset;
+		page.firstCluster = (uint32_t)clusterRecords.size();
+		page.clusterCount = (uint32_t)pageClusters[p].size();
+		page.vertexCount = 0;
+		page.indexCount = 0;
+		for (unsigned int c : pageClusters[p])
+		{
+			BuildCluster &cluster = clusters[c];
+			cluster.vertices = cluster.indices;
+			std::sort(cluster.vertices.begin(), cluster.vertices.end());
+			cluster.vertices.erase(std::unique(cluster.vertices.begin(), cluster.vertices.end()), cluster.vertices.end());
+
+			ClusterDagCluster record;
+			record.bounds = cluster.bounds;
+			record.bounds.firstIndex = page.indexCount;
+			record.firstVertex = page.vertexCount;
+			record.vertexCount = (uint32_t)cluster.vertices.size();
+			record.producer = cluster.producer;
+			record.consumer = cluster.consumer;
+			clusterRecords.push_back(record);
+
+			page.vertexCount += record.vertexCount;
+			page.indexCount += (uint32_t)cluster.indices.size();
+		}
+
+		if (p > 0)
+		{
+			header.maxPageVertices = std::max(header.maxPageVertices, page.vertexCount);
+			header.maxPageIndices = std::max(header.maxPageIndices, page.indexCount);
+		}
+		offset += page.vertexCount * sizeof(Mesh::Vertex) + page.indexCount;
+		offset = (offset + kPageAlignment - 1) & ~(uint64_t)(kPageAlignment - 1);
+	}
+
+	std::ofstream file(outputPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Couldn't write cluster file " << outputPath << std::endl;
+		return false;
+	}
+
+	file.write((const char *)&header, sizeof(header));
+	WriteArray(file, clusterRecords);
+	WriteArray(file, groupRecords);
+	WriteArray(file, parentRecords);
+	WriteArray(file, pageRecords);
+
+	std::vector<Mesh::Vertex> pageVertices;
+	std::vector<unsigned char> pageIndices;
+	const char padding[kPageAlignment] = {};
+	for (size_t p = 0; p < pageClusters.size(); p++)
+	{
+		uint64_t position = (uint64_t)file.tellp();
+		file.write(padding, (std::streamsize)(pageRecords[p].offset - position));
+
+		pageVertices.clear();
+		pageIndices.clear();
+		for (unsigned int c : pageClusters[p])
+		{
+			BuildCluster &cluster = clusters[c];
+			for (unsigned int v : cluster.vertices)
+				pageVertices.push_back(vertices[v]);
+			for (unsigned int index : cluster.indices)
+				pageIndices.push_back((unsigned char)(std::lower_bound(cluster.vertices.begin(), cluster.vertices.end(), index) - cluster.vertices.begin()));
+		}
+		WriteArray(file, pageVertices);
+		WriteArray(file, pageIndices);
+	}
+
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing cluster file " << outputPath << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+// Cooks a mesh into a cluster DAG file for ClusterMesh to stream. Splits the mesh into meshlets, then repeatedly
+// groups neighbouring clusters, simplifies each group to half with its border locked and splits the result back
+// into clusters, until nothing is left to simplify. Needs the whole mesh in memory, so it's meant to be run once
+// per scan rather than every load.
+class ClusterDagBuilder
+{
+public:
+	static const unsigned int kGroupSize = 8; // Clusters simplified together.
+
+public:
+	// Returns false if the file couldn't be written.
+	static bool Build(const Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount, const char *outputPath);
+
+};
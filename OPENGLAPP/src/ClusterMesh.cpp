@@ -0,0 +1,411 @@
+#include "ClusterMesh.h"
+
+#include "Application.h"
+#include "ClusterDagBuilder.h"
+#include "MeshletBuilder.h"
+#include "ObjLoader.h"
+#include "PlyLoader.h"
+#include "TangentGenerator.h"
+#include "ThreadPool.h"
+
+#include <glad.h>
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cfloat>
+#include <filesystem>
+
+namespace
+{
+	const size_t kMaxLoadsInFlight = 32;
+	const unsigned int kMaxUploadsPerFrame = 16; // Keeps a sudden camera jump from stalling a frame on uploads.
+	const unsigned int kMinSlots = 16;
+	const double kEvictDelay = 0.25; // Seconds a page has to go unused before its slot can be reused.
+
+	double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+ClusterMesh::ClusterMesh()
+{ }
+ClusterMesh::~ClusterMesh()
+{
+	// Workers read straight out of the mapping, so let them finish before it goes.
+	for (std::future<PageData> &load : m_loads)
+		load.wait();
+}
+
+void ClusterMesh::InitializeFromFile(const char *filePath)
+{
+	if (Load(filePath))
+		return;
+	std::cout << "WARNING: " << "Couldn't stream " << filePath << " as clusters, loading it whole." << std::endl;
+	Mesh::InitializeFromFile(filePath);
+}
+
+bool ClusterMesh::Load(const char *filePath, size_t residentBytes)
+{
+	std::string path(filePath);
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (extension != "cdag")
+	{
+		std::string cookedPath = path + ".cdag";
+		std::error_code error;
+		bool upToDate = std::filesystem::exists(cookedPath, error) &&
+			std::filesystem::last_write_time(cookedPath, error) >= std::filesystem::last_write_time(path, error);
+		if (!upToDate && !Cook(filePath, cookedPath.c_str()))
+			return false;
+		path = cookedPath;
+	}
+
+	if (!m_file.Open(path.c_str()))
+	{
+		std::cout << "WARNING: " << "Couldn't open cluster file " << path << std::endl;
+		return false;
+	}
+	if (!ReadTables())
+	{
+		std::cout << "WARNING: " << path << " isn't a valid cluster file, delete it to cook it again." << std::endl;
+		m_file.Close();
+		return false;
+	}
+
+	// Size the slots to fit the budget. Page 0 doesn't count against it, it's always resident.
+	size_t slotBytes = (size_t)m_header.maxPageVertices * sizeof(Vertex) + (size_t)m_header.maxPageIndices * sizeof(unsigned int);
+	size_t maxSlots = std::min<size_t>(m_pages.size() - 1, (0xFFFFFFFFull - m_pages[0].vertexCount) / std::max(1u, m_header.maxPageVertices));
+	m_slotCount = (unsigned int)std::min(std::max<size_t>(slotBytes > 0 ? residentBytes / slotBytes : 0, kMinSlots), maxSlots);
+
+	m_pageSlots.assign(m_pages.size(), kClusterDagNone);
+	m_pageLastUsed.assign(m_pages.size(), 0.0);
+	m_pageLoading.assign(m_pages.size(), 0);
+	m_slotPages.assign(m_slotCount, kClusterDagNone);
+	m_refined.assign(m_groups.size(), 0);
+
+	Allocate(m_pages[0].vertexCount + m_slotCount * m_header.maxPageVertices, m_pages[0].indexCount + m_slotCount * m_header.maxPageIndices);
+	PageData root = ReadPage(0);
+	UpdateVertices(0, (unsigned int)root.vertices.size(), root.vertices.data());
+	UpdateIndices(0, (unsigned int)root.indices.size(), root.indices.data());
+	m_pageSlots[0] = 0;
+	m_residentPages = 1;
+
+	m_boundsCenter = m_header.boundsCenter;
+	m_boundsRadius = m_header.boundsRadius;
+	return true;
+}
+
+bool ClusterMesh::Cook(const char *sourcePath, const char *cookedPath)
+{
+	std::string extension(sourcePath);
+	extension = extension.substr(extension.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	bool loaded = false;
+	if (extension == "ply")
+	{
+		loaded = PlyLoader::Load(sourcePath, vertices, indices);
+	}
+	else if (extension == "obj")
+	{
+		loaded = ObjLoader::Load(sourcePath, vertices, indices);
+		if (loaded)
+			TangentGenerator::Generate(vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size(), m_tangentMode);
+	}
+
+	if (!loaded)
+	{
+		std::cout << "WARNING: " << "Couldn't load " << sourcePath << " to build clusters from, only binary PLY and OBJ are supported." << std::endl;
+		return false;
+	}
+	return ClusterDagBuilder::Build(vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size(), cookedPath);
+}
+
+bool ClusterMesh::ReadTables()
+{
+	if (m_file.GetSize() < sizeof(ClusterDagHeader))
+		return false;
+	std::memcpy(&m_header, m_file.GetData(), sizeof(ClusterDagHeader));
+	if (m_header.magic != kClusterDagMagic || m_header.version != kClusterDagVersion || m_header.pageCount != m_header.groupCount + 1)
+		return false;
+
+	uint64_t offset = sizeof(ClusterDagHeader);
+	auto readTable = [&](auto &table, uint32_t count)
+	{
+		using Record = typename std::remove_reference<decltype(table)>::type::value_type;
+		if (offset + (uint64_t)count * sizeof(Record) > m_file.GetSize())
+			return false;
+		table.resize(count);
+		if (count > 0)
+			std::memcpy(table.data(), m_file.GetData() + offset, (size_t)count * sizeof(Record));
+		offset += (uint64_t)count * sizeof(Record);
+		return true;
+	};
+	if (!readTable(m_clusters, m_header.clusterCount) || !readTable(m_groups, m_header.groupCount) ||
+		!readTable(m_parents, m_header.parentCount) || !readTable(m_pages, m_header.pageCount))
+		return false;
+
+	// Check everything the streaming relies on up front, so a damaged file can't send it out of bounds later.
+	for (const ClusterDagPage &page : m_pages)
+	{
+		if (page.offset + (uint64_t)page.vertexCount * sizeof(Vertex) + page.indexCount > m_file.GetSize() ||
+			(uint64_t)page.firstCluster + page.clusterCount > m_clusters.size())
+			return false;
+		if (&page != &m_pages[0] && (page.vertexCount > m_header.maxPageVertices || page.indexCount > m_header.maxPageIndices))
+			return false;
+
+		for (uint32_t c = page.firstCluster; c < page.firstCluster + page.clusterCount; c++)
+		{
+			const ClusterDagCluster &cluster = m_clusters[c];
+			if ((uint64_t)cluster.firstVertex + cluster.vertexCount > page.vertexCount ||
+				(uint64_t)cluster.bounds.firstIndex + cluster.bounds.triangleCount * 3 > page.indexCount ||
+				(cluster.producer != kClusterDagNone && cluster.producer >= m_groups.size()))
+				return false;
+		}
+	}
+	for (uint32_t g = 0; g < (uint32_t)m_groups.size(); g++)
+	{
+		const ClusterDagGroup &group = m_groups[g];
+		if (group.page >= m_pages.size() || (uint64_t)group.firstParent + group.parentCount > m_parents.size())
+			return false;
+		for (uint32_t p = 0; p < group.parentCount; p++)
+		{
+			if (m_parents[group.firstParent + p] >= g) // Parents have to come first for SelectCut's single pass.
+				return false;
+		}
+	}
+	return true;
+}
+
+// Copies a page out of the mapping, widening the byte indices. Runs on the thread pool, the page faults happen here.
+ClusterMesh::PageData ClusterMesh::ReadPage(uint32_t page) const
+{
+	const ClusterDagPage &record = m_pages[page];
+	const char *data = m_file.GetData() + record.offset;
+
+	PageData result;
+	result.page = page;
+	result.vertices.resize(record.vertexCount);
+	std::memcpy(result.vertices.data(), data, (size_t)record.vertexCount * sizeof(Vertex));
+
+	const unsigned char *bytes = (const unsigned char *)(data + (size_t)record.vertexCount * sizeof(Vertex));
+	result.indices.resize(record.indexCount);
+	for (uint32_t c = record.firstCluster; c < record.firstCluster + record.clusterCount; c++)
+	{
+		const ClusterDagCluster &cluster = m_clusters[c];
+		unsigned int first = cluster.bounds.firstIndex;
+		for (unsigned int i = first; i < first + cluster.bounds.triangleCount * 3; i++)
+			result.indices[i] = cluster.firstVertex + std::min<unsigned int>(bytes[i], cluster.vertexCount - 1);
+	}
+	return result;
+}
+
+void ClusterMesh::FinishLoads()
+{
+	double now = Now();
+	unsigned int uploads = 0;
+	for (size_t i = 0; i < m_loads.size();)
+	{
+		if (uploads >= kMaxUploadsPerFrame || m_loads[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			i++;
+			continue;
+		}
+
+		PageData data = m_loads[i].get();
+		m_loads[i] = std::move(m_loads.back());
+		m_loads.pop_back();
+		m_pageLoading[data.page] = 0;
+
+		unsigned int slot = FindSlot(now);
+		if (slot == kClusterDagNone) // Everything's in use, it'll be asked for again if it's still needed.
+			continue;
+		UploadPage(data, slot);
+		m_pageLastUsed[data.page] = now;
+		uploads++;
+	}
+}
+
+// A free slot, or failing that the one whose page has gone unused longest. None if every page is still in use.
+unsigned int ClusterMesh::FindSlot(double now) const
+{
+	unsigned int best = kClusterDagNone;
+	double oldest = now - kEvictDelay;
+	for (unsigned int slot = 0; slot < m_slotCount; slot++)
+	{
+		uint32_t page = m_slotPages[slot];
+		if (page == kClusterDagNone)
+			return slot;
+		if (m_pageLastUsed[page] < oldest)
+		{
+			oldest = m_pageLastUsed[page];
+			best = slot;
+		}
+	}
+	return best;
+}
+
+void ClusterMesh::UploadPage(const PageData &data, unsigned int slot)
+{
+	uint32_t evicted = m_slotPages[slot];
+	if (evicted != kClusterDagNone)
+		m_pageSlots[evicted] = kClusterDagNone;
+	else
+		m_residentPages++;
+
+	// Indices are uploaded pointing straight at the slot's vertices, so draws don't need a base vertex.
+	unsigned int firstVertex = m_pages[0].vertexCount + slot * m_header.maxPageVertices;
+	unsigned int firstIndex = m_pages[0].indexCount + slot * m_header.maxPageIndices;
+	std::vector<unsigned int> indices(data.indices);
+	for (unsigned int &index : indices)
+		index += firstVertex;
+
+	UpdateVertices(firstVertex, (unsigned int)data.vertices.size(), data.vertices.data());
+	UpdateIndices(firstIndex, (unsigned int)indices.size(), indices.data());
+	m_slotPages[slot] = data.page;
+	m_pageSlots[data.page] = slot;
+}
+
+// Refines every group whose error would show, from the top down. A group only refines once all the groups using
+// its coarse clusters have, so each part of the surface is drawn at exactly one level.
+void ClusterMesh::SelectCut(const glm::mat4 &mvp)
+{
+	// Row 1 of the matrix scales local lengths into clip space height and row 3 gives depth.
+	glm::vec4 heightRow = glm::row(mvp, 1), depthRow = glm::row(mvp, 3);
+	float unitsToPixels = glm::length(glm::vec3(heightRow)) * 0.5f * (float)Application::GetInstance()->GetWindowHeight();
+	float depthScale = glm::length(glm::vec3(depthRow));
+	MeshletBuilder::Frustum frustum = MeshletBuilder::MakeFrustum(mvp);
+
+	double now = Now();
+	m_requests.clear();
+	for (uint32_t g = 0; g < (uint32_t)m_groups.size(); g++)
+	{
+		const ClusterDagGroup &group = m_groups[g];
+		m_refined[g] = 0;
+
+		bool parentsRefined = true;
+		for (uint32_t p = 0; p < group.parentCount && parentsRefined; p++)
+			parentsRefined = m_refined[m_parents[group.firstParent + p]] != 0;
+		if (!parentsRefined)
+			continue;
+
+		// Nothing offscreen is worth refining, it's culled anyway.
+		bool visible = true;
+		for (int p = 0; p < 6 && visible; p++)
+			visible = glm::dot(glm::vec3(frustum.planes[p]), group.center) + frustum.planes[p].w >= -group.radius;
+		if (!visible)
+			continue;
+
+		float depth = glm::dot(glm::vec3(depthRow), group.center) + depthRow.w - group.radius * depthScale;
+		float pixels = depth > 0.0f ? group.error * unitsToPixels / depth : FLT_MAX;
+		if (pixels <= m_lodErrorThreshold)
+			continue;
+
+		if (m_pageSlots[group.page] != kClusterDagNone)
+		{
+			m_refined[g] = 1;
+			m_pageLastUsed[group.page] = now;
+		}
+		else if (!m_pageLoading[group.page])
+		{
+			m_requests.push_back({ pixels, group.page });
+		}
+	}
+}
+
+// Queues the pages that are most visibly missing, as many as there's room for.
+void ClusterMesh::IssueLoads(double now)
+{
+	if (m_requests.empty() || m_loads.size() >= kMaxLoadsInFlight)
+		return;
+
+	size_t available = 0;
+	for (unsigned int slot = 0; slot < m_slotCount; slot++)
+	{
+		uint32_t page = m_slotPages[slot];
+		if (page == kClusterDagNone || m_pageLastUsed[page] < now - kEvictDelay)
+			available++;
+	}
+	available = available > m_loads.size() ? available - m_loads.size() : 0;
+
+	size_t count = std::min({ m_requests.size(), kMaxLoadsInFlight - m_loads.size(), available });
+	std::partial_sort(m_requests.begin(), m_requests.begin() + count, m_requests.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) { return a.first > b.first; });
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t page = m_requests[i].second;
+		m_pageLoading[page] = 1;
+		m_loads.push_back(ThreadPool::Get().Submit([this, page]() { return ReadPage(page); }));
+	}
+}
+
+void ClusterMesh::BuildDrawCommands(const glm::mat4 &mvp)
+{
+	MeshletBuilder::Frustum frustum = MeshletBuilder::MakeFrustum(mvp);
+	m_drawCommands.clear();
+	m_drawnClusters = 0;
+	m_drawnTriangles = 0;
+
+	auto addPage = [&](uint32_t page, unsigned int firstIndex)
+	{
+		const ClusterDagPage &record = m_pages[page];
+		for (uint32_t c = record.firstCluster; c < record.firstCluster + record.clusterCount; c++)
+		{
+			const ClusterDagCluster &cluster = m_clusters[c];
+			if (cluster.producer != kClusterDagNone && m_refined[cluster.producer]) // Drawn finer instead.
+				continue;
+			if (!MeshletBuilder::IsVisible(frustum, cluster.bounds))
+				continue;
+
+			unsigned int first = firstIndex + cluster.bounds.firstIndex;
+			unsigned int count = cluster.bounds.triangleCount * 3;
+			if (!m_drawCommands.empty() && m_drawCommands.back().firstIndex + m_drawCommands.back().count == first)
+				m_drawCommands.back().count += count;
+			else
+				m_drawCommands.push_back({ count, 1, first, 0, 0 });
+			m_drawnClusters++;
+			m_drawnTriangles += cluster.bounds.triangleCount;
+		}
+	};
+
+	addPage(0, 0);
+	for (uint32_t g = 0; g < (uint32_t)m_groups.size(); g++)
+	{
+		if (m_refined[g])
+			addPage(m_groups[g].page, m_pages[0].indexCount + m_pageSlots[m_groups[g].page] * m_header.maxPageIndices);
+	}
+}
+
+void ClusterMesh::Draw()
+{
+	if (m_pages.empty()) // Loaded whole instead.
+	{
+		Mesh::Draw();
+		return;
+	}
+	DrawIndirect();
+}
+
+void ClusterMesh::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
+{
+	if (m_pages.empty()) // Loaded whole instead.
+	{
+		Mesh::Render(shader, projectionView, transform);
+		return;
+	}
+
+	glm::mat4 mvp = projectionView * transform;
+	FinishLoads();
+	SelectCut(mvp);
+	IssueLoads(Now());
+	BuildDrawCommands(mvp);
+
+	// The caller has already bound this instance's matrices.
+	ApplyMaterial(shader);
+	DrawIndirect();
+}
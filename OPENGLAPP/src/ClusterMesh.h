@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "ClusterDag.h"
+#include "MappedFile.h"
+
+#include <future>
+
+// Scans too big for VRAM, drawn from a cooked cluster DAG. Only the coarsest clusters are loaded up front. Finer
+// pages are read out of the memory mapped file on the thread pool once the camera is close enough to need them,
+// and the least recently used are evicted when the resident budget is full. Each frame draws the coarsest
+// watertight cut whose error projects to under the LOD error threshold, out of whatever is resident.
+class ClusterMesh : public Mesh
+{
+public:
+	static const size_t kDefaultResidentBytes = (size_t)256 << 20;
+
+public:
+	ClusterMesh();
+	virtual ~ClusterMesh();
+
+	// Opens a .cdag file. Any other mesh file (PLY or OBJ) is cooked to a .cdag next to it first, unless there's
+	// already one newer than it.
+	bool Load(const char *filePath, size_t residentBytes = kDefaultResidentBytes);
+	// Load with the default budget, for AssetManager. Falls back to an ordinary mesh if the file can't be cooked.
+	virtual void InitializeFromFile(const char *filePath) override;
+
+	virtual void Draw() override; // Draws the cut picked by the last Render.
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform) override;
+
+	unsigned int GetPageCount() const { return (unsigned int)m_pages.size(); }
+	unsigned int GetResidentPageCount() const { return m_residentPages; }
+	unsigned int GetDrawnClusterCount() const { return m_drawnClusters; }
+	uint64_t GetDrawnTriangleCount() const { return m_drawnTriangles; }
+	uint64_t GetFullTriangleCount() const { return m_header.triangleCount; }
+
+protected:
+	struct PageData
+	{
+		uint32_t page;
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices; // Relative to the page's first vertex.
+	};
+
+	bool Cook(const char *sourcePath, const char *cookedPath);
+	bool ReadTables();
+	PageData ReadPage(uint32_t page) const;
+
+	void FinishLoads();
+	void UploadPage(const PageData &data, unsigned int slot);
+	unsigned int FindSlot(double now) const;
+	void SelectCut(const glm::mat4 &mvp);
+	void IssueLoads(double now);
+	void BuildDrawCommands(const glm::mat4 &mvp);
+
+protected:
+	MappedFile m_file;
+	ClusterDagHeader m_header = {};
+	std::vector<ClusterDagCluster> m_clusters;
+	std::vector<ClusterDagGroup> m_groups;
+	std::vector<uint32_t> m_parents;
+	std::vector<ClusterDagPage> m_pages;
+
+	// Page 0 is loaded at the start of the buffers, every other page goes in one of the fixed size slots after it.
+	unsigned int m_slotCount = 0;
+	std::vector<uint32_t> m_pageSlots; // kClusterDagNone if the page isn't resident.
+	std::vector<uint32_t> m_slotPages;
+	std::vector<double> m_pageLastUsed; // Seconds, so instances sharing the mesh don't evict each other's pages.
+	std::vector<unsigned char> m_pageLoading;
+	std::vector<std::future<PageData>> m_loads;
+	std::vector<std::pair<float, uint32_t>> m_requests; // Projected error and page.
+
+	std::vector<unsigned char> m_refined; // Per group, whether its finer clusters are drawn this frame.
+
+	unsigned int m_residentPages = 0;
+	unsigned int m_drawnClusters = 0;
+	uint64_t m_drawnTriangles = 0;
+
+};
@@ -0,0 +1,497 @@
+#include "CompressedClip.h"
+
+#include "MappedFile.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CLIP_SIMD 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const uint32_t kClipFileMagic = 0x504C4341; // "ACLP"
+	const uint32_t kClipFileVersion = 3; // 2: settings in the header. 3: errors measured after quantization.
+
+	const float kMaxKeyTime = 65535.0f;
+	const float kVectorScale = 1.0f / 65535.0f;
+	// The three smallest components of a unit quaternion are within +-1/sqrt(2), stored in 15 bits.
+	const float kRotationRange = 0.70710678f;
+	const float kRotationScale = 2.0f * kRotationRange / 32767.0f;
+
+	struct ClipFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t clipCount;
+		uint32_t jointCount;
+		float translationError; // Settings the clips were compressed with.
+		float rotationError;
+		float scaleError;
+	};
+
+	// Followed by the name, the tracks and the keys.
+	struct ClipFileRecord
+	{
+		float duration;
+		uint32_t nameLength;
+		uint32_t trackCount;
+		uint32_t keyCount; // In uint16s.
+	};
+
+	inline glm::vec3 Lerp(const glm::vec3 &a, const glm::vec3 &b, float t)
+	{
+		return glm::mix(a, b, t);
+	}
+
+	// Normalized lerp, what the sampler blends rotations with, so the key reduction measures the same curve.
+	inline glm::quat Lerp(const glm::quat &a, glm::quat b, float t)
+	{
+		if (glm::dot(a, b) < 0.0f)
+			b = -b;
+		glm::quat q(a.w + (b.w - a.w) * t, a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
+		return glm::normalize(q);
+	}
+
+	inline float Error(const glm::vec3 &a, const glm::vec3 &b)
+	{
+		return glm::length(a - b);
+	}
+
+	// Angle between them, from the chord rather than acos of the dot product, which loses small angles to rounding.
+	inline float Error(const glm::quat &a, const glm::quat &b)
+	{
+		glm::quat d = glm::dot(a, b) < 0.0f ? a + b : a - b;
+		float chord = std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z + d.w * d.w);
+		return 4.0f * std::asin(std::min(chord * 0.5f, 1.0f));
+	}
+
+	inline uint16_t QuantizeTime(float time, float timeScale)
+	{
+		return (uint16_t)glm::clamp(std::round(time * timeScale), 0.0f, kMaxKeyTime);
+	}
+
+	inline uint16_t QuantizeUnit(float value, float range) // [0, range] to 16 bits.
+	{
+		return range > 0.0f ? (uint16_t)glm::clamp(std::round(value / range * 65535.0f), 0.0f, 65535.0f) : 0;
+	}
+
+	// Smallest three: drop the largest component, flipping the quaternion so it's positive, and keep which one it was
+	// in the top bits of the first two.
+	inline void QuantizeRotation(glm::quat q, uint16_t *out)
+	{
+		q = glm::normalize(q);
+		float components[4] = { q.x, q.y, q.z, q.w };
+		unsigned int largest = 0;
+		for (unsigned int i = 1; i < 4; i++)
+		{
+			if (std::fabs(components[i]) > std::fabs(components[largest]))
+				largest = i;
+		}
+		float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+		unsigned int written = 0;
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			if (i == largest)
+				continue;
+			float value = (components[i] * sign + kRotationRange) / kRotationScale;
+			out[written++] = (uint16_t)glm::clamp(std::round(value), 0.0f, 32767.0f);
+		}
+		out[0] |= (uint16_t)((largest & 1) << 15);
+		out[1] |= (uint16_t)((largest >> 1) << 15);
+	}
+
+	// small holds the three stored components already scaled back to floats.
+	inline glm::quat RebuildRotation(const float *small, unsigned int largest)
+	{
+		float components[4];
+		float sum = 0.0f;
+		unsigned int read = 0;
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			if (i == largest)
+				continue;
+			components[i] = small[read++];
+			sum += components[i] * components[i];
+		}
+		components[largest] = std::sqrt(std::max(1.0f - sum, 0.0f));
+		return glm::quat(components[3], components[0], components[1], components[2]);
+	}
+
+	inline unsigned int LargestComponent(const uint16_t *key)
+	{
+		return (unsigned int)(key[1] >> 15) | ((unsigned int)(key[2] >> 15) << 1);
+	}
+
+	glm::quat DecodeRotation(const uint16_t *key)
+	{
+		float small[3];
+		for (unsigned int i = 0; i < 3; i++)
+			small[i] = (float)(key[i + 1] & 0x7FFF) * kRotationScale - kRotationRange;
+		return RebuildRotation(small, LargestComponent(key));
+	}
+
+	// Finds the key at or before keyTime, stepping on from the cursor. Going backwards, when the clip loops or is
+	// scrubbed, starts over from the first key. t is how far towards the next key it is, zero to use the key as is.
+	inline unsigned int FindKey(const uint16_t *keys, unsigned int count, float keyTime, unsigned int &cursor, float &t)
+	{
+		const unsigned int stride = CompressedClip::kValuesPerKey;
+		t = 0.0f;
+		if (count == 1 || keyTime <= (float)keys[0])
+			return cursor = 0;
+		if (keyTime >= (float)keys[(count - 1) * stride])
+			return cursor = count - 1;
+
+		if (cursor >= count - 1 || (float)keys[cursor * stride] > keyTime)
+			cursor = 0;
+		while ((float)keys[(cursor + 1) * stride] <= keyTime)
+			cursor++;
+
+		float start = (float)keys[cursor * stride];
+		float end = (float)keys[(cursor + 1) * stride];
+		t = (keyTime - start) / (end - start); // end is past keyTime, which is at or past start.
+		return cursor;
+	}
+
+	glm::vec3 SampleVector(const uint16_t *keys, unsigned int count, float keyTime, unsigned int &cursor, const glm::vec3 &min, const glm::vec3 &extent)
+	{
+		float t;
+		const uint16_t *key = keys + FindKey(keys, count, keyTime, cursor, t) * CompressedClip::kValuesPerKey;
+		glm::vec3 scale = extent * kVectorScale;
+		if (t <= 0.0f)
+			return min + glm::vec3(key[1], key[2], key[3]) * scale;
+
+#if CLIP_SIMD
+		// Both keys in one load, widened to floats and blended with the time lane coming along for the ride.
+		__m128i packed = _mm_loadu_si128((const __m128i *)key);
+		__m128i zero = _mm_setzero_si128();
+		__m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero));
+		__m128 b = _mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, zero));
+		__m128 value = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+		value = _mm_add_ps(_mm_mul_ps(value, _mm_setr_ps(0.0f, scale.x, scale.y, scale.z)), _mm_setr_ps(0.0f, min.x, min.y, min.z));
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, value);
+		return glm::vec3(lanes[1], lanes[2], lanes[3]);
+#else
+		const uint16_t *next = key + CompressedClip::kValuesPerKey;
+		glm::vec3 a(key[1], key[2], key[3]), b(next[1], next[2], next[3]);
+		return min + glm::mix(a, b, t) * scale;
+#endif
+	}
+
+	glm::quat SampleRotation(const uint16_t *keys, unsigned int count, float keyTime, unsigned int &cursor)
+	{
+		float t;
+		const uint16_t *key = keys + FindKey(keys, count, keyTime, cursor, t) * CompressedClip::kValuesPerKey;
+		if (t <= 0.0f)
+			return DecodeRotation(key);
+
+		const uint16_t *next = key + CompressedClip::kValuesPerKey;
+#if CLIP_SIMD
+		// Mask the index bits off and scale both keys' stored components back at once.
+		__m128i packed = _mm_and_si128(_mm_loadu_si128((const __m128i *)key), _mm_set1_epi16(0x7FFF));
+		__m128i zero = _mm_setzero_si128();
+		__m128 scale = _mm_set1_ps(kRotationScale);
+		__m128 offset = _mm_set1_ps(kRotationRange);
+		__m128 a = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, zero)), scale), offset);
+		__m128 b = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(packed, zero)), scale), offset);
+
+		float lanesA[4], lanesB[4];
+		_mm_storeu_ps(lanesA, a);
+		_mm_storeu_ps(lanesB, b);
+		glm::quat from = RebuildRotation(lanesA + 1, LargestComponent(key));
+		glm::quat to = RebuildRotation(lanesB + 1, LargestComponent(next));
+#else
+		glm::quat from = DecodeRotation(key);
+		glm::quat to = DecodeRotation(next);
+#endif
+		return Lerp(from, to, t);
+	}
+
+	// Quantized and read back as the sampler will see them, so the key reduction measures what's actually stored.
+	inline glm::vec3 StoredVector(const glm::vec3 &value, const glm::vec3 &min, const glm::vec3 &extent)
+	{
+		glm::vec3 offset = value - min;
+		glm::vec3 key(QuantizeUnit(offset.x, extent.x), QuantizeUnit(offset.y, extent.y), QuantizeUnit(offset.z, extent.z));
+		return min + key * (extent * kVectorScale);
+	}
+
+	inline glm::quat StoredRotation(const glm::quat &value)
+	{
+		uint16_t key[4] = {};
+		QuantizeRotation(value, key + 1);
+		return DecodeRotation(key);
+	}
+
+	// Keys that a straight line from the last key kept to a later one passes within tolerance of are dropped. The line
+	// runs between the stored keys at their quantized times and is measured against the original values, so what's
+	// played back stays within tolerance after quantization too. A channel whose first stored key is within tolerance
+	// of every value comes back with just that one.
+	template<typename Value>
+	std::vector<size_t> ReduceKeys(const std::vector<float> &times, const std::vector<Value> &values, const std::vector<Value> &stored,
+		float timeScale, float tolerance)
+	{
+		std::vector<size_t> kept;
+		size_t count = std::min(times.size(), values.size());
+		if (count == 0)
+			return kept;
+
+		bool constant = true;
+		for (size_t i = 0; i < count && constant; i++)
+			constant = Error(stored[0], values[i]) <= tolerance;
+		kept.push_back(0);
+		if (constant)
+			return kept;
+
+		size_t anchor = 0;
+		for (size_t end = 2; end < count; end++)
+		{
+			float start = (float)QuantizeTime(times[anchor], timeScale);
+			float span = (float)QuantizeTime(times[end], timeScale) - start;
+			bool fits = true;
+			for (size_t i = anchor + 1; i < end && fits; i++)
+			{
+				float t = span > 0.0f ? glm::clamp((times[i] * timeScale - start) / span, 0.0f, 1.0f) : 0.0f;
+				fits = Error(Lerp(stored[anchor], stored[end], t), values[i]) <= tolerance;
+			}
+			if (!fits)
+			{
+				anchor = end - 1;
+				kept.push_back(anchor);
+			}
+		}
+		kept.push_back(count - 1);
+		return kept;
+	}
+
+	// The range a vector channel is quantized into, over all of its keys so it's known before the reduction picks any.
+	void GetRange(const std::vector<glm::vec3> &values, glm::vec3 &min, glm::vec3 &extent)
+	{
+		min = glm::vec3(FLT_MAX);
+		glm::vec3 max(-FLT_MAX);
+		for (const glm::vec3 &value : values)
+		{
+			min = glm::min(min, value);
+			max = glm::max(max, value);
+		}
+		extent = max - min;
+	}
+
+	std::vector<size_t> ReduceVectorKeys(const std::vector<float> &times, const std::vector<glm::vec3> &values, float timeScale, float tolerance,
+		glm::vec3 &min, glm::vec3 &extent)
+	{
+		GetRange(values, min, extent);
+		std::vector<glm::vec3> stored(values.size());
+		for (size_t i = 0; i < values.size(); i++)
+			stored[i] = StoredVector(values[i], min, extent);
+		return ReduceKeys(times, values, stored, timeScale, tolerance);
+	}
+
+	std::vector<size_t> ReduceRotationKeys(const std::vector<float> &times, const std::vector<glm::quat> &values, float timeScale, float tolerance)
+	{
+		std::vector<glm::quat> stored(values.size());
+		for (size_t i = 0; i < values.size(); i++)
+			stored[i] = StoredRotation(values[i]);
+		return ReduceKeys(times, values, stored, timeScale, tolerance);
+	}
+
+	// Appends a vector channel's kept keys, quantized into the range it was reduced with.
+	void WriteVectorKeys(const std::vector<float> &times, const std::vector<glm::vec3> &values, const std::vector<size_t> &kept, float timeScale,
+		const glm::vec3 &min, const glm::vec3 &extent, std::vector<uint16_t> &keys)
+	{
+		for (size_t i : kept)
+		{
+			glm::vec3 offset = values[i] - min;
+			keys.push_back(QuantizeTime(times[i], timeScale));
+			keys.push_back(QuantizeUnit(offset.x, extent.x));
+			keys.push_back(QuantizeUnit(offset.y, extent.y));
+			keys.push_back(QuantizeUnit(offset.z, extent.z));
+		}
+	}
+
+	// A dropped channel plays the bind pose, so every value has to be within tolerance of it, not just the one kept.
+	template<typename Value>
+	bool MatchesBindPose(const std::vector<Value> &values, const std::vector<size_t> &kept, const Value &bind, float tolerance)
+	{
+		if (kept.size() != 1)
+			return false;
+		for (const Value &value : values)
+		{
+			if (Error(value, bind) > tolerance)
+				return false;
+		}
+		return true;
+	}
+}
+
+CompressedClip CompressedClip::Compress(const AnimationClip &clip, const Skeleton &skeleton, const Settings &settings)
+{
+	CompressedClip result;
+	result.m_name = clip.name;
+	result.m_duration = clip.duration;
+	result.m_timeScale = clip.duration > 0.0f ? kMaxKeyTime / clip.duration : 0.0f;
+
+	for (const AnimationTrack &track : clip.tracks)
+	{
+		if (track.joint >= skeleton.GetJointCount())
+			continue;
+
+		CompressedTrack out = {};
+		out.joint = track.joint;
+
+		glm::vec3 min, extent;
+		std::vector<size_t> kept = ReduceVectorKeys(track.translationTimes, track.translations, result.m_timeScale, settings.translationError, min, extent);
+		if (!kept.empty() && !MatchesBindPose(track.translations, kept, skeleton.bindTranslations[track.joint], settings.translationError))
+		{
+			out.offsets[0] = (uint32_t)result.m_keys.size();
+			out.counts[0] = (uint32_t)kept.size();
+			out.translationMin = min;
+			out.translationExtent = extent;
+			WriteVectorKeys(track.translationTimes, track.translations, kept, result.m_timeScale, min, extent, result.m_keys);
+		}
+
+		kept = ReduceRotationKeys(track.rotationTimes, track.rotations, result.m_timeScale, settings.rotationError);
+		if (!kept.empty() && !MatchesBindPose(track.rotations, kept, skeleton.bindRotations[track.joint], settings.rotationError))
+		{
+			out.offsets[1] = (uint32_t)result.m_keys.size();
+			out.counts[1] = (uint32_t)kept.size();
+			for (size_t i : kept)
+			{
+				uint16_t key[4];
+				key[0] = QuantizeTime(track.rotationTimes[i], result.m_timeScale);
+				QuantizeRotation(track.rotations[i], key + 1);
+				result.m_keys.insert(result.m_keys.end(), key, key + 4);
+			}
+		}
+
+		kept = ReduceVectorKeys(track.scaleTimes, track.scales, result.m_timeScale, settings.scaleError, min, extent);
+		if (!kept.empty() && !MatchesBindPose(track.scales, kept, skeleton.bindScales[track.joint], settings.scaleError))
+		{
+			out.offsets[2] = (uint32_t)result.m_keys.size();
+			out.counts[2] = (uint32_t)kept.size();
+			out.scaleMin = min;
+			out.scaleExtent = extent;
+			WriteVectorKeys(track.scaleTimes, track.scales, kept, result.m_timeScale, min, extent, result.m_keys);
+		}
+
+		if (out.counts[0] + out.counts[1] + out.counts[2] > 0) // Tracks that only hold the bind pose aren't kept.
+			result.m_tracks.push_back(out);
+	}
+	return result;
+}
+
+void CompressedClip::Sample(float time, unsigned int *cursors, glm::vec3 *translations, glm::quat *rotations, glm::vec3 *scales) const
+{
+	float keyTime = time * m_timeScale;
+	const uint16_t *keys = m_keys.data();
+	for (const CompressedTrack &track : m_tracks)
+	{
+		if (track.counts[0] > 0)
+			translations[track.joint] = SampleVector(keys + track.offsets[0], track.counts[0], keyTime, cursors[0], track.translationMin, track.translationExtent);
+		if (track.counts[1] > 0)
+			rotations[track.joint] = SampleRotation(keys + track.offsets[1], track.counts[1], keyTime, cursors[1]);
+		if (track.counts[2] > 0)
+			scales[track.joint] = SampleVector(keys + track.offsets[2], track.counts[2], keyTime, cursors[2], track.scaleMin, track.scaleExtent);
+		cursors += 3;
+	}
+}
+
+bool CompressedClip::Write(const char *filePath, const std::vector<CompressedClip> &clips, unsigned int jointCount, const Settings &settings)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Couldn't write animation clips " << filePath << std::endl;
+		return false;
+	}
+
+	ClipFileHeader header = { kClipFileMagic, kClipFileVersion, (uint32_t)clips.size(), jointCount,
+		settings.translationError, settings.rotationError, settings.scaleError };
+	file.write((const char *)&header, sizeof(header));
+	for (const CompressedClip &clip : clips)
+	{
+		ClipFileRecord record = { clip.m_duration, (uint32_t)clip.m_name.size(), (uint32_t)clip.m_tracks.size(), (uint32_t)clip.m_keys.size() };
+		file.write((const char *)&record, sizeof(record));
+		file.write(clip.m_name.data(), (std::streamsize)clip.m_name.size());
+		file.write((const char *)clip.m_tracks.data(), (std::streamsize)(clip.m_tracks.size() * sizeof(CompressedTrack)));
+		file.write((const char *)clip.m_keys.data(), (std::streamsize)(clip.m_keys.size() * sizeof(uint16_t)));
+	}
+
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing animation clips " << filePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool CompressedClip::Read(const char *filePath, std::vector<CompressedClip> &clips, unsigned int jointCount, const Settings &settings)
+{
+	clips.clear();
+	MappedFile file;
+	if (!file.Open(filePath))
+		return false;
+
+	const char *data = file.GetData();
+	uint64_t size = file.GetSize();
+	uint64_t offset = sizeof(ClipFileHeader);
+
+	ClipFileHeader header;
+	if (size < sizeof(header))
+		return false;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != kClipFileMagic || header.version != kClipFileVersion || header.jointCount != jointCount)
+		return false;
+	if (header.translationError != settings.translationError || header.rotationError != settings.rotationError || header.scaleError != settings.scaleError)
+		return false; // Cooked with other settings, compress again.
+
+	// Everything Sample reads is checked here, so a damaged file can't send it out of bounds later.
+	for (uint32_t c = 0; c < header.clipCount; c++)
+	{
+		ClipFileRecord record;
+		if (offset + sizeof(record) > size)
+			break;
+		std::memcpy(&record, data + offset, sizeof(record));
+		offset += sizeof(record);
+		uint64_t end = offset + record.nameLength + (uint64_t)record.trackCount * sizeof(CompressedTrack) + (uint64_t)record.keyCount * sizeof(uint16_t);
+		if (end > size)
+			break;
+
+		CompressedClip clip;
+		clip.m_name.assign(data + offset, record.nameLength);
+		offset += record.nameLength;
+		clip.m_duration = record.duration;
+		clip.m_timeScale = record.duration > 0.0f ? kMaxKeyTime / record.duration : 0.0f;
+		clip.m_tracks.resize(record.trackCount);
+		std::memcpy(clip.m_tracks.data(), data + offset, clip.m_tracks.size() * sizeof(CompressedTrack));
+		offset += clip.m_tracks.size() * sizeof(CompressedTrack);
+		clip.m_keys.resize(record.keyCount);
+		std::memcpy(clip.m_keys.data(), data + offset, clip.m_keys.size() * sizeof(uint16_t));
+		offset = end;
+
+		bool valid = true;
+		for (const CompressedTrack &track : clip.m_tracks)
+		{
+			valid = valid && track.joint < jointCount;
+			for (int channel = 0; channel < 3 && valid; channel++)
+				valid = (uint64_t)track.offsets[channel] + (uint64_t)track.counts[channel] * kValuesPerKey <= record.keyCount;
+		}
+		if (!valid)
+			break;
+		clips.push_back(std::move(clip));
+	}
+
+	if (clips.size() != header.clipCount)
+	{
+		clips.clear();
+		return false;
+	}
+	return true;
+}
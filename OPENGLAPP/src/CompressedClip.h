@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Animation.h"
+
+#include <cstdint>
+
+// One joint's channels in a compressed clip. Keys are 16 bit time and three 16 bit values, a channel's keys are
+// stored together and a track's channels follow each other, so stepping a cursor stays in the same cache line.
+struct CompressedTrack
+{
+	uint32_t joint;
+	uint32_t offsets[3]; // Translation, rotation and scale keys, in uint16s into the clip's key data.
+	uint32_t counts[3]; // Zero for a channel that holds the bind pose the whole clip.
+	glm::vec3 translationMin, translationExtent; // Range the quantized translations cover.
+	glm::vec3 scaleMin, scaleExtent;
+};
+
+// An AnimationClip quantized for playback. Keys a straight line between their neighbours already passes close enough
+// to are dropped, rotations keep their three smallest components in 15 bits each, and translations and scales are
+// scaled into each track's range, so every key is 8 bytes against the 16 or 20 it was imported as.
+class CompressedClip
+{
+public:
+	struct Settings
+	{
+		float translationError = 1e-4f; // Model units.
+		float rotationError = 1e-4f; // Radians.
+		float scaleError = 1e-4f;
+	};
+
+	static const unsigned int kValuesPerKey = 4; // Time then the value.
+
+public:
+	static CompressedClip Compress(const AnimationClip &clip, const Skeleton &skeleton) { return Compress(clip, skeleton, Settings()); }
+	static CompressedClip Compress(const AnimationClip &clip, const Skeleton &skeleton, const Settings &settings);
+
+	// Writes the sampled channels into the pose, leaving joints without a track alone. cursors holds three per track,
+	// the key each channel was last sampled after, so playing forwards only steps on from there.
+	void Sample(float time, unsigned int *cursors, glm::vec3 *translations, glm::quat *rotations, glm::vec3 *scales) const;
+
+	const std::string &GetName() const { return m_name; }
+	float GetDuration() const { return m_duration; }
+	unsigned int GetTrackCount() const { return (unsigned int)m_tracks.size(); }
+	size_t GetSize() const { return m_tracks.size() * sizeof(CompressedTrack) + m_keys.size() * sizeof(uint16_t); } // Bytes.
+
+	// Clips cooked next to the model they came from (.aclip), along with the settings they were compressed with. Read
+	// fails if the file is damaged, or was cooked for a skeleton with a different number of joints or other settings.
+	static bool Write(const char *filePath, const std::vector<CompressedClip> &clips, unsigned int jointCount, const Settings &settings);
+	static bool Read(const char *filePath, std::vector<CompressedClip> &clips, unsigned int jointCount, const Settings &settings);
+
+private:
+	std::string m_name;
+	float m_duration = 0.0f; // Seconds.
+	float m_timeScale = 0.0f; // Seconds to quantized key time.
+	std::vector<CompressedTrack> m_tracks;
+	std::vector<uint16_t> m_keys;
+
+};
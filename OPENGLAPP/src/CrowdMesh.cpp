@@ -0,0 +1,127 @@
+#include "CrowdMesh.h"
+
+#include "Shader.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <glad.h>
+
+namespace
+{
+	const size_t kMinCapacity = 256; // Agents.
+
+	double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+CrowdMesh::CrowdMesh()
+{
+	m_startTime = Now();
+}
+CrowdMesh::~CrowdMesh()
+{
+	glDeleteBuffers(1, &m_agentBuffer);
+}
+
+bool CrowdMesh::Load(std::shared_ptr<SkinnedMesh> source, float frameRate)
+{
+	if (source == nullptr || !m_animationTexture.Bake(*source, frameRate))
+		return false;
+
+	m_source = std::move(source);
+	return true;
+}
+
+void CrowdMesh::AddAgent(const glm::mat4 &transform, int clip, float timeOffset, float speed)
+{
+	if (m_source == nullptr)
+		return;
+
+	int clipCount = (int)m_animationTexture.GetClips().size();
+	m_agents.push_back({ transform, glm::clamp(clip, 0, std::max(clipCount - 1, 0)), timeOffset, speed, 0.0f });
+	m_agentsDirty = true;
+
+	// Grow the bounds to take in the agent. Only loosely, poses can reach a little past the bind pose's bounds.
+	glm::vec3 center = glm::vec3(transform * glm::vec4(m_source->GetBoundsCenter(), 1.0f));
+	float radius = m_source->GetBoundsRadius() * glm::length(glm::vec3(transform[0]));
+	if (m_agents.size() == 1)
+	{
+		m_boundsCenter = center;
+		m_boundsRadius = radius;
+		return;
+	}
+	float distance = glm::length(center - m_boundsCenter);
+	if (distance + radius <= m_boundsRadius)
+		return;
+	if (distance + m_boundsRadius <= radius)
+	{
+		m_boundsCenter = center;
+		m_boundsRadius = radius;
+		return;
+	}
+	float newRadius = (distance + radius + m_boundsRadius) * 0.5f;
+	m_boundsCenter += (center - m_boundsCenter) * ((newRadius - m_boundsRadius) / distance);
+	m_boundsRadius = newRadius;
+}
+
+void CrowdMesh::ClearAgents()
+{
+	m_agents.clear();
+	m_agentsDirty = true;
+	m_boundsCenter = glm::vec3(0.0f);
+	m_boundsRadius = 0.0f;
+}
+
+unsigned int CrowdMesh::GetDrawCallCount() const
+{
+	if (m_source == nullptr || m_agents.empty())
+		return 0;
+	return std::max((unsigned int)m_source->GetSubmeshes().size(), 1u);
+}
+
+void CrowdMesh::GetTextures(std::vector<const aie::Texture *> &textures) const
+{
+	if (m_source)
+		m_source->GetTextures(textures);
+}
+
+void CrowdMesh::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
+{
+	if (m_source == nullptr || m_agents.empty())
+		return;
+
+	// Agents only change when they're added or cleared, so the buffer is usually left alone.
+	if (m_agentsDirty)
+	{
+		if (m_agents.size() > m_agentCapacity)
+		{
+			glDeleteBuffers(1, &m_agentBuffer);
+			m_agentCapacity = std::max(kMinCapacity, m_agents.size() * 2);
+			glGenBuffers(1, &m_agentBuffer);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_agentBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(m_agentCapacity * sizeof(Agent)), nullptr, GL_DYNAMIC_DRAW);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_agentBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr)(m_agents.size() * sizeof(Agent)), m_agents.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		m_agentsDirty = false;
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kAgentBinding, m_agentBuffer);
+	m_animationTexture.Bind(shader);
+	if (shader->getUniform("crowdTime") >= 0)
+		shader->bindUniform("crowdTime", (float)(Now() - m_startTime));
+
+	// Agents are uniformly scaled, so only the model needs an inverse for its normals and it's the same for all of them.
+	int normalMatrix = shader->getCachedUniform("crowdNormalMatrix");
+	if (normalMatrix >= 0)
+		shader->bindUniform(normalMatrix, glm::transpose(glm::inverse(glm::mat3(transform))));
+
+	// Straight to the base, the source's own skinning has nothing to do with the crowd.
+	m_source->SetInstanceCount((unsigned int)m_agents.size());
+	m_source->Mesh::Render(shader, projectionView, transform);
+	m_source->SetInstanceCount(1);
+}
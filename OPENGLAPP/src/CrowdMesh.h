@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "SkinnedMesh.h"
+#include "VertexAnimationTexture.h"
+
+#include <memory>
+
+// Crowds of one skinned mesh played back from vertex animation textures. Every agent's transform, clip and timing
+// sits in a storage buffer and the crowd shader poses each agent from gl_InstanceID, so however many there are the
+// crowd is one instanced draw per part of the mesh, with nothing evaluated on the CPU. Transforms are relative to the
+// instance the crowd is drawn with.
+class CrowdMesh : public Mesh
+{
+public:
+	static const unsigned int kAgentBinding = 5; // CrowdAgentSBO in the crowd shader.
+
+	// As CrowdAgentSBO lays it out.
+	struct Agent
+	{
+		glm::mat4 transform; // Uniform scale only, the shader turns normals by it without an inverse.
+		int clip;
+		float timeOffset; // Seconds, so agents playing the same clip aren't in step.
+		float speed;
+		float padding;
+	};
+
+public:
+	CrowdMesh();
+	virtual ~CrowdMesh();
+
+	// Bakes the source's clips, the source is drawn for each agent and kept for as long as the crowd is.
+	bool Load(std::shared_ptr<SkinnedMesh> source, float frameRate = 30.0f);
+
+	void AddAgent(const glm::mat4 &transform, int clip, float timeOffset = 0.0f, float speed = 1.0f);
+	void ClearAgents();
+	unsigned int GetAgentCount() const { return (unsigned int)m_agents.size(); }
+
+	const VertexAnimationTexture &GetAnimationTexture() const { return m_animationTexture; }
+	unsigned int GetDrawCallCount() const; // Per frame, one per part of the source mesh.
+
+	virtual void GetTextures(std::vector<const aie::Texture *> &textures) const override; // The source mesh's.
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform) override;
+
+private:
+	std::shared_ptr<SkinnedMesh> m_source;
+	VertexAnimationTexture m_animationTexture;
+
+	std::vector<Agent> m_agents;
+	unsigned int m_agentBuffer = 0;
+	size_t m_agentCapacity = 0; // In agents.
+	bool m_agentsDirty = false;
+	double m_startTime = 0.0; // Seconds, the shader's clock starts at zero here.
+
+};
@@ -0,0 +1,438 @@
+#include "EnvironmentMap.h"
+
+#include "Shader.h"
+#include "ThreadPool.h"
+#include "SamplerCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include <glad.h>
+#include <stb_image.h>
+
+#include <glm/gtc/packing.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define ENVIRONMENT_SIMD 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	const uint32_t kEnvironmentMagic = 0x4D564E45; // "ENVM"
+	const uint32_t kEnvironmentVersion = 1;
+	const size_t kRowsPerTask = 8;
+	const unsigned int kMinSourceSize = 8; // Texels, the coarsest the source's mips go.
+
+	// The file is the header then every level, each face in GL order, as RGB half floats.
+	struct EnvironmentHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t faceSize;
+		uint32_t levelCount;
+		glm::vec3 coefficients[EnvironmentMap::kCoefficientCount];
+	};
+
+	// The image and its box filtered mips, RGBA so a texel loads straight into a register.
+	struct SourceLevel
+	{
+		unsigned int width = 0;
+		unsigned int height = 0;
+		std::vector<glm::vec4> texels;
+	};
+
+	// A GGX sample around +z, with the weight it adds and the source level that covers its share of the lobe.
+	struct LobeSample
+	{
+		glm::vec3 direction;
+		float weight;
+		float lod;
+	};
+
+	SourceLevel Downsample(const SourceLevel &source)
+	{
+		SourceLevel level;
+		level.width = std::max(source.width / 2, 1u);
+		level.height = std::max(source.height / 2, 1u);
+		level.texels.resize((size_t)level.width * level.height);
+		for (unsigned int y = 0; y < level.height; y++)
+		{
+			unsigned int y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+			for (unsigned int x = 0; x < level.width; x++)
+			{
+				unsigned int x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+				level.texels[(size_t)y * level.width + x] = 0.25f * (
+					source.texels[(size_t)y0 * source.width + x0] + source.texels[(size_t)y0 * source.width + x1] +
+					source.texels[(size_t)y1 * source.width + x0] + source.texels[(size_t)y1 * source.width + x1]);
+			}
+		}
+		return level;
+	}
+
+	// Bilinear, wrapping around horizontally and clamped at the poles.
+	glm::vec4 SampleLevel(const SourceLevel &level, const glm::vec3 &direction)
+	{
+		float u = std::atan2(direction.z, direction.x) * (0.5f / glm::pi<float>()) + 0.5f;
+		float v = std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<float>();
+		float x = u * level.width - 0.5f;
+		float y = glm::clamp(v * level.height - 0.5f, 0.0f, (float)(level.height - 1));
+		float fx = std::floor(x), fy = std::floor(y);
+		float tx = x - fx, ty = y - fy;
+
+		int width = (int)level.width;
+		unsigned int x0 = (unsigned int)(((int)fx % width + width) % width);
+		unsigned int x1 = (x0 + 1) % level.width;
+		unsigned int y0 = (unsigned int)fy, y1 = std::min(y0 + 1, level.height - 1);
+		const glm::vec4 *row0 = &level.texels[(size_t)y0 * level.width];
+		const glm::vec4 *row1 = &level.texels[(size_t)y1 * level.width];
+
+		glm::vec4 result;
+#if ENVIRONMENT_SIMD
+		__m128 a = _mm_loadu_ps(&row0[x0].x), b = _mm_loadu_ps(&row0[x1].x);
+		__m128 c = _mm_loadu_ps(&row1[x0].x), d = _mm_loadu_ps(&row1[x1].x);
+		__m128 s = _mm_set1_ps(tx);
+		__m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), s));
+		__m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), s));
+		_mm_storeu_ps(&result.x, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(ty))));
+#else
+		result = glm::mix(glm::mix(row0[x0], row0[x1], tx), glm::mix(row1[x0], row1[x1], tx), ty);
+#endif
+		return result;
+	}
+
+	glm::vec4 SampleSource(const std::vector<SourceLevel> &source, const glm::vec3 &direction, float lod)
+	{
+		lod = glm::clamp(lod, 0.0f, (float)(source.size() - 1));
+		unsigned int level = (unsigned int)lod;
+		float t = lod - (float)level;
+		glm::vec4 result = SampleLevel(source[level], direction);
+		if (t > 0.0f && level + 1 < source.size())
+			result = glm::mix(result, SampleLevel(source[level + 1], direction), t);
+		return result;
+	}
+
+	// Real L2 spherical harmonics, in the order the lit shader evaluates them.
+	void EvaluateBasis(const glm::vec3 &d, float basis[EnvironmentMap::kCoefficientCount])
+	{
+		basis[0] = 0.282095f;
+		basis[1] = 0.488603f * d.y;
+		basis[2] = 0.488603f * d.z;
+		basis[3] = 0.488603f * d.x;
+		basis[4] = 1.092548f * d.x * d.y;
+		basis[5] = 1.092548f * d.y * d.z;
+		basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+		basis[7] = 1.092548f * d.x * d.z;
+		basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+	}
+
+	// Integrates radiance times each basis function over the sphere, then convolves with the cosine lobe so the
+	// coefficients give irradiance, divided by pi so a white diffuse surface reflects exactly that.
+	void Project(const SourceLevel &source, glm::vec3 coefficients[EnvironmentMap::kCoefficientCount])
+	{
+		const unsigned int count = EnvironmentMap::kCoefficientCount;
+		std::vector<float> cosPhi(source.width), sinPhi(source.width);
+		for (unsigned int x = 0; x < source.width; x++)
+		{
+			float phi = glm::two_pi<float>() * ((x + 0.5f) / source.width - 0.5f);
+			cosPhi[x] = std::cos(phi);
+			sinPhi[x] = std::sin(phi);
+		}
+
+		// Each row's sums are added up in order afterwards, so the result doesn't depend on how the rows were split.
+		std::vector<glm::vec4> rows((size_t)source.height * count);
+		ThreadPool::Get().ParallelFor(source.height, kRowsPerTask, [&](size_t begin, size_t end)
+		{
+			float basis[count];
+			for (size_t y = begin; y < end; y++)
+			{
+				float theta = glm::pi<float>() * (y + 0.5f) / source.height;
+				float sinTheta = std::sin(theta), cosTheta = std::cos(theta);
+				float solidAngle = (glm::two_pi<float>() / source.width) * (glm::pi<float>() / source.height) * sinTheta;
+				const glm::vec4 *row = &source.texels[y * source.width];
+
+#if ENVIRONMENT_SIMD
+				__m128 sums[count];
+				for (unsigned int i = 0; i < count; i++)
+					sums[i] = _mm_setzero_ps();
+				for (unsigned int x = 0; x < source.width; x++)
+				{
+					EvaluateBasis(glm::vec3(sinTheta * cosPhi[x], cosTheta, sinTheta * sinPhi[x]), basis);
+					__m128 radiance = _mm_loadu_ps(&row[x].x);
+					for (unsigned int i = 0; i < count; i++)
+						sums[i] = _mm_add_ps(sums[i], _mm_mul_ps(radiance, _mm_set1_ps(basis[i])));
+				}
+				__m128 weight = _mm_set1_ps(solidAngle);
+				for (unsigned int i = 0; i < count; i++)
+					_mm_storeu_ps(&rows[y * count + i].x, _mm_mul_ps(sums[i], weight));
+#else
+				glm::vec4 sums[count] = {};
+				for (unsigned int x = 0; x < source.width; x++)
+				{
+					EvaluateBasis(glm::vec3(sinTheta * cosPhi[x], cosTheta, sinTheta * sinPhi[x]), basis);
+					for (unsigned int i = 0; i < count; i++)
+						sums[i] += row[x] * basis[i];
+				}
+				for (unsigned int i = 0; i < count; i++)
+					rows[y * count + i] = sums[i] * solidAngle;
+#endif
+			}
+		});
+
+		const float bands[] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec4 sum(0.0f);
+			for (unsigned int y = 0; y < source.height; y++)
+				sum += rows[(size_t)y * count + i];
+			coefficients[i] = glm::vec3(sum) * bands[i];
+		}
+	}
+
+	// Van der Corput sequence, the second coordinate of the Hammersley points.
+	float RadicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return (float)bits * 2.3283064365386963e-10f;
+	}
+
+	// Assumes the view is along the normal, so the lobe only depends on roughness and is the same for every texel.
+	// Each sample reads the source at the level whose texels cover about as much of the sphere as the sample does,
+	// which keeps the few samples from aliasing on small bright spots.
+	std::vector<LobeSample> MakeLobe(float roughness, float sourceTexelAngle)
+	{
+		std::vector<LobeSample> lobe;
+		float alpha = roughness * roughness, alpha2 = alpha * alpha;
+		for (unsigned int i = 0; i < EnvironmentMap::kSampleCount; i++)
+		{
+			float phi = glm::two_pi<float>() * i / EnvironmentMap::kSampleCount;
+			float xi = RadicalInverse(i);
+			float cosTheta = std::sqrt((1.0f - xi) / (1.0f + (alpha2 - 1.0f) * xi));
+			float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+			glm::vec3 half(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+			glm::vec3 direction = 2.0f * half.z * half - glm::vec3(0.0f, 0.0f, 1.0f);
+			if (direction.z <= 0.0f)
+				continue;
+
+			float denominator = cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f;
+			float pdf = alpha2 / (glm::pi<float>() * denominator * denominator) * 0.25f;
+			float sampleAngle = 1.0f / (EnvironmentMap::kSampleCount * pdf);
+			float lod = std::max(0.5f * std::log2(sampleAngle / sourceTexelAngle) + 1.0f, 0.0f);
+			lobe.push_back({ direction, direction.z, lod });
+		}
+		return lobe;
+	}
+
+	// Direction through a point on a cubemap face, faces in GL order with s and t from -1 to 1.
+	glm::vec3 FaceDirection(unsigned int face, float s, float t)
+	{
+		switch (face)
+		{
+		case 0: return glm::normalize(glm::vec3(1.0f, -t, -s));
+		case 1: return glm::normalize(glm::vec3(-1.0f, -t, s));
+		case 2: return glm::normalize(glm::vec3(s, 1.0f, t));
+		case 3: return glm::normalize(glm::vec3(s, -1.0f, -t));
+		case 4: return glm::normalize(glm::vec3(s, -t, 1.0f));
+		default: return glm::normalize(glm::vec3(-s, -t, -1.0f));
+		}
+	}
+}
+
+EnvironmentMap::~EnvironmentMap()
+{
+	Release();
+}
+
+bool EnvironmentMap::Load(const char *filePath)
+{
+	Release();
+
+	std::string cachePath = std::string(filePath) + ".env";
+	std::error_code error;
+	bool upToDate = std::filesystem::exists(cachePath, error) &&
+		std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(filePath, error);
+
+	Levels levels;
+	if (!upToDate || !Read(cachePath, levels))
+	{
+		if (!Filter(filePath, levels))
+		{
+			std::cout << "WARNING: " << "Couldn't load environment map " << filePath << std::endl;
+			return false;
+		}
+		Write(cachePath, levels);
+	}
+
+	m_filePath = filePath;
+	Upload(levels);
+	return true;
+}
+
+bool EnvironmentMap::Read(const std::string &cachePath, Levels &levels)
+{
+	std::ifstream file(cachePath, std::ios::binary);
+	EnvironmentHeader header = {};
+	if (!file.read((char *)&header, sizeof(header)) || header.magic != kEnvironmentMagic || header.version != kEnvironmentVersion ||
+		header.faceSize != kFaceSize || header.levelCount != kLevelCount)
+	{
+		return false;
+	}
+
+	levels.resize(kLevelCount);
+	for (unsigned int level = 0; level < kLevelCount; level++)
+	{
+		unsigned int size = std::max(kFaceSize >> level, 1u);
+		levels[level].resize((size_t)6 * size * size * 3);
+		if (!file.read((char *)levels[level].data(), (std::streamsize)(levels[level].size() * sizeof(uint16_t))))
+			return false;
+	}
+
+	std::copy(header.coefficients, header.coefficients + kCoefficientCount, m_coefficients);
+	return true;
+}
+
+bool EnvironmentMap::Write(const std::string &cachePath, const Levels &levels) const
+{
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Couldn't write environment cache " << cachePath << std::endl;
+		return false;
+	}
+
+	EnvironmentHeader header = {};
+	header.magic = kEnvironmentMagic;
+	header.version = kEnvironmentVersion;
+	header.faceSize = kFaceSize;
+	header.levelCount = kLevelCount;
+	std::copy(m_coefficients, m_coefficients + kCoefficientCount, header.coefficients);
+
+	file.write((const char *)&header, sizeof(header));
+	for (const std::vector<uint16_t> &level : levels)
+		file.write((const char *)level.data(), (std::streamsize)(level.size() * sizeof(uint16_t)));
+
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing environment cache " << cachePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool EnvironmentMap::Filter(const std::string &filePath, Levels &levels)
+{
+	int width = 0, height = 0, components = 0;
+	float *pixels = stbi_loadf(filePath.c_str(), &width, &height, &components, 3);
+	if (pixels == nullptr)
+		return false;
+
+	std::vector<SourceLevel> source(1);
+	source[0].width = (unsigned int)width;
+	source[0].height = (unsigned int)height;
+	source[0].texels.resize((size_t)width * height);
+	for (size_t i = 0; i < source[0].texels.size(); i++)
+		source[0].texels[i] = glm::vec4(pixels[i * 3], pixels[i * 3 + 1], pixels[i * 3 + 2], 0.0f);
+	stbi_image_free(pixels);
+
+	while (std::min(source.back().width, source.back().height) > kMinSourceSize)
+		source.push_back(Downsample(source.back()));
+
+	Project(source[0], m_coefficients);
+
+	// The top level is a plain resample, every one after is a rougher lobe than the last.
+	float sourceTexelAngle = 4.0f * glm::pi<float>() / ((float)source[0].width * source[0].height); // On average.
+	levels.resize(kLevelCount);
+	for (unsigned int level = 0; level < kLevelCount; level++)
+	{
+		unsigned int size = std::max(kFaceSize >> level, 1u);
+		std::vector<LobeSample> lobe;
+		if (level == 0)
+		{
+			float texelAngle = 4.0f * glm::pi<float>() / (6.0f * size * size);
+			lobe.push_back({ glm::vec3(0.0f, 0.0f, 1.0f), 1.0f, std::max(0.5f * std::log2(texelAngle / sourceTexelAngle), 0.0f) });
+		}
+		else
+		{
+			lobe = MakeLobe((float)level / (kLevelCount - 1), sourceTexelAngle);
+		}
+
+		std::vector<uint16_t> &data = levels[level];
+		data.resize((size_t)6 * size * size * 3);
+		ThreadPool::Get().ParallelFor((size_t)6 * size, kRowsPerTask, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				unsigned int face = (unsigned int)(row / size), y = (unsigned int)(row % size);
+				for (unsigned int x = 0; x < size; x++)
+				{
+					glm::vec3 normal = FaceDirection(face, 2.0f * (x + 0.5f) / size - 1.0f, 2.0f * (y + 0.5f) / size - 1.0f);
+					glm::vec3 up = std::fabs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+					glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+					glm::vec3 bitangent = glm::cross(normal, tangent);
+
+					glm::vec4 sum(0.0f);
+					float weight = 0.0f;
+					for (const LobeSample &sample : lobe)
+					{
+						glm::vec3 direction = tangent * sample.direction.x + bitangent * sample.direction.y + normal * sample.direction.z;
+						sum += SampleSource(source, direction, sample.lod) * sample.weight;
+						weight += sample.weight;
+					}
+					sum /= std::max(weight, 1e-6f);
+
+					uint16_t *texel = &data[(row * size + x) * 3];
+					texel[0] = glm::packHalf1x16(sum.r);
+					texel[1] = glm::packHalf1x16(sum.g);
+					texel[2] = glm::packHalf1x16(sum.b);
+				}
+			}
+		});
+	}
+	return true;
+}
+
+void EnvironmentMap::Upload(const Levels &levels)
+{
+	// Filters across the edges of the faces, or the seams show in the rougher levels.
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &m_cubemap);
+	glTextureStorage2D(m_cubemap, kLevelCount, GL_RGB16F, kFaceSize, kFaceSize);
+	for (unsigned int level = 0; level < kLevelCount; level++)
+	{
+		GLsizei size = (GLsizei)std::max(kFaceSize >> level, 1u);
+		glTextureSubImage3D(m_cubemap, level, 0, 0, 0, size, size, 6, GL_RGB, GL_HALF_FLOAT, levels[level].data());
+	}
+}
+
+void EnvironmentMap::Bind(aie::ShaderProgram *shader) const
+{
+	glBindTextureUnit(kUnit, m_cubemap);
+	SamplerCache::Get().Bind(kUnit, SamplerState::Environment());
+	shader->bindUniform("environmentSH", (int)kCoefficientCount, m_coefficients);
+	shader->bindUniform("environmentMaxLod", (float)(kLevelCount - 1));
+}
+
+glm::vec3 EnvironmentMap::Evaluate(const glm::vec3 &normal) const
+{
+	float basis[kCoefficientCount];
+	EvaluateBasis(normal, basis);
+	glm::vec3 result(0.0f);
+	for (unsigned int i = 0; i < kCoefficientCount; i++)
+		result += m_coefficients[i] * basis[i];
+	return glm::max(result, glm::vec3(0.0f));
+}
+
+void EnvironmentMap::Release()
+{
+	if (m_cubemap != 0)
+		glDeleteTextures(1, &m_cubemap);
+	m_cubemap = 0;
+	m_filePath.clear();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.h"
+
+#include <cstdint>
+
+namespace aie
+{
+	class ShaderProgram;
+}
+
+// Image based lighting from an equirectangular HDR image. Diffuse light is the image's irradiance projected onto L2
+// spherical harmonics, nine coefficients the lit shader evaluates against the normal. Specular light is a cubemap
+// whose mips are the image prefiltered with the GGX lobe for increasing roughness, fetched once along the reflection
+// vector at the material's level. Both are worked out on the CPU across the thread pool and cooked to a file next
+// to the image (.env), so later loads only read it back.
+class EnvironmentMap
+{
+public:
+	static const unsigned int kFaceSize = 128; // Texels across each face of the finest level.
+	static const unsigned int kLevelCount = 6; // Mips, from mirror-like at the top to fully rough at the bottom.
+	static const unsigned int kSampleCount = 128; // GGX samples for each prefiltered texel.
+	static const unsigned int kUnit = 13; // Texture unit, after the texture arrays.
+	static const unsigned int kCoefficientCount = 9;
+
+public:
+	EnvironmentMap() = default;
+	~EnvironmentMap();
+
+	EnvironmentMap(const EnvironmentMap &) = delete;
+	EnvironmentMap &operator=(const EnvironmentMap &) = delete;
+
+	// Reads the cooked file if it's newer than the image, otherwise loads the image, filters it and writes the file.
+	// Returns false if neither could be read.
+	bool Load(const char *filePath);
+	void Release();
+
+	// Binds the cubemap and coefficients for the lit shader.
+	void Bind(aie::ShaderProgram *shader) const;
+
+	bool IsLoaded() const { return m_cubemap != 0; }
+	const std::string &GetFilePath() const { return m_filePath; }
+	const glm::vec3 *GetCoefficients() const { return m_coefficients; }
+	glm::vec3 Evaluate(const glm::vec3 &normal) const; // Irradiance over pi facing the normal, as the lit shader has it.
+
+private:
+	// Every level, each face in GL order, as half floats.
+	typedef std::vector<std::vector<uint16_t>> Levels;
+
+	bool Read(const std::string &cachePath, Levels &levels);
+	bool Write(const std::string &cachePath, const Levels &levels) const;
+	bool Filter(const std::string &filePath, Levels &levels);
+	void Upload(const Levels &levels);
+
+private:
+	std::string m_filePath;
+	glm::vec3 m_coefficients[kCoefficientCount] = {}; // Convolved with the cosine lobe and divided by pi.
+	unsigned int m_cubemap = 0;
+
+};
@@ -0,0 +1,637 @@
+#include "GltfModel.h"
+
+#include "Json.h"
+#include "MappedFile.h"
+#include "Shader.h"
+#include "Texture.h"
+#include "AssetManager.h"
+#include "OcclusionBaker.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glad.h>
+
+namespace
+{
+	const uint32_t kGlbMagic = 0x46546C67; // "glTF"
+	const uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+	const uint32_t kGlbChunkBin = 0x004E4942; // "BIN\0"
+	const int kMaxNodeDepth = 64;
+
+	// Vertex attribute locations, matching the layout Mesh uses in the lit shaders.
+	struct AttributeSlot
+	{
+		const char *name;
+		unsigned int location;
+		glm::vec4 fallback; // Constant value when the primitive doesn't have it.
+	};
+	const AttributeSlot kAttributeSlots[] =
+	{
+		{ "POSITION", 0, glm::vec4(0, 0, 0, 1) },
+		{ "NORMAL", 1, glm::vec4(0, 0, 1, 0) },
+		{ "TEXCOORD_0", 2, glm::vec4(0, 0, 0, 0) },
+		{ "TANGENT", 3, glm::vec4(1, 0, 0, 1) },
+	};
+
+	int ComponentCount(const std::string &type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		return 0;
+	}
+
+	int ComponentSize(int componentType)
+	{
+		switch (componentType)
+		{
+			case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+			case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+			case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+			default: return 0;
+		}
+	}
+
+	std::string GetDirectory(const char *filePath)
+	{
+		std::string directory(filePath);
+		size_t index = directory.find_last_of("/\\");
+		return index == std::string::npos ? std::string() : directory.substr(0, index + 1);
+	}
+}
+
+GltfModel::GltfModel()
+{ }
+GltfModel::~GltfModel()
+{
+	Release();
+}
+
+void GltfModel::Release()
+{
+	// Cleanup OpenGL Objects.
+	for (const Primitive &primitive : m_primitives)
+	{
+		glDeleteVertexArrays(1, &primitive.vao);
+		glDeleteBuffers(1, &primitive.occlusionBuffer);
+	}
+	for (unsigned int buffer : m_viewBuffers)
+	{
+		if (buffer != 0)
+			glDeleteBuffers(1, &buffer);
+	}
+
+	m_primitives.clear();
+	m_viewBuffers.clear();
+	m_meshPrimitives.clear();
+	m_drawItems.clear();
+	m_bufferData.clear();
+	m_bufferSizes.clear();
+	m_materials.clear();
+	m_materialTextures.clear();
+	m_triCount = 0;
+}
+
+void GltfModel::InitializeFromFile(const char *filePath)
+{
+	if (Load(filePath))
+		return;
+
+	Release();
+	std::cout << "WARNING: " << "Native glTF loader failed on " << filePath << ", falling back to assimp." << std::endl;
+	Mesh::InitializeFromFile(filePath);
+}
+
+bool GltfModel::Load(const char *filePath)
+{
+	ASSERT(!m_primitives.empty(), "Model already loaded.");
+
+	MappedFile file;
+	if (!file.Open(filePath))
+	{
+		std::cout << "Error whilst opening glTF file: " << filePath << std::endl;
+		return false;
+	}
+
+	const char *json = file.GetData();
+	size_t jsonLength = (size_t)file.GetSize();
+	const char *binChunk = nullptr;
+	size_t binLength = 0;
+
+	// Binary container, a JSON chunk followed by an optional BIN chunk.
+	uint32_t magic = 0;
+	memcpy(&magic, file.GetData(), std::min<size_t>(4, (size_t)file.GetSize()));
+	if (magic == kGlbMagic)
+	{
+		uint32_t header[3]; // magic, version, length
+		if (file.GetSize() < 20)
+			return false;
+		memcpy(header, file.GetData(), sizeof(header));
+		if (header[1] != 2 || header[2] > file.GetSize())
+		{
+			std::cout << "Error: unsupported .glb version in " << filePath << std::endl;
+			return false;
+		}
+
+		size_t offset = 12;
+		json = nullptr;
+		while (offset + 8 <= header[2])
+		{
+			uint32_t chunk[2]; // length, type
+			memcpy(chunk, file.GetData() + offset, sizeof(chunk));
+			offset += 8;
+			if (offset + chunk[0] > header[2])
+				break;
+
+			if (chunk[1] == kGlbChunkJson && json == nullptr)
+			{
+				json = file.GetData() + offset;
+				jsonLength = chunk[0];
+			}
+			else if (chunk[1] == kGlbChunkBin && binChunk == nullptr)
+			{
+				binChunk = file.GetData() + offset;
+				binLength = chunk[0];
+			}
+			offset += (chunk[0] + 3) & ~3u;
+		}
+		if (json == nullptr)
+			return false;
+	}
+
+	JsonValue document;
+	if (!JsonValue::Parse(json, jsonLength, document))
+	{
+		std::cout << "Error whilst parsing glTF JSON in " << filePath << std::endl;
+		return false;
+	}
+
+	// Resolve buffers, the GLB chunk or external files which get mapped for the duration of the load.
+	std::string directory = GetDirectory(filePath);
+	const JsonValue &buffers = document["buffers"];
+	std::vector<std::unique_ptr<MappedFile>> externalBuffers;
+	m_bufferData.assign(buffers.Size(), nullptr);
+	m_bufferSizes.assign(buffers.Size(), 0);
+	for (size_t i = 0; i < buffers.Size(); i++)
+	{
+		const JsonValue &buffer = buffers[i];
+		if (!buffer.Has("uri"))
+		{
+			m_bufferData[i] = binChunk;
+			m_bufferSizes[i] = binLength;
+		}
+		else if (buffer["uri"].AsString().compare(0, 5, "data:") != 0)
+		{
+			externalBuffers.push_back(std::make_unique<MappedFile>());
+			MappedFile &external = *externalBuffers.back();
+			if (external.Open((directory + buffer["uri"].AsString()).c_str()))
+			{
+				m_bufferData[i] = external.GetData();
+				m_bufferSizes[i] = (size_t)external.GetSize();
+			}
+		}
+
+		if (m_bufferData[i] == nullptr)
+			std::cout << "WARNING: " << "glTF buffer " << i << " in " << filePath << " couldn't be loaded (data URIs aren't supported)." << std::endl;
+	}
+	m_viewBuffers.assign(document["bufferViews"].Size(), 0);
+
+	// Images, either embedded in a buffer view or referenced by path (png, jpg, ktx...).
+	const JsonValue &images = document["images"];
+	std::vector<aie::Texture::Usage> usages(images.Size(), aie::Texture::COLOUR);
+	const JsonValue &materials = document["materials"];
+	for (size_t i = 0; i < materials.Size(); i++) // Normal maps aren't colour, so they're compressed and filtered as normals.
+	{
+		const JsonValue &normalTexture = materials[i]["normalTexture"];
+		if (!normalTexture.Has("index"))
+			continue;
+		size_t source = (size_t)document["textures"][(size_t)normalTexture["index"].AsInt()]["source"].AsInt(-1);
+		if (source < usages.size())
+			usages[source] = aie::Texture::NORMAL_MAP;
+	}
+	for (size_t i = 0; i < images.Size(); i++)
+	{
+		const JsonValue &image = images[i];
+		std::shared_ptr<aie::Texture> texture;
+		bool loaded = false;
+		if (image.Has("bufferView"))
+		{
+			texture = std::make_shared<aie::Texture>();
+			const JsonValue &view = document["bufferViews"][(size_t)image["bufferView"].AsInt()];
+			size_t buffer = (size_t)view["buffer"].AsInt();
+			size_t offset = (size_t)view["byteOffset"].AsNumber();
+			size_t length = (size_t)view["byteLength"].AsNumber();
+			if (buffer < m_bufferData.size() && m_bufferData[buffer] && offset + length <= m_bufferSizes[buffer])
+				loaded = texture->loadFromMemory((const unsigned char *)m_bufferData[buffer] + offset, length, image["name"].AsString().c_str(), usages[i]);
+		}
+		else if (image.Has("uri"))
+		{
+			texture = AssetManager::Get().GetTexture(directory + image["uri"].AsString(), usages[i]); // Shared with anything else using the file.
+			loaded = texture != nullptr;
+		}
+
+		if (!loaded)
+			std::cout << "WARNING: " << "glTF image " << i << " in " << filePath << " couldn't be loaded." << std::endl;
+		m_materialTextures.push_back(loaded ? texture : nullptr);
+	}
+
+	// Materials, mapped onto the lit shader's parameters as closely as it allows.
+	auto getImage = [&document, this](const JsonValue &textureInfo) -> const aie::Texture *
+	{
+		if (!textureInfo.Has("index"))
+			return nullptr;
+		const JsonValue &texture = document["textures"][(size_t)textureInfo["index"].AsInt()];
+		size_t source = (size_t)texture["source"].AsInt(-1);
+		if (source >= m_materialTextures.size() || !m_materialTextures[source])
+			return nullptr;
+		return m_materialTextures[source].get();
+	};
+
+	for (size_t i = 0; i <= materials.Size(); i++) // One extra for the default.
+	{
+		const JsonValue &source = materials[i];
+		const JsonValue &pbr = source["pbrMetallicRoughness"];
+
+		glm::vec3 baseColor(1.0f);
+		const JsonValue &factor = pbr["baseColorFactor"];
+		for (size_t c = 0; c < 3 && c < factor.Size(); c++)
+			baseColor[(int)c] = factor[c].AsFloat(1.0f);
+		float roughness = pbr["roughnessFactor"].AsFloat(1.0f);
+
+		Material material;
+		material.Ka = baseColor;
+		material.Kd = baseColor;
+		material.Ks = glm::vec3(1.0f - roughness); // Rougher surfaces get less of the Cook-Torrance lobe.
+		material.specular = glm::mix(128.0f, 1.0f, roughness);
+
+		const aie::Texture *baseColorTexture = getImage(pbr["baseColorTexture"]);
+		const aie::Texture *normalTexture = getImage(source["normalTexture"]);
+		material.mapKd = baseColorTexture;
+		material.mapBump = normalTexture; // Maps left null get fallbacks when applied.
+		m_materials.push_back(std::move(material));
+	}
+	unsigned int defaultMaterial = (unsigned int)materials.Size();
+
+	// Primitives, one vertex array each with its attributes pointing straight at the uploaded buffer views. Occlusion is
+	// baked the first time and read back from the .ao file next to the model after that.
+	std::vector<float> cachedOcclusion, occlusion;
+	bool occlusionCached = OcclusionBaker::ReadCache(filePath, cachedOcclusion);
+	const JsonValue &meshes = document["meshes"];
+	const JsonValue &accessors = document["accessors"];
+	for (size_t m = 0; m < meshes.Size(); m++)
+	{
+		const JsonValue &primitives = meshes[m]["primitives"];
+		unsigned int firstPrimitive = (unsigned int)m_primitives.size();
+
+		for (size_t p = 0; p < primitives.Size(); p++)
+		{
+			const JsonValue &source = primitives[p];
+			const JsonValue &attributes = source["attributes"];
+			const JsonValue &positionAccessor = accessors[(size_t)attributes["POSITION"].AsInt(-1)];
+			if (positionAccessor.IsNull())
+				continue;
+
+			Primitive primitive;
+			primitive.mode = (unsigned int)source["mode"].AsInt(GL_TRIANGLES);
+			primitive.material = source.Has("material") ? (unsigned int)source["material"].AsInt() : defaultMaterial;
+			if (primitive.material > defaultMaterial)
+				primitive.material = defaultMaterial;
+			primitive.count = (unsigned int)positionAccessor["count"].AsNumber();
+
+			glGenVertexArrays(1, &primitive.vao);
+			glBindVertexArray(primitive.vao);
+
+			for (const AttributeSlot &slot : kAttributeSlots)
+			{
+				const JsonValue &accessor = accessors[(size_t)attributes[slot.name].AsInt(-1)];
+				unsigned int buffer = accessor.IsNull() ? 0 : GetBufferView(document, accessor["bufferView"].AsInt(-1));
+				int components = ComponentCount(accessor["type"].AsString());
+				int componentType = accessor["componentType"].AsInt();
+				if (buffer == 0 || components == 0 || ComponentSize(componentType) == 0) // Missing or sparse, use a constant.
+				{
+					glDisableVertexAttribArray(slot.location);
+					primitive.missingAttributes |= 1u << slot.location;
+					continue;
+				}
+
+				const JsonValue &view = document["bufferViews"][(size_t)accessor["bufferView"].AsInt()];
+				GLsizei stride = (GLsizei)view["byteStride"].AsInt(components * ComponentSize(componentType));
+				glVertexAttribFormat(slot.location, components, (GLenum)componentType, accessor["normalized"].AsBool() ? GL_TRUE : GL_FALSE, 0);
+				glVertexAttribBinding(slot.location, slot.location);
+				glBindVertexBuffer(slot.location, buffer, (GLintptr)accessor["byteOffset"].AsNumber(), stride);
+				glEnableVertexAttribArray(slot.location);
+			}
+
+			// Occlusion in a buffer of its own. Without one the attribute is left off and reads as 0, nothing occluded.
+			primitive.occlusionBuffer = MakeOcclusionBuffer(document, source, cachedOcclusion, occlusion);
+			if (primitive.occlusionBuffer != 0)
+			{
+				const unsigned int location = OcclusionBaker::kAttributeLocation;
+				glVertexAttribFormat(location, 1, GL_FLOAT, GL_FALSE, 0);
+				glVertexAttribBinding(location, location);
+				glBindVertexBuffer(location, primitive.occlusionBuffer, 0, sizeof(float));
+				glEnableVertexAttribArray(location);
+			}
+
+			if (source.Has("indices"))
+			{
+				const JsonValue &accessor = accessors[(size_t)source["indices"].AsInt()];
+				unsigned int buffer = GetBufferView(document, accessor["bufferView"].AsInt(-1));
+				if (buffer != 0)
+				{
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+					primitive.indexType = (unsigned int)accessor["componentType"].AsInt(GL_UNSIGNED_INT);
+					primitive.indexOffset = (size_t)accessor["byteOffset"].AsNumber();
+					primitive.count = (unsigned int)accessor["count"].AsNumber();
+				}
+			}
+
+			glBindVertexArray(0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			m_primitives.push_back(primitive);
+		}
+
+		m_meshPrimitives.push_back({ firstPrimitive, (unsigned int)m_primitives.size() - firstPrimitive });
+	}
+	if (!occlusionCached || cachedOcclusion.size() != occlusion.size())
+		OcclusionBaker::WriteCache(filePath, occlusion);
+
+	// Walk the node hierarchy of the default scene, or every root if there are no scenes.
+	const JsonValue &scene = document["scenes"][(size_t)document["scene"].AsInt(0)];
+	if (!scene.IsNull())
+	{
+		const JsonValue &roots = scene["nodes"];
+		for (size_t i = 0; i < roots.Size(); i++)
+			LoadNode(document, roots[i].AsInt(-1), glm::mat4(1.0f), 0);
+	}
+	else
+	{
+		const JsonValue &nodes = document["nodes"];
+		std::vector<bool> isChild(nodes.Size(), false);
+		for (size_t i = 0; i < nodes.Size(); i++)
+		{
+			const JsonValue &children = nodes[i]["children"];
+			for (size_t c = 0; c < children.Size(); c++)
+			{
+				size_t child = (size_t)children[c].AsInt(-1);
+				if (child < isChild.size())
+					isChild[child] = true;
+			}
+		}
+		for (size_t i = 0; i < nodes.Size(); i++)
+		{
+			if (!isChild[i])
+				LoadNode(document, (int)i, glm::mat4(1.0f), 0);
+		}
+	}
+
+	// The file is unmapped once we return.
+	m_bufferData.clear();
+	m_bufferSizes.clear();
+
+	m_triCount = 0;
+	for (const DrawItem &item : m_drawItems)
+	{
+		for (unsigned int i = 0; i < item.primitiveCount; i++)
+			m_triCount += m_primitives[item.firstPrimitive + i].count / 3;
+	}
+
+	return !m_drawItems.empty();
+}
+
+unsigned int GltfModel::GetBufferView(const JsonValue &document, int viewIndex)
+{
+	if (viewIndex < 0 || (size_t)viewIndex >= m_viewBuffers.size())
+		return 0;
+	if (m_viewBuffers[viewIndex] != 0)
+		return m_viewBuffers[viewIndex];
+
+	const JsonValue &view = document["bufferViews"][(size_t)viewIndex];
+	size_t buffer = (size_t)view["buffer"].AsInt(-1);
+	size_t offset = (size_t)view["byteOffset"].AsNumber();
+	size_t length = (size_t)view["byteLength"].AsNumber();
+	if (buffer >= m_bufferData.size() || m_bufferData[buffer] == nullptr || offset + length > m_bufferSizes[buffer])
+		return 0;
+
+	// Straight from the mapped file into GL, no repacking.
+	unsigned int handle = 0;
+	glGenBuffers(1, &handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)length, m_bufferData[buffer] + offset, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	m_viewBuffers[viewIndex] = handle;
+	return handle;
+}
+
+const char *GltfModel::GetAccessorData(const JsonValue &document, const JsonValue &accessor, size_t elementSize, size_t &stride) const
+{
+	const JsonValue &view = document["bufferViews"][(size_t)accessor["bufferView"].AsInt(-1)];
+	size_t buffer = (size_t)view["buffer"].AsInt(-1);
+	size_t count = (size_t)accessor["count"].AsNumber();
+	if (view.IsNull() || count == 0 || buffer >= m_bufferData.size() || m_bufferData[buffer] == nullptr)
+		return nullptr;
+
+	stride = (size_t)view["byteStride"].AsInt((int)elementSize);
+	size_t offset = (size_t)accessor["byteOffset"].AsNumber();
+	size_t length = (size_t)view["byteLength"].AsNumber();
+	size_t viewOffset = (size_t)view["byteOffset"].AsNumber();
+	if (stride < elementSize || offset + (count - 1) * stride + elementSize > length || viewOffset + length > m_bufferSizes[buffer])
+		return nullptr;
+	return m_bufferData[buffer] + viewOffset + offset;
+}
+
+unsigned int GltfModel::MakeOcclusionBuffer(const JsonValue &document, const JsonValue &source, const std::vector<float> &cached, std::vector<float> &occlusion)
+{
+	// Baked against the primitive's own triangles, which needs float positions to trace as the spec requires unless
+	// the file is quantised. Anything else has no occlusion.
+	const JsonValue &accessors = document["accessors"];
+	const JsonValue &attributes = source["attributes"];
+	const JsonValue &normalAccessor = accessors[(size_t)attributes["NORMAL"].AsInt(-1)];
+	const JsonValue &positionAccessor = accessors[(size_t)attributes["POSITION"].AsInt(-1)];
+	if (normalAccessor.IsNull() || ComponentCount(normalAccessor["type"].AsString()) != 3 || source["mode"].AsInt(GL_TRIANGLES) != GL_TRIANGLES)
+		return 0;
+	if (positionAccessor["componentType"].AsInt() != GL_FLOAT || ComponentCount(positionAccessor["type"].AsString()) != 3)
+		return 0;
+
+	// Float normals, or the normalised bytes and shorts quantised files use.
+	int normalType = normalAccessor["componentType"].AsInt();
+	if (normalType != GL_FLOAT && normalType != GL_BYTE && normalType != GL_SHORT)
+		return 0;
+	unsigned int vertexCount = (unsigned int)normalAccessor["count"].AsNumber();
+	size_t componentSize = (size_t)ComponentSize(normalType), normalStride = 0, positionStride = 0;
+	const char *normalData = GetAccessorData(document, normalAccessor, componentSize * 3, normalStride);
+	const char *positionData = GetAccessorData(document, positionAccessor, 12, positionStride);
+	if (normalData == nullptr || positionData == nullptr || (unsigned int)positionAccessor["count"].AsNumber() != vertexCount)
+		return 0;
+
+	// Primitives take their turn in the cache in the order they're loaded, so only a stale one is baked again.
+	size_t first = occlusion.size();
+	if (cached.size() >= first + vertexCount)
+	{
+		occlusion.insert(occlusion.end(), cached.begin() + first, cached.begin() + first + vertexCount);
+	}
+	else
+	{
+		std::vector<Mesh::Vertex> vertices(vertexCount);
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			const char *element = normalData + (size_t)v * normalStride;
+			glm::vec3 normal;
+			for (int c = 0; c < 3; c++)
+			{
+				if (normalType == GL_FLOAT)
+				{
+					memcpy(&normal[c], element + c * 4, 4);
+				}
+				else if (normalType == GL_SHORT)
+				{
+					int16_t value;
+					memcpy(&value, element + c * 2, 2);
+					normal[c] = std::max(value / 32767.0f, -1.0f);
+				}
+				else
+				{
+					normal[c] = std::max((int8_t)element[c] / 127.0f, -1.0f);
+				}
+			}
+			glm::vec3 position;
+			memcpy(&position[0], positionData + (size_t)v * positionStride, 12);
+			vertices[v].position = glm::vec4(position, 1.0f);
+			vertices[v].normal = glm::vec4(normal, 0.0f);
+		}
+
+		std::vector<unsigned int> indices;
+		bool indicesValid = true;
+		if (source.Has("indices"))
+		{
+			const JsonValue &indexAccessor = accessors[(size_t)source["indices"].AsInt()];
+			int indexType = indexAccessor["componentType"].AsInt();
+			size_t indexSize = (size_t)ComponentSize(indexType), indexStride = 0;
+			const char *indexData = indexSize != 0 && indexType != GL_FLOAT ? GetAccessorData(document, indexAccessor, indexSize, indexStride) : nullptr;
+			indices.resize(indexData != nullptr ? (size_t)indexAccessor["count"].AsNumber() : 0);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				const char *element = indexData + i * indexStride;
+				if (indexSize == 4)
+					memcpy(&indices[i], element, 4);
+				else if (indexSize == 2)
+				{
+					uint16_t value;
+					memcpy(&value, element, 2);
+					indices[i] = value;
+				}
+				else
+					indices[i] = (uint8_t)element[0];
+				indicesValid = indicesValid && indices[i] < vertexCount;
+			}
+		}
+		else
+		{
+			indices.resize(vertexCount);
+			for (unsigned int i = 0; i < vertexCount; i++)
+				indices[i] = i;
+		}
+
+		if (indicesValid && !indices.empty())
+			OcclusionBaker::Bake(vertices.data(), vertexCount, indices.data(), indices.size()); // Leaves w at 0 if it can't.
+		for (unsigned int v = 0; v < vertexCount; v++)
+			occlusion.push_back(vertices[v].normal.w);
+	}
+
+	unsigned int handle = 0;
+	glCreateBuffers(1, &handle);
+	glNamedBufferData(handle, (GLsizeiptr)vertexCount * sizeof(float), occlusion.data() + first, GL_STATIC_DRAW);
+	return handle;
+}
+
+void GltfModel::LoadNode(const JsonValue &document, int nodeIndex, const glm::mat4 &parentTransform, int depth)
+{
+	const JsonValue &node = document["nodes"][(size_t)nodeIndex];
+	if (node.IsNull() || depth > kMaxNodeDepth)
+		return;
+
+	glm::mat4 local(1.0f);
+	const JsonValue &matrix = node["matrix"];
+	if (matrix.Size() == 16)
+	{
+		for (size_t i = 0; i < 16; i++)
+			local[(int)(i / 4)][(int)(i % 4)] = matrix[i].AsFloat(); // Column major, same as glm.
+	}
+	else
+	{
+		const JsonValue &t = node["translation"];
+		const JsonValue &r = node["rotation"];
+		const JsonValue &s = node["scale"];
+		glm::vec3 translation(t[(size_t)0].AsFloat(0.0f), t[1].AsFloat(0.0f), t[2].AsFloat(0.0f));
+		glm::quat rotation(r[3].AsFloat(1.0f), r[(size_t)0].AsFloat(0.0f), r[1].AsFloat(0.0f), r[2].AsFloat(0.0f)); // glTF stores xyzw.
+		glm::vec3 scale(s[(size_t)0].AsFloat(1.0f), s[1].AsFloat(1.0f), s[2].AsFloat(1.0f));
+		local = glm::translate(glm::mat4(1.0f), translation) * glm::toMat4(rotation) * glm::scale(glm::mat4(1.0f), scale);
+	}
+	glm::mat4 world = parentTransform * local;
+
+	size_t mesh = (size_t)node["mesh"].AsInt(-1);
+	if (mesh < m_meshPrimitives.size() && m_meshPrimitives[mesh].second > 0)
+		m_drawItems.push_back({ world, m_meshPrimitives[mesh].first, m_meshPrimitives[mesh].second });
+
+	const JsonValue &children = node["children"];
+	for (size_t i = 0; i < children.Size(); i++)
+		LoadNode(document, children[i].AsInt(-1), world, depth + 1);
+}
+
+void GltfModel::DrawPrimitive(const Primitive &primitive) const
+{
+	// Constant attributes are context state rather than vertex array state, so they have to be set every draw.
+	for (const AttributeSlot &slot : kAttributeSlots)
+	{
+		if (primitive.missingAttributes & (1u << slot.location))
+			glVertexAttrib4fv(slot.location, &slot.fallback[0]);
+	}
+
+	glBindVertexArray(primitive.vao);
+	if (primitive.indexType != 0)
+		glDrawElements(primitive.mode, primitive.count, primitive.indexType, (void*)primitive.indexOffset);
+	else
+		glDrawArrays(primitive.mode, 0, primitive.count);
+}
+
+void GltfModel::Draw()
+{
+	if (m_drawItems.empty()) // Loaded through assimp instead.
+	{
+		Mesh::Draw();
+		return;
+	}
+
+	for (const DrawItem &item : m_drawItems)
+	{
+		for (unsigned int i = 0; i < item.primitiveCount; i++)
+			DrawPrimitive(m_primitives[item.firstPrimitive + i]);
+	}
+}
+
+void GltfModel::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
+{
+	if (m_drawItems.empty()) // Loaded through assimp instead.
+	{
+		Mesh::Render(shader, projectionView, transform);
+		return;
+	}
+
+	// Each node carries its own transform, so rebind the matrices per node.
+	for (const DrawItem &item : m_drawItems)
+	{
+		glm::mat4 model = transform * item.transform;
+		shader->bindUniform("mvp", projectionView * model);
+		shader->bindUniform("model", model);
+
+		for (unsigned int i = 0; i < item.primitiveCount; i++)
+		{
+			const Primitive &primitive = m_primitives[item.firstPrimitive + i];
+			m_materials[primitive.material].Apply(shader);
+			DrawPrimitive(primitive);
+		}
+	}
+}
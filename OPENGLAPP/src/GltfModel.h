@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+class JsonValue;
+
+// glTF 2.0 model (.glb, or .gltf with external buffers). Buffer views are uploaded to GL exactly as they are in
+// the file and accessors are turned straight into vertex attribute formats, so nothing is repacked per vertex. The
+// occlusion OcclusionBaker bakes goes in a small buffer per primitive beside them, cached next to the file.
+class GltfModel : public Mesh
+{
+public:
+	GltfModel();
+	virtual ~GltfModel();
+
+	bool Load(const char *filePath);
+	// Loads with Load, or through assimp like any other Mesh if the file can't be read natively.
+	virtual void InitializeFromFile(const char *filePath) override;
+
+	virtual void Draw() override;
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform) override;
+
+	unsigned int GetPrimitiveCount() const { return (unsigned int)m_primitives.size(); }
+
+protected:
+	struct Primitive
+	{
+		unsigned int vao = 0;
+		unsigned int mode = 0; // GL primitive type, glTF uses the same values.
+		unsigned int count = 0; // Indices, or vertices if not indexed.
+		unsigned int indexType = 0; // 0 if not indexed.
+		size_t indexOffset = 0; // Byte offset into the bound element buffer.
+		unsigned int material = 0;
+		unsigned int missingAttributes = 0; // Bit per location that needs its constant fallback set before drawing.
+		unsigned int occlusionBuffer = 0; // A float per vertex, owned by the primitive. 0 if it has no occlusion.
+	};
+
+	struct DrawItem // A node that references a mesh, with its world transform flattened at load.
+	{
+		glm::mat4 transform;
+		unsigned int firstPrimitive;
+		unsigned int primitiveCount;
+	};
+
+	void Release(); // Frees everything Load created, so a failed load leaves nothing behind.
+	unsigned int GetBufferView(const JsonValue &document, int viewIndex);
+	// Where an accessor's first element is in the mapped buffers, null if it's sparse or out of bounds.
+	const char *GetAccessorData(const JsonValue &document, const JsonValue &accessor, size_t elementSize, size_t &stride) const;
+	// Appends the primitive's occlusion, from cached if it has enough values or baked if not, and uploads it. 0 if the
+	// primitive can't be baked, without appending anything.
+	unsigned int MakeOcclusionBuffer(const JsonValue &document, const JsonValue &source, const std::vector<float> &cached, std::vector<float> &occlusion);
+	void LoadNode(const JsonValue &document, int nodeIndex, const glm::mat4 &parentTransform, int depth);
+	void DrawPrimitive(const Primitive &primitive) const;
+
+protected:
+	std::vector<const char *> m_bufferData; // Mapped buffer contents, only valid during Load.
+	std::vector<size_t> m_bufferSizes;
+
+	std::vector<unsigned int> m_viewBuffers; // GL buffer per buffer view, 0 until something uses it.
+	std::vector<Primitive> m_primitives;
+	std::vector<std::pair<unsigned int, unsigned int>> m_meshPrimitives; // First primitive and count per glTF mesh.
+	std::vector<DrawItem> m_drawItems;
+	// Images go in m_materialTextures, indexed by glTF image. The last of m_materials is the default for primitives without one.
+
+};
@@ -7,11 +7,33 @@
 #include "Shader.h"
 #include "Mesh.h"
 #include "Light.h"
+#include "SkinnedMesh.h"
+#include "Animation.h"
+#include "TextureResidency.h"
+#include "EnvironmentMap.h"
+#include "ProbeVolume.h"
 
 #include <glad.h>
 
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+
+namespace
+{
+	// Fades start one level of the 4x4 dither in. At 0 the shader skips the test, and both levels would draw whole.
+	const float kLodFadeStep = 1.0f / 16.0f;
+
+	unsigned int NextId()
+	{
+		static std::atomic<unsigned int> id(1);
+		return id++;
+	}
+}
+
 Instance::Instance(glm::mat4 transform, Mesh *mesh, aie::ShaderProgram *shader)
 	: m_transform(transform)
+	, m_id(NextId())
 	, m_mesh(mesh)
 	, m_shader(shader)
 { 
@@ -21,6 +43,15 @@ Instance::Instance(glm::mat4 transform, Mesh *mesh, aie::ShaderProgram *shader)
 	glm::quat orientation;
 	glm::decompose(transform, m_scale, orientation, m_position, skew, perspective);
 	m_eulerAngles = glm::eulerAngles(orientation);
+
+	SkinnedMesh *skinnedMesh = dynamic_cast<SkinnedMesh *>(mesh);
+	if (skinnedMesh != nullptr && skinnedMesh->GetSkeleton().GetBoneCount() > 0)
+		m_animator = std::make_unique<Animator>(skinnedMesh);
+}
+Instance::Instance(glm::mat4 transform, std::shared_ptr<Mesh> mesh, aie::ShaderProgram *shader)
+	: Instance(transform, mesh.get(), shader)
+{
+	m_meshHandle = std::move(mesh);
 }
 Instance::~Instance()
 { }
@@ -39,6 +70,58 @@ glm::mat4 Instance::MakeTransform(glm::vec3 position, glm::vec3 eulerAngles, glm
 		glm::scale(glm::mat4(1.0f), scale);
 }
 
+void Instance::UpdateLod(const glm::vec3 &cameraPosition, float pixelsPerUnit, float errorThreshold, float fadeTime, float dt)
+{
+	m_mesh->SetLodErrorThreshold(errorThreshold);
+	if (m_lodFade < 1.0f)
+		m_lodFade = fadeTime > 0.0f ? std::min(m_lodFade + dt / fadeTime, 1.0f) : 1.0f;
+
+	unsigned int lodCount = m_mesh->GetLodCount();
+	if (lodCount <= 1 || m_lodFade < 1.0f) // Let the current fade finish before starting another.
+		return;
+
+	// Distance to the nearest point of the bounding sphere, errors are scaled by the largest axis.
+	float scale = std::max(std::fabs(m_scale.x), std::max(std::fabs(m_scale.y), std::fabs(m_scale.z)));
+	glm::vec3 center = glm::vec3(m_transform * glm::vec4(m_mesh->GetBoundsCenter(), 1.0f));
+	float distance = glm::length(center - cameraPosition) - m_mesh->GetBoundsRadius() * scale;
+	if (distance <= 0.0f) // Camera's inside the bounds.
+		distance = 0.0f;
+
+	unsigned int lod = 0;
+	for (unsigned int i = lodCount - 1; i > 0; i--)
+	{
+		float pixels = m_mesh->GetLodError(i) * scale * pixelsPerUnit / std::max(distance, 1e-4f);
+		if (pixels <= errorThreshold)
+		{
+			lod = i;
+			break;
+		}
+	}
+
+	if (lod != m_lod)
+	{
+		m_previousLod = m_lod;
+		m_lod = lod;
+		m_lodFade = fadeTime > 0.0f ? kLodFadeStep : 1.0f;
+	}
+}
+
+void Instance::RequestTextures(const glm::vec3 &cameraPosition, float pixelsPerUnit)
+{
+	// Assumes a texture is stretched once across the bounds, so it needs about as many texels as they cover pixels.
+	float scale = std::max(std::fabs(m_scale.x), std::max(std::fabs(m_scale.y), std::fabs(m_scale.z)));
+	float radius = m_mesh->GetBoundsRadius() * scale;
+	glm::vec3 center = glm::vec3(m_transform * glm::vec4(m_mesh->GetBoundsCenter(), 1.0f));
+	float distance = std::max(glm::length(center - cameraPosition) - radius, 1e-4f);
+	float pixels = 2.0f * radius * pixelsPerUnit / distance;
+
+	static std::vector<const aie::Texture *> textures;
+	textures.clear();
+	m_mesh->GetTextures(textures);
+	for (const aie::Texture *texture : textures)
+		TextureResidency::Get().Request(texture, pixels);
+}
+
 void Instance::Draw(Scene *scene)
 {
 	float windowWidth = (float)Application::GetInstance()->GetWindowWidth();
@@ -49,32 +132,72 @@ void Instance::Draw(Scene *scene)
 	glm::vec3 ambientLight = scene->GetAmbientLight();
 
 	m_transform = MakeTransform(m_position, m_eulerAngles, m_scale);
-	glm::mat4 mvp = camera->GetProjectionMatrix(90.0f, windowWidth, windowHeight) * camera->GetViewMatrixFromQuaternion() * m_transform;
+	glm::mat4 projectionView = camera->GetProjectionMatrix(90.0f, windowWidth, windowHeight) * camera->GetViewMatrixFromQuaternion();
+	glm::mat4 mvp = projectionView * m_transform;
 
 	// Setup shaders and materials then draw mesh.
 	m_shader->bind();
-	m_shader->bindUniform("cameraPosition", camera->GetPosition());
-
 	m_shader->bindUniform("mvp", mvp);
-	m_shader->bindUniform("view", camera->GetTransformMatrix());
 	m_shader->bindUniform("model", m_transform);
 
-	m_shader->bindUniform("sunlightDir", glm::vec3(sunLight->direction));
-	m_shader->bindUniform("sunlightColor", glm::vec3(sunLight->color));
-	m_shader->bindUniform("ambientColor", ambientLight);
-
-	auto pointLights = scene->GetPointLights();
-	auto spotLights = scene->GetSpotLights();
-
-	m_shader->bindUniform("numPointLights", (int)pointLights->size());
-	m_shader->bindUniform("numSpotLights", (int)spotLights->size());
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, scene->GetPointLightBufferID());
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PointLight) * pointLights->size(), pointLights->data()); // Pass scene point lights to the storage buffer object.
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, scene->GetSpotLightBufferID());
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(SpotLight) * spotLights->size(), spotLights->data()); // Pass scene spotlights to the storage buffer object.
-
-	m_mesh->ApplyMaterial(m_shader);
-	m_mesh->Draw();
+	// Simpler shaders like the point splats only use some of the lighting, skip whatever they don't declare.
+	auto bindOptional = [this](const char *name, const auto &value)
+	{
+		if (m_shader->getUniform(name) >= 0)
+			m_shader->bindUniform(name, value);
+	};
+	bindOptional("cameraPosition", camera->GetPosition());
+	bindOptional("view", camera->GetTransformMatrix());
+
+	bindOptional("sunlightDir", glm::vec3(sunLight->direction));
+	bindOptional("sunlightColor", glm::vec3(sunLight->color));
+	bindOptional("ambientColor", ambientLight);
+
+	EnvironmentMap *environment = scene->GetEnvironment();
+	bindOptional("useEnvironment", environment != nullptr && environment->IsLoaded() ? 1 : 0);
+	if (environment != nullptr && environment->IsLoaded() && m_shader->getUniform("environmentSH") >= 0)
+		environment->Bind(m_shader);
+
+	ProbeVolume *probeVolume = scene->GetProbeVolume();
+	bindOptional("useProbes", probeVolume != nullptr && probeVolume->IsBaked() ? 1 : 0);
+	if (probeVolume != nullptr && probeVolume->IsBaked() && m_shader->getUniform("probeVolumeMin") >= 0)
+		probeVolume->Bind(m_shader);
+
+	if (m_shader->getUniform("numPointLights") >= 0)
+	{
+		auto pointLights = scene->GetPointLights();
+		auto spotLights = scene->GetSpotLights();
+
+		m_shader->bindUniform("numPointLights", (int)pointLights->size());
+		m_shader->bindUniform("numSpotLights", (int)spotLights->size());
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, scene->GetPointLightBufferID());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(PointLight) * pointLights->size(), pointLights->data()); // Pass scene point lights to the storage buffer object.
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, scene->GetSpotLightBufferID());
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(SpotLight) * spotLights->size(), spotLights->data()); // Pass scene spotlights to the storage buffer object.
+	}
+
+	// Skinned shaders read this instance's bones out of the scene's palette.
+	if (m_animator)
+		m_animator->Bind(m_shader);
+	else
+		bindOptional("boneOffset", -1);
+
+	// While fading between levels of detail both are drawn, each dithering away the pixels the other keeps.
+	bool fadeUniform = m_shader->getUniform("lodFade") >= 0;
+	if (m_lodFade < 1.0f && fadeUniform)
+	{
+		m_shader->bindUniform("lodFade", -m_lodFade);
+		m_mesh->SetLod(m_previousLod);
+		m_mesh->Render(m_shader, projectionView, m_transform);
+		m_shader->bindUniform("lodFade", m_lodFade);
+	}
+	else if (fadeUniform)
+	{
+		m_shader->bindUniform("lodFade", 0.0f);
+	}
+
+	m_mesh->SetLod(m_lod);
+	m_mesh->Render(m_shader, projectionView, m_transform);
 }
@@ -2,6 +2,9 @@
 
 #include "Common.h"
 
+#include <memory>
+
+class Animator; // Forward Declare
 class Camera; // Forward Declare
 class Mesh; // Forward Declare
 class Scene; // Forward Declare
@@ -15,7 +18,8 @@ namespace aie
 class Instance
 {
 public:
-	Instance(glm::mat4 transform, Mesh *mesh, aie::ShaderProgram *shader);
+	Instance(glm::mat4 transform, Mesh *mesh, aie::ShaderProgram *shader); // The mesh has to outlive the instance.
+	Instance(glm::mat4 transform, std::shared_ptr<Mesh> mesh, aie::ShaderProgram *shader); // Holds on to the mesh.
 	~Instance();
 
 	glm::vec3 &GetPosition() { return m_position; }
@@ -25,6 +29,18 @@ public:
 	glm::mat4 MakeTransform(glm::vec3 position, glm::vec3 eulerAngles, glm::vec3 scale);
 	glm::mat4 &GetTransform() { return m_transform; }
 
+	unsigned int GetId() const { return m_id; } // Never reused, unlike the instance's address.
+	Mesh *GetMesh() const { return m_mesh; }
+	Animator *GetAnimator() const { return m_animator.get(); } // Null unless the mesh is skinned.
+	unsigned int GetLod() const { return m_lod; }
+
+	// Picks the coarsest level of detail whose error projects to at most errorThreshold pixels. pixelsPerUnit is the
+	// screen height over the height of the view frustum one unit in front of the camera. Switching fades between the
+	// two levels over fadeTime seconds, or snaps if it's zero.
+	void UpdateLod(const glm::vec3 &cameraPosition, float pixelsPerUnit, float errorThreshold, float fadeTime, float dt);
+	// Asks the TextureResidency for as much detail in the mesh's textures as the instance covers pixels on screen.
+	void RequestTextures(const glm::vec3 &cameraPosition, float pixelsPerUnit);
+
 	void Draw(Scene *scene);
 
 protected:
@@ -33,7 +49,14 @@ protected:
 	glm::vec3 m_eulerAngles = glm::vec3(0);
 	glm::vec3 m_scale = glm::vec3(1);
 
+	unsigned int m_id;
 	Mesh *m_mesh;
+	std::shared_ptr<Mesh> m_meshHandle; // Null if the mesh isn't shared.
 	aie::ShaderProgram *m_shader;
+	std::unique_ptr<Animator> m_animator; // Each instance of a skinned mesh plays its own clip.
+
+	unsigned int m_lod = 0;
+	unsigned int m_previousLod = 0; // Level being faded out.
+	float m_lodFade = 1.0f; // How far through the fade to m_lod, 1 once it's finished.
 
 };
@@ -0,0 +1,251 @@
+#include "Json.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+	const JsonValue s_null; // Returned for anything missing.
+}
+
+// Recursive descent parser, fills in a JsonValue tree.
+class JsonParser
+{
+public:
+	JsonParser(const char *text, size_t length) : m_p(text), m_end(text + length) { }
+
+	bool ParseDocument(JsonValue &value)
+	{
+		if (!ParseValue(value, 0))
+			return false;
+		SkipWhitespace();
+		return m_p == m_end || *m_p == '\0';
+	}
+
+private:
+	static const int kMaxDepth = 256;
+
+	void SkipWhitespace()
+	{
+		while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+			m_p++;
+	}
+
+	bool Match(const char *literal)
+	{
+		size_t length = strlen(literal);
+		if ((size_t)(m_end - m_p) < length || strncmp(m_p, literal, length) != 0)
+			return false;
+		m_p += length;
+		return true;
+	}
+
+	static void AppendUtf8(std::string &out, unsigned int codepoint)
+	{
+		if (codepoint < 0x80)
+		{
+			out += (char)codepoint;
+		}
+		else if (codepoint < 0x800)
+		{
+			out += (char)(0xC0 | (codepoint >> 6));
+			out += (char)(0x80 | (codepoint & 0x3F));
+		}
+		else if (codepoint < 0x10000)
+		{
+			out += (char)(0xE0 | (codepoint >> 12));
+			out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+			out += (char)(0x80 | (codepoint & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | (codepoint >> 18));
+			out += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+			out += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+			out += (char)(0x80 | (codepoint & 0x3F));
+		}
+	}
+
+	bool ParseHex(unsigned int &value)
+	{
+		if (m_end - m_p < 4)
+			return false;
+		std::from_chars_result result = std::from_chars(m_p, m_p + 4, value, 16);
+		if (result.ec != std::errc() || result.ptr != m_p + 4)
+			return false;
+		m_p += 4;
+		return true;
+	}
+
+	bool ParseString(std::string &out)
+	{
+		if (m_p >= m_end || *m_p != '"')
+			return false;
+		m_p++;
+
+		while (m_p < m_end && *m_p != '"')
+		{
+			if (*m_p != '\\')
+			{
+				out += *m_p++;
+				continue;
+			}
+
+			m_p++;
+			if (m_p >= m_end)
+				return false;
+			switch (*m_p++)
+			{
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u':
+				{
+					unsigned int codepoint = 0;
+					if (!ParseHex(codepoint))
+						return false;
+					if (codepoint >= 0xD800 && codepoint <= 0xDBFF && Match("\\u")) // Surrogate pair.
+					{
+						unsigned int low = 0;
+						if (!ParseHex(low))
+							return false;
+						codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+					}
+					AppendUtf8(out, codepoint);
+				} break;
+				default: return false;
+			}
+		}
+
+		if (m_p >= m_end)
+			return false;
+		m_p++; // Closing quote.
+		return true;
+	}
+
+	bool ParseValue(JsonValue &value, int depth)
+	{
+		if (depth > kMaxDepth)
+			return false;
+
+		SkipWhitespace();
+		if (m_p >= m_end)
+			return false;
+
+		switch (*m_p)
+		{
+			case '{':
+			{
+				m_p++;
+				value.m_type = JsonValue::JSON_OBJECT;
+				SkipWhitespace();
+				if (m_p < m_end && *m_p == '}')
+				{
+					m_p++;
+					return true;
+				}
+				while (true)
+				{
+					SkipWhitespace();
+					std::string key;
+					if (!ParseString(key))
+						return false;
+					SkipWhitespace();
+					if (m_p >= m_end || *m_p != ':')
+						return false;
+					m_p++;
+
+					value.m_keys.push_back(std::move(key));
+					value.m_children.emplace_back();
+					if (!ParseValue(value.m_children.back(), depth + 1))
+						return false;
+
+					SkipWhitespace();
+					if (m_p < m_end && *m_p == ',') { m_p++; continue; }
+					if (m_p < m_end && *m_p == '}') { m_p++; return true; }
+					return false;
+				}
+			}
+			case '[':
+			{
+				m_p++;
+				value.m_type = JsonValue::JSON_ARRAY;
+				SkipWhitespace();
+				if (m_p < m_end && *m_p == ']')
+				{
+					m_p++;
+					return true;
+				}
+				while (true)
+				{
+					value.m_children.emplace_back();
+					if (!ParseValue(value.m_children.back(), depth + 1))
+						return false;
+
+					SkipWhitespace();
+					if (m_p < m_end && *m_p == ',') { m_p++; continue; }
+					if (m_p < m_end && *m_p == ']') { m_p++; return true; }
+					return false;
+				}
+			}
+			case '"':
+				value.m_type = JsonValue::JSON_STRING;
+				return ParseString(value.m_string);
+			case 't':
+				value.m_type = JsonValue::JSON_BOOL;
+				value.m_bool = true;
+				return Match("true");
+			case 'f':
+				value.m_type = JsonValue::JSON_BOOL;
+				value.m_bool = false;
+				return Match("false");
+			case 'n':
+				value.m_type = JsonValue::JSON_NULL;
+				return Match("null");
+			default:
+			{
+				value.m_type = JsonValue::JSON_NUMBER;
+				std::from_chars_result result = std::from_chars(m_p, m_end, value.m_number);
+				if (result.ec != std::errc())
+					return false;
+				m_p = result.ptr;
+				return true;
+			}
+		}
+	}
+
+private:
+	const char *m_p;
+	const char *m_end;
+};
+
+bool JsonValue::Parse(const char *text, size_t length, JsonValue &document)
+{
+	document = JsonValue();
+	JsonParser parser(text, length);
+	return parser.ParseDocument(document);
+}
+
+const JsonValue &JsonValue::operator[](const char *key) const
+{
+	if (m_type != JSON_OBJECT)
+		return s_null;
+	for (size_t i = 0; i < m_keys.size(); i++)
+	{
+		if (m_keys[i] == key)
+			return m_children[i];
+	}
+	return s_null;
+}
+
+const JsonValue &JsonValue::operator[](size_t index) const
+{
+	if (m_type != JSON_ARRAY || index >= m_children.size())
+		return s_null;
+	return m_children[index];
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Minimal JSON document, just enough for glTF. Missing keys and out of range indices return a null value
+// so lookups can be chained without checking every step.
+class JsonValue
+{
+public:
+	enum Type
+	{
+		JSON_NULL = 0,
+		JSON_BOOL,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT,
+	};
+
+public:
+	JsonValue() = default;
+
+	static bool Parse(const char *text, size_t length, JsonValue &document);
+
+	Type GetType() const { return m_type; }
+	bool IsNull() const { return m_type == JSON_NULL; }
+	bool IsNumber() const { return m_type == JSON_NUMBER; }
+	bool IsString() const { return m_type == JSON_STRING; }
+	bool IsArray() const { return m_type == JSON_ARRAY; }
+	bool IsObject() const { return m_type == JSON_OBJECT; }
+
+	bool Has(const char *key) const { return !(*this)[key].IsNull(); }
+	const JsonValue &operator[](const char *key) const;
+	const JsonValue &operator[](size_t index) const;
+	size_t Size() const { return m_children.size(); } // Array elements or object members.
+	const std::string &GetKey(size_t index) const { return m_keys[index]; }
+
+	bool AsBool(bool fallback = false) const { return m_type == JSON_BOOL ? m_bool : fallback; }
+	double AsNumber(double fallback = 0.0) const { return m_type == JSON_NUMBER ? m_number : fallback; }
+	float AsFloat(float fallback = 0.0f) const { return m_type == JSON_NUMBER ? (float)m_number : fallback; }
+	int AsInt(int fallback = 0) const { return m_type == JSON_NUMBER ? (int)m_number : fallback; }
+	const std::string &AsString() const { return m_string; }
+
+private:
+	friend class JsonParser;
+
+	Type m_type = JSON_NULL;
+	bool m_bool = false;
+	double m_number = 0.0;
+	std::string m_string;
+	std::vector<JsonValue> m_children;
+	std::vector<std::string> m_keys; // Parallel to m_children for objects.
+
+};
@@ -0,0 +1,147 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{ }
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char *filePath, bool mapWholeFile)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) // Can't map an empty file.
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+	m_size = (uint64_t)size.QuadPart;
+#else
+	int fd = open(filePath, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	m_fileDescriptor = fd;
+	m_size = (uint64_t)info.st_size;
+#endif
+	m_isOpen = true;
+
+	if (mapWholeFile && Map(0, (size_t)m_size) == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	Unmap();
+
+#ifdef _WIN32
+	if (m_mappingHandle) CloseHandle((HANDLE)m_mappingHandle);
+	if (m_fileHandle) CloseHandle((HANDLE)m_fileHandle);
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+#else
+	if (m_fileDescriptor >= 0) close(m_fileDescriptor);
+	m_fileDescriptor = -1;
+#endif
+
+	m_isOpen = false;
+	m_size = 0;
+}
+
+const char *MappedFile::Map(uint64_t offset, size_t length)
+{
+	Unmap();
+
+	if (!m_isOpen || offset >= m_size)
+		return nullptr;
+	if (offset + length > m_size)
+		length = (size_t)(m_size - offset);
+
+	// Views have to start on the allocation granularity, so map from the aligned offset and hand out a pointer past the padding.
+#ifdef _WIN32
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	uint64_t granularity = systemInfo.dwAllocationGranularity;
+#else
+	uint64_t granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+	uint64_t alignedOffset = offset - (offset % granularity);
+	size_t padding = (size_t)(offset - alignedOffset);
+	size_t mappedSize = length + padding;
+
+#ifdef _WIN32
+	void *view = MapViewOfFile((HANDLE)m_mappingHandle, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), mappedSize);
+	if (view == nullptr)
+		return nullptr;
+#else
+	void *view = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, m_fileDescriptor, (off_t)alignedOffset);
+	if (view == MAP_FAILED)
+		return nullptr;
+	madvise(view, mappedSize, MADV_SEQUENTIAL);
+#endif
+
+	m_view = view;
+	m_mappedSize = mappedSize;
+	m_data = (const char *)view + padding;
+	m_viewOffset = offset;
+	m_viewSize = length;
+	return m_data;
+}
+
+void MappedFile::Unmap()
+{
+	if (m_view == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_view);
+#else
+	munmap(m_view, m_mappedSize);
+#endif
+
+	m_view = nullptr;
+	m_data = nullptr;
+	m_mappedSize = 0;
+	m_viewOffset = 0;
+	m_viewSize = 0;
+}
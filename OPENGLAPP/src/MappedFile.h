@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapped file, lets loaders parse straight out of the page cache instead of copying through streams.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool Open(const char *filePath, bool mapWholeFile = true);
+	void Close();
+
+	// Maps a window of the file, replacing any previous view. Used to stream files that are too big to map at once.
+	const char *Map(uint64_t offset, size_t length);
+	void Unmap();
+
+	bool IsOpen() const { return m_isOpen; }
+	uint64_t GetSize() const { return m_size; }
+
+	const char *GetData() const { return m_data; } // Start of the current view.
+	uint64_t GetViewOffset() const { return m_viewOffset; }
+	size_t GetViewSize() const { return m_viewSize; }
+
+private:
+	bool m_isOpen = false;
+	uint64_t m_size = 0;
+
+	const char *m_data = nullptr; // User facing pointer, may be offset into the aligned view.
+	void *m_view = nullptr; // Actual mapped address.
+	size_t m_mappedSize = 0;
+	uint64_t m_viewOffset = 0;
+	size_t m_viewSize = 0;
+
+#ifdef _WIN32
+	void *m_fileHandle = nullptr;
+	void *m_mappingHandle = nullptr;
+#else
+	int m_fileDescriptor = -1;
+#endif
+
+};
@@ -0,0 +1,213 @@
+#include "Material.h"
+
+#include "Texture.h"
+#include "Shader.h"
+#include "AssetManager.h"
+#include "TextureArrays.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glad.h>
+
+namespace
+{
+	const unsigned int kMaterialBinding = 2; // MaterialSBO in the lit shaders.
+	const size_t kMinCapacity = 64;
+
+	// A material as the lit shaders' MaterialSBO lays it out.
+	struct GpuMaterial
+	{
+		glm::vec4 Ka;
+		glm::vec4 Kd;
+		glm::vec4 Ks; // w is the specular power.
+		glm::ivec4 layers; // Where each map is packed in the TextureArrays, or TextureArrays::kNotPacked.
+	};
+
+	// Properties of every material that has been applied, uploaded only when they change.
+	class MaterialBuffer
+	{
+	public:
+		static MaterialBuffer &Get()
+		{
+			static MaterialBuffer *buffer = new MaterialBuffer(); // Never destroyed, materials in statics can outlive it otherwise.
+			return *buffer;
+		}
+
+		int Allocate()
+		{
+			int slot;
+			if (!m_freeSlots.empty())
+			{
+				slot = m_freeSlots.back();
+				m_freeSlots.pop_back();
+			}
+			else
+			{
+				slot = (int)m_materials.size();
+				m_materials.emplace_back();
+			}
+			MarkDirty(slot); // Whatever the buffer holds there isn't this material.
+			return slot;
+		}
+
+		void Free(int slot) { m_freeSlots.push_back(slot); }
+
+		void Set(int slot, const GpuMaterial &material)
+		{
+			if (std::memcmp(&m_materials[slot], &material, sizeof(GpuMaterial)) == 0)
+				return;
+			m_materials[slot] = material;
+			MarkDirty(slot);
+		}
+
+		void Upload()
+		{
+			if (m_dirtyBegin >= m_dirtyEnd)
+				return;
+
+			if (m_materials.size() > m_capacity) // Grow, which means uploading the lot.
+			{
+				glDeleteBuffers(1, &m_buffer);
+				m_capacity = std::max(kMinCapacity, m_materials.size() * 2);
+				glGenBuffers(1, &m_buffer);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialBinding, m_buffer);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(m_capacity * sizeof(GpuMaterial)), nullptr, GL_DYNAMIC_DRAW);
+				m_dirtyBegin = 0;
+				m_dirtyEnd = m_materials.size();
+			}
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)(m_dirtyBegin * sizeof(GpuMaterial)),
+				(GLsizeiptr)((m_dirtyEnd - m_dirtyBegin) * sizeof(GpuMaterial)), m_materials.data() + m_dirtyBegin);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			m_dirtyBegin = m_dirtyEnd = 0;
+		}
+
+		void Release()
+		{
+			glDeleteBuffers(1, &m_buffer);
+			m_buffer = 0;
+			m_capacity = 0; // Recreated and filled again if anything is applied after.
+			m_dirtyBegin = 0;
+			m_dirtyEnd = m_materials.size();
+		}
+
+	private:
+		void MarkDirty(int slot)
+		{
+			if (m_dirtyBegin >= m_dirtyEnd)
+			{
+				m_dirtyBegin = (size_t)slot;
+				m_dirtyEnd = (size_t)slot + 1;
+			}
+			else
+			{
+				m_dirtyBegin = std::min(m_dirtyBegin, (size_t)slot);
+				m_dirtyEnd = std::max(m_dirtyEnd, (size_t)slot + 1);
+			}
+		}
+
+	private:
+		std::vector<GpuMaterial> m_materials; // What the buffer holds, once the dirty range is uploaded.
+		std::vector<int> m_freeSlots;
+		unsigned int m_buffer = 0;
+		size_t m_capacity = 0; // In materials.
+		size_t m_dirtyBegin = 0, m_dirtyEnd = 0;
+	};
+}
+
+Material::Material(const Material &other)
+	: specular(other.specular), Ka(other.Ka), Kd(other.Kd), Ks(other.Ks), mapKd(other.mapKd), mapKs(other.mapKs), mapBump(other.mapBump)
+{ }
+Material::Material(Material &&other) noexcept
+	: specular(other.specular), Ka(other.Ka), Kd(other.Kd), Ks(other.Ks), mapKd(other.mapKd), mapKs(other.mapKs), mapBump(other.mapBump), m_slot(other.m_slot)
+{
+	other.m_slot = -1;
+}
+Material::~Material()
+{
+	if (m_slot >= 0)
+		MaterialBuffer::Get().Free(m_slot);
+}
+
+Material &Material::operator=(const Material &other)
+{
+	// Keeps its own slot, the next Apply sees the new properties and uploads them.
+	specular = other.specular;
+	Ka = other.Ka;
+	Kd = other.Kd;
+	Ks = other.Ks;
+	mapKd = other.mapKd;
+	mapKs = other.mapKs;
+	mapBump = other.mapBump;
+	return *this;
+}
+
+Material &Material::operator=(Material &&other) noexcept
+{
+	if (this != &other)
+	{
+		*this = (const Material &)other;
+		if (m_slot >= 0)
+			MaterialBuffer::Get().Free(m_slot);
+		m_slot = other.m_slot;
+		other.m_slot = -1;
+	}
+	return *this;
+}
+
+void Material::Apply(aie::ShaderProgram *shader) const
+{
+	// A texture still streaming in has no handle yet.
+	AssetManager &assets = AssetManager::Get();
+	auto resident = [](const aie::Texture *texture) { return texture != nullptr && texture->getHandle() != 0; };
+	const aie::Texture *maps[] = {
+		resident(mapKd) ? mapKd : assets.GetWhiteTexture(),
+		resident(mapKs) ? mapKs : assets.GetWhiteTexture(),
+		resident(mapBump) ? mapBump : assets.GetFlatNormalTexture()
+	};
+
+	// Maps packed into the texture arrays are picked by the index in the buffer, so a shader that reads them switches
+	// materials without binding anything.
+	glm::ivec4 layers(TextureArrays::kNotPacked);
+	if (shader->getCachedUniform("materialArrays[0]") >= 0)
+	{
+		TextureArrays &arrays = TextureArrays::Get();
+		for (int i = 0; i < 3; i++)
+			layers[i] = arrays.Find(maps[i]);
+		arrays.Bind();
+	}
+
+	// Colours go through the material buffer, samplers are bound to these units in the shaders.
+	MaterialBuffer &buffer = MaterialBuffer::Get();
+	if (m_slot < 0)
+		m_slot = buffer.Allocate();
+	buffer.Set(m_slot, { glm::vec4(Ka, 0.0f), glm::vec4(Kd, 0.0f), glm::vec4(Ks, specular), layers });
+	buffer.Upload();
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (layers[i] == TextureArrays::kNotPacked)
+			maps[i]->bind(i);
+	}
+
+	int location = shader->getCachedUniform("materialIndex");
+	if (location >= 0) // Shaders that only sample the diffuse map don't read the buffer.
+		shader->bindUniform(location, m_slot);
+}
+
+void Material::ReleaseBuffer()
+{
+	MaterialBuffer::Get().Release();
+}
+
+const Material *MaterialLibrary::Find(const std::string &name) const
+{
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		if (names[i] == name)
+			return &materials[i];
+	}
+	return nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Common.h"
+
+#include <memory>
+
+namespace aie
+{
+	class Texture;
+	class ShaderProgram;
+}
+
+// Surface properties for the lit shader. Textures are owned by whoever loaded them. The colours live in a storage
+// buffer shared by every material, so applying one binds its maps and sets a single index. Small maps are packed into
+// the TextureArrays and aren't bound at all, the buffer says which layer each is in.
+struct Material
+{
+	float specular = 1.0f; // Specular power.
+	glm::vec3 Ka = { 1.0f, 1.0f, 1.0f }; // Ambient colour.
+	glm::vec3 Kd = { 1.0f, 1.0f, 1.0f }; // Diffuse colour.
+	glm::vec3 Ks = { 1.0f, 1.0f, 1.0f }; // Specular colour.
+
+	const aie::Texture *mapKd = nullptr; // Diffuse texture.
+	const aie::Texture *mapKs = nullptr; // Specular texture.
+	const aie::Texture *mapBump = nullptr; // Bump/normal map.
+
+	Material() = default;
+	Material(const Material &other); // Copies get their own slot in the buffer.
+	Material(Material &&other) noexcept;
+	Material &operator=(const Material &other);
+	Material &operator=(Material &&other) noexcept;
+	~Material();
+
+	void Apply(aie::ShaderProgram *shader) const; // Maps left null, or still streaming in, get the asset manager's fallbacks.
+
+	static void ReleaseBuffer(); // Frees the storage buffer, call before the GL context goes.
+
+private:
+	mutable int m_slot = -1; // In the storage buffer, given out the first time it's applied.
+};
+
+// Every material in an .mtl file along with the textures they use, which stay loaded for as long as anything holds on
+// to the library.
+struct MaterialLibrary
+{
+	std::vector<Material> materials;
+	std::vector<std::string> names; // Same order as materials.
+	std::vector<std::shared_ptr<aie::Texture>> textures;
+
+	const Material *Find(const std::string &name) const; // Null if there's no material by that name.
+};
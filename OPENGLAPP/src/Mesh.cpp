@@ -1,21 +1,97 @@
 #include "Mesh.h"
 
 #include "Shader.h"
+#include "ObjLoader.h"
+#include "PlyLoader.h"
+#include "TangentGenerator.h"
+#include "OcclusionBaker.h"
+#include "MeshletBuilder.h"
+#include "MeshSimplifier.h"
+#include "MeshCache.h"
+#include "AssetManager.h"
+#include "ThreadPool.h"
 
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <climits>
+#include <cfloat>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <filesystem>
 
 #include <glad.h>
 
 #include <assimp/scene.h>
 #include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <assimp/material.h>
+
+static const unsigned int s_minClusterTriangles = 1 << 16; // Smaller meshes are drawn whole, culling them per cluster isn't worth it.
+static const unsigned int s_minLodTriangles = 1 << 10; // Below this a mesh only gets full detail.
+static const unsigned int s_maxLodTriangles = 1 << 22; // Anything bigger is left to the streaming cluster path.
+static const unsigned int s_maxLods = 6;
+static const size_t s_progressiveUploadBytes = (size_t)16 << 20; // Per frame, so a level arriving doesn't stall the frame.
+static const size_t s_minThreadedUploadBytes = (size_t)1 << 20; // Smaller meshes upload in place, a frame or more of waiting isn't worth it.
+
+// Shared between a mesh and the task loading it progressively.
+struct Mesh::ProgressiveLoad
+{
+	struct Level
+	{
+		unsigned int lod;
+		unsigned int firstVertex;
+		unsigned int firstIndex;
+		std::vector<Vertex> vertices; // Only the ones it adds to the coarser levels.
+		std::vector<unsigned int> indices;
+	};
+
+	std::string filePath;
+	TangentMode tangentMode;
+	MeshCache cache;
+	bool fromCache = false; // The coarsest level has been read from the cache, the task reads the rest from it too.
+	std::future<void> task;
+	std::atomic<bool> cancelled { false };
+
+	// Shared with the task, under mutex.
+	std::mutex mutex;
+	bool hasLayout = false;
+	MeshCache::Layout layout;
+	std::deque<Level> levels; // Coarsest first.
+	bool finished = false;
+	bool failed = false;
+
+	// Main thread only.
+	bool allocated = false;
+	bool uploading = false;
+	Level level; // Being uploaded.
+	size_t uploadedVertices = 0;
+	size_t uploadedIndices = 0;
+};
+
+static unsigned int NextMeshId()
+{
+	static std::atomic<unsigned int> id(1);
+	return id++;
+}
 
 Mesh::Mesh()
+	: m_id(NextMeshId())
 { }
 Mesh::~Mesh()
 {
+	if (m_progressiveLoad) // The task only touches the load, but it has to finish before that goes.
+	{
+		m_progressiveLoad->cancelled = true;
+		m_progressiveLoad->task.wait();
+	}
+	FinishUpload(true); // Likewise the upload thread and the buffers.
+
 	// Cleanup OpenGL Objects.
+	glDeleteBuffers(1, &m_indirectBuffer);
 	glDeleteBuffers(1, &m_EBO);
 	glDeleteBuffers(1, &m_VBO);
 	glDeleteVertexArrays(1, &m_VAO);
@@ -23,18 +99,155 @@ Mesh::~Mesh()
 
 // Initialize mesh with given vertices and optionally indices.
 void Mesh::Initialize(unsigned int vertexCount, const Vertex *vertices, unsigned int indexCount, unsigned int *indices)
+{
+	ASSERT(indexCount != 0 && indices == nullptr, "No indices have been passed in.");
+	if ((size_t)vertexCount * sizeof(Vertex) + (size_t)indexCount * sizeof(unsigned int) < s_minThreadedUploadBytes || !UploadThread::Get().IsRunning())
+	{
+		CreateBuffers(vertexCount, vertices, indexCount, indices);
+		return;
+	}
+	Initialize(std::vector<Vertex>(vertices, vertices + vertexCount), std::vector<unsigned int>(indices, indices + indexCount));
+}
+
+// As above, but the upload thread takes the data as it is rather than a copy of it.
+void Mesh::Initialize(std::vector<Vertex> &&vertices, std::vector<unsigned int> &&indices)
+{
+	unsigned int vertexCount = (unsigned int)vertices.size(), indexCount = (unsigned int)indices.size();
+	if (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int) < s_minThreadedUploadBytes || !UploadThread::Get().IsRunning())
+	{
+		CreateBuffers(vertexCount, vertices.data(), indexCount, indexCount != 0 ? indices.data() : nullptr);
+		return;
+	}
+
+	// The vertex array can point at the buffers straight away, they just aren't drawn from until they're filled.
+	CreateVertexArray(vertexCount, indexCount);
+	struct Data
+	{
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+	};
+	std::shared_ptr<Data> data = std::make_shared<Data>(Data { std::move(vertices), std::move(indices) });
+	unsigned int vbo = m_VBO, ebo = m_EBO;
+	m_upload = UploadThread::Get().Submit([data, vbo, ebo]()
+	{
+		glNamedBufferData(vbo, (GLsizeiptr)(data->vertices.size() * sizeof(Vertex)), data->vertices.data(), GL_STATIC_DRAW);
+		if (ebo != 0)
+			glNamedBufferData(ebo, (GLsizeiptr)(data->indices.size() * sizeof(unsigned int)), data->indices.data(), GL_STATIC_DRAW);
+	});
+}
+
+bool Mesh::FinishUpload(bool wait)
+{
+	if (m_upload == nullptr)
+		return true;
+
+	if (wait)
+		UploadThread::Wait(m_upload);
+	else if (!UploadThread::IsResident(m_upload))
+		return false;
+	m_upload.reset();
+	AttachBuffers();
+	return true;
+}
+
+// Allocate empty buffers, for loaders that stream the mesh in with UpdateVertices and UpdateIndices.
+void Mesh::Allocate(unsigned int vertexCount, unsigned int indexCount)
+{
+	CreateBuffers(vertexCount, nullptr, indexCount, nullptr);
+	m_triCount = 0; // Nothing to draw until indices arrive.
+}
+
+void Mesh::ReleaseBuffers()
+{
+	FinishUpload(true);
+	glDeleteBuffers(1, &m_EBO);
+	glDeleteBuffers(1, &m_VBO);
+	glDeleteVertexArrays(1, &m_VAO);
+	m_VAO = m_VBO = m_EBO = 0;
+	m_vertexCapacity = m_indexCapacity = 0;
+	m_triCount = 0;
+}
+
+void Mesh::UpdateVertices(unsigned int firstVertex, unsigned int vertexCount, const Vertex *vertices)
+{
+	ASSERT(firstVertex + vertexCount > m_vertexCapacity, "Vertex upload out of range.");
+	FinishUpload(true);
+	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)firstVertex * sizeof(Vertex), (GLsizeiptr)vertexCount * sizeof(Vertex), vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Mesh::UpdateIndices(unsigned int firstIndex, unsigned int indexCount, const unsigned int *indices)
+{
+	ASSERT(m_EBO == 0, "Mesh wasn't allocated with an index buffer.");
+	FinishUpload(true);
+
+	if (firstIndex + indexCount > m_indexCapacity) // Grow the index buffer, keeping what has already been uploaded.
+	{
+		unsigned int newCapacity = std::max(firstIndex + indexCount, m_indexCapacity + m_indexCapacity / 2);
+		unsigned int newEBO = 0;
+		glGenBuffers(1, &newEBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newEBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, m_EBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)firstIndex * sizeof(unsigned int));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glDeleteBuffers(1, &m_EBO);
+		m_EBO = newEBO;
+		m_indexCapacity = newCapacity;
+
+		glBindVertexArray(m_VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+		glBindVertexArray(0);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)firstIndex * sizeof(unsigned int), (GLsizeiptr)indexCount * sizeof(unsigned int), indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void Mesh::CreateBuffers(unsigned int vertexCount, const Vertex *vertices, unsigned int indexCount, const unsigned int *indices)
+{
+	CreateVertexArray(vertexCount, indexCount);
+
+	glNamedBufferData(m_VBO, (GLsizeiptr)vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW); // Pass vertices array into buffer.
+	if (indexCount != 0) // Has indices.
+		glNamedBufferData(m_EBO, (GLsizeiptr)indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW); // Pass indices array into buffer.
+}
+
+// Makes the vertex array and the buffers it reads from, without giving the buffers any storage yet.
+void Mesh::CreateVertexArray(unsigned int vertexCount, unsigned int indexCount)
 {
 	ASSERT(m_VAO != 0, "VAO already initialized.");
 
-	// Create OpenGL objects.
+	// Create OpenGL objects. Created rather than generated, so they exist for the upload thread's context right away.
 	glGenVertexArrays(1, &m_VAO); // Vertex array object.
-	glGenBuffers(1, &m_VBO); // Vertex buffer object.
+	glCreateBuffers(1, &m_VBO); // Vertex buffer object.
+	m_vertexCapacity = vertexCount;
 
+	if (indexCount != 0) // Has indices.
+	{
+		glCreateBuffers(1, &m_EBO); // Element buffer object.
+		m_indexCapacity = indexCount;
+		m_triCount = indexCount / 3;
+	}
+	else
+	{
+		m_triCount = vertexCount / 3;
+	}
+
+	AttachBuffers();
+}
+
+// Points the vertex array at the buffers. Called again once the upload thread has filled them, as another context's
+// changes to a buffer are only guaranteed to be seen here after it's bound again.
+void Mesh::AttachBuffers()
+{
 	glBindVertexArray(m_VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
 
-	glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW); // Pass vertices array into buffer.
-
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); // Setup vertex position attribute for shader.
 	glEnableVertexAttribArray(0);
 
@@ -47,18 +260,12 @@ void Mesh::Initialize(unsigned int vertexCount, const Vertex *vertices, unsigned
 	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)40); // Setup vertex tangent attribute for shader.
 	glEnableVertexAttribArray(3);
 
-	if (indexCount != 0) // Has indices.
-	{
-		ASSERT(indices == nullptr, "No indices have been passed in.");
-		glGenBuffers(1, &m_EBO); // Element buffer object.
+	// Baked occlusion, read out of the normal's w so it's the same attribute glTF models give a buffer of its own.
+	glVertexAttribPointer(OcclusionBaker::kAttributeLocation, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)28);
+	glEnableVertexAttribArray(OcclusionBaker::kAttributeLocation);
+
+	if (m_EBO != 0)
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW); // Pass indices array into buffer.
-		m_triCount = indexCount / 3;
-	}
-	else
-	{
-		m_triCount = vertexCount / 3;
-	}
 
 	// Unbind OpenGL objects.
 	glBindVertexArray(0);
@@ -66,198 +273,545 @@ void Mesh::Initialize(unsigned int vertexCount, const Vertex *vertices, unsigned
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+bool Mesh::IsStreamedScan(const char *filePath)
+{
+	std::string extension(filePath);
+	extension = extension.substr(extension.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension != "ply")
+		return false;
+
+	uint64_t vertexCount = 0, faceCount = 0; // Every face is at least one triangle.
+	return PlyLoader::ReadCounts(filePath, vertexCount, faceCount) && faceCount > s_maxLodTriangles;
+}
+
 // Initialize the mesh object from file.
 void Mesh::InitializeFromFile(const char *filePath)
 {
-	const aiScene *scene = aiImportFile(filePath, 0); // Import mesh from file using Assimp.
-	aiMesh *mesh = scene->mMeshes[0]; // Get first mesh from assimp scene.
+	std::string extension(filePath);
+	extension = extension.substr(extension.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-	// Setup indices with the imported mesh.
-	int numFaces = mesh->mNumFaces;
-	std::vector<unsigned int> indices;
-	for (int i = 0; i < numFaces; i++)
+	if (m_progressive && (extension == "obj" || extension == "ply"))
+	{
+		StartProgressiveLoad(filePath);
+		return;
+	}
+
+	if (extension == "obj") // Native OBJ parser, much faster than assimp's.
 	{
-		indices.push_back(mesh->mFaces[i].mIndices[0]);
-		indices.push_back(mesh->mFaces[i].mIndices[2]);
-		indices.push_back(mesh->mFaces[i].mIndices[1]);
-		if (mesh->mFaces[i].mNumIndices == 4)
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		bool multipleMaterials = false;
+		if (ObjLoader::Load(filePath, vertices, indices, &multipleMaterials))
 		{
-			indices.push_back(mesh->mFaces[i].mIndices[0]);
-			indices.push_back(mesh->mFaces[i].mIndices[3]);
-			indices.push_back(mesh->mFaces[i].mIndices[2]);
+			CalculateTangents(vertices.data(), (unsigned int)vertices.size(), indices);
+			OcclusionBaker::BakeCached(filePath, vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size());
+			BuildMeshlets(vertices.data(), (unsigned int)vertices.size(), indices, m_meshlets);
+			unsigned int fullDetailIndices = (unsigned int)indices.size();
+			BuildLods(vertices.data(), (unsigned int)vertices.size(), indices, m_lods, m_boundsCenter, m_boundsRadius);
+			m_currentLod = 0;
+			Initialize(std::move(vertices), std::move(indices));
+			SetIndexCount(fullDetailIndices); // Lower levels of detail follow the full detail triangles.
+			return;
 		}
+		if (!multipleMaterials) // Multi material files are expected to go through assimp, which splits them up.
+			std::cout << "WARNING: " << "Native OBJ parser failed on " << filePath << ", falling back to assimp." << std::endl;
 	}
-
-	// Setup vertices with the imported mesh.
-	int numV = mesh->mNumVertices;
-	Vertex *vertices = new Vertex[numV];
-	for (int i = 0; i < numV; i++)
+	else if (extension == "ply") // Binary PLY scans are streamed straight into the GPU buffers.
 	{
-		vertices[i].position = glm::vec4(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f);
-		vertices[i].normal = glm::vec4(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 0.0f);
-
-		if (mesh->mTextureCoords[0]) // Imported mesh has texture coords.
+		if (PlyLoader::Load(filePath, *this))
 		{
-			vertices[i].texCoord = glm::vec2(mesh->mTextureCoords[0][i].x, 1.0f - mesh->mTextureCoords[0][i].y);
+			if (m_triCount >= s_minLodTriangles && m_triCount <= s_maxLodTriangles)
+			{
+				// The loader never holds the whole mesh, so read it back to build meshlets and levels of detail.
+				std::vector<Vertex> vertices;
+				std::vector<unsigned int> indices;
+				ReadBack(vertices, indices);
+				if (OcclusionBaker::BakeCached(filePath, vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size()))
+					UpdateVertices(0, (unsigned int)vertices.size(), vertices.data());
+				BuildMeshlets(vertices.data(), (unsigned int)vertices.size(), indices, m_meshlets);
+				unsigned int fullDetailIndices = (unsigned int)indices.size();
+				BuildLods(vertices.data(), (unsigned int)vertices.size(), indices, m_lods, m_boundsCenter, m_boundsRadius);
+				m_currentLod = 0;
+				UpdateIndices(0, (unsigned int)indices.size(), indices.data());
+				SetIndexCount(fullDetailIndices);
+			}
+			// Anything bigger is drawn whole. Reading it back to build meshlets would need the whole scan in memory,
+			// which the streaming load is there to avoid, so AssetManager sends these to ClusterMesh instead.
+			return;
 		}
-		else // Doesn't have texture coords.
+	}
+
+	InitializeFromScene(filePath);
+}
+
+// Starts loading the file on the thread pool. If it has an up to date cache, the coarsest level is read and uploaded
+// here, which only takes a moment, so the mesh is on screen from the first frame.
+void Mesh::StartProgressiveLoad(const char *filePath)
+{
+	m_progressiveLoad = std::make_unique<ProgressiveLoad>();
+	ProgressiveLoad &load = *m_progressiveLoad;
+	load.filePath = filePath;
+	load.tangentMode = m_tangentMode;
+	m_finestLoadedLod = GetLodCount(); // Nothing to draw yet.
+
+	std::string cachePath = load.filePath + ".mcache";
+	std::error_code error;
+	bool upToDate = std::filesystem::exists(cachePath, error) &&
+		std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(load.filePath, error);
+	if (upToDate && load.cache.Open(cachePath.c_str()) && load.cache.GetLayout().tangentMode == m_tangentMode)
+	{
+		const MeshCache::Layout &layout = load.cache.GetLayout();
+		ProgressiveLoad::Level level;
+		level.lod = (unsigned int)layout.lods.size() - 1;
+		level.firstIndex = layout.lods[level.lod].firstIndex;
+		if (load.cache.ReadLevel(level.lod, level.firstVertex, level.vertices, level.indices))
 		{
-			vertices[i].texCoord = glm::vec2(0.0f); // Default to zero.
+			load.fromCache = true;
+			load.hasLayout = true;
+			load.layout = layout;
+			load.levels.push_back(std::move(level));
+			UpdateProgressiveLoad();
 		}
+	}
+	if (!load.fromCache)
+		load.cache.Close(); // The task is about to cook a new one over it.
 
-		if (mesh->HasTangentsAndBitangents())
+	load.task = ThreadPool::Get().Submit([&load]() { RunProgressiveLoad(load); });
+}
+
+// Loading task. Reads the remaining levels out of the cache, or imports the file, builds its meshlets and levels of
+// detail and hands them over coarsest first, then writes the cache for next time.
+void Mesh::RunProgressiveLoad(ProgressiveLoad &load)
+{
+	if (load.fromCache)
+	{
+		const MeshCache::Layout &layout = load.cache.GetLayout();
+		for (unsigned int lod = (unsigned int)layout.lods.size() - 1; lod-- > 0 && !load.cancelled;)
 		{
-			vertices[i].tangent = glm::vec4(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z, 1.0f);
+			ProgressiveLoad::Level level;
+			level.lod = lod;
+			level.firstIndex = layout.lods[lod].firstIndex;
+			if (!load.cache.ReadLevel(lod, level.firstVertex, level.vertices, level.indices))
+			{
+				std::cout << "WARNING: " << "Mesh cache for " << load.filePath << " is damaged, stopping at level of detail " << lod + 1 << "." << std::endl;
+				break;
+			}
+
+			std::lock_guard<std::mutex> lock(load.mutex);
+			load.levels.push_back(std::move(level));
 		}
+
+		std::lock_guard<std::mutex> lock(load.mutex);
+		load.finished = true;
+		return;
 	}
 
-	if (!mesh->HasTangentsAndBitangents()) // Imported mesh doesn't have tangent information.
-		CalculateTangents(vertices, numV, indices);
+	std::string extension = load.filePath.substr(load.filePath.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-	Initialize(numV, vertices, (unsigned int)indices.size(), indices.data()); // Initialize the mesh.
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	bool loaded = false;
+	if (extension == "obj")
+	{
+		loaded = ObjLoader::Load(load.filePath.c_str(), vertices, indices);
+		if (loaded)
+			TangentGenerator::Generate(vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size(), load.tangentMode);
+	}
+	else
+	{
+		loaded = PlyLoader::Load(load.filePath.c_str(), vertices, indices);
+	}
 
-	delete[] vertices; vertices = nullptr;
-}
+	if (!loaded || load.cancelled) // The mesh falls back to assimp, which blocks.
+	{
+		std::lock_guard<std::mutex> lock(load.mutex);
+		load.failed = true;
+		load.finished = true;
+		return;
+	}
 
-// Get material information from .mtl file.
-void Mesh::LoadMaterial(const char *filePath)
-{
-	std::fstream file(filePath, std::ios::in);
-	std::stringstream contents;
-	std::string line;
-	std::string header;
-	char buffer[256];
+	OcclusionBaker::Bake(vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size()); // Cached along with the rest.
 
-	std::string directory(filePath);
-	int index = (int)directory.rfind('/');
-	if (index != -1)
-		directory = directory.substr(0, index + 1);
+	MeshCache::Layout layout;
+	layout.tangentMode = load.tangentMode;
+	BuildMeshlets(vertices.data(), (unsigned int)vertices.size(), indices, layout.meshlets);
+	BuildLods(vertices.data(), (unsigned int)vertices.size(), indices, layout.lods, layout.boundsCenter, layout.boundsRadius);
+	if (layout.lods.empty())
+		layout.lods.push_back({ 0, (unsigned int)indices.size(), 0.0f });
+	MeshCache::SortForStreaming(vertices, indices, layout);
 
-	while (!file.eof())
 	{
-		file.getline(buffer, 256);
-		line = buffer;
-		contents << line;
-		std::stringstream ss(line, std::stringstream::in | std::stringstream::out);
-		if (line.find("Ka") == 0) // Ambient colour
-			ss >> header >> Ka.x >> Ka.y >> Ka.z;
-		else if (line.find("Ks") == 0) // Specular colour
-			ss >> header >> Ks.x >> Ks.y >> Ks.z;
-		else if (line.find("Kd") == 0) // Diffuse colour
-			ss >> header >> Kd.x >> Kd.y >> Kd.z;
-		else if (line.find("Ns") == 0) // Specular power.
-			ss >> header >> specular;
-		else if (line.find("map_Kd") == 0) // Diffuse texture.
-		{
-			std::string mapFileName;
-			ss >> header >> mapFileName;
-			mapKd.load((directory + mapFileName).c_str());
-		}
-		else if (line.find("map_Ks") == 0) // Specular texture.
-		{
-			std::string mapFileName;
-			ss >> header >> mapFileName;
-			mapKs.load((directory + mapFileName).c_str());
-		}
-		else if (line.find("bump") == 0) // Bump/normal texture.
+		std::lock_guard<std::mutex> lock(load.mutex);
+		load.hasLayout = true;
+		load.layout = layout;
+		for (unsigned int lod = (unsigned int)layout.lods.size(); lod-- > 0;)
 		{
-			std::string mapFileName;
-			ss >> header >> mapFileName;
-			mapBump.load((directory + mapFileName).c_str());
+			ProgressiveLoad::Level level;
+			level.lod = lod;
+			level.firstVertex = lod + 1 < layout.lods.size() ? layout.lodVertexCounts[lod + 1] : 0;
+			level.firstIndex = layout.lods[lod].firstIndex;
+			level.vertices.assign(vertices.begin() + level.firstVertex, vertices.begin() + layout.lodVertexCounts[lod]);
+			level.indices.assign(indices.begin() + level.firstIndex, indices.begin() + level.firstIndex + layout.lods[lod].indexCount);
+			load.levels.push_back(std::move(level));
 		}
 	}
 
-	// Fallback textures.
-	// TODO: probably could handle the fallback checking better,
-	// currently storing all the contents of the material file in a stringstream and then looking through it to see if the maps are defined.
-	// TODO: Fix these fallback textures, they seem to break lighting even though they shouldn't???
-	const unsigned int width = 8;
-	const unsigned int height = 8;
-	if (contents.str().find("map_Kd") == std::string::npos)
+	if (!load.cancelled)
+		MeshCache::Write((load.filePath + ".mcache").c_str(), layout, vertices.data(), indices.data());
+
+	std::lock_guard<std::mutex> lock(load.mutex);
+	load.finished = true;
+}
+
+// Uploads whatever the loading task has handed over, up to s_progressiveUploadBytes a frame. A level is only drawn
+// once all of it is on the GPU, so the mesh swaps from one complete level to the next and never shows half of one.
+void Mesh::Update()
+{
+	if (m_progressiveLoad)
+		UpdateProgressiveLoad();
+}
+
+void Mesh::UpdateProgressiveLoad()
+{
+	ProgressiveLoad &load = *m_progressiveLoad;
+	size_t budget = s_progressiveUploadBytes;
+	while (budget > 0)
 	{
-		const size_t size = (width * height) * 3;
-		unsigned char pixels[size];
-		for (int i = 0, k = 0; i < size; i += 3, k++)
+		if (!load.uploading)
 		{
-			// funny css missing texture pattern
-			if (k >= size || i >= size) break;
-			int x = (k) % width;
-			int y = (k) / width;
-			if ((x + y) % 2 == 0)
+			MeshCache::Layout layout;
+			bool newLayout = false, finished = false, failed = false;
+			{
+				std::lock_guard<std::mutex> lock(load.mutex);
+				if (load.hasLayout && !load.allocated)
+				{
+					layout = std::move(load.layout);
+					newLayout = load.allocated = true;
+				}
+				if (!load.levels.empty())
+				{
+					load.level = std::move(load.levels.front());
+					load.levels.pop_front();
+					load.uploading = true;
+					load.uploadedVertices = 0;
+					load.uploadedIndices = 0;
+				}
+				finished = load.finished;
+				failed = load.failed;
+			}
+
+			if (newLayout) // Sized for every level, each one fills in its part.
 			{
-				// pink
-				pixels[i+0] = 0xFF; // r
-				pixels[i+1] = 0x00; // g
-				pixels[i+2] = 0xFF; // b
+				Allocate(layout.vertexCount, layout.indexCount);
+				m_lods = layout.lods.size() > 1 ? layout.lods : std::vector<LodLevel>();
+				m_meshlets = std::move(layout.meshlets);
+				m_boundsCenter = layout.boundsCenter;
+				m_boundsRadius = layout.boundsRadius;
+				m_currentLod = 0;
+				m_finestLoadedLod = GetLodCount();
 			}
-			else
+
+			if (!load.uploading)
 			{
-				// black
-				pixels[i+0] = 0x00; // r
-				pixels[i+1] = 0x00; // g
-				pixels[i+2] = 0x00; // b
+				if (finished)
+				{
+					std::string filePath = load.filePath;
+					load.task.wait();
+					m_progressiveLoad.reset();
+					if (failed)
+					{
+						m_finestLoadedLod = 0;
+						InitializeFromScene(filePath.c_str());
+					}
+				}
+				return;
 			}
 		}
 
-		mapKd.create(width, height, aie::Texture::Format::RGB, pixels);
+		ProgressiveLoad::Level &level = load.level;
+		if (load.uploadedVertices < level.vertices.size())
+		{
+			size_t count = std::min(level.vertices.size() - load.uploadedVertices, std::max(budget / sizeof(Vertex), (size_t)1));
+			UpdateVertices(level.firstVertex + (unsigned int)load.uploadedVertices, (unsigned int)count, level.vertices.data() + load.uploadedVertices);
+			load.uploadedVertices += count;
+			budget -= std::min(budget, count * sizeof(Vertex));
+		}
+		else if (load.uploadedIndices < level.indices.size())
+		{
+			size_t count = std::min(level.indices.size() - load.uploadedIndices, std::max(budget / sizeof(unsigned int), (size_t)1));
+			UpdateIndices(level.firstIndex + (unsigned int)load.uploadedIndices, (unsigned int)count, level.indices.data() + load.uploadedIndices);
+			load.uploadedIndices += count;
+			budget -= std::min(budget, count * sizeof(unsigned int));
+		}
+		else // All of it is up, draw it from now on.
+		{
+			m_finestLoadedLod = level.lod;
+			if (level.lod == 0)
+				SetIndexCount((unsigned int)level.indices.size());
+			load.level = ProgressiveLoad::Level();
+			load.uploading = false;
+		}
+	}
+}
+
+// Import every mesh in the file through assimp into one vertex and index buffer, with a submesh per mesh
+// and a material per assimp material. Node transforms are flattened so Render can place each part.
+void Mesh::InitializeFromScene(const char *filePath)
+{
+	const aiScene *scene = aiImportFile(filePath, aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenSmoothNormals);
+	if (scene == nullptr || scene->mNumMeshes == 0)
+	{
+		std::cout << "WARNING: " << "Failed to import " << filePath << ": " << aiGetErrorString() << std::endl;
+		if (scene) aiReleaseImport(scene);
+		return;
+	}
+
+	LoadScene(scene, filePath);
+	aiReleaseImport(scene);
+}
+
+void Mesh::LoadScene(const aiScene *scene, const char *filePath, std::vector<unsigned int> *meshBaseVertices)
+{
+	std::string directory(filePath);
+	size_t slash = directory.find_last_of("/\\");
+	directory = (slash != std::string::npos) ? directory.substr(0, slash + 1) : "";
+
+	// Work out where each mesh lands in the shared buffers. Points and lines are sorted out and skipped.
+	std::vector<unsigned int> baseVertices(scene->mNumMeshes, 0), firstIndices(scene->mNumMeshes, 0);
+	unsigned int vertexCount = 0, indexCount = 0;
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		const aiMesh *mesh = scene->mMeshes[m];
+		baseVertices[m] = vertexCount;
+		firstIndices[m] = indexCount;
+		if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+			continue;
+		vertexCount += mesh->mNumVertices;
+		indexCount += mesh->mNumFaces * 3;
 	}
-	else if (contents.str().find("map_Ks") == std::string::npos)
+
+	std::vector<Vertex> vertices(vertexCount);
+	std::vector<unsigned int> indices(indexCount);
+	std::vector<float> occlusion; // Only baked if there isn't an up to date .ao for every vertex.
+	bool occlusionCached = OcclusionBaker::ReadCache(filePath, occlusion) && occlusion.size() == vertexCount;
+	m_submeshes.clear();
+	std::vector<int> meshSubmesh(scene->mNumMeshes, -1);
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
 	{
-		const size_t size = (width * height) * 3;
-		unsigned char pixels[size];
-		for (int i = 0; i < size; i += 3)
+		const aiMesh *mesh = scene->mMeshes[m];
+		if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+			continue;
+
+		// Setup indices with the imported mesh, offset into the shared vertex buffer.
+		unsigned int baseVertex = baseVertices[m];
+		unsigned int *index = indices.data() + firstIndices[m];
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			// black
-			if (i >= size) break;
-			pixels[i+0] = 0x00; // r
-			pixels[i+1] = 0x00; // g
-			pixels[i+2] = 0x00; // b
+			*index++ = baseVertex + mesh->mFaces[i].mIndices[0];
+			*index++ = baseVertex + mesh->mFaces[i].mIndices[2];
+			*index++ = baseVertex + mesh->mFaces[i].mIndices[1];
 		}
 
-		mapKs.create(width, height, aie::Texture::Format::RGB, pixels);
+		// Setup vertices with the imported mesh.
+		Vertex *vertex = vertices.data() + baseVertex;
+		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		{
+			vertex[i].position = glm::vec4(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z, 1.0f);
+			vertex[i].normal = glm::vec4(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z, 0.0f);
+
+			if (mesh->mTextureCoords[0]) // Imported mesh has texture coords.
+				vertex[i].texCoord = glm::vec2(mesh->mTextureCoords[0][i].x, 1.0f - mesh->mTextureCoords[0][i].y);
+			else // Doesn't have texture coords.
+				vertex[i].texCoord = glm::vec2(0.0f); // Default to zero.
+
+			if (mesh->HasTangentsAndBitangents())
+				vertex[i].tangent = glm::vec4(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z, 1.0f);
+		}
+
+		std::vector<unsigned int> localIndices(indices.begin() + firstIndices[m], indices.begin() + firstIndices[m] + mesh->mNumFaces * 3);
+		for (unsigned int &i : localIndices)
+			i -= baseVertex;
+		if (!mesh->HasTangentsAndBitangents()) // Imported mesh doesn't have tangent information.
+			CalculateTangents(vertex, mesh->mNumVertices, localIndices);
+		if (!occlusionCached)
+			OcclusionBaker::Bake(vertex, mesh->mNumVertices, localIndices.data(), localIndices.size()); // Each part against its own triangles.
+
+		meshSubmesh[m] = (int)m_submeshes.size();
+		m_submeshes.push_back({ firstIndices[m], mesh->mNumFaces * 3, mesh->mMaterialIndex });
+	}
+
+	if (occlusionCached)
+	{
+		for (unsigned int v = 0; v < vertexCount; v++)
+			vertices[v].normal.w = occlusion[v];
+	}
+	else
+	{
+		occlusion.resize(vertexCount);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			occlusion[v] = vertices[v].normal.w;
+		OcclusionBaker::WriteCache(filePath, occlusion);
+	}
+
+	// Materials, with textures shared through the asset manager.
+	m_materials.clear();
+	m_materialTextures.clear();
+	auto loadTexture = [&](const aiMaterial *source, aiTextureType type, aie::Texture::Usage usage = aie::Texture::COLOUR) -> const aie::Texture *
+	{
+		aiString path;
+		if (aiGetMaterialTexture(source, type, 0, &path) != AI_SUCCESS || path.length == 0)
+			return nullptr;
+
+		std::shared_ptr<aie::Texture> texture = AssetManager::Get().GetTextureAsync(directory + path.C_Str(), usage);
+		if (texture)
+			m_materialTextures.push_back(texture);
+		return texture.get();
+	};
+
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+	{
+		const aiMaterial *source = scene->mMaterials[i];
+		Material material;
+
+		aiColor4D colour;
+		if (aiGetMaterialColor(source, AI_MATKEY_COLOR_AMBIENT, &colour) == AI_SUCCESS) material.Ka = glm::vec3(colour.r, colour.g, colour.b);
+		if (aiGetMaterialColor(source, AI_MATKEY_COLOR_DIFFUSE, &colour) == AI_SUCCESS) material.Kd = glm::vec3(colour.r, colour.g, colour.b);
+		if (aiGetMaterialColor(source, AI_MATKEY_COLOR_SPECULAR, &colour) == AI_SUCCESS) material.Ks = glm::vec3(colour.r, colour.g, colour.b);
+		float shininess = 0.0f;
+		if (aiGetMaterialFloat(source, AI_MATKEY_SHININESS, &shininess) == AI_SUCCESS && shininess > 0.0f)
+			material.specular = shininess;
+
+		const aie::Texture *diffuse = loadTexture(source, aiTextureType_DIFFUSE);
+		const aie::Texture *specularMap = loadTexture(source, aiTextureType_SPECULAR, aie::Texture::LINEAR);
+		const aie::Texture *normal = loadTexture(source, aiTextureType_NORMALS, aie::Texture::NORMAL_MAP);
+		if (normal == nullptr) // OBJ bump maps come through as height maps.
+			normal = loadTexture(source, aiTextureType_HEIGHT, aie::Texture::NORMAL_MAP);
+		material.mapKd = diffuse;
+		material.mapKs = specularMap;
+		material.mapBump = normal; // Maps left null get fallbacks when applied.
+		m_materials.push_back(std::move(material));
+	}
+	for (Submesh &submesh : m_submeshes) // Shouldn't happen, assimp always makes a default material.
+	{
+		if (submesh.material >= m_materials.size())
+			submesh.material = 0;
 	}
-	else if (contents.str().find("bump") == std::string::npos)
+
+	// Flatten the node hierarchy into world transforms relative to the root.
+	m_nodeTransforms.clear();
+	m_drawList.clear();
+	std::vector<std::pair<const aiNode *, glm::mat4>> stack = { { scene->mRootNode, glm::mat4(1.0f) } };
+	while (!stack.empty())
 	{
-		const size_t size = (width * height) * 3;
-		unsigned char pixels[size];
-		for (int i = 0; i < size; i += 3)
+		const aiNode *node = stack.back().first;
+		glm::mat4 parent = stack.back().second;
+		stack.pop_back();
+		if (node == nullptr)
+			continue;
+
+		const aiMatrix4x4 &m = node->mTransformation; // Row major.
+		glm::mat4 local(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3, m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+		glm::mat4 world = parent * local;
+
+		if (node->mNumMeshes > 0)
 		{
-			// normal map neutral blue (127, 127, 255)
-			if (i >= size) break;
-			pixels[i+0] = 0x7F; // r
-			pixels[i+1] = 0x7F; // g
-			pixels[i+2] = 0xFF; // b
+			unsigned int nodeIndex = (unsigned int)m_nodeTransforms.size();
+			m_nodeTransforms.push_back(world);
+			for (unsigned int i = 0; i < node->mNumMeshes; i++)
+			{
+				unsigned int meshIndex = node->mMeshes[i];
+				if (meshIndex < scene->mNumMeshes && meshSubmesh[meshIndex] >= 0)
+					m_drawList.push_back({ nodeIndex, (unsigned int)meshSubmesh[meshIndex] });
+			}
 		}
+		for (unsigned int i = 0; i < node->mNumChildren; i++)
+			stack.push_back({ node->mChildren[i], world });
+	}
+
+	// Group draws by material, then by node, so Render changes as little state as it can.
+	std::sort(m_drawList.begin(), m_drawList.end(), [this](const SubmeshDraw &a, const SubmeshDraw &b)
+	{
+		unsigned int materialA = m_submeshes[a.submesh].material, materialB = m_submeshes[b.submesh].material;
+		if (materialA != materialB)
+			return materialA < materialB;
+		return a.node < b.node;
+	});
+
+	if (meshBaseVertices != nullptr)
+		*meshBaseVertices = baseVertices;
 
-		mapBump.create(width, height, aie::Texture::Format::RGB, pixels);
+	if (indexCount == 0)
+	{
+		std::cout << "WARNING: " << filePath << " has no triangles." << std::endl;
+		return;
 	}
+	Initialize(std::move(vertices), std::move(indices)); // Initialize the mesh.
+}
+
+// Get material information from .mtl file.
+void Mesh::LoadMaterial(const char *filePath, const char *materialName)
+{
+	m_materials.clear(); // An explicit material replaces any imported with the model.
+	m_materialLibrary = AssetManager::Get().GetMaterialLibrary(filePath);
+	m_material = nullptr;
+	if (materialName != nullptr)
+		m_material = m_materialLibrary->Find(materialName);
+	else if (!m_materialLibrary->materials.empty())
+		m_material = &m_materialLibrary->materials[0];
+
+	if (m_material == nullptr)
+		std::cout << "WARNING: " << "No material " << (materialName ? materialName : "") << " in " << filePath << std::endl;
 }
 
 void Mesh::ApplyMaterial(aie::ShaderProgram *shader)
 {
-	// Bind material information to shader.
-	shader->bindUniform("specular", specular); // TODO: fix bug with shader stating "specular" is not being found or used even though it is?
-	shader->bindUniform("Ka", Ka);
-	shader->bindUniform("Kd", Kd);
-	shader->bindUniform("Ks", Ks);
-	mapKd.bind(0);
-	shader->bindUniform("diffuseTex", 0);
-	mapKs.bind(1);
-	shader->bindUniform("specularTex", 1);
-	mapBump.bind(2);
-	shader->bindUniform("normalTex", 2);
+	static const Material defaultMaterial;
+	(m_material ? *m_material : defaultMaterial).Apply(shader);
 }
 
 void Mesh::MakeMaterial(glm::vec3 Ka, glm::vec3 Kd, glm::vec3 Ks, float specular, const char *diffusePath, const char *specularPath, const char *normalPath)
 {
-	this->specular = specular;
-	this->Ka = Ka;
-	this->Kd = Kd;
-	this->Ks = Ks;
-
-	if (diffusePath) mapKd.load(diffusePath);
-	if (specularPath) mapKs.load(specularPath);
-	if (normalPath) mapBump.load(normalPath);
+	m_materials.clear(); // An explicit material replaces any imported with the model.
+
+	std::shared_ptr<MaterialLibrary> library = std::make_shared<MaterialLibrary>();
+	auto loadMap = [&library](const char *path, aie::Texture::Usage usage = aie::Texture::COLOUR) -> const aie::Texture *
+	{
+		std::shared_ptr<aie::Texture> texture = path ? AssetManager::Get().GetTextureAsync(path, usage) : nullptr;
+		if (texture)
+			library->textures.push_back(texture);
+		return texture.get();
+	};
+
+	Material material;
+	material.specular = specular;
+	material.Ka = Ka;
+	material.Kd = Kd;
+	material.Ks = Ks;
+	material.mapKd = loadMap(diffusePath);
+	material.mapKs = loadMap(specularPath, aie::Texture::LINEAR);
+	material.mapBump = loadMap(normalPath, aie::Texture::NORMAL_MAP);
+	library->materials.push_back(std::move(material));
+	library->names.push_back("");
+
+	m_materialLibrary = library;
+	m_material = &library->materials[0];
+}
+
+void Mesh::GetTextures(std::vector<const aie::Texture *> &textures) const
+{
+	if (m_materialLibrary)
+	{
+		for (const std::shared_ptr<aie::Texture> &texture : m_materialLibrary->textures)
+			textures.push_back(texture.get());
+	}
+	for (const std::shared_ptr<aie::Texture> &texture : m_materialTextures)
+	{
+		if (texture)
+			textures.push_back(texture.get());
+	}
 }
 
 void Mesh::InitializeQuad()
@@ -661,7 +1215,7 @@ void Mesh::InitializePrimitive(PrimitiveID type)
 		case PRIMITIVE_CONE:
 		{
 			// TODO: fix cone generation.
-			const int sectorCount = 12;
+			const int sectorCount = kPrimitiveSegments;
 
 			vertexCount = (sectorCount + 4) * 2 + 1; // probably incorrect atm.
 			vertices = new Vertex[vertexCount];
@@ -764,7 +1318,7 @@ void Mesh::InitializePrimitive(PrimitiveID type)
 		case PRIMITIVE_CYLINDER:
 		{
 			// TODO: fix cylinder generation.
-			const int sectorCount = 12;
+			const int sectorCount = kPrimitiveSegments;
 
 			vertexCount = (sectorCount * 2 + 2) * 2; // algorithm uses a higher vertex count than it should, not sure why. might be accounting for normals?
 			vertices = new Vertex[vertexCount];
@@ -881,8 +1435,8 @@ void Mesh::InitializePrimitive(PrimitiveID type)
 		case PRIMITIVE_SPHERE:
 		{
 			// TODO: fix sphere generation.
-			const unsigned int sectorCount = 12;
-			const unsigned int stackCount = 6;
+			const unsigned int sectorCount = kPrimitiveSegments;
+			const unsigned int stackCount = kPrimitiveSegments / 2;
 
 			vertexCount = (sectorCount+1) * (stackCount+1); // the proper vertex count should be 62 according to blender's sphere primitive but this algorithm creates 91, not sure why
 			vertices = new Vertex[vertexCount];
@@ -957,74 +1511,223 @@ void Mesh::InitializePrimitive(PrimitiveID type)
 
 void Mesh::Draw()
 {
+	if (!FinishUpload(false))
+		return;
+
+	// Meshes still loading fall back to the finest level that has arrived.
+	unsigned int currentLod = std::max(m_currentLod, m_finestLoadedLod);
+	if (currentLod >= GetLodCount())
+		return;
+
 	glBindVertexArray(m_VAO);
-	if (m_EBO != 0)
+	if (m_EBO != 0 && currentLod > 0 && currentLod < m_lods.size())
+	{
+		// Draw a simplified level of detail.
+		const LodLevel &lod = m_lods[currentLod];
+		glDrawElementsInstanced(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (void *)((size_t)lod.firstIndex * sizeof(unsigned int)), m_instanceCount);
+	}
+	else if (m_EBO != 0)
 	{
 		// Draw with indices.
-		glDrawElements(GL_TRIANGLES, 3 * m_triCount, GL_UNSIGNED_INT, 0);
+		glDrawElementsInstanced(GL_TRIANGLES, 3 * m_triCount, GL_UNSIGNED_INT, 0, m_instanceCount);
 	}
 	else
 	{
 		// Draw with vertices.
-		glDrawArrays(GL_TRIANGLES, 0, 3 * m_triCount);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 3 * m_triCount, m_instanceCount);
 	}
 }
 
-void Mesh::CalculateTangents(Vertex *vertices, unsigned int vertexCount, const std::vector<unsigned int> &indices)
+void Mesh::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
 {
-	glm::vec4 *tan1 = new glm::vec4[vertexCount * 2]; // Temp array.
-	glm::vec4 *tan2 = tan1 + vertexCount;
-	memset(tan1, 0, vertexCount * sizeof(glm::vec4) * 2);
+	if (!FinishUpload(false))
+		return;
 
-	// Compute the tangent at each point.
-	unsigned int indexCount = (unsigned int)indices.size();
-	for (unsigned int a = 0; a < indexCount; a += 3)
+	if (m_drawList.empty() || m_EBO == 0)
 	{
-		long i1 = indices[a];
-		long i2 = indices[a + 1];
-		long i3 = indices[a + 2];
-
-		const glm::vec4 &v1 = vertices[i1].position;
-		const glm::vec4 &v2 = vertices[i2].position;
-		const glm::vec4 &v3 = vertices[i3].position;
-
-		const glm::vec2 &w1 = vertices[i1].texCoord;
-		const glm::vec2 &w2 = vertices[i2].texCoord;
-		const glm::vec2 &w3 = vertices[i3].texCoord;
-
-		float x1 = v2.x - v1.x;
-		float x2 = v3.x - v1.x;
-		float y1 = v2.y - v1.y;
-		float y2 = v3.y - v1.y;
-		float z1 = v2.z - v1.z;
-		float z2 = v3.z - v1.z;
-
-		float s1 = w2.x - w1.x;
-		float s2 = w3.x - w1.x;
-		float t1 = w2.y - w1.y;
-		float t2 = w3.y - w1.y;
-
-		float r = 1.0f / (s1 * t2 - s2 * t1);
-		glm::vec4 sdir((t2 * x1 - t1 * x2) * r, (t2 * y1 - t1 * y2) * r, (t2 * z1 - t1 * z2) * r, 0.0f);
-		glm::vec4 tdir((s1 * x2 - s2 * x1) * r, (s1 * y2 - s2 * y1) * r, (s1 * z2 - s2 * z1) * r, 0.0f);
-
-		tan1[i1] += sdir;
-		tan1[i2] += sdir;
-		tan1[i3] += sdir;
-
-		tan2[i1] += tdir;
-		tan2[i2] += tdir;
-		tan2[i3] += tdir;
+		// The caller has already bound this instance's matrices.
+		ApplyMaterial(shader);
+		if (m_clusterCulling && !m_meshlets.empty() && m_EBO != 0 && m_currentLod == 0 && m_finestLoadedLod == 0 && m_instanceCount == 1)
+			DrawClusters(projectionView * transform);
+		else
+			Draw();
+		return;
 	}
 
-	for (unsigned int a = 0; a < vertexCount; a++)
+	// Submeshes share the buffers, the draw list is sorted by material so each is only applied once.
+	glBindVertexArray(m_VAO);
+	unsigned int boundNode = UINT_MAX;
+	unsigned int boundMaterial = UINT_MAX;
+	bool appliedOwnMaterial = false;
+	for (const SubmeshDraw &draw : m_drawList)
 	{
-		const glm::vec3 &n = glm::vec3(vertices[a].normal);
-		const glm::vec3 &t = glm::vec3(tan1[a]);
+		const Submesh &submesh = m_submeshes[draw.submesh];
+		if (draw.node != boundNode)
+		{
+			glm::mat4 model = transform * m_nodeTransforms[draw.node];
+			shader->bindUniform("mvp", projectionView * model);
+			shader->bindUniform("model", model);
+			boundNode = draw.node;
+		}
+
+		if (m_materials.empty()) // Material was set with LoadMaterial or MakeMaterial.
+		{
+			if (!appliedOwnMaterial)
+				ApplyMaterial(shader);
+			appliedOwnMaterial = true;
+		}
+		else if (submesh.material != boundMaterial)
+		{
+			m_materials[submesh.material].Apply(shader);
+			boundMaterial = submesh.material;
+		}
+
+		glDrawElementsInstanced(GL_TRIANGLES, submesh.indexCount, GL_UNSIGNED_INT, (void *)((size_t)submesh.indexOffset * sizeof(unsigned int)), m_instanceCount);
+	}
+}
+
+// Splits the mesh into meshlets if it's big enough, reordering the indices to match. Call before uploading.
+void Mesh::BuildMeshlets(const Vertex *vertices, unsigned int vertexCount, std::vector<unsigned int> &indices, std::vector<Meshlet> &meshlets)
+{
+	meshlets.clear();
+	if (indices.size() / 3 < s_minClusterTriangles)
+		return;
+	MeshletBuilder::Build(vertices, vertexCount, indices.data(), indices.size(), meshlets);
+}
 
-		vertices[a].tangent = glm::vec4(glm::normalize(t - n * glm::dot(n, t)), 0.0f);
-		vertices[a].tangent.w = (glm::dot(glm::cross(glm::vec3(n), glm::vec3(t)), glm::vec3(tan2[a])) < 0.0f) ? 1.0f : -1.0f;
+void Mesh::BuildClusters()
+{
+	if (m_EBO == 0 || m_triCount == 0)
+		return;
+
+	// Read the mesh back, build the meshlets and upload the reordered indices.
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	ReadBack(vertices, indices);
+	MeshletBuilder::Build(vertices.data(), (unsigned int)vertices.size(), indices.data(), indices.size(), m_meshlets);
+	UpdateIndices(0, (unsigned int)indices.size(), indices.data());
+}
+
+// Copies the vertices and full detail indices back out of the GPU buffers. Meshes without an index buffer get the
+// indices they'd have had.
+void Mesh::ReadBack(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+	FinishUpload(true);
+	vertices.resize(m_vertexCapacity);
+	indices.resize((size_t)m_triCount * 3);
+	glBindBuffer(GL_COPY_READ_BUFFER, m_VBO);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)vertices.size() * sizeof(Vertex), vertices.data());
+	if (m_EBO != 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, m_EBO);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)indices.size() * sizeof(unsigned int), indices.data());
+	}
+	else
+	{
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = (unsigned int)i;
 	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void Mesh::GetTriangles(std::vector<glm::vec3> &positions)
+{
+	if (m_VBO == 0 || m_triCount == 0)
+		return;
 
-	delete[] tan1;
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	ReadBack(vertices, indices);
+	auto appendRange = [&](unsigned int first, unsigned int count, const glm::mat4 &transform)
+	{
+		for (unsigned int i = first; i < first + count && i < indices.size(); i++)
+		{
+			unsigned int index = indices[i];
+			positions.push_back(index < vertices.size() ? glm::vec3(transform * glm::vec4(glm::vec3(vertices[index].position), 1.0f)) : glm::vec3(0.0f));
+		}
+	};
+
+	if (m_drawList.empty() || m_EBO == 0)
+	{
+		appendRange(0, m_triCount * 3, glm::mat4(1.0f));
+		return;
+	}
+	for (const SubmeshDraw &draw : m_drawList)
+	{
+		const Submesh &submesh = m_submeshes[draw.submesh];
+		appendRange(submesh.indexOffset, submesh.indexCount, m_nodeTransforms[draw.node]);
+	}
+}
+
+// Simplifies the mesh down in halves, appending each level's indices after the full detail ones.
+void Mesh::BuildLods(const Vertex *vertices, unsigned int vertexCount, std::vector<unsigned int> &indices, std::vector<LodLevel> &lods,
+	glm::vec3 &boundsCenter, float &boundsRadius)
+{
+	lods.clear();
+
+	// Bounding sphere, for working out how big the mesh is on screen.
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		minimum = glm::min(minimum, glm::vec3(vertices[i].position));
+		maximum = glm::max(maximum, glm::vec3(vertices[i].position));
+	}
+	boundsCenter = (minimum + maximum) * 0.5f;
+	boundsRadius = 0.0f;
+	for (unsigned int i = 0; i < vertexCount; i++)
+		boundsRadius = std::max(boundsRadius, glm::length(glm::vec3(vertices[i].position) - boundsCenter));
+
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < s_minLodTriangles || triangleCount > s_maxLodTriangles)
+		return;
+
+	lods.push_back({ 0, (unsigned int)indices.size(), 0.0f });
+	std::vector<unsigned int> previous(indices), simplified;
+	float error = 0.0f;
+	while (lods.size() < s_maxLods)
+	{
+		size_t target = (previous.size() / 6) * 3;
+		error = std::max(error, MeshSimplifier::Simplify(vertices, vertexCount, previous.data(), previous.size(), target, boundsRadius * 0.1f, simplified));
+		if (simplified.size() > previous.size() * 4 / 5) // Not getting anywhere, seams or the error limit are in the way.
+			break;
+
+		lods.push_back({ (unsigned int)indices.size(), (unsigned int)simplified.size(), error });
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+
+	if (lods.size() == 1)
+		lods.clear();
+}
+
+// Culls the meshlets on the CPU and draws the survivors with one indirect call.
+void Mesh::DrawClusters(const glm::mat4 &mvp)
+{
+	m_visibleMeshlets = MeshletBuilder::Cull(m_meshlets, mvp, m_drawCommands);
+	DrawIndirect();
+}
+
+void Mesh::DrawIndirect()
+{
+	if (m_drawCommands.empty())
+		return;
+
+	if (m_indirectBuffer == 0)
+		glGenBuffers(1, &m_indirectBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+	if (m_drawCommands.size() > m_indirectCapacity)
+	{
+		m_indirectCapacity = (unsigned int)m_drawCommands.size();
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, (GLsizeiptr)m_indirectCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+	}
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, (GLsizeiptr)m_drawCommands.size() * sizeof(DrawElementsIndirectCommand), m_drawCommands.data());
+
+	glBindVertexArray(m_VAO);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)m_drawCommands.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Mesh::CalculateTangents(Vertex *vertices, unsigned int vertexCount, const std::vector<unsigned int> &indices)
+{
+	TangentGenerator::Generate(vertices, vertexCount, indices.data(), indices.size(), m_tangentMode);
 }
@@ -3,12 +3,19 @@
 #include "Common.h"
 
 #include "Texture.h"
+#include "Material.h"
+#include "Meshlet.h"
+#include "UploadThread.h"
+
+#include <memory>
 
 namespace aie
 {
 	class ShaderProgram;
 }
 
+struct aiScene;
+
 class Mesh
 {
 public:
@@ -33,36 +40,171 @@ public:
 		PRIMITIVE_COUNT
 	};
 
+	static const unsigned int kPrimitiveSegments = 12; // Around the round primitives.
+
+	enum TangentMode
+	{
+		TANGENT_FAST = 0, // Area weighted sum of the triangle tangents.
+		// Angle weighted and projected into each corner's tangent plane, so it doesn't depend on the triangulation. Not
+		// MikkTSpace: vertices aren't split where their corners disagree on handedness or welded by tangent space, so
+		// normal maps baked by other tools won't match it exactly, mirrored UVs least of all.
+		TANGENT_ANGLE_WEIGHTED,
+	};
+
+	// A simplified copy of the mesh's triangles, stored after the full detail ones in the same index buffer.
+	struct LodLevel
+	{
+		unsigned int firstIndex;
+		unsigned int indexCount;
+		float error; // Furthest the surface has moved from full detail, in model units.
+	};
+
+	// A range of the shared index buffer drawn with one material.
+	struct Submesh
+	{
+		unsigned int indexOffset;
+		unsigned int indexCount;
+		unsigned int material; // Index into the materials imported with the model.
+	};
+
 public:
 	Mesh();
 	virtual ~Mesh();
 
+	// Never reused, unlike the mesh's address once it's freed, so caches keyed by it can't mix meshes up.
+	unsigned int GetId() const { return m_id; }
+
 	void InitializeQuad();
 	void InitializeFullscreenQuad();
 	void InitializePrimitive(PrimitiveID type);
+	// Big meshes are uploaded on the upload thread when it's running, and aren't drawn until they're resident.
 	void Initialize(unsigned int vertexCount, const Vertex *vertices, unsigned int indexCount = 0, unsigned int *indices = nullptr);
-	void InitializeFromFile(const char *filePath);
+	void Initialize(std::vector<Vertex> &&vertices, std::vector<unsigned int> &&indices);
+	// Picks a loader by extension, falling back to assimp for anything the native loaders can't read. Models with a
+	// loader of their own (GltfModel) override this.
+	virtual void InitializeFromFile(const char *filePath);
+	// Whether the file is a PLY scan with too many triangles for levels of detail or meshlets built in memory. Those are
+	// ClusterMesh's, which streams them from a cooked cluster DAG. Only reads the header.
+	static bool IsStreamedScan(const char *filePath);
+
+	// Streaming uploads, for loaders that never hold the whole mesh in memory.
+	void Allocate(unsigned int vertexCount, unsigned int indexCount);
+	void UpdateVertices(unsigned int firstVertex, unsigned int vertexCount, const Vertex *vertices);
+	void UpdateIndices(unsigned int firstIndex, unsigned int indexCount, const unsigned int *indices); // Grows the index buffer if needed.
+	void SetIndexCount(unsigned int indexCount) { m_triCount = indexCount / 3; }
+	void ReleaseBuffers(); // Frees what Allocate made, for a streaming load that has to give up part way through.
+
+	// How tangents are generated for files that don't have them, set before InitializeFromFile.
+	void SetTangentMode(TangentMode mode) { m_tangentMode = mode; }
+	// Load OBJ and PLY files on the thread pool instead of blocking, set before InitializeFromFile. The coarsest level of
+	// detail is drawn as soon as it's ready and finer ones replace it as they finish uploading. Other formats still block.
+	void SetProgressive(bool progressive) { m_progressive = progressive; }
+	bool IsLoading() const { return m_progressiveLoad != nullptr || m_upload != nullptr; }
+	// Once a frame before drawing, uploads whatever a progressive load has ready. Drawing never changes the buffers.
+	void Update();
 
-	void LoadMaterial(const char *filePath);
+	// Uses the named material in an .mtl file, or its first. The file is shared with every other mesh using it.
+	void LoadMaterial(const char *filePath, const char *materialName = nullptr);
 	void ApplyMaterial(aie::ShaderProgram *shader);
 	void MakeMaterial(glm::vec3 Ka, glm::vec3 Kd, glm::vec3 Ks, float specular, const char *diffusePath = nullptr, const char *specularPath = nullptr, const char *normalPath = nullptr);
+	virtual void GetTextures(std::vector<const aie::Texture *> &textures) const; // Appends every texture it draws with.
+	// Appends the full detail triangles as three positions each, with each part's node transform applied. Reads the
+	// buffers back, waiting for any upload, so it's for bakers rather than anything per frame.
+	virtual void GetTriangles(std::vector<glm::vec3> &positions);
 
 	virtual void Draw();
+	// Copies Draw and Render draw, for shaders that place each copy themselves from gl_InstanceID. Skips cluster culling.
+	void SetInstanceCount(unsigned int count) { m_instanceCount = std::max(count, 1u); }
+	// Applies the material and draws. Models made of several parts override this to draw each with its own transform.
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform);
+
+	// Splits the mesh into meshlets so Render can cull it a cluster at a time. Reads the uploaded buffers back, files
+	// loaded with InitializeFromFile that are big enough get their meshlets built before upload instead.
+	void BuildClusters();
+	void SetClusterCulling(bool enabled) { m_clusterCulling = enabled; }
+	const std::vector<Meshlet> &GetMeshlets() const { return m_meshlets; }
+	unsigned int GetVisibleMeshletCount() const { return m_visibleMeshlets; }
+
+	// Level of detail chain, built at import for meshes big enough to need one. Level 0 is full detail.
+	unsigned int GetLodCount() const { return m_lods.empty() ? 1 : (unsigned int)m_lods.size(); }
+	float GetLodError(unsigned int lod) const { return lod < m_lods.size() ? m_lods[lod].error : 0.0f; }
+	void SetLod(unsigned int lod) { m_currentLod = std::min(lod, GetLodCount() - 1); }
+	unsigned int GetLod() const { return m_currentLod; }
+	void SetLodErrorThreshold(float pixels) { m_lodErrorThreshold = pixels; } // For meshes that pick their own detail while drawing.
+	const glm::vec3 &GetBoundsCenter() const { return m_boundsCenter; }
+	float GetBoundsRadius() const { return m_boundsRadius; }
+
+	const std::vector<Submesh> &GetSubmeshes() const { return m_submeshes; }
+	unsigned int GetMaterialCount() const { return (unsigned int)m_materials.size(); }
+
+protected:
+	void DrawIndirect(); // Uploads m_drawCommands and draws them in one call.
+	// Uploads an imported scene's triangles, materials and node transforms. meshBaseVertices, if given, gets the first
+	// vertex of each of the scene's meshes in the shared buffer, for anything that adds its own per vertex data.
+	void LoadScene(const aiScene *scene, const char *filePath, std::vector<unsigned int> *meshBaseVertices = nullptr);
+	// Whether the buffers Initialize handed to the upload thread are resident yet, waiting until they are if asked to.
+	// Anything that touches the buffers outside of drawing waits first.
+	bool FinishUpload(bool wait);
 
 private:
+	struct ProgressiveLoad;
+
+	void InitializeFromScene(const char *filePath);
+	void StartProgressiveLoad(const char *filePath);
+	void UpdateProgressiveLoad();
+	static void RunProgressiveLoad(ProgressiveLoad &load);
+	static void BuildMeshlets(const Vertex *vertices, unsigned int vertexCount, std::vector<unsigned int> &indices, std::vector<Meshlet> &meshlets);
+	static void BuildLods(const Vertex *vertices, unsigned int vertexCount, std::vector<unsigned int> &indices, std::vector<LodLevel> &lods,
+		glm::vec3 &boundsCenter, float &boundsRadius);
+	void ReadBack(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+	void DrawClusters(const glm::mat4 &mvp);
+	void CreateBuffers(unsigned int vertexCount, const Vertex *vertices, unsigned int indexCount, const unsigned int *indices);
+	void CreateVertexArray(unsigned int vertexCount, unsigned int indexCount);
+	void AttachBuffers();
 	void CalculateTangents(Vertex *vertices, unsigned int vertexCount, const std::vector<unsigned int> &indices);
 
 protected:
 	unsigned int m_triCount = 0;
 	unsigned int m_VAO = 0, m_VBO = 0, m_EBO = 0; // OpenGL Objects.
+	unsigned int m_vertexCapacity = 0, m_indexCapacity = 0; // Buffer sizes, in elements.
+	TangentMode m_tangentMode = TANGENT_FAST;
+
+	std::shared_ptr<const MaterialLibrary> m_materialLibrary; // From LoadMaterial or MakeMaterial.
+	const Material *m_material = nullptr; // In m_materialLibrary, null for the default.
+
+	// Multi-part models share the buffers above and draw a range per submesh.
+	struct SubmeshDraw
+	{
+		unsigned int node; // Index into m_nodeTransforms.
+		unsigned int submesh;
+	};
+	std::vector<Submesh> m_submeshes;
+	std::vector<glm::mat4> m_nodeTransforms; // Node hierarchy flattened, relative to the mesh's own transform.
+	std::vector<SubmeshDraw> m_drawList; // Sorted by material so state changes are grouped.
+
+	std::vector<Material> m_materials; // Imported with the model. LoadMaterial and MakeMaterial replace them.
+	std::vector<std::shared_ptr<aie::Texture>> m_materialTextures; // Null for any that didn't load.
+
+	unsigned int m_id;
+
+	std::vector<Meshlet> m_meshlets; // Empty unless the mesh was big enough to be worth culling per cluster.
+	std::vector<DrawElementsIndirectCommand> m_drawCommands;
+	unsigned int m_indirectBuffer = 0;
+	unsigned int m_indirectCapacity = 0; // In commands.
+	unsigned int m_visibleMeshlets = 0;
+	bool m_clusterCulling = true;
+	unsigned int m_instanceCount = 1;
+
+	std::vector<LodLevel> m_lods; // Empty if the mesh only has full detail.
+	unsigned int m_currentLod = 0;
+	glm::vec3 m_boundsCenter = glm::vec3(0.0f);
+	float m_boundsRadius = 0.0f;
+	float m_lodErrorThreshold = 1.0f; // Pixels.
 
-	float specular = 1.0f;
-	glm::vec3 Ka = { 1.0f, 1.0f, 1.0f }; // Material properties.
-	glm::vec3 Kd = { 1.0f, 1.0f, 1.0f };
-	glm::vec3 Ks = { 1.0f, 1.0f, 1.0f };
+	UploadThread::Ticket m_upload; // Until the buffers are resident, nothing is drawn.
 
-	aie::Texture mapKd; // Diffuse texture.
-	aie::Texture mapKs; // Specular texture.
-	aie::Texture mapBump; // Bump/normal map.
+	bool m_progressive = false;
+	std::unique_ptr<ProgressiveLoad> m_progressiveLoad; // Until every level is uploaded.
+	unsigned int m_finestLoadedLod = 0; // Finer levels aren't drawn until they arrive, the level count while nothing has.
 
 };
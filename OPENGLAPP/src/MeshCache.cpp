@@ -0,0 +1,206 @@
+#include "MeshCache.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const uint32_t kMeshCacheMagic = 0x4853454D; // "MESH"
+	const uint32_t kMeshCacheVersion = 2; // 2: vertices carry baked occlusion in normal.w.
+	const unsigned int kUnsorted = 0xFFFFFFFF;
+
+	// The file is the header, the level and meshlet tables, then each level's data from the coarsest up.
+	struct MeshCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t lodCount;
+		uint32_t meshletCount;
+		uint32_t tangentMode;
+		float boundsRadius;
+		glm::vec3 boundsCenter;
+		uint32_t padding;
+	};
+
+	struct MeshCacheLevel
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t vertexCount; // Prefix of the vertices it uses.
+		uint64_t offset; // Of the vertices it adds, its indices follow straight after.
+	};
+}
+
+void MeshCache::SortForStreaming(std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, Layout &layout)
+{
+	std::vector<unsigned int> remap(vertices.size(), kUnsorted);
+	std::vector<Mesh::Vertex> sorted;
+	sorted.reserve(vertices.size());
+
+	layout.lodVertexCounts.assign(layout.lods.size(), 0);
+	for (size_t lod = layout.lods.size(); lod-- > 0;)
+	{
+		const Mesh::LodLevel &level = layout.lods[lod];
+		for (unsigned int i = level.firstIndex; i < level.firstIndex + level.indexCount; i++)
+		{
+			unsigned int &index = remap[indices[i]];
+			if (index == kUnsorted)
+			{
+				index = (unsigned int)sorted.size();
+				sorted.push_back(vertices[indices[i]]);
+			}
+		}
+		layout.lodVertexCounts[lod] = (unsigned int)sorted.size();
+	}
+
+	for (unsigned int &index : indices)
+		index = remap[index];
+	vertices.swap(sorted);
+	layout.vertexCount = (unsigned int)vertices.size();
+	layout.indexCount = (unsigned int)indices.size();
+}
+
+bool MeshCache::Write(const char *filePath, const Layout &layout, const Mesh::Vertex *vertices, const unsigned int *indices)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Couldn't write mesh cache " << filePath << std::endl;
+		return false;
+	}
+
+	unsigned int lodCount = (unsigned int)layout.lods.size();
+	MeshCacheHeader header = {};
+	header.magic = kMeshCacheMagic;
+	header.version = kMeshCacheVersion;
+	header.vertexCount = layout.vertexCount;
+	header.indexCount = layout.indexCount;
+	header.lodCount = lodCount;
+	header.meshletCount = (uint32_t)layout.meshlets.size();
+	header.tangentMode = (uint32_t)layout.tangentMode;
+	header.boundsRadius = layout.boundsRadius;
+	header.boundsCenter = layout.boundsCenter;
+
+	// Lay the levels out coarsest first, each after the one it refines.
+	std::vector<MeshCacheLevel> levels(lodCount);
+	uint64_t offset = sizeof(header) + (uint64_t)lodCount * sizeof(MeshCacheLevel) + layout.meshlets.size() * sizeof(Meshlet);
+	for (unsigned int lod = lodCount; lod-- > 0;)
+	{
+		const Mesh::LodLevel &level = layout.lods[lod];
+		unsigned int firstVertex = lod + 1 < lodCount ? layout.lodVertexCounts[lod + 1] : 0;
+		levels[lod] = { level.firstIndex, level.indexCount, level.error, layout.lodVertexCounts[lod], offset };
+		offset += (uint64_t)(layout.lodVertexCounts[lod] - firstVertex) * sizeof(Mesh::Vertex) + (uint64_t)level.indexCount * sizeof(unsigned int);
+	}
+
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)levels.data(), (std::streamsize)(levels.size() * sizeof(MeshCacheLevel)));
+	file.write((const char *)layout.meshlets.data(), (std::streamsize)(layout.meshlets.size() * sizeof(Meshlet)));
+	for (unsigned int lod = lodCount; lod-- > 0;)
+	{
+		const Mesh::LodLevel &level = layout.lods[lod];
+		unsigned int firstVertex = lod + 1 < lodCount ? layout.lodVertexCounts[lod + 1] : 0;
+		file.write((const char *)(vertices + firstVertex), (std::streamsize)(layout.lodVertexCounts[lod] - firstVertex) * sizeof(Mesh::Vertex));
+		file.write((const char *)(indices + level.firstIndex), (std::streamsize)level.indexCount * sizeof(unsigned int));
+	}
+
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing mesh cache " << filePath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::Open(const char *filePath)
+{
+	if (!m_file.Open(filePath))
+		return false;
+
+	// Check everything ReadLevel relies on up front, so a damaged file can't send it out of bounds later.
+	MeshCacheHeader header;
+	uint64_t tableSize = 0;
+	bool valid = m_file.GetSize() >= sizeof(header);
+	if (valid)
+	{
+		std::memcpy(&header, m_file.GetData(), sizeof(header));
+		tableSize = sizeof(header) + (uint64_t)header.lodCount * sizeof(MeshCacheLevel) + (uint64_t)header.meshletCount * sizeof(Meshlet);
+		valid = header.magic == kMeshCacheMagic && header.version == kMeshCacheVersion && header.lodCount > 0 && tableSize <= m_file.GetSize();
+	}
+
+	std::vector<MeshCacheLevel> levels;
+	if (valid)
+	{
+		levels.resize(header.lodCount);
+		std::memcpy(levels.data(), m_file.GetData() + sizeof(header), levels.size() * sizeof(MeshCacheLevel));
+		for (unsigned int lod = 0; lod < header.lodCount && valid; lod++)
+		{
+			const MeshCacheLevel &level = levels[lod];
+			unsigned int firstVertex = lod + 1 < header.lodCount ? levels[lod + 1].vertexCount : 0;
+			valid = (uint64_t)level.firstIndex + level.indexCount <= header.indexCount && level.vertexCount >= firstVertex && level.vertexCount <= header.vertexCount &&
+				level.offset + (uint64_t)(level.vertexCount - firstVertex) * sizeof(Mesh::Vertex) + (uint64_t)level.indexCount * sizeof(unsigned int) <= m_file.GetSize();
+		}
+		valid = valid && levels[0].vertexCount == header.vertexCount;
+	}
+
+	if (valid)
+	{
+		m_layout.meshlets.resize(header.meshletCount);
+		std::memcpy(m_layout.meshlets.data(), m_file.GetData() + sizeof(header) + levels.size() * sizeof(MeshCacheLevel), m_layout.meshlets.size() * sizeof(Meshlet));
+		for (const Meshlet &meshlet : m_layout.meshlets)
+		{
+			if ((uint64_t)meshlet.firstIndex + meshlet.triangleCount * 3 > levels[0].firstIndex + levels[0].indexCount)
+				valid = false;
+		}
+	}
+
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+
+	m_layout.vertexCount = header.vertexCount;
+	m_layout.indexCount = header.indexCount;
+	m_layout.boundsCenter = header.boundsCenter;
+	m_layout.boundsRadius = header.boundsRadius;
+	m_layout.tangentMode = (Mesh::TangentMode)header.tangentMode;
+	m_layout.lods.clear();
+	m_layout.lodVertexCounts.clear();
+	m_levelOffsets.clear();
+	for (const MeshCacheLevel &level : levels)
+	{
+		m_layout.lods.push_back({ level.firstIndex, level.indexCount, level.error });
+		m_layout.lodVertexCounts.push_back(level.vertexCount);
+		m_levelOffsets.push_back(level.offset);
+	}
+	return true;
+}
+
+void MeshCache::Close()
+{
+	m_file.Close();
+	m_layout = Layout();
+	m_levelOffsets.clear();
+}
+
+bool MeshCache::ReadLevel(unsigned int lod, unsigned int &firstVertex, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices) const
+{
+	if (lod >= m_layout.lods.size())
+		return false;
+
+	firstVertex = lod + 1 < m_layout.lods.size() ? m_layout.lodVertexCounts[lod + 1] : 0;
+	unsigned int vertexCount = m_layout.lodVertexCounts[lod] - firstVertex;
+	const char *data = m_file.GetData() + m_levelOffsets[lod];
+	vertices.resize(vertexCount);
+	std::memcpy(vertices.data(), data, (size_t)vertexCount * sizeof(Mesh::Vertex));
+	indices.resize(m_layout.lods[lod].indexCount);
+	std::memcpy(indices.data(), data + (size_t)vertexCount * sizeof(Mesh::Vertex), indices.size() * sizeof(unsigned int));
+
+	// An index past the level's vertices would read whatever the GPU has there.
+	return std::all_of(indices.begin(), indices.end(), [&](unsigned int index) { return index < m_layout.lodVertexCounts[lod]; });
+}
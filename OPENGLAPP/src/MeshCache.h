@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "Meshlet.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+
+// Imported meshes cooked to a binary file next to their source (.mcache), so later loads skip parsing, tangents,
+// meshlets and simplification. Levels of detail are stored coarsest first, with the vertices ordered by the first
+// level that uses them, so each level only adds to what's already loaded and can be drawn as soon as it arrives.
+class MeshCache
+{
+public:
+	struct Layout
+	{
+		unsigned int vertexCount = 0;
+		unsigned int indexCount = 0; // Every level.
+		std::vector<Mesh::LodLevel> lods; // As Mesh stores them, full detail first. Never empty.
+		std::vector<unsigned int> lodVertexCounts; // Vertices each level needs, always a prefix of the vertex buffer.
+		std::vector<Meshlet> meshlets; // Full detail only.
+		glm::vec3 boundsCenter = glm::vec3(0.0f);
+		float boundsRadius = 0.0f;
+		Mesh::TangentMode tangentMode = Mesh::TANGENT_FAST; // The cache is stale if a different mode is asked for.
+	};
+
+public:
+	// Puts the vertices in the order the levels first use them, coarsest first, dropping any nothing uses, and fills in
+	// lodVertexCounts. indices holds every level, at the offsets in layout.lods.
+	static void SortForStreaming(std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, Layout &layout);
+	static bool Write(const char *filePath, const Layout &layout, const Mesh::Vertex *vertices, const unsigned int *indices);
+
+	// Maps the file and reads the tables, false if it's missing or damaged.
+	bool Open(const char *filePath);
+	void Close(); // Unmaps the file, so it can be rewritten.
+	const Layout &GetLayout() const { return m_layout; }
+
+	// The vertices a level adds to the next coarser one, starting at firstVertex, and all of the level's indices.
+	// Safe to call from any thread once the cache is open.
+	bool ReadLevel(unsigned int lod, unsigned int &firstVertex, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices) const;
+
+private:
+	MappedFile m_file;
+	Layout m_layout;
+	std::vector<uint64_t> m_levelOffsets;
+
+};
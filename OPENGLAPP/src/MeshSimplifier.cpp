@@ -0,0 +1,384 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+	const double kBorderWeight = 10.0; // How hard open borders are held in place, relative to the surface.
+	const float kMaxNormalChange = 0.25f; // Cosine, collapses that turn a triangle further than this are rejected.
+	const double kTexCoordWeight = 0.25; // Texture coordinates span 0-1 over the whole model, so count for less than normals.
+
+	enum VertexKind : unsigned char
+	{
+		KIND_MANIFOLD = 0, // Free to collapse onto any neighbour.
+		KIND_BORDER, // On an open border, can only collapse along it.
+		KIND_LOCKED, // Texture seams, corners and anything non-manifold.
+	};
+
+	// Sum of squared distances to a set of weighted planes, as a symmetric 4x4 matrix.
+	struct Quadric
+	{
+		double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+		double weight = 0;
+
+		void AddPlane(const glm::dvec3 &normal, double distance, double planeWeight)
+		{
+			a00 += planeWeight * normal.x * normal.x;
+			a11 += planeWeight * normal.y * normal.y;
+			a22 += planeWeight * normal.z * normal.z;
+			a01 += planeWeight * normal.x * normal.y;
+			a02 += planeWeight * normal.x * normal.z;
+			a12 += planeWeight * normal.y * normal.z;
+			b0 += planeWeight * normal.x * distance;
+			b1 += planeWeight * normal.y * distance;
+			b2 += planeWeight * normal.z * distance;
+			c += planeWeight * distance * distance;
+			weight += planeWeight;
+		}
+
+		void Add(const Quadric &other)
+		{
+			a00 += other.a00; a11 += other.a11; a22 += other.a22;
+			a01 += other.a01; a02 += other.a02; a12 += other.a12;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+			weight += other.weight;
+		}
+
+		double Evaluate(const glm::dvec3 &p) const
+		{
+			return a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+				+ 2.0 * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+				+ 2.0 * (b0 * p.x + b1 * p.y + b2 * p.z) + c;
+		}
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float cost;
+	};
+
+	inline glm::dvec3 Position(const Mesh::Vertex *vertices, unsigned int index)
+	{
+		return glm::dvec3(vertices[index].position);
+	}
+
+	inline uint64_t EdgeKey(unsigned int a, unsigned int b)
+	{
+		return ((uint64_t)a << 32) | b;
+	}
+}
+
+float MeshSimplifier::Simplify(const Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount,
+	size_t targetIndexCount, float maxError, std::vector<unsigned int> &result, float attributeWeight, const unsigned char *lockedVertices)
+{
+	result.assign(indices, indices + indexCount - indexCount % 3);
+	if (result.size() <= targetIndexCount || vertexCount == 0)
+		return 0.0f;
+
+	// Exact duplicates (some exporters write every face's corners out separately) are merged outright. Vertices
+	// that share a position but differ otherwise are split on a seam, they're treated as one for topology and error.
+	std::vector<unsigned int> positionId(vertexCount);
+	std::vector<unsigned int> groupSize(vertexCount, 0);
+	{
+		std::vector<unsigned int> order(vertexCount);
+		std::iota(order.begin(), order.end(), 0u);
+		auto key = [vertices](unsigned int v)
+		{
+			const Mesh::Vertex &vertex = vertices[v];
+			return std::make_tuple(vertex.position.x, vertex.position.y, vertex.position.z,
+				vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.texCoord.x, vertex.texCoord.y);
+		};
+		auto samePosition = [vertices](unsigned int a, unsigned int b) { return glm::vec3(vertices[a].position) == glm::vec3(vertices[b].position); };
+		std::sort(order.begin(), order.end(), [&key](unsigned int a, unsigned int b) { return key(a) < key(b); });
+
+		std::vector<unsigned int> duplicateOf(vertexCount);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			unsigned int v = order[i];
+			bool duplicate = i > 0 && key(order[i - 1]) == key(v);
+			duplicateOf[v] = duplicate ? duplicateOf[order[i - 1]] : v;
+			positionId[v] = (i > 0 && samePosition(order[i - 1], v)) ? positionId[order[i - 1]] : v;
+			if (!duplicate)
+				groupSize[positionId[v]]++;
+		}
+		for (unsigned int &index : result)
+			index = duplicateOf[index];
+	}
+
+	// Locking any copy of a position locks all of them.
+	std::vector<unsigned char> lockedPositions;
+	if (lockedVertices != nullptr)
+	{
+		lockedPositions.assign(vertexCount, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			lockedPositions[positionId[v]] |= lockedVertices[v];
+	}
+
+	// Directed edges between positions. An edge without a twin going the other way is on an open border.
+	std::vector<uint64_t> edges;
+	auto buildEdges = [&]()
+	{
+		edges.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = positionId[result[i + k]], b = positionId[result[i + (k + 1) % 3]];
+				if (a != b)
+					edges.push_back(EdgeKey(a, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+	};
+	auto hasEdge = [&edges](unsigned int a, unsigned int b) { return std::binary_search(edges.begin(), edges.end(), EdgeKey(a, b)); };
+	auto isBorderEdge = [&hasEdge](unsigned int a, unsigned int b) { return hasEdge(a, b) != hasEdge(b, a); };
+
+	// Plane quadrics of every triangle weighted by area, plus planes through open borders, perpendicular to the
+	// surface, to hold their shape.
+	std::vector<Quadric> quadrics(vertexCount);
+	buildEdges();
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		glm::dvec3 p0 = Position(vertices, result[i]), p1 = Position(vertices, result[i + 1]), p2 = Position(vertices, result[i + 2]);
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(normal);
+		if (length <= 0.0)
+			continue;
+		normal /= length;
+		for (int k = 0; k < 3; k++)
+			quadrics[positionId[result[i + k]]].AddPlane(normal, -glm::dot(normal, p0), length * 0.5);
+
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = positionId[result[i + k]], b = positionId[result[i + (k + 1) % 3]];
+			if (a == b || hasEdge(b, a))
+				continue;
+
+			glm::dvec3 pa = Position(vertices, a);
+			glm::dvec3 edge = Position(vertices, b) - pa;
+			glm::dvec3 perpendicular = glm::cross(edge, normal);
+			double edgeLength = glm::length(perpendicular);
+			if (edgeLength <= 0.0)
+				continue;
+			perpendicular /= edgeLength;
+			double distance = -glm::dot(perpendicular, pa);
+			quadrics[a].AddPlane(perpendicular, distance, edgeLength * edgeLength * kBorderWeight);
+			quadrics[b].AddPlane(perpendicular, distance, edgeLength * edgeLength * kBorderWeight);
+		}
+	}
+
+	std::vector<unsigned char> kinds(vertexCount);
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1), adjacency;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<unsigned char> collapsed(vertexCount);
+	std::vector<Collapse> candidates;
+	float resultError = 0.0f;
+
+	bool firstPass = true;
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+		if (!firstPass)
+			buildEdges();
+		firstPass = false;
+
+		// Classify each position by its border edges.
+		std::vector<unsigned char> borderOut(vertexCount, 0), borderIn(vertexCount, 0), nonManifold(vertexCount, 0);
+		for (size_t i = 0; i < edges.size(); i++)
+		{
+			unsigned int a = (unsigned int)(edges[i] >> 32), b = (unsigned int)edges[i];
+			if (i > 0 && edges[i - 1] == edges[i]) // Same directed edge twice, the surface isn't manifold here.
+			{
+				nonManifold[a] = nonManifold[b] = 1;
+				continue;
+			}
+			if (!hasEdge(b, a))
+			{
+				borderOut[a] = (unsigned char)std::min(borderOut[a] + 1, 2);
+				borderIn[b] = (unsigned char)std::min(borderIn[b] + 1, 2);
+			}
+		}
+
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			unsigned int id = positionId[v];
+			if (nonManifold[id] || groupSize[id] > 1 || (!lockedPositions.empty() && lockedPositions[id]))
+				kinds[v] = KIND_LOCKED;
+			else if (borderOut[id] == 0 && borderIn[id] == 0)
+				kinds[v] = KIND_MANIFOLD;
+			else if (borderOut[id] == 1 && borderIn[id] == 1)
+				kinds[v] = KIND_BORDER;
+			else
+				kinds[v] = KIND_LOCKED;
+		}
+
+		// Triangles around each vertex.
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0u);
+		for (unsigned int index : result)
+			adjacencyOffsets[index + 1]++;
+		for (unsigned int v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(result.size());
+		{
+			std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+				adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+		}
+
+		// Every allowed collapse along every edge, cheapest first.
+		auto cost = [&](unsigned int from, unsigned int to)
+		{
+			Quadric quadric = quadrics[positionId[from]];
+			quadric.Add(quadrics[positionId[to]]);
+			glm::dvec3 target = Position(vertices, to);
+			double geometric = quadric.weight > 0.0 ? std::max(0.0, quadric.Evaluate(target)) / quadric.weight : 0.0;
+
+			// Moving the vertex drags its normal and texture coordinate along the edge with it.
+			double length = glm::length(target - Position(vertices, from));
+			double normalChange = 0.5 * glm::length(glm::vec3(vertices[from].normal - vertices[to].normal));
+			double texCoordChange = glm::length(vertices[from].texCoord - vertices[to].texCoord);
+			double attribute = attributeWeight * length * (normalChange + kTexCoordWeight * texCoordChange);
+			return (float)std::sqrt(geometric + attribute * attribute);
+		};
+
+		candidates.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+				for (int direction = 0; direction < 2; direction++)
+				{
+					unsigned int from = direction ? b : a, to = direction ? a : b;
+					if (kinds[from] == KIND_LOCKED)
+						continue;
+					if (kinds[from] == KIND_BORDER && (kinds[to] != KIND_BORDER || !isBorderEdge(positionId[from], positionId[to])))
+						continue;
+					candidates.push_back({ from, to, cost(from, to) });
+				}
+			}
+		}
+		if (candidates.empty())
+			break;
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+		// Would replacing from with to turn any of from's triangles too far, or inside out?
+		auto flips = [&](unsigned int from, unsigned int to)
+		{
+			glm::dvec3 target = Position(vertices, to);
+			for (unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++)
+			{
+				const unsigned int *triangle = &result[adjacency[a] * 3];
+				unsigned int corners[3] = { remap[triangle[0]], remap[triangle[1]], remap[triangle[2]] };
+				if (corners[0] == to || corners[1] == to || corners[2] == to)
+					continue; // Collapses away.
+
+				glm::dvec3 p[3] = { Position(vertices, corners[0]), Position(vertices, corners[1]), Position(vertices, corners[2]) };
+				glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				for (int k = 0; k < 3; k++)
+				{
+					if (corners[k] == from)
+						p[k] = target;
+				}
+				glm::dvec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+				if (glm::dot(before, after) < kMaxNormalChange * glm::length(before) * glm::length(after))
+					return true;
+			}
+			return false;
+		};
+
+		// Would it pinch the surface? Any neighbour the two share has to be across a triangle on the edge itself,
+		// otherwise two edges merge into one with four triangles on it.
+		std::vector<unsigned int> fromNeighbours, edgeOpposites;
+		auto pinches = [&](unsigned int from, unsigned int to)
+		{
+			fromNeighbours.clear();
+			edgeOpposites.clear();
+			unsigned int toPosition = positionId[to];
+			for (unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++)
+			{
+				const unsigned int *triangle = &result[adjacency[a] * 3];
+				bool onEdge = positionId[triangle[0]] == toPosition || positionId[triangle[1]] == toPosition || positionId[triangle[2]] == toPosition;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int position = positionId[triangle[k]];
+					if (position != toPosition && triangle[k] != from)
+						(onEdge ? edgeOpposites : fromNeighbours).push_back(position);
+				}
+			}
+
+			for (unsigned int a = adjacencyOffsets[to]; a < adjacencyOffsets[to + 1]; a++)
+			{
+				const unsigned int *triangle = &result[adjacency[a] * 3];
+				unsigned int shared = 0;
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int position = positionId[triangle[k]];
+					if (std::find(fromNeighbours.begin(), fromNeighbours.end(), position) == fromNeighbours.end())
+						continue;
+					if (std::find(edgeOpposites.begin(), edgeOpposites.end(), position) == edgeOpposites.end())
+						return true;
+					shared++;
+				}
+				if (shared == 2) // One of from's triangles would land on top of this one.
+					return true;
+			}
+			return false;
+		};
+
+		// Everything around a collapse is left alone for the rest of the pass, so the checks above stay valid.
+		auto touch = [&](unsigned int vertex)
+		{
+			for (unsigned int a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+			{
+				const unsigned int *triangle = &result[adjacency[a] * 3];
+				collapsed[triangle[0]] = collapsed[triangle[1]] = collapsed[triangle[2]] = 1;
+			}
+		};
+
+		// Take the cheapest collapses that don't touch each other, about enough to reach the target.
+		std::iota(remap.begin(), remap.end(), 0u);
+		std::fill(collapsed.begin(), collapsed.end(), (unsigned char)0);
+		size_t collapseLimit = (result.size() - targetIndexCount) / 6 + 1; // Each one removes around two triangles.
+		size_t collapseCount = 0;
+		for (const Collapse &collapse : candidates)
+		{
+			if (collapse.cost > maxError || collapseCount >= collapseLimit)
+				break;
+			if (collapsed[collapse.from] || collapsed[collapse.to] || flips(collapse.from, collapse.to) || pinches(collapse.from, collapse.to))
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[positionId[collapse.to]].Add(quadrics[positionId[collapse.from]]);
+			touch(collapse.from);
+			touch(collapse.to);
+			resultError = std::max(resultError, collapse.cost);
+			collapseCount++;
+		}
+		if (collapseCount == 0)
+			break;
+
+		// Apply them and drop the triangles that collapsed.
+		size_t write = 0;
+		for (size_t i = 0; i < triangleCount; i++)
+		{
+			unsigned int a = remap[result[i * 3 + 0]], b = remap[result[i * 3 + 1]], c = remap[result[i * 3 + 2]];
+			if (positionId[a] == positionId[b] || positionId[b] == positionId[c] || positionId[a] == positionId[c]) // Includes slivers between seam copies.
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return resultError;
+}
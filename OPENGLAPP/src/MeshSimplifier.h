@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+// Quadric error edge collapse simplifier. Vertices only ever collapse onto one of their neighbours, so the result
+// is a new index list over the same vertex buffer and every level of detail can share it.
+class MeshSimplifier
+{
+public:
+	// Simplifies until the index count drops to targetIndexCount or the next collapse would cost more than maxError.
+	// Error is a distance in model units, made up of the quadric error plus how far the normals and texture
+	// coordinates get dragged, scaled by attributeWeight. Open borders can only slide along themselves and vertices
+	// on texture seams are kept, as is any vertex with a non-zero lockedVertices entry. Returns the largest error of
+	// any collapse made.
+	static float Simplify(const Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount,
+		size_t targetIndexCount, float maxError, std::vector<unsigned int> &result, float attributeWeight = 1.0f,
+		const unsigned char *lockedVertices = nullptr);
+
+};
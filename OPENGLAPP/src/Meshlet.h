@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Common.h"
+
+// A cluster of at most MeshletBuilder::kMaxVertices vertices and kMaxTriangles triangles, stored as a contiguous
+// range of its mesh's index buffer. The bounds are in the mesh's local space.
+struct Meshlet
+{
+	glm::vec3 center; // Bounding sphere.
+	float radius;
+	glm::vec3 coneAxis; // Average facing of the triangles.
+	float coneCutoff; // Sine of the cone's half angle, 1 if the triangles face too many ways to ever be back facing.
+	unsigned int firstIndex;
+	unsigned int triangleCount;
+};
+
+// Layout glMultiDrawElementsIndirect reads from the draw indirect buffer.
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
@@ -0,0 +1,284 @@
+#include "MeshletBuilder.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cfloat>
+
+namespace
+{
+	const float kMinConeDot = 0.1f; // Cones wider than this are never back facing from anywhere, don't bother testing them.
+	const size_t kCullBatch = 1024; // Meshlets per culling task.
+
+	const unsigned int kNoTriangle = UINT_MAX;
+
+	// Sphere and normal cone of one meshlet's triangles.
+	void ComputeBounds(const Mesh::Vertex *vertices, const unsigned int *indices, Meshlet &meshlet)
+	{
+		const unsigned int *triangles = indices + meshlet.firstIndex;
+		unsigned int cornerCount = meshlet.triangleCount * 3;
+
+		glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+		for (unsigned int i = 0; i < cornerCount; i++)
+		{
+			glm::vec3 position = glm::vec3(vertices[triangles[i]].position);
+			minimum = glm::min(minimum, position);
+			maximum = glm::max(maximum, position);
+		}
+		meshlet.center = (minimum + maximum) * 0.5f;
+
+		float radiusSquared = 0.0f;
+		for (unsigned int i = 0; i < cornerCount; i++)
+		{
+			glm::vec3 offset = glm::vec3(vertices[triangles[i]].position) - meshlet.center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		meshlet.radius = std::sqrt(radiusSquared);
+
+		// Face normals, pointed the same way as the vertex normals so the result doesn't depend on winding.
+		auto faceNormal = [&](unsigned int t, glm::vec3 &normal)
+		{
+			const Mesh::Vertex &a = vertices[triangles[t * 3 + 0]];
+			const Mesh::Vertex &b = vertices[triangles[t * 3 + 1]];
+			const Mesh::Vertex &c = vertices[triangles[t * 3 + 2]];
+			normal = glm::cross(glm::vec3(b.position - a.position), glm::vec3(c.position - a.position));
+			float length = glm::length(normal);
+			if (length <= 0.0f)
+				return false;
+			normal /= length;
+			if (glm::dot(normal, glm::vec3(a.normal + b.normal + c.normal)) < 0.0f)
+				normal = -normal;
+			return true;
+		};
+
+		unsigned int faceCount = 0;
+		glm::vec3 axis(0.0f), normal;
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+		{
+			if (faceNormal(t, normal))
+			{
+				axis += normal;
+				faceCount++;
+			}
+		}
+
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		float axisLength = glm::length(axis);
+		if (faceCount == 0 || axisLength <= 0.0f)
+			return;
+
+		axis /= axisLength;
+		float minimumDot = 1.0f;
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+		{
+			if (faceNormal(t, normal))
+				minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+		}
+
+		meshlet.coneAxis = axis;
+		if (minimumDot > kMinConeDot)
+			meshlet.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+	}
+}
+
+void MeshletBuilder::Build(const Mesh::Vertex *vertices, unsigned int vertexCount, unsigned int *indices, size_t indexCount, std::vector<Meshlet> &meshlets,
+	unsigned int maxVertices, unsigned int maxTriangles)
+{
+	meshlets.clear();
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return;
+
+	// Triangles around each vertex.
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacencyOffsets[indices[i] + 1]++;
+	for (unsigned int v = 0; v < vertexCount; v++)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	{
+		std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<bool> used(triangleCount, false);
+	std::vector<unsigned int> liveTriangles(vertexCount); // Unused triangles left around each vertex.
+	for (unsigned int v = 0; v < vertexCount; v++)
+		liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+	std::vector<unsigned int> vertexMeshlet(vertexCount, UINT_MAX); // Which meshlet last took each vertex.
+	std::vector<unsigned int> reordered;
+	reordered.reserve(triangleCount * 3);
+
+	std::vector<unsigned int> meshletVertices(maxVertices);
+	unsigned int meshletVertexCount = 0;
+	unsigned int meshletTriangleCount = 0;
+	unsigned int meshletIndex = 0;
+	size_t scanCursor = 0;
+
+	// How many vertices a triangle would add to the current meshlet.
+	auto newVertices = [&](unsigned int triangle)
+	{
+		unsigned int count = 0;
+		for (int i = 0; i < 3; i++)
+			count += vertexMeshlet[indices[triangle * 3 + i]] != meshletIndex;
+		return count;
+	};
+
+	// Best unused neighbour of the given vertices, the one that adds the fewest new vertices.
+	auto bestNeighbour = [&](const unsigned int *candidates, unsigned int candidateCount)
+	{
+		unsigned int best = kNoTriangle, bestScore = 4;
+		for (unsigned int c = 0; c < candidateCount && bestScore > 0; c++)
+		{
+			unsigned int vertex = candidates[c];
+			if (liveTriangles[vertex] == 0)
+				continue;
+			for (unsigned int a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+			{
+				unsigned int triangle = adjacency[a];
+				if (used[triangle])
+					continue;
+				unsigned int score = newVertices(triangle);
+				if (score < bestScore)
+				{
+					best = triangle;
+					bestScore = score;
+					if (score == 0)
+						break;
+				}
+			}
+		}
+		return best;
+	};
+
+	auto finishMeshlet = [&]()
+	{
+		Meshlet meshlet = {};
+		meshlet.firstIndex = (unsigned int)(reordered.size() - meshletTriangleCount * 3);
+		meshlet.triangleCount = meshletTriangleCount;
+		meshlets.push_back(meshlet);
+
+		meshletIndex++;
+		meshletVertexCount = 0;
+		meshletTriangleCount = 0;
+	};
+
+	for (size_t emitted = 0; emitted < triangleCount; emitted++)
+	{
+		// Grow with whichever neighbour adds the fewest vertices, or start somewhere new.
+		unsigned int triangle = kNoTriangle;
+		if (meshletVertexCount > 0)
+			triangle = bestNeighbour(meshletVertices.data(), meshletVertexCount);
+		bool connected = triangle != kNoTriangle;
+		if (!connected)
+		{
+			while (used[scanCursor])
+				scanCursor++;
+			triangle = (unsigned int)scanCursor;
+		}
+
+		// Don't let a meshlet jump to a disconnected triangle, its bounds would cover everything in between.
+		if (meshletTriangleCount > 0 && (!connected || meshletVertexCount + newVertices(triangle) > maxVertices || meshletTriangleCount + 1 > maxTriangles))
+			finishMeshlet();
+
+		for (int i = 0; i < 3; i++)
+		{
+			unsigned int vertex = indices[triangle * 3 + i];
+			if (vertexMeshlet[vertex] != meshletIndex)
+			{
+				vertexMeshlet[vertex] = meshletIndex;
+				meshletVertices[meshletVertexCount++] = vertex;
+			}
+			reordered.push_back(vertex);
+			liveTriangles[vertex]--;
+		}
+		used[triangle] = true;
+		meshletTriangleCount++;
+	}
+	if (meshletTriangleCount > 0)
+		finishMeshlet();
+
+	std::copy(reordered.begin(), reordered.end(), indices);
+
+	ThreadPool::Get().ParallelFor(meshlets.size(), 256, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			ComputeBounds(vertices, indices, meshlets[i]);
+	});
+}
+
+MeshletBuilder::Frustum MeshletBuilder::MakeFrustum(const glm::mat4 &mvp)
+{
+	Frustum frustum;
+
+	// Frustum planes in the mesh's local space, straight out of the rows of the matrix.
+	glm::vec4 rows[4] = { glm::row(mvp, 0), glm::row(mvp, 1), glm::row(mvp, 2), glm::row(mvp, 3) };
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[3] + rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+	for (glm::vec4 &plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	// The camera is the local point that lands on (0, 0, z, 0) in clip space. Orthographic cameras have it at
+	// infinity, so skip the cone test for those.
+	glm::vec4 eye = glm::inverse(mvp) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	frustum.testCones = std::fabs(eye.w) > 1e-6f;
+	frustum.cameraPosition = frustum.testCones ? glm::vec3(eye) / eye.w : glm::vec3(0.0f);
+	return frustum;
+}
+
+bool MeshletBuilder::IsVisible(const Frustum &frustum, const Meshlet &meshlet)
+{
+	for (int p = 0; p < 6; p++)
+	{
+		if (glm::dot(glm::vec3(frustum.planes[p]), meshlet.center) + frustum.planes[p].w < -meshlet.radius)
+			return false;
+	}
+
+	if (frustum.testCones && meshlet.coneCutoff < 1.0f)
+	{
+		glm::vec3 view = meshlet.center - frustum.cameraPosition;
+		return glm::dot(view, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(view) + meshlet.radius;
+	}
+	return true;
+}
+
+unsigned int MeshletBuilder::Cull(const std::vector<Meshlet> &meshlets, const glm::mat4 &mvp, std::vector<DrawElementsIndirectCommand> &commands)
+{
+	commands.clear();
+	if (meshlets.empty())
+		return 0;
+
+	Frustum frustum = MakeFrustum(mvp);
+	std::vector<unsigned char> visible(meshlets.size());
+	ThreadPool::Get().ParallelFor(meshlets.size(), kCullBatch, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			visible[i] = IsVisible(frustum, meshlets[i]) ? 1 : 0;
+	});
+
+	// Neighbouring meshlets are contiguous in the index buffer, so visible runs merge into one command.
+	unsigned int visibleCount = 0;
+	for (size_t i = 0; i < meshlets.size(); i++)
+	{
+		if (!visible[i])
+			continue;
+		visibleCount++;
+
+		const Meshlet &meshlet = meshlets[i];
+		if (!commands.empty() && i > 0 && visible[i - 1])
+		{
+			commands.back().count += meshlet.triangleCount * 3;
+			continue;
+		}
+		commands.push_back({ meshlet.triangleCount * 3, 1, meshlet.firstIndex, 0, 0 });
+	}
+	return visibleCount;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "Meshlet.h"
+
+// Splits a mesh into meshlets at import and culls them against the camera each frame.
+class MeshletBuilder
+{
+public:
+	static const unsigned int kMaxVertices = 64;
+	static const unsigned int kMaxTriangles = 124;
+
+	// Frustum planes and camera position in a mesh's local space.
+	struct Frustum
+	{
+		glm::vec4 planes[6];
+		glm::vec3 cameraPosition;
+		bool testCones; // False for orthographic cameras, which have no position to test against.
+	};
+
+public:
+	// Groups neighbouring triangles into meshlets, reordering indices so each meshlet's triangles are contiguous.
+	// The limits can be raised for clusters that are never going to be fed to a mesh shader.
+	static void Build(const Mesh::Vertex *vertices, unsigned int vertexCount, unsigned int *indices, size_t indexCount, std::vector<Meshlet> &meshlets,
+		unsigned int maxVertices = kMaxVertices, unsigned int maxTriangles = kMaxTriangles);
+
+	// Writes a draw command per run of visible meshlets, dropping any outside the frustum or facing away from the camera.
+	// mvp takes the mesh's local space to clip space. Returns the number of meshlets that survived.
+	static unsigned int Cull(const std::vector<Meshlet> &meshlets, const glm::mat4 &mvp, std::vector<DrawElementsIndirectCommand> &commands);
+
+	// The same tests for one meshlet at a time, for callers that build their own draw commands.
+	static Frustum MakeFrustum(const glm::mat4 &mvp);
+	static bool IsVisible(const Frustum &frustum, const Meshlet &meshlet);
+
+};
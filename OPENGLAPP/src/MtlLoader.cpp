@@ -0,0 +1,126 @@
+#include "MtlLoader.h"
+
+#include "MappedFile.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+	inline bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline const char *SkipSpaces(const char *p, const char *end)
+	{
+		while (p < end && IsSpace(*p))
+			p++;
+		return p;
+	}
+
+	// Compares the keyword at p, which has to be followed by whitespace or the end of the line.
+	inline bool MatchKeyword(const char *p, const char *end, const char *keyword, size_t length)
+	{
+		return (size_t)(end - p) >= length && std::memcmp(p, keyword, length) == 0 && (p + length == end || IsSpace(p[length]));
+	}
+
+	inline void ParseFloats(const char *p, const char *end, float *values, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			p = SkipSpaces(p, end);
+			if (p < end && *p == '+') // from_chars doesn't accept a leading plus.
+				p++;
+			std::from_chars_result result = std::from_chars(p, end, values[i]);
+			if (result.ec != std::errc())
+				return;
+			p = result.ptr;
+		}
+	}
+
+	// The rest of the line with surrounding whitespace trimmed.
+	inline std::string ParseRest(const char *p, const char *end)
+	{
+		p = SkipSpaces(p, end);
+		while (end > p && IsSpace(end[-1]))
+			end--;
+		return std::string(p, end);
+	}
+
+	// Map statements can put options before the file name ("bump -bm 0.5 normal.tga"), it's always the last token.
+	inline std::string ParseMapPath(const char *p, const char *end, const std::string &directory)
+	{
+		while (end > p && IsSpace(end[-1]))
+			end--;
+		const char *name = end;
+		while (name > p && !IsSpace(name[-1]))
+			name--;
+		return name < end ? directory + std::string(name, end) : std::string();
+	}
+}
+
+bool MtlLoader::Load(const char *filePath, std::vector<MaterialDefinition> &materials)
+{
+	materials.clear();
+
+	MappedFile file;
+	if (!file.Open(filePath))
+		return false;
+
+	std::string directory(filePath);
+	size_t slash = directory.find_last_of("/\\");
+	directory = (slash != std::string::npos) ? directory.substr(0, slash + 1) : "";
+
+	const char *p = file.GetData();
+	const char *fileEnd = p + file.GetSize();
+	bool implicitMaterial = false; // The last material hasn't had a newmtl yet.
+	while (p < fileEnd)
+	{
+		const char *lineEnd = (const char *)std::memchr(p, '\n', fileEnd - p);
+		if (lineEnd == nullptr)
+			lineEnd = fileEnd;
+
+		const char *keyword = SkipSpaces(p, lineEnd);
+		const char *keywordEnd = keyword;
+		while (keywordEnd < lineEnd && !IsSpace(*keywordEnd))
+			keywordEnd++;
+		p = lineEnd + (lineEnd < fileEnd ? 1 : 0);
+
+		if (keyword == keywordEnd || *keyword == '#')
+			continue;
+
+		if (MatchKeyword(keyword, lineEnd, "newmtl", 6))
+		{
+			if (!implicitMaterial) // Anything given before the first newmtl goes to it.
+				materials.emplace_back();
+			materials.back().name = ParseRest(keywordEnd, lineEnd);
+			implicitMaterial = false;
+			continue;
+		}
+
+		if (materials.empty()) // Older files leave out newmtl when there's only one material.
+		{
+			materials.emplace_back();
+			implicitMaterial = true;
+		}
+		MaterialDefinition &material = materials.back();
+
+		if (MatchKeyword(keyword, lineEnd, "Ka", 2)) // Ambient colour
+			ParseFloats(keywordEnd, lineEnd, &material.Ka.x, 3);
+		else if (MatchKeyword(keyword, lineEnd, "Kd", 2)) // Diffuse colour
+			ParseFloats(keywordEnd, lineEnd, &material.Kd.x, 3);
+		else if (MatchKeyword(keyword, lineEnd, "Ks", 2)) // Specular colour
+			ParseFloats(keywordEnd, lineEnd, &material.Ks.x, 3);
+		else if (MatchKeyword(keyword, lineEnd, "Ns", 2)) // Specular power.
+			ParseFloats(keywordEnd, lineEnd, &material.specular, 1);
+		else if (MatchKeyword(keyword, lineEnd, "map_Kd", 6)) // Diffuse texture.
+			material.mapKd = ParseMapPath(keywordEnd, lineEnd, directory);
+		else if (MatchKeyword(keyword, lineEnd, "map_Ks", 6)) // Specular texture.
+			material.mapKs = ParseMapPath(keywordEnd, lineEnd, directory);
+		else if (MatchKeyword(keyword, lineEnd, "bump", 4) || MatchKeyword(keyword, lineEnd, "map_bump", 8) || MatchKeyword(keyword, lineEnd, "map_Bump", 8)) // Bump/normal texture.
+			material.mapBump = ParseMapPath(keywordEnd, lineEnd, directory);
+	}
+
+	return true;
+}
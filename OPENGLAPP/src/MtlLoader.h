@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Common.h"
+
+// Wavefront .mtl reader. The file is memory mapped and read in one pass, each newmtl starts a new material.
+class MtlLoader
+{
+public:
+	struct MaterialDefinition
+	{
+		std::string name; // Empty for properties given before the first newmtl.
+		float specular = 1.0f;
+		glm::vec3 Ka = { 1.0f, 1.0f, 1.0f };
+		glm::vec3 Kd = { 1.0f, 1.0f, 1.0f };
+		glm::vec3 Ks = { 1.0f, 1.0f, 1.0f };
+		std::string mapKd; // Paths already joined onto the .mtl's directory, empty if not given.
+		std::string mapKs;
+		std::string mapBump;
+	};
+
+public:
+	// Returns false if the file can't be read. Statements it doesn't use (illum, d, Ni...) are skipped.
+	static bool Load(const char *filePath, std::vector<MaterialDefinition> &materials);
+
+};
@@ -0,0 +1,416 @@
+#include "ObjLoader.h"
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <charconv>
+#include <algorithm>
+#include <climits>
+#include <atomic>
+#include <string>
+
+namespace
+{
+	const int kMissingIndex = INT_MIN; // Corner has no vt/vn.
+	const size_t kMinChunkSize = 1 << 20; // Don't bother splitting files smaller than this per thread.
+
+	enum RelativeFlags : unsigned char
+	{
+		RELATIVE_V = 1 << 0,
+		RELATIVE_VT = 1 << 1,
+		RELATIVE_VN = 1 << 2,
+	};
+
+	// A face corner as 0-based indices. Relative (negative) file indices are stored relative to the start of
+	// the chunk and flagged, they get the chunk's base offsets added once every chunk has been counted.
+	struct ObjCorner
+	{
+		int v, vt, vn;
+		unsigned char relative;
+	};
+
+	// Everything one thread pulled out of its slice of the file.
+	struct ObjChunk
+	{
+		const char *begin = nullptr;
+		const char *end = nullptr;
+
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+		std::vector<ObjCorner> corners; // Already triangulated, three per triangle.
+		std::vector<std::string> materials; // Distinct usemtl names seen.
+
+		size_t positionBase = 0, texCoordBase = 0, normalBase = 0; // Global offsets, filled in after parsing.
+		bool failed = false;
+	};
+
+	inline const char *SkipSpaces(const char *p, const char *end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	inline const char *SkipLine(const char *p, const char *end)
+	{
+		while (p < end && *p != '\n')
+			p++;
+		return p < end ? p + 1 : end;
+	}
+
+	inline bool ParseFloat(const char *&p, const char *end, float &value)
+	{
+		p = SkipSpaces(p, end);
+		if (p < end && *p == '+') // from_chars doesn't accept a leading plus.
+			p++;
+		std::from_chars_result result = std::from_chars(p, end, value);
+		if (result.ec != std::errc())
+			return false;
+		p = result.ptr;
+		return true;
+	}
+
+	inline bool ParseInt(const char *&p, const char *end, int &value)
+	{
+		std::from_chars_result result = std::from_chars(p, end, value);
+		if (result.ec != std::errc())
+			return false;
+		p = result.ptr;
+		return true;
+	}
+
+	// Converts a 1-based (or negative, relative) file index to our stored form, see ObjCorner.
+	inline int EncodeIndex(int index, size_t localCount, unsigned char flag, unsigned char &relative)
+	{
+		if (index > 0)
+			return index - 1;
+		relative |= flag;
+		return (int)localCount + index; // May point back into an earlier chunk, so can go negative.
+	}
+
+	inline bool ResolveIndex(int &index, bool relative, size_t base, size_t count)
+	{
+		if (index == kMissingIndex)
+			return true;
+		if (relative)
+			index += (int)base;
+		return index >= 0 && (size_t)index < count;
+	}
+
+	bool ParseCorner(const char *&p, const char *end, const ObjChunk &chunk, ObjCorner &corner)
+	{
+		int value = 0;
+		corner.relative = 0;
+		if (!ParseInt(p, end, value) || value == 0)
+			return false;
+		corner.v = EncodeIndex(value, chunk.positions.size(), RELATIVE_V, corner.relative);
+		corner.vt = kMissingIndex;
+		corner.vn = kMissingIndex;
+
+		if (p < end && *p == '/')
+		{
+			p++;
+			if (p < end && *p != '/') // v/vt
+			{
+				if (!ParseInt(p, end, value) || value == 0)
+					return false;
+				corner.vt = EncodeIndex(value, chunk.texCoords.size(), RELATIVE_VT, corner.relative);
+			}
+			if (p < end && *p == '/') // v/vt/vn or v//vn
+			{
+				p++;
+				if (!ParseInt(p, end, value) || value == 0)
+					return false;
+				corner.vn = EncodeIndex(value, chunk.normals.size(), RELATIVE_VN, corner.relative);
+			}
+		}
+		return true;
+	}
+
+	void ParseChunk(ObjChunk &chunk)
+	{
+		const char *p = chunk.begin;
+		const char *end = chunk.end;
+
+		ObjCorner polygon[2]; // Fan anchor and the previous corner.
+		while (p < end)
+		{
+			p = SkipSpaces(p, end);
+			if (p >= end)
+				break;
+
+			if (p[0] == 'v' && p + 1 < end)
+			{
+				if (p[1] == ' ' || p[1] == '\t') // Position.
+				{
+					p += 2;
+					glm::vec3 position;
+					if (!ParseFloat(p, end, position.x) || !ParseFloat(p, end, position.y) || !ParseFloat(p, end, position.z))
+					{
+						chunk.failed = true;
+						return;
+					}
+					chunk.positions.push_back(position);
+				}
+				else if (p[1] == 't') // Texture coordinate.
+				{
+					p += 2;
+					glm::vec2 texCoord(0.0f);
+					if (!ParseFloat(p, end, texCoord.x))
+					{
+						chunk.failed = true;
+						return;
+					}
+					ParseFloat(p, end, texCoord.y); // v is optional.
+					chunk.texCoords.push_back(texCoord);
+				}
+				else if (p[1] == 'n') // Normal.
+				{
+					p += 2;
+					glm::vec3 normal;
+					if (!ParseFloat(p, end, normal.x) || !ParseFloat(p, end, normal.y) || !ParseFloat(p, end, normal.z))
+					{
+						chunk.failed = true;
+						return;
+					}
+					chunk.normals.push_back(normal);
+				}
+			}
+			else if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t')) // Face.
+			{
+				p += 2;
+				int cornerCount = 0;
+				while (true)
+				{
+					p = SkipSpaces(p, end);
+					if (p >= end || *p == '\r' || *p == '\n' || *p == '#')
+						break;
+
+					ObjCorner corner;
+					if (!ParseCorner(p, end, chunk, corner))
+					{
+						chunk.failed = true;
+						return;
+					}
+
+					// Triangulate as a fan, with the same 0, 2, 1 winding the assimp path uses.
+					if (cornerCount < 2)
+					{
+						polygon[cornerCount] = corner;
+					}
+					else
+					{
+						chunk.corners.push_back(polygon[0]);
+						chunk.corners.push_back(corner);
+						chunk.corners.push_back(polygon[1]);
+						polygon[1] = corner;
+					}
+					cornerCount++;
+				}
+			}
+
+			else if (end - p > 7 && std::equal(p, p + 6, "usemtl") && (p[6] == ' ' || p[6] == '\t')) // Material switch.
+			{
+				const char *name = SkipSpaces(p + 7, end);
+				const char *nameEnd = name;
+				while (nameEnd < end && *nameEnd != '\r' && *nameEnd != '\n')
+					nameEnd++;
+				std::string material(name, nameEnd);
+				if (std::find(chunk.materials.begin(), chunk.materials.end(), material) == chunk.materials.end())
+					chunk.materials.push_back(material);
+			}
+
+			p = SkipLine(p, end); // Comments, groups, smoothing groups etc. are ignored.
+		}
+	}
+}
+
+bool ObjLoader::Load(const char *filePath, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, bool *multipleMaterials)
+{
+	if (multipleMaterials)
+		*multipleMaterials = false;
+
+	MappedFile file;
+	if (!file.Open(filePath))
+		return false;
+
+	const char *data = file.GetData();
+	const char *dataEnd = data + file.GetSize();
+
+	// Split the file into line aligned chunks, one per thread.
+	ThreadPool &pool = ThreadPool::Get();
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.GetThreadCount() + 1, (size_t)file.GetSize() / kMinChunkSize));
+	std::vector<ObjChunk> chunks(chunkCount);
+	const char *chunkBegin = data;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char *chunkEnd = (i == chunkCount - 1) ? dataEnd : data + (file.GetSize() * (i + 1)) / chunkCount;
+		if (chunkEnd < chunkBegin)
+			chunkEnd = chunkBegin;
+		while (chunkEnd < dataEnd && chunkEnd[-1] != '\n')
+			chunkEnd++;
+
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	pool.ParallelFor(chunkCount, 1, [&chunks](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			ParseChunk(chunks[i]);
+	});
+
+	// Work out where each chunk's elements land in the merged streams.
+	size_t positionCount = 0, texCoordCount = 0, normalCount = 0, cornerCount = 0;
+	std::vector<std::string> materials;
+	for (ObjChunk &chunk : chunks)
+	{
+		if (chunk.failed)
+			return false;
+
+		for (const std::string &material : chunk.materials)
+		{
+			if (std::find(materials.begin(), materials.end(), material) == materials.end())
+				materials.push_back(material);
+		}
+		if (materials.size() > 1) // We only build a single submesh, leave multi material files to assimp.
+		{
+			if (multipleMaterials)
+				*multipleMaterials = true;
+			return false;
+		}
+
+		chunk.positionBase = positionCount;
+		chunk.texCoordBase = texCoordCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positions.size();
+		texCoordCount += chunk.texCoords.size();
+		normalCount += chunk.normals.size();
+		cornerCount += chunk.corners.size();
+	}
+
+	if (cornerCount == 0 || positionCount == 0 || positionCount > (size_t)INT_MAX)
+		return false;
+
+	std::vector<glm::vec3> positions(positionCount);
+	std::vector<glm::vec2> texCoords(texCoordCount);
+	std::vector<glm::vec3> normals(normalCount);
+	std::vector<ObjCorner> corners(cornerCount);
+
+	std::vector<size_t> cornerBases(chunkCount);
+	for (size_t i = 0, base = 0; i < chunkCount; i++)
+	{
+		cornerBases[i] = base;
+		base += chunks[i].corners.size();
+	}
+
+	// Merge the streams and resolve relative indices in parallel.
+	std::atomic<bool> indicesValid(true);
+	pool.ParallelFor(chunkCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			ObjChunk &chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+			std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + chunk.texCoordBase);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+
+			ObjCorner *out = corners.data() + cornerBases[i];
+			for (const ObjCorner &corner : chunk.corners)
+			{
+				ObjCorner resolved = corner;
+				if (!ResolveIndex(resolved.v, (corner.relative & RELATIVE_V) != 0, chunk.positionBase, positionCount) ||
+					!ResolveIndex(resolved.vt, (corner.relative & RELATIVE_VT) != 0, chunk.texCoordBase, texCoordCount) ||
+					!ResolveIndex(resolved.vn, (corner.relative & RELATIVE_VN) != 0, chunk.normalBase, normalCount))
+				{
+					indicesValid.store(false, std::memory_order_relaxed); // Only ever written false, the join orders it.
+				}
+				*out++ = resolved;
+			}
+
+			chunk.positions = std::vector<glm::vec3>(); // Free as we go, these can be big.
+			chunk.texCoords = std::vector<glm::vec2>();
+			chunk.normals = std::vector<glm::vec3>();
+			chunk.corners = std::vector<ObjCorner>();
+		}
+	});
+
+	if (!indicesValid.load(std::memory_order_relaxed))
+		return false;
+
+	// Weld identical v/vt/vn triplets. Corners sharing a position are chained off it, so the lookup only ever
+	// compares against the handful of vertices that split on a seam.
+	std::vector<int> firstVertex(positionCount, -1);
+	std::vector<int> nextVertex;
+	std::vector<ObjCorner> vertexKeys;
+	nextVertex.reserve(positionCount);
+	vertexKeys.reserve(positionCount);
+
+	indices.resize(cornerCount);
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		const ObjCorner &corner = corners[i];
+
+		int vertex = firstVertex[corner.v];
+		while (vertex != -1 && (vertexKeys[vertex].vt != corner.vt || vertexKeys[vertex].vn != corner.vn))
+			vertex = nextVertex[vertex];
+
+		if (vertex == -1)
+		{
+			vertex = (int)vertexKeys.size();
+			vertexKeys.push_back(corner);
+			nextVertex.push_back(firstVertex[corner.v]);
+			firstVertex[corner.v] = vertex;
+		}
+		indices[i] = (unsigned int)vertex;
+	}
+
+	// Build the GPU vertices.
+	size_t vertexCount = vertexKeys.size();
+	vertices.resize(vertexCount);
+	pool.ParallelFor(vertexCount, 1 << 16, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const ObjCorner &key = vertexKeys[i];
+			Mesh::Vertex &vertex = vertices[i];
+			vertex.position = glm::vec4(positions[key.v], 1.0f);
+
+			if (key.vn != kMissingIndex)
+				vertex.normal = glm::vec4(normals[key.vn], 0.0f);
+			else
+				vertex.normal = glm::vec4(0.0f); // Generated below.
+
+			if (key.vt != kMissingIndex) // Flip v to match the assimp path.
+				vertex.texCoord = glm::vec2(texCoords[key.vt].x, 1.0f - texCoords[key.vt].y);
+			else
+				vertex.texCoord = glm::vec2(0.0f);
+
+			vertex.tangent = glm::vec4(0.0f);
+		}
+	});
+
+	bool hasNormals = std::all_of(vertexKeys.begin(), vertexKeys.end(), [](const ObjCorner &key) { return key.vn != kMissingIndex; });
+	if (!hasNormals) // Generate smooth normals, weighted by face area.
+	{
+		for (size_t i = 0; i < cornerCount; i += 3)
+		{
+			Mesh::Vertex &a = vertices[indices[i + 0]];
+			Mesh::Vertex &b = vertices[indices[i + 1]];
+			Mesh::Vertex &c = vertices[indices[i + 2]];
+			glm::vec3 normal = glm::cross(glm::vec3(c.position - a.position), glm::vec3(b.position - a.position)); // Stored winding is 0, 2, 1.
+			if (vertexKeys[indices[i + 0]].vn == kMissingIndex) a.normal += glm::vec4(normal, 0.0f);
+			if (vertexKeys[indices[i + 1]].vn == kMissingIndex) b.normal += glm::vec4(normal, 0.0f);
+			if (vertexKeys[indices[i + 2]].vn == kMissingIndex) c.normal += glm::vec4(normal, 0.0f);
+		}
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			if (vertexKeys[i].vn == kMissingIndex && glm::dot(vertices[i].normal, vertices[i].normal) > 0.0f)
+				vertices[i].normal = glm::normalize(vertices[i].normal);
+		}
+	}
+
+	return true;
+}
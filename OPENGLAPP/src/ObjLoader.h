@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+// Native Wavefront .obj reader, a fast path beside assimp for our main interchange format.
+// The file is memory mapped and split into line aligned chunks that are parsed on the thread pool.
+class ObjLoader
+{
+public:
+	// Parses positions, texture coordinates, normals and faces into welded vertices, polygons are triangulated as a fan.
+	// Returns false if the file can't be read or isn't something we understand, so the caller can fall back to assimp.
+	// Files that switch between more than one material also return false, with multipleMaterials set.
+	static bool Load(const char *filePath, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices, bool *multipleMaterials = nullptr);
+
+};
@@ -0,0 +1,191 @@
+#include "OcclusionBaker.h"
+
+#include "ThreadPool.h"
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+
+const float OcclusionBaker::kMaxDistance = 0.25f;
+
+namespace
+{
+	const size_t kVerticesPerTask = 256;
+	const float kBias = 1e-4f; // Ray origins are pushed off the surface by this much of the bounds' diagonal.
+
+	const uint32_t kCacheMagic = 0x43434F41; // "AOCC"
+	const uint32_t kCacheVersion = 1;
+
+	// Followed by a byte per vertex.
+	struct CacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t rayCount; // Settings it was baked with.
+		float maxDistance;
+		uint64_t count;
+	};
+
+	// Van der Corput sequence, the second coordinate of the Hammersley points.
+	float RadicalInverse(uint32_t bits)
+	{
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return (float)bits * 2.3283064365386963e-10f;
+	}
+
+	// Hashes the vertex index to an angle, so neighbouring vertices turn the same set of rays by different amounts
+	// and don't all miss the same gaps.
+	float Rotation(uint32_t vertex)
+	{
+		vertex ^= vertex >> 16u;
+		vertex *= 0x7FEB352Du;
+		vertex ^= vertex >> 15u;
+		vertex *= 0x846CA68Bu;
+		vertex ^= vertex >> 16u;
+		return (float)vertex * 2.3283064365386963e-10f * glm::two_pi<float>();
+	}
+}
+
+bool OcclusionBaker::Bake(Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || triangleCount > kMaxTriangles)
+		return false;
+
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	std::vector<glm::vec3> positions(triangleCount * 3);
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		positions[i] = glm::vec3(vertices[indices[i]].position);
+		minimum = glm::min(minimum, positions[i]);
+		maximum = glm::max(maximum, positions[i]);
+	}
+	float diagonal = glm::length(maximum - minimum);
+	if (diagonal <= 0.0f)
+		return false;
+
+	TriangleBvh bvh;
+	bvh.Build(std::move(positions));
+
+	// Cosine-weighted directions about +z: Hammersley points on the disc, projected up onto the hemisphere.
+	glm::vec3 directions[kRayCount];
+	for (unsigned int i = 0; i < kRayCount; i++)
+	{
+		float radius = std::sqrt(RadicalInverse(i)), phi = glm::two_pi<float>() * (i + 0.5f) / kRayCount;
+		directions[i] = glm::vec3(radius * std::cos(phi), radius * std::sin(phi), std::sqrt(std::max(1.0f - radius * radius, 0.0f)));
+	}
+
+	float bias = diagonal * kBias, maxDistance = diagonal * kMaxDistance;
+	ThreadPool::Get().ParallelFor(vertexCount, kVerticesPerTask, [&](size_t begin, size_t end)
+	{
+		for (size_t v = begin; v < end; v++)
+		{
+			Mesh::Vertex &vertex = vertices[v];
+			glm::vec3 normal(vertex.normal);
+			float length = glm::length(normal);
+			if (length <= 0.0f) // Nothing to point the rays along.
+			{
+				vertex.normal.w = 0.0f;
+				continue;
+			}
+			normal /= length;
+
+			// Frame about the normal, turned by the vertex's own angle.
+			glm::vec3 up = std::fabs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+			glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+			glm::vec3 bitangent = glm::cross(normal, tangent);
+			float angle = Rotation((uint32_t)v), c = std::cos(angle), s = std::sin(angle);
+			glm::vec3 x = tangent * c + bitangent * s, y = bitangent * c - tangent * s;
+
+			glm::vec3 origin = glm::vec3(vertex.position) + normal * bias;
+			unsigned int hits = 0;
+			for (unsigned int i = 0; i < kRayCount; i++)
+			{
+				glm::vec3 direction = x * directions[i].x + y * directions[i].y + normal * directions[i].z;
+				if (bvh.IsOccluded(origin, direction, maxDistance))
+					hits++;
+			}
+			vertex.normal.w = (float)hits / kRayCount;
+		}
+	});
+	return true;
+}
+
+bool OcclusionBaker::BakeCached(const std::string &modelPath, Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount)
+{
+	std::vector<float> occlusion;
+	if (ReadCache(modelPath, occlusion) && occlusion.size() == vertexCount)
+	{
+		for (unsigned int v = 0; v < vertexCount; v++)
+			vertices[v].normal.w = occlusion[v];
+		return true;
+	}
+
+	if (!Bake(vertices, vertexCount, indices, indexCount))
+		return false;
+	occlusion.resize(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++)
+		occlusion[v] = vertices[v].normal.w;
+	WriteCache(modelPath, occlusion);
+	return true;
+}
+
+bool OcclusionBaker::ReadCache(const std::string &modelPath, std::vector<float> &occlusion)
+{
+	occlusion.clear();
+	std::string cachePath = GetCachePath(modelPath);
+	std::error_code error;
+	bool upToDate = std::filesystem::exists(cachePath, error) &&
+		std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(modelPath, error);
+	if (!upToDate)
+		return false;
+	uintmax_t size = std::filesystem::file_size(cachePath, error);
+
+	std::ifstream file(cachePath, std::ios::in | std::ios::binary);
+	CacheHeader header;
+	if (!file.read((char *)&header, sizeof(header)))
+		return false;
+	if (header.magic != kCacheMagic || header.version != kCacheVersion || header.rayCount != kRayCount || header.maxDistance != kMaxDistance ||
+		error || size < sizeof(header) + header.count)
+		return false;
+
+	std::vector<uint8_t> values((size_t)header.count);
+	if (!file.read((char *)values.data(), (std::streamsize)values.size()))
+		return false;
+	occlusion.resize(values.size());
+	for (size_t i = 0; i < values.size(); i++)
+		occlusion[i] = values[i] / 255.0f;
+	return true;
+}
+
+bool OcclusionBaker::WriteCache(const std::string &modelPath, const std::vector<float> &occlusion)
+{
+	std::string cachePath = GetCachePath(modelPath);
+	std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Couldn't write occlusion " << cachePath << std::endl;
+		return false;
+	}
+
+	CacheHeader header = { kCacheMagic, kCacheVersion, kRayCount, kMaxDistance, (uint64_t)occlusion.size() };
+	std::vector<uint8_t> values(occlusion.size());
+	for (size_t i = 0; i < values.size(); i++)
+		values[i] = (uint8_t)std::lround(glm::clamp(occlusion[i], 0.0f, 1.0f) * 255.0f);
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)values.data(), (std::streamsize)values.size());
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing occlusion " << cachePath << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+// Per-vertex ambient occlusion, baked at import so the lit shaders get an occlusion term without paying for it at
+// runtime. Each vertex casts cosine-weighted rays about its normal against a BVH of the mesh's own triangles, the
+// vertices split across the thread pool. Only nearby geometry counts, rays are cut short at a fraction of the mesh's
+// size so a closed mesh doesn't occlude itself completely.
+class OcclusionBaker
+{
+public:
+	static const unsigned int kRayCount = 64; // Per vertex.
+	static const unsigned int kMaxTriangles = 1 << 22; // Bigger meshes aren't baked, they'd hold up the import too long.
+	static const float kMaxDistance; // Of a ray, as a fraction of the diagonal of the mesh's bounds.
+	static const unsigned int kAttributeLocation = 6; // Where the lit shaders read it, after the skinned meshes' bones.
+
+	// Writes the fraction of rays that hit something to normal.w, 0 where the vertex is fully open. normal.w is unused
+	// otherwise, tangent.w already holds the bitangent sign. Returns false if the mesh was too big or had no triangles,
+	// leaving the vertices as they were.
+	static bool Bake(Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount);
+	// Bake, but reads the result back from the model's .ao file if it's up to date, and writes one if it isn't.
+	static bool BakeCached(const std::string &modelPath, Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount);
+
+	// Occlusion cooked next to the model it was baked for (.ao), a byte per vertex in the order they were baked, so
+	// only the first load traces anything. Read fails if the file is older than the model, damaged, or was baked with
+	// other settings. Callers check the count matches the vertices they have.
+	static std::string GetCachePath(const std::string &modelPath) { return modelPath + ".ao"; }
+	static bool ReadCache(const std::string &modelPath, std::vector<float> &occlusion);
+	static bool WriteCache(const std::string &modelPath, const std::vector<float> &occlusion);
+
+};
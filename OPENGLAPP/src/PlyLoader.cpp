@@ -0,0 +1,784 @@
+#include "PlyLoader.h"
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+namespace
+{
+	const size_t kHeaderWindow = 64 * 1024; // Headers are tiny, this is plenty.
+	const size_t kWindowSize = 64 << 20; // Bytes of the file mapped at once.
+	const size_t kVertexBatch = 1 << 16; // Vertices decoded per upload.
+	const size_t kIndexBatch = 1 << 20; // Indices per upload.
+	const size_t kAbsent = (size_t)-1;
+
+	enum PlyType
+	{
+		PLY_NONE = 0,
+		PLY_INT8,
+		PLY_UINT8,
+		PLY_INT16,
+		PLY_UINT16,
+		PLY_INT32,
+		PLY_UINT32,
+		PLY_FLOAT32,
+		PLY_FLOAT64,
+	};
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type = PLY_NONE; // Element type for lists.
+		PlyType countType = PLY_NONE; // Only for lists.
+		bool isList = false;
+		size_t offset = 0; // From the start of the record, scalars before the first list only.
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		uint64_t count = 0;
+		std::vector<PlyProperty> properties;
+		size_t stride = 0; // Fixed record size, only meaningful without lists.
+		bool hasList = false;
+	};
+
+	// Where each attribute we care about lives in a vertex record.
+	enum VertexAttribute { ATTRIB_X, ATTRIB_Y, ATTRIB_Z, ATTRIB_NX, ATTRIB_NY, ATTRIB_NZ, ATTRIB_U, ATTRIB_V, ATTRIB_RED, ATTRIB_GREEN, ATTRIB_BLUE, ATTRIB_COUNT };
+	struct VertexFormat
+	{
+		size_t stride = 0;
+		size_t offsets[ATTRIB_COUNT];
+		PlyType types[ATTRIB_COUNT];
+	};
+
+	// Face records are [scalars] list [scalars], we only need the list so the rest is skipped by size.
+	struct FaceFormat
+	{
+		size_t leadingBytes = 0;
+		size_t trailingBytes = 0;
+		PlyType countType = PLY_NONE;
+		PlyType indexType = PLY_NONE;
+	};
+
+	size_t TypeSize(PlyType type)
+	{
+		switch (type)
+		{
+			case PLY_INT8: case PLY_UINT8: return 1;
+			case PLY_INT16: case PLY_UINT16: return 2;
+			case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+			case PLY_FLOAT64: return 8;
+			default: return 0;
+		}
+	}
+
+	PlyType ParseType(const std::string &name)
+	{
+		if (name == "char" || name == "int8") return PLY_INT8;
+		if (name == "uchar" || name == "uint8") return PLY_UINT8;
+		if (name == "short" || name == "int16") return PLY_INT16;
+		if (name == "ushort" || name == "uint16") return PLY_UINT16;
+		if (name == "int" || name == "int32") return PLY_INT32;
+		if (name == "uint" || name == "uint32") return PLY_UINT32;
+		if (name == "float" || name == "float32") return PLY_FLOAT32;
+		if (name == "double" || name == "float64") return PLY_FLOAT64;
+		return PLY_NONE;
+	}
+
+	// Endian aware reads. Everything is resolved at compile time for the fast paths.
+	template<size_t Size> struct UnsignedOfSize;
+	template<> struct UnsignedOfSize<1> { using Type = uint8_t; };
+	template<> struct UnsignedOfSize<2> { using Type = uint16_t; };
+	template<> struct UnsignedOfSize<4> { using Type = uint32_t; };
+	template<> struct UnsignedOfSize<8> { using Type = uint64_t; };
+
+	inline uint8_t ByteSwap(uint8_t value) { return value; }
+	inline uint16_t ByteSwap(uint16_t value) { return (uint16_t)((value >> 8) | (value << 8)); }
+	inline uint32_t ByteSwap(uint32_t value)
+	{
+		return (value >> 24) | ((value >> 8) & 0x0000FF00u) | ((value << 8) & 0x00FF0000u) | (value << 24);
+	}
+	inline uint64_t ByteSwap(uint64_t value)
+	{
+		return ((uint64_t)ByteSwap((uint32_t)value) << 32) | ByteSwap((uint32_t)(value >> 32));
+	}
+
+	template<typename T, bool BigEndian>
+	inline T Read(const char *p)
+	{
+		typename UnsignedOfSize<sizeof(T)>::Type bits;
+		memcpy(&bits, p, sizeof(T));
+		if (BigEndian)
+			bits = ByteSwap(bits);
+		T value;
+		memcpy(&value, &bits, sizeof(T));
+		return value;
+	}
+
+	template<bool BigEndian>
+	inline double ReadScalar(PlyType type, const char *p)
+	{
+		switch (type)
+		{
+			case PLY_INT8: return (double)Read<int8_t, BigEndian>(p);
+			case PLY_UINT8: return (double)Read<uint8_t, BigEndian>(p);
+			case PLY_INT16: return (double)Read<int16_t, BigEndian>(p);
+			case PLY_UINT16: return (double)Read<uint16_t, BigEndian>(p);
+			case PLY_INT32: return (double)Read<int32_t, BigEndian>(p);
+			case PLY_UINT32: return (double)Read<uint32_t, BigEndian>(p);
+			case PLY_FLOAT32: return (double)Read<float, BigEndian>(p);
+			case PLY_FLOAT64: return Read<double, BigEndian>(p);
+			default: return 0.0;
+		}
+	}
+
+	// Integer reads for face lists. When the type is known at compile time the switch folds away.
+	template<bool BigEndian, PlyType StaticType>
+	inline int64_t ReadInteger(PlyType runtimeType, const char *p)
+	{
+		switch (StaticType != PLY_NONE ? StaticType : runtimeType)
+		{
+			case PLY_INT8: return Read<int8_t, BigEndian>(p);
+			case PLY_UINT8: return Read<uint8_t, BigEndian>(p);
+			case PLY_INT16: return Read<int16_t, BigEndian>(p);
+			case PLY_UINT16: return Read<uint16_t, BigEndian>(p);
+			case PLY_INT32: return Read<int32_t, BigEndian>(p);
+			case PLY_UINT32: return Read<uint32_t, BigEndian>(p);
+			default: return -1;
+		}
+	}
+
+	// Any vector perpendicular to the normal, scans don't have texture coordinates to derive a real tangent from.
+	inline glm::vec4 MakeTangent(const glm::vec3 &normal)
+	{
+		glm::vec3 axis = glm::abs(normal.y) < 0.99f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+		glm::vec3 tangent = glm::cross(axis, normal);
+		float length = glm::length(tangent);
+		return length > 0.0f ? glm::vec4(tangent / length, 1.0f) : glm::vec4(1, 0, 0, 1);
+	}
+
+	template<bool BigEndian, bool AllFloat>
+	inline float GetAttribute(const char *record, const VertexFormat &format, VertexAttribute attribute)
+	{
+		if (AllFloat)
+			return Read<float, BigEndian>(record + format.offsets[attribute]);
+		return (float)ReadScalar<BigEndian>(format.types[attribute], record + format.offsets[attribute]);
+	}
+
+	// Decodes vertex records into the GPU layout. Specialised on the layout so the common
+	// float xyz / normal cases compile down to straight loads.
+	template<bool BigEndian, bool HasNormals, bool HasTexCoords, bool AllFloat>
+	void DecodeVertices(const char *records, size_t count, const VertexFormat &format, Mesh::Vertex *vertices)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const char *record = records + i * format.stride;
+			Mesh::Vertex &vertex = vertices[i];
+
+			vertex.position = glm::vec4(
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_X),
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_Y),
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_Z), 1.0f);
+
+			if (HasNormals)
+			{
+				glm::vec3 normal(
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NX),
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NY),
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NZ));
+				vertex.normal = glm::vec4(normal, 0.0f);
+				vertex.tangent = MakeTangent(normal);
+			}
+			else
+			{
+				vertex.normal = glm::vec4(0.0f); // Generated from the faces later.
+				vertex.tangent = glm::vec4(0.0f);
+			}
+
+			if (HasTexCoords) // Flip v to match the assimp path.
+				vertex.texCoord = glm::vec2(GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_U), 1.0f - GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_V));
+			else
+				vertex.texCoord = glm::vec2(0.0f);
+		}
+	}
+
+	// Decodes vertex records as points. Colors are scaled from whatever range their type has to bytes.
+	template<bool BigEndian, bool AllFloat>
+	void DecodePoints(const char *records, size_t count, const VertexFormat &format, bool hasNormals, bool hasColors, float colorScale,
+		glm::vec3 *positions, glm::vec3 *normals, glm::u8vec4 *colors)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const char *record = records + i * format.stride;
+			positions[i] = glm::vec3(
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_X),
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_Y),
+				GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_Z));
+
+			if (hasNormals)
+			{
+				normals[i] = glm::vec3(
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NX),
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NY),
+					GetAttribute<BigEndian, AllFloat>(record, format, ATTRIB_NZ));
+			}
+
+			if (hasColors)
+			{
+				glm::vec3 color(
+					(float)ReadScalar<BigEndian>(format.types[ATTRIB_RED], record + format.offsets[ATTRIB_RED]),
+					(float)ReadScalar<BigEndian>(format.types[ATTRIB_GREEN], record + format.offsets[ATTRIB_GREEN]),
+					(float)ReadScalar<BigEndian>(format.types[ATTRIB_BLUE], record + format.offsets[ATTRIB_BLUE]));
+				colors[i] = glm::u8vec4(glm::clamp(color * colorScale + 0.5f, 0.0f, 255.0f), 255);
+			}
+		}
+	}
+
+	typedef void (*PointDecoder)(const char *records, size_t count, const VertexFormat &format, bool hasNormals, bool hasColors, float colorScale,
+		glm::vec3 *positions, glm::vec3 *normals, glm::u8vec4 *colors);
+
+	typedef void (*VertexDecoder)(const char *records, size_t count, const VertexFormat &format, Mesh::Vertex *vertices);
+
+	template<bool BigEndian, bool HasNormals, bool HasTexCoords>
+	VertexDecoder SelectVertexDecoder(bool allFloat)
+	{
+		return allFloat ? &DecodeVertices<BigEndian, HasNormals, HasTexCoords, true> : &DecodeVertices<BigEndian, HasNormals, HasTexCoords, false>;
+	}
+
+	template<bool BigEndian>
+	VertexDecoder SelectVertexDecoder(bool hasNormals, bool hasTexCoords, bool allFloat)
+	{
+		if (hasNormals)
+			return hasTexCoords ? SelectVertexDecoder<BigEndian, true, true>(allFloat) : SelectVertexDecoder<BigEndian, true, false>(allFloat);
+		return hasTexCoords ? SelectVertexDecoder<BigEndian, false, true>(allFloat) : SelectVertexDecoder<BigEndian, false, false>(allFloat);
+	}
+
+	// Decodes as many whole face records as fit in [data, data + size) or until the batch is full.
+	// Polygons are triangulated as a fan with the 0, 2, 1 winding the other loaders use. Returns bytes consumed.
+	template<bool BigEndian, PlyType CountType, PlyType IndexType>
+	size_t DecodeFaces(const char *data, size_t size, const FaceFormat &format, uint64_t &facesLeft, unsigned int vertexCount, std::vector<unsigned int> &indices)
+	{
+		const size_t countSize = TypeSize(CountType != PLY_NONE ? CountType : format.countType);
+		const size_t indexSize = TypeSize(IndexType != PLY_NONE ? IndexType : format.indexType);
+
+		const char *p = data;
+		const char *end = data + size;
+		while (facesLeft > 0 && indices.size() < kIndexBatch)
+		{
+			if ((size_t)(end - p) < format.leadingBytes + countSize)
+				break;
+
+			const char *list = p + format.leadingBytes;
+			int64_t cornerCount = ReadInteger<BigEndian, CountType>(format.countType, list);
+			if (cornerCount < 0)
+				cornerCount = 0;
+
+			size_t recordSize = format.leadingBytes + countSize + (size_t)cornerCount * indexSize + format.trailingBytes;
+			if ((size_t)(end - p) < recordSize) // Straddles the window, the caller remaps from here.
+				break;
+
+			const char *corners = list + countSize;
+			if (cornerCount >= 3)
+			{
+				int64_t first = ReadInteger<BigEndian, IndexType>(format.indexType, corners);
+				int64_t previous = ReadInteger<BigEndian, IndexType>(format.indexType, corners + indexSize);
+				for (int64_t i = 2; i < cornerCount; i++)
+				{
+					int64_t current = ReadInteger<BigEndian, IndexType>(format.indexType, corners + (size_t)i * indexSize);
+					bool valid = first >= 0 && previous >= 0 && current >= 0 && first < vertexCount && previous < vertexCount && current < vertexCount;
+					if (valid)
+					{
+						indices.push_back((unsigned int)first);
+						indices.push_back((unsigned int)current);
+						indices.push_back((unsigned int)previous);
+					}
+					previous = current;
+				}
+			}
+
+			p += recordSize;
+			facesLeft--;
+		}
+		return (size_t)(p - data);
+	}
+
+	typedef size_t (*FaceDecoder)(const char *data, size_t size, const FaceFormat &format, uint64_t &facesLeft, unsigned int vertexCount, std::vector<unsigned int> &indices);
+
+	template<bool BigEndian>
+	FaceDecoder SelectFaceDecoder(const FaceFormat &format)
+	{
+		if (format.countType == PLY_UINT8 && format.indexType == PLY_INT32) return &DecodeFaces<BigEndian, PLY_UINT8, PLY_INT32>; // The usual one.
+		if (format.countType == PLY_UINT8 && format.indexType == PLY_UINT32) return &DecodeFaces<BigEndian, PLY_UINT8, PLY_UINT32>;
+		return &DecodeFaces<BigEndian, PLY_NONE, PLY_NONE>;
+	}
+
+	bool ParseHeader(const char *data, size_t size, bool &bigEndian, std::vector<PlyElement> &elements, uint64_t &dataOffset)
+	{
+		const char *terminator = "end_header";
+		const char *found = std::search(data, data + size, terminator, terminator + strlen(terminator));
+		if (size < 3 || strncmp(data, "ply", 3) != 0 || found == data + size)
+			return false;
+
+		const char *headerEnd = found + strlen(terminator);
+		while (headerEnd < data + size && *headerEnd != '\n')
+			headerEnd++;
+		if (headerEnd == data + size)
+			return false;
+		dataOffset = (uint64_t)(headerEnd + 1 - data);
+
+		std::stringstream header(std::string(data, found));
+		std::string line;
+		bool hasFormat = false;
+		while (std::getline(header, line))
+		{
+			std::stringstream ss(line);
+			std::string keyword;
+			ss >> keyword;
+
+			if (keyword == "format")
+			{
+				std::string format;
+				ss >> format;
+				if (format == "binary_little_endian") bigEndian = false;
+				else if (format == "binary_big_endian") bigEndian = true;
+				else return false; // ascii is left to assimp.
+				hasFormat = true;
+			}
+			else if (keyword == "element")
+			{
+				PlyElement element;
+				ss >> element.name >> element.count;
+				elements.push_back(element);
+			}
+			else if (keyword == "property")
+			{
+				if (elements.empty())
+					return false;
+				PlyElement &element = elements.back();
+
+				PlyProperty property;
+				std::string type;
+				ss >> type;
+				if (type == "list")
+				{
+					std::string countType, indexType;
+					ss >> countType >> indexType;
+					property.isList = true;
+					property.countType = ParseType(countType);
+					property.type = ParseType(indexType);
+					if (property.countType == PLY_NONE || property.type == PLY_NONE ||
+						property.countType == PLY_FLOAT32 || property.countType == PLY_FLOAT64)
+						return false;
+					element.hasList = true;
+				}
+				else
+				{
+					property.type = ParseType(type);
+					if (property.type == PLY_NONE)
+						return false;
+					property.offset = element.stride;
+					if (!element.hasList)
+						element.stride += TypeSize(property.type);
+				}
+				ss >> property.name;
+				element.properties.push_back(property);
+			}
+		}
+		return hasFormat;
+	}
+
+	bool FindAttribute(const PlyElement &element, std::initializer_list<const char *> names, VertexFormat &format, VertexAttribute attribute)
+	{
+		for (const PlyProperty &property : element.properties)
+		{
+			for (const char *name : names)
+			{
+				if (!property.isList && property.name == name)
+				{
+					format.offsets[attribute] = property.offset;
+					format.types[attribute] = property.type;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Collects the decoded mesh in memory, in place of the Mesh the loader normally streams straight to.
+	struct ArrayTarget
+	{
+		std::vector<Mesh::Vertex> &vertices;
+		std::vector<unsigned int> &indices;
+
+		void Allocate(unsigned int vertexCount, unsigned int indexCount) { vertices.resize(vertexCount); indices.clear(); indices.reserve(indexCount); }
+		void UpdateVertices(unsigned int firstVertex, unsigned int vertexCount, const Mesh::Vertex *data) { std::copy(data, data + vertexCount, vertices.begin() + firstVertex); }
+		void UpdateIndices(unsigned int firstIndex, unsigned int indexCount, const unsigned int *data) { indices.resize(firstIndex); indices.insert(indices.end(), data, data + indexCount); }
+		void SetIndexCount(unsigned int indexCount) { indices.resize(indexCount); }
+		void ReleaseBuffers() { vertices.clear(); indices.clear(); }
+	};
+}
+
+bool PlyLoader::Load(const char *filePath, Mesh &mesh)
+{
+	return LoadInto(filePath, mesh);
+}
+
+bool PlyLoader::Load(const char *filePath, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices)
+{
+	ArrayTarget target = { vertices, indices };
+	return LoadInto(filePath, target);
+}
+
+template<typename Target>
+bool PlyLoader::LoadInto(const char *filePath, Target &mesh)
+{
+	MappedFile file;
+	if (!file.Open(filePath, false))
+		return false;
+
+	const char *headerData = file.Map(0, kHeaderWindow);
+	if (headerData == nullptr)
+		return false;
+
+	bool bigEndian = false;
+	std::vector<PlyElement> elements;
+	uint64_t dataOffset = 0;
+	if (!ParseHeader(headerData, file.GetViewSize(), bigEndian, elements, dataOffset))
+		return false;
+
+	// Find the vertex and face data. Anything between them has to be fixed size so we can skip over it.
+	const PlyElement *vertexElement = nullptr;
+	const PlyElement *faceElement = nullptr;
+	uint64_t vertexOffset = 0, faceOffset = 0;
+	uint64_t offset = dataOffset;
+	for (const PlyElement &element : elements)
+	{
+		if (element.name == "vertex" && vertexElement == nullptr)
+		{
+			if (element.hasList)
+				return false;
+			vertexElement = &element;
+			vertexOffset = offset;
+		}
+		else if (element.name == "face" && faceElement == nullptr)
+		{
+			faceElement = &element;
+			faceOffset = offset;
+			break; // Whatever comes after the faces doesn't matter.
+		}
+		else if (element.hasList)
+		{
+			return false;
+		}
+		offset += element.count * element.stride;
+	}
+
+	if (vertexElement == nullptr || faceElement == nullptr || vertexElement->count == 0 || vertexElement->count > 0xFFFFFFFFull)
+		return false;
+
+	VertexFormat vertexFormat;
+	vertexFormat.stride = vertexElement->stride;
+	std::fill(std::begin(vertexFormat.offsets), std::end(vertexFormat.offsets), kAbsent);
+	std::fill(std::begin(vertexFormat.types), std::end(vertexFormat.types), PLY_NONE);
+	if (!FindAttribute(*vertexElement, { "x" }, vertexFormat, ATTRIB_X) ||
+		!FindAttribute(*vertexElement, { "y" }, vertexFormat, ATTRIB_Y) ||
+		!FindAttribute(*vertexElement, { "z" }, vertexFormat, ATTRIB_Z))
+		return false;
+
+	bool hasNormals = FindAttribute(*vertexElement, { "nx" }, vertexFormat, ATTRIB_NX) &&
+		FindAttribute(*vertexElement, { "ny" }, vertexFormat, ATTRIB_NY) &&
+		FindAttribute(*vertexElement, { "nz" }, vertexFormat, ATTRIB_NZ);
+	bool hasTexCoords = FindAttribute(*vertexElement, { "u", "s", "texture_u" }, vertexFormat, ATTRIB_U) &&
+		FindAttribute(*vertexElement, { "v", "t", "texture_v" }, vertexFormat, ATTRIB_V);
+
+	bool allFloat = true;
+	for (int i = 0; i < ATTRIB_COUNT; i++)
+	{
+		if (vertexFormat.offsets[i] != kAbsent && vertexFormat.types[i] != PLY_FLOAT32)
+			allFloat = false;
+	}
+
+	FaceFormat faceFormat;
+	bool pastList = false;
+	for (const PlyProperty &property : faceElement->properties)
+	{
+		if (property.isList)
+		{
+			if (pastList || (property.name != "vertex_indices" && property.name != "vertex_index"))
+				return false;
+			faceFormat.countType = property.countType;
+			faceFormat.indexType = property.type;
+			pastList = true;
+		}
+		else if (pastList)
+		{
+			faceFormat.trailingBytes += TypeSize(property.type);
+		}
+		else
+		{
+			faceFormat.leadingBytes += TypeSize(property.type);
+		}
+	}
+	if (!pastList || faceFormat.indexType == PLY_FLOAT32 || faceFormat.indexType == PLY_FLOAT64)
+		return false;
+
+	// Make sure the file is at least big enough for what the header promises before committing to anything.
+	uint64_t minimumFaceBytes = faceFormat.leadingBytes + TypeSize(faceFormat.countType) + 3 * TypeSize(faceFormat.indexType) + faceFormat.trailingBytes;
+	if (vertexOffset + vertexElement->count * vertexFormat.stride > faceOffset ||
+		faceOffset + faceElement->count * minimumFaceBytes > file.GetSize())
+		return false;
+
+	VertexDecoder decodeVertices = bigEndian ? SelectVertexDecoder<true>(hasNormals, hasTexCoords, allFloat) : SelectVertexDecoder<false>(hasNormals, hasTexCoords, allFloat);
+	FaceDecoder decodeFaces = bigEndian ? SelectFaceDecoder<true>(faceFormat) : SelectFaceDecoder<false>(faceFormat);
+
+	unsigned int vertexCount = (unsigned int)vertexElement->count;
+	mesh.Allocate(vertexCount, (unsigned int)std::min<uint64_t>(faceElement->count * 3, 0xFFFFFFFFull));
+
+	// Without normals we have to see every face first, so keep just what's needed to rebuild the vertices afterwards.
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texCoords;
+	if (!hasNormals)
+	{
+		positions.resize(vertexCount);
+		normals.assign(vertexCount, glm::vec3(0.0f));
+		if (hasTexCoords)
+			texCoords.resize(vertexCount);
+	}
+
+	// Stream the vertices, a window of whole records at a time.
+	std::vector<Mesh::Vertex> staging(kVertexBatch);
+	size_t recordsPerWindow = std::max<size_t>(1, kWindowSize / vertexFormat.stride);
+	for (uint64_t first = 0; first < vertexCount; first += recordsPerWindow)
+	{
+		size_t windowRecords = (size_t)std::min<uint64_t>(recordsPerWindow, vertexCount - first);
+		const char *records = file.Map(vertexOffset + first * vertexFormat.stride, windowRecords * vertexFormat.stride);
+		if (records == nullptr)
+		{
+			mesh.ReleaseBuffers(); // Leave the mesh as we found it for the fallback.
+			return false;
+		}
+
+		for (size_t batch = 0; batch < windowRecords; batch += kVertexBatch)
+		{
+			size_t batchCount = std::min(kVertexBatch, windowRecords - batch);
+			decodeVertices(records + batch * vertexFormat.stride, batchCount, vertexFormat, staging.data());
+
+			unsigned int firstVertex = (unsigned int)(first + batch);
+			if (!hasNormals)
+			{
+				for (size_t i = 0; i < batchCount; i++)
+				{
+					positions[firstVertex + i] = glm::vec3(staging[i].position);
+					if (hasTexCoords)
+						texCoords[firstVertex + i] = staging[i].texCoord;
+				}
+			}
+			else
+			{
+				mesh.UpdateVertices(firstVertex, (unsigned int)batchCount, staging.data());
+			}
+		}
+	}
+
+	// Stream the faces. Records are variable length so remap from wherever the last window stopped.
+	std::vector<unsigned int> indices;
+	indices.reserve(kIndexBatch + 256);
+	unsigned int indexCount = 0;
+	uint64_t facesLeft = faceElement->count;
+	offset = faceOffset;
+	while (facesLeft > 0)
+	{
+		if (offset >= file.GetSize()) // Truncated file, keep what we have.
+		{
+			std::cout << "WARNING: " << filePath << " ends part way through its faces." << std::endl;
+			break;
+		}
+		const char *data = file.Map(offset, kWindowSize);
+		if (data == nullptr)
+		{
+			mesh.ReleaseBuffers();
+			return false;
+		}
+
+		size_t consumed = decodeFaces(data, file.GetViewSize(), faceFormat, facesLeft, vertexCount, indices);
+		if (consumed == 0 && indices.empty()) // Truncated file, keep what we have.
+		{
+			std::cout << "WARNING: " << filePath << " ends part way through its faces." << std::endl;
+			break;
+		}
+		offset += consumed;
+
+		if (!hasNormals) // Accumulate area weighted face normals, stored winding is 0, 2, 1.
+		{
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				const glm::vec3 &a = positions[indices[i + 0]];
+				const glm::vec3 &b = positions[indices[i + 1]];
+				const glm::vec3 &c = positions[indices[i + 2]];
+				glm::vec3 normal = glm::cross(c - a, b - a);
+				normals[indices[i + 0]] += normal;
+				normals[indices[i + 1]] += normal;
+				normals[indices[i + 2]] += normal;
+			}
+		}
+
+		if (!indices.empty())
+		{
+			mesh.UpdateIndices(indexCount, (unsigned int)indices.size(), indices.data());
+			indexCount += (unsigned int)indices.size();
+			indices.clear();
+		}
+	}
+	file.Close();
+
+	// Now the normals are known, build and upload the vertices.
+	if (!hasNormals)
+	{
+		for (size_t first = 0; first < vertexCount; first += kVertexBatch)
+		{
+			size_t batchCount = std::min<size_t>(kVertexBatch, vertexCount - first);
+			for (size_t i = 0; i < batchCount; i++)
+			{
+				glm::vec3 normal = normals[first + i];
+				float length = glm::length(normal);
+				normal = length > 0.0f ? normal / length : glm::vec3(0, 1, 0);
+
+				Mesh::Vertex &vertex = staging[i];
+				vertex.position = glm::vec4(positions[first + i], 1.0f);
+				vertex.normal = glm::vec4(normal, 0.0f);
+				vertex.texCoord = hasTexCoords ? texCoords[first + i] : glm::vec2(0.0f);
+				vertex.tangent = MakeTangent(normal);
+			}
+			mesh.UpdateVertices((unsigned int)first, (unsigned int)batchCount, staging.data());
+		}
+	}
+
+	mesh.SetIndexCount(indexCount);
+	return true;
+}
+
+bool PlyLoader::ReadCounts(const char *filePath, uint64_t &vertexCount, uint64_t &faceCount)
+{
+	MappedFile file;
+	if (!file.Open(filePath, false))
+		return false;
+
+	const char *headerData = file.Map(0, kHeaderWindow);
+	if (headerData == nullptr)
+		return false;
+
+	bool bigEndian = false;
+	std::vector<PlyElement> elements;
+	uint64_t dataOffset = 0;
+	if (!ParseHeader(headerData, file.GetViewSize(), bigEndian, elements, dataOffset))
+		return false;
+
+	vertexCount = 0;
+	faceCount = 0;
+	for (const PlyElement &element : elements)
+	{
+		if (element.name == "vertex")
+			vertexCount = element.count;
+		else if (element.name == "face")
+			faceCount = element.count;
+	}
+	return true;
+}
+
+bool PlyLoader::LoadPoints(const char *filePath, const PointBatch &batch)
+{
+	MappedFile file;
+	if (!file.Open(filePath, false))
+		return false;
+
+	const char *headerData = file.Map(0, kHeaderWindow);
+	if (headerData == nullptr)
+		return false;
+
+	bool bigEndian = false;
+	std::vector<PlyElement> elements;
+	uint64_t dataOffset = 0;
+	if (!ParseHeader(headerData, file.GetViewSize(), bigEndian, elements, dataOffset))
+		return false;
+
+	// Only the vertices matter, anything before them has to be fixed size so we can skip over it.
+	const PlyElement *vertexElement = nullptr;
+	uint64_t vertexOffset = dataOffset;
+	for (const PlyElement &element : elements)
+	{
+		if (element.name == "vertex")
+		{
+			vertexElement = &element;
+			break;
+		}
+		if (element.hasList)
+			return false;
+		vertexOffset += element.count * element.stride;
+	}
+	if (vertexElement == nullptr || vertexElement->hasList || vertexElement->count == 0 ||
+		vertexOffset + vertexElement->count * vertexElement->stride > file.GetSize())
+		return false;
+
+	VertexFormat format;
+	format.stride = vertexElement->stride;
+	std::fill(std::begin(format.offsets), std::end(format.offsets), kAbsent);
+	std::fill(std::begin(format.types), std::end(format.types), PLY_NONE);
+	if (!FindAttribute(*vertexElement, { "x" }, format, ATTRIB_X) ||
+		!FindAttribute(*vertexElement, { "y" }, format, ATTRIB_Y) ||
+		!FindAttribute(*vertexElement, { "z" }, format, ATTRIB_Z))
+		return false;
+
+	bool hasNormals = FindAttribute(*vertexElement, { "nx" }, format, ATTRIB_NX) &&
+		FindAttribute(*vertexElement, { "ny" }, format, ATTRIB_NY) &&
+		FindAttribute(*vertexElement, { "nz" }, format, ATTRIB_NZ);
+	bool hasColors = FindAttribute(*vertexElement, { "red", "diffuse_red", "r" }, format, ATTRIB_RED) &&
+		FindAttribute(*vertexElement, { "green", "diffuse_green", "g" }, format, ATTRIB_GREEN) &&
+		FindAttribute(*vertexElement, { "blue", "diffuse_blue", "b" }, format, ATTRIB_BLUE);
+
+	// Positions and normals decide the fast path, colors are nearly always bytes and read separately anyway.
+	bool allFloat = true;
+	for (int i = ATTRIB_X; i <= ATTRIB_NZ; i++)
+	{
+		if (format.offsets[i] != kAbsent && format.types[i] != PLY_FLOAT32)
+			allFloat = false;
+	}
+
+	float colorScale = 1.0f;
+	if (hasColors)
+	{
+		PlyType colorType = format.types[ATTRIB_RED];
+		if (colorType == PLY_FLOAT32 || colorType == PLY_FLOAT64) colorScale = 255.0f;
+		else if (colorType == PLY_UINT16 || colorType == PLY_INT16) colorScale = 255.0f / 65535.0f;
+	}
+
+	PointDecoder decodePoints = bigEndian ?
+		(allFloat ? &DecodePoints<true, true> : &DecodePoints<true, false>) :
+		(allFloat ? &DecodePoints<false, true> : &DecodePoints<false, false>);
+
+	std::vector<glm::vec3> positions(kVertexBatch);
+	std::vector<glm::vec3> normals(hasNormals ? kVertexBatch : 0);
+	std::vector<glm::u8vec4> colors(hasColors ? kVertexBatch : 0);
+
+	uint64_t pointCount = vertexElement->count;
+	size_t recordsPerWindow = std::max<size_t>(1, kWindowSize / format.stride);
+	for (uint64_t first = 0; first < pointCount; first += recordsPerWindow)
+	{
+		size_t windowRecords = (size_t)std::min<uint64_t>(recordsPerWindow, pointCount - first);
+		const char *records = file.Map(vertexOffset + first * format.stride, windowRecords * format.stride);
+		if (records == nullptr)
+			return false;
+
+		for (size_t offset = 0; offset < windowRecords; offset += kVertexBatch)
+		{
+			size_t count = std::min(kVertexBatch, windowRecords - offset);
+			decodePoints(records + offset * format.stride, count, format, hasNormals, hasColors, colorScale, positions.data(), normals.data(), colors.data());
+			batch(positions.data(), hasNormals ? normals.data() : nullptr, hasColors ? colors.data() : nullptr, count);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+#include <functional>
+
+// Binary PLY reader for the Stanford scans. The file is memory mapped a window at a time and vertices and faces are
+// decoded straight into the GPU vertex layout in small batches, so files bigger than RAM still load.
+class PlyLoader
+{
+public:
+	// Returns false without touching the mesh if the file isn't a binary PLY we can stream (ascii files, faces with
+	// list properties we don't understand etc.), so the caller can fall back to assimp. If the file can't be mapped
+	// part way through, the buffers already made are freed again before returning false.
+	static bool Load(const char *filePath, Mesh &mesh);
+
+	// Just the element counts from the header, without reading any of the data. False if it isn't a binary PLY.
+	static bool ReadCounts(const char *filePath, uint64_t &vertexCount, uint64_t &faceCount);
+
+	// Same again into memory, for offline processing that needs the whole mesh at once.
+	static bool Load(const char *filePath, std::vector<Mesh::Vertex> &vertices, std::vector<unsigned int> &indices);
+
+	// Streams just the vertices of a binary PLY as points, in batches. Faces are skipped if there are any, normals and
+	// colors are null for files without them. Nothing is kept between batches, so it copes with any size of scan.
+	typedef std::function<void(const glm::vec3 *positions, const glm::vec3 *normals, const glm::u8vec4 *colors, size_t count)> PointBatch;
+	static bool LoadPoints(const char *filePath, const PointBatch &batch);
+
+private:
+	template<typename Target>
+	static bool LoadInto(const char *filePath, Target &target); // Target takes the same streaming calls as Mesh.
+
+};
@@ -0,0 +1,389 @@
+#include "PointCloud.h"
+
+#include "Application.h"
+#include "MeshletBuilder.h"
+#include "PointOctreeBuilder.h"
+#include "Shader.h"
+
+#include <glad.h>
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <cfloat>
+#include <filesystem>
+#include <queue>
+
+namespace
+{
+	const size_t kMaxQueuedLoads = 64;
+	const size_t kMaxCompletedLoads = 64; // Read ahead of the uploads, the streaming thread waits past this.
+	const uint64_t kMaxUploadPointsPerFrame = 1 << 20; // Keeps a sudden camera jump from stalling a frame on uploads.
+	const double kEvictDelay = 0.25; // Seconds a node has to go unused before it can be evicted.
+	const float kMaxSplatPixels = 64.0f;
+
+	double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+PointCloud::PointCloud()
+{ }
+PointCloud::~PointCloud()
+{
+	if (m_streamThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_condition.notify_all();
+		m_streamThread.join();
+	}
+
+	for (unsigned int &buffer : m_nodeBuffers)
+		glDeleteBuffers(1, &buffer);
+}
+
+bool PointCloud::Load(const char *filePath, size_t residentBytes)
+{
+	std::string path(filePath);
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (extension != "pcot")
+	{
+		std::string cookedPath = path + ".pcot";
+		std::error_code error;
+		bool upToDate = std::filesystem::exists(cookedPath, error) &&
+			std::filesystem::last_write_time(cookedPath, error) >= std::filesystem::last_write_time(path, error);
+		if (!upToDate && !PointOctreeBuilder::Build(filePath, cookedPath.c_str()))
+			return false;
+		path = cookedPath;
+	}
+
+	if (!m_file.Open(path.c_str()))
+	{
+		std::cout << "WARNING: " << "Couldn't open point cloud file " << path << std::endl;
+		return false;
+	}
+	if (!ReadTables())
+	{
+		std::cout << "WARNING: " << path << " isn't a valid point cloud file, delete it to cook it again." << std::endl;
+		m_file.Close();
+		return false;
+	}
+
+	m_maxResidentPoints = std::max<uint64_t>(residentBytes / sizeof(PointOctreePoint), m_nodes[0].pointCount);
+	m_nodeBuffers.assign(m_nodes.size(), 0);
+	m_nodeLastUsed.assign(m_nodes.size(), 0.0);
+	m_nodeLoading.assign(m_nodes.size(), 0);
+
+	// Points are bound a node's buffer at a time, so only the format lives in the vertex array.
+	glGenVertexArrays(1, &m_VAO);
+	glBindVertexArray(m_VAO);
+	glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(PointOctreePoint, position));
+	glVertexAttribFormat(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(PointOctreePoint, color));
+	glVertexAttribFormat(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PointOctreePoint, normal));
+	for (unsigned int attribute = 0; attribute < 3; attribute++)
+	{
+		glVertexAttribBinding(attribute, 0);
+		glEnableVertexAttribArray(attribute);
+	}
+	glBindVertexArray(0);
+
+	UploadNode(ReadNode(0)); // The root is always resident so there's always something to draw.
+
+	float size = m_header.boundsSize;
+	m_boundsCenter = m_header.boundsMin + glm::vec3(size * 0.5f);
+	m_boundsRadius = size * 0.5f * glm::root_three<float>();
+
+	m_streamThread = std::thread(&PointCloud::StreamLoop, this);
+	return true;
+}
+
+bool PointCloud::ReadTables()
+{
+	if (m_file.GetSize() < sizeof(PointOctreeHeader))
+		return false;
+	std::memcpy(&m_header, m_file.GetData(), sizeof(PointOctreeHeader));
+	if (m_header.magic != kPointOctreeMagic || m_header.version != kPointOctreeVersion || m_header.nodeCount == 0 ||
+		m_header.nodeOffset + (uint64_t)m_header.nodeCount * sizeof(PointOctreeNode) > m_file.GetSize())
+		return false;
+
+	m_nodes.resize(m_header.nodeCount);
+	std::memcpy(m_nodes.data(), m_file.GetData() + m_header.nodeOffset, m_nodes.size() * sizeof(PointOctreeNode));
+
+	// Check everything the streaming relies on up front, so a damaged file can't send it out of bounds later.
+	for (uint32_t n = 0; n < (uint32_t)m_nodes.size(); n++)
+	{
+		const PointOctreeNode &node = m_nodes[n];
+		if (node.offset + (uint64_t)node.pointCount * sizeof(PointOctreePoint) > m_header.nodeOffset)
+			return false;
+		for (uint32_t child : node.children)
+		{
+			if (child != kPointOctreeNone && (child <= n || child >= m_nodes.size())) // Children come after their parents, so there can't be cycles.
+				return false;
+		}
+	}
+	return true;
+}
+
+// Copies a node's points out of the mapping. Runs on the streaming thread, the page faults happen here.
+PointCloud::NodeData PointCloud::ReadNode(uint32_t node) const
+{
+	const PointOctreeNode &record = m_nodes[node];
+	NodeData result;
+	result.node = node;
+	result.points.resize(record.pointCount);
+	std::memcpy(result.points.data(), m_file.GetData() + record.offset, (size_t)record.pointCount * sizeof(PointOctreePoint));
+	return result;
+}
+
+// A thread of its own rather than the shared pool, so the queue can be reordered every frame as the camera moves.
+void PointCloud::StreamLoop()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_condition.wait(lock, [this]() { return m_stopping || (!m_queue.empty() && m_completed.size() < kMaxCompletedLoads); });
+		if (m_stopping)
+			return;
+
+		uint32_t node = m_queue.back();
+		m_queue.pop_back();
+
+		lock.unlock();
+		NodeData data = ReadNode(node);
+		lock.lock();
+		m_completed.push_back(std::move(data));
+	}
+}
+
+void PointCloud::FinishLoads(double now)
+{
+	uint64_t uploaded = 0;
+	while (uploaded < kMaxUploadPointsPerFrame)
+	{
+		NodeData data;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_completed.empty())
+				break;
+			data = std::move(m_completed.front());
+			m_completed.pop_front();
+		}
+		m_condition.notify_one();
+		m_nodeLoading[data.node] = 0;
+
+		if (!MakeRoom(data.points.size(), now)) // Everything's in use, it'll be asked for again if it's still needed.
+			continue;
+		UploadNode(data);
+		m_nodeLastUsed[data.node] = now;
+		uploaded += data.points.size();
+	}
+}
+
+void PointCloud::UploadNode(const NodeData &data)
+{
+	unsigned int &buffer = m_nodeBuffers[data.node];
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(data.points.size() * sizeof(PointOctreePoint)), data.points.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	m_residentNodes.push_back(data.node);
+	m_residentPoints += data.points.size();
+}
+
+// Evicts the least recently used nodes until pointCount more fit. False if that would mean evicting one still in use.
+bool PointCloud::MakeRoom(uint64_t pointCount, double now)
+{
+	while (m_residentPoints + pointCount > m_maxResidentPoints)
+	{
+		uint32_t oldest = kPointOctreeNone;
+		double oldestTime = now - kEvictDelay;
+		for (uint32_t node : m_residentNodes)
+		{
+			if (node != 0 && m_nodeLastUsed[node] < oldestTime)
+			{
+				oldestTime = m_nodeLastUsed[node];
+				oldest = node;
+			}
+		}
+		if (oldest == kPointOctreeNone)
+			return false;
+		EvictNode(oldest);
+	}
+	return true;
+}
+
+void PointCloud::EvictNode(uint32_t node)
+{
+	glDeleteBuffers(1, &m_nodeBuffers[node]);
+	m_nodeBuffers[node] = 0;
+	m_residentPoints -= m_nodes[node].pointCount;
+	m_residentNodes.erase(std::find(m_residentNodes.begin(), m_residentNodes.end(), node));
+}
+
+// Walks the octree biggest node on screen first, drawing every resident node that's visible until the next one
+// would go over the point budget. Children are only worth visiting while the node's spacing shows on screen, and
+// nodes that aren't resident yet are requested instead, without their children.
+void PointCloud::SelectNodes(const glm::mat4 &mvp, double now)
+{
+	// Row 1 of the matrix scales local lengths into clip space height and row 3 gives depth.
+	glm::vec4 heightRow = glm::row(mvp, 1), depthRow = glm::row(mvp, 3);
+	m_pixelsPerUnit = glm::length(glm::vec3(heightRow)) * 0.5f * (float)Application::GetInstance()->GetWindowHeight();
+	float depthScale = glm::length(glm::vec3(depthRow));
+	MeshletBuilder::Frustum frustum = MeshletBuilder::MakeFrustum(mvp);
+
+	struct Candidate
+	{
+		float pixels; // Projected size.
+		float depth;
+		uint32_t node;
+		uint32_t parent; // In the draw list.
+		unsigned int octant; // Within the parent.
+		bool operator<(const Candidate &other) const { return pixels < other.pixels; }
+	};
+	auto makeCandidate = [&](uint32_t node, uint32_t parent, unsigned int octant)
+	{
+		const PointOctreeNode &record = m_nodes[node];
+		glm::vec3 center = record.min + glm::vec3(record.size * 0.5f);
+		float radius = record.size * 0.5f * glm::root_three<float>();
+		float depth = glm::dot(glm::vec3(depthRow), center) + depthRow.w - radius * depthScale;
+		return Candidate{ depth > 0.0f ? radius * m_pixelsPerUnit / depth : FLT_MAX, depth, node, parent, octant };
+	};
+
+	std::priority_queue<Candidate> candidates;
+	candidates.push(makeCandidate(0, kPointOctreeNone, 0));
+	std::vector<uint32_t> drawParents;
+
+	m_drawList.clear();
+	m_requests.clear();
+	m_drawnPoints = 0;
+	while (!candidates.empty())
+	{
+		Candidate candidate = candidates.top();
+		candidates.pop();
+		const PointOctreeNode &node = m_nodes[candidate.node];
+
+		glm::vec3 center = node.min + glm::vec3(node.size * 0.5f);
+		float radius = node.size * 0.5f * glm::root_three<float>();
+		bool visible = true;
+		for (int p = 0; p < 6 && visible; p++)
+			visible = glm::dot(glm::vec3(frustum.planes[p]), center) + frustum.planes[p].w >= -radius;
+		if (!visible)
+			continue;
+
+		if (m_nodeBuffers[candidate.node] == 0)
+		{
+			if (!m_nodeLoading[candidate.node])
+				m_requests.push_back({ candidate.pixels, candidate.node });
+			continue;
+		}
+		if (!m_drawList.empty() && m_drawnPoints + node.pointCount > m_pointBudget)
+			break;
+
+		DrawNode draw;
+		draw.node = candidate.node;
+		std::fill(std::begin(draw.octantSpacing), std::end(draw.octantSpacing), node.spacing);
+		m_drawList.push_back(draw);
+		drawParents.push_back(candidate.parent);
+		m_drawnPoints += node.pointCount;
+		m_nodeLastUsed[candidate.node] = now;
+
+		float spacingPixels = candidate.depth > 0.0f ? node.spacing * m_pixelsPerUnit / candidate.depth : FLT_MAX;
+		if (spacingPixels <= m_lodErrorThreshold)
+			continue;
+		for (unsigned int octant = 0; octant < 8; octant++)
+		{
+			if (node.children[octant] != kPointOctreeNone)
+				candidates.push(makeCandidate(node.children[octant], (uint32_t)m_drawList.size() - 1, octant));
+		}
+	}
+
+	// Children are always drawn after their parents, so going backwards each node's finest spacing is known before
+	// it's passed up. Only the coarsest of it counts, any finer and parts of the octant would have gaps.
+	for (size_t i = m_drawList.size(); i-- > 0;)
+	{
+		if (drawParents[i] == kPointOctreeNone)
+			continue;
+		const float *spacing = m_drawList[i].octantSpacing;
+		float covered = *std::max_element(spacing, spacing + 8);
+		const PointOctreeNode &node = m_nodes[m_drawList[i].node];
+		const PointOctreeNode &parent = m_nodes[m_drawList[drawParents[i]].node];
+		glm::vec3 center = node.min + glm::vec3(node.size * 0.5f), parentCenter = parent.min + glm::vec3(parent.size * 0.5f);
+		unsigned int octant = (center.x > parentCenter.x ? 1 : 0) | (center.y > parentCenter.y ? 2 : 0) | (center.z > parentCenter.z ? 4 : 0);
+		float &parentSpacing = m_drawList[drawParents[i]].octantSpacing[octant];
+		parentSpacing = std::min(parentSpacing, covered);
+	}
+}
+
+// Hands the streaming thread the most visibly missing nodes, replacing whatever it hadn't got to yet.
+void PointCloud::IssueLoads()
+{
+	size_t count = std::min(m_requests.size(), kMaxQueuedLoads);
+	std::partial_sort(m_requests.begin(), m_requests.begin() + count, m_requests.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b) { return a.first > b.first; });
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (uint32_t node : m_queue)
+			m_nodeLoading[node] = 0;
+		m_queue.clear();
+		for (size_t i = count; i-- > 0;)
+		{
+			m_queue.push_back(m_requests[i].second);
+			m_nodeLoading[m_requests[i].second] = 1;
+		}
+	}
+	m_condition.notify_one();
+}
+
+void PointCloud::DrawNodes(aie::ShaderProgram *shader)
+{
+	int centerUniform = shader != nullptr ? shader->getUniform("nodeCenter") : -1;
+	int spacingUniform = shader != nullptr ? shader->getUniform("octantSpacing") : -1;
+
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glBindVertexArray(m_VAO);
+	for (DrawNode &draw : m_drawList)
+	{
+		const PointOctreeNode &node = m_nodes[draw.node];
+		if (centerUniform >= 0)
+			shader->bindUniform(centerUniform, node.min + glm::vec3(node.size * 0.5f));
+		if (spacingUniform >= 0)
+			shader->bindUniform(spacingUniform, 8, draw.octantSpacing);
+
+		glBindVertexBuffer(0, m_nodeBuffers[draw.node], 0, sizeof(PointOctreePoint));
+		glDrawArrays(GL_POINTS, 0, (GLsizei)node.pointCount);
+	}
+	glBindVertexArray(0);
+	glDisable(GL_PROGRAM_POINT_SIZE); // Other point shaders don't write a size.
+}
+
+void PointCloud::Draw()
+{
+	DrawNodes(nullptr);
+}
+
+void PointCloud::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
+{
+	if (m_nodes.empty())
+		return;
+
+	double now = Now();
+	FinishLoads(now);
+	SelectNodes(projectionView * transform, now);
+	IssueLoads();
+
+	// The caller has already bound this instance's matrices.
+	if (shader->getUniform("pixelsPerUnit") >= 0)
+		shader->bindUniform("pixelsPerUnit", m_pixelsPerUnit * m_pointSize);
+	if (shader->getUniform("maxPointSize") >= 0)
+		shader->bindUniform("maxPointSize", kMaxSplatPixels);
+	DrawNodes(shader);
+}
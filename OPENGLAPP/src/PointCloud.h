@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "PointOctree.h"
+#include "MappedFile.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// Raw scan point clouds, drawn as GL_POINTS splats out of a cooked octree. Only the root is loaded up front, a
+// streaming thread reads the nodes the camera needs out of the memory mapped file, most important first, and the
+// least recently used are evicted when the resident budget is full. Each frame draws the nodes with the largest
+// projected size until the point budget is spent, so the cost of a frame stays the same however big the scan is.
+class PointCloud : public Mesh
+{
+public:
+	static const size_t kDefaultResidentBytes = (size_t)512 << 20;
+	static const unsigned int kDefaultPointBudget = 5000000;
+
+public:
+	PointCloud();
+	virtual ~PointCloud();
+
+	// Opens a .pcot file. A binary PLY is cooked to a .pcot next to it first, unless there's already one newer than it.
+	bool Load(const char *filePath, size_t residentBytes = kDefaultResidentBytes);
+
+	void SetPointBudget(unsigned int points) { m_pointBudget = points; }
+	unsigned int GetPointBudget() const { return m_pointBudget; }
+	float &GetPointSize() { return m_pointSize; } // Splat size relative to the spacing of the points.
+
+	virtual void Draw() override; // Draws the nodes picked by the last Render.
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform) override;
+
+	uint64_t GetPointCount() const { return m_header.pointCount; }
+	uint64_t GetDrawnPointCount() const { return m_drawnPoints; }
+	unsigned int GetNodeCount() const { return (unsigned int)m_nodes.size(); }
+	unsigned int GetResidentNodeCount() const { return (unsigned int)m_residentNodes.size(); }
+	unsigned int GetDrawnNodeCount() const { return (unsigned int)m_drawList.size(); }
+
+protected:
+	struct NodeData
+	{
+		uint32_t node;
+		std::vector<PointOctreePoint> points;
+	};
+
+	// A node picked to draw. Parts of it that finer nodes are drawn over only need splats as big as theirs.
+	struct DrawNode
+	{
+		uint32_t node;
+		float octantSpacing[8];
+	};
+
+	bool ReadTables();
+	NodeData ReadNode(uint32_t node) const;
+	void StreamLoop();
+
+	void FinishLoads(double now);
+	void UploadNode(const NodeData &data);
+	bool MakeRoom(uint64_t pointCount, double now);
+	void EvictNode(uint32_t node);
+	void SelectNodes(const glm::mat4 &mvp, double now);
+	void IssueLoads();
+	void DrawNodes(aie::ShaderProgram *shader);
+
+protected:
+	MappedFile m_file;
+	PointOctreeHeader m_header = {};
+	std::vector<PointOctreeNode> m_nodes;
+
+	std::vector<unsigned int> m_nodeBuffers; // Vertex buffer per resident node, 0 if it isn't.
+	std::vector<double> m_nodeLastUsed; // Seconds.
+	std::vector<unsigned char> m_nodeLoading; // Queued, being read or waiting to be uploaded.
+	std::vector<uint32_t> m_residentNodes;
+	uint64_t m_residentPoints = 0;
+	uint64_t m_maxResidentPoints = 0;
+
+	// Shared with the streaming thread, under m_mutex.
+	std::thread m_streamThread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	std::vector<uint32_t> m_queue; // Most important last, the thread reads from the back.
+	std::deque<NodeData> m_completed;
+	bool m_stopping = false;
+
+	std::vector<std::pair<float, uint32_t>> m_requests; // Projected size and node.
+	std::vector<DrawNode> m_drawList;
+	float m_pixelsPerUnit = 0.0f; // Of the last Render, at a depth of one.
+
+	unsigned int m_pointBudget = kDefaultPointBudget;
+	float m_pointSize = 1.0f;
+	uint64_t m_drawnPoints = 0;
+
+};
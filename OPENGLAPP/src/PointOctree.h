@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Common.h"
+
+#include <cstdint>
+
+// Layout of a cooked point cloud octree (.pcot), written by PointOctreeBuilder and streamed by PointCloud. The file is
+// the header, then every node's points, then the node table. The table is written last since node sizes aren't known
+// until their points are, and only the points are streamed, the table stays in memory.
+
+const uint32_t kPointOctreeMagic = 0x544F4350; // "PCOT"
+const uint32_t kPointOctreeVersion = 1;
+const uint32_t kPointOctreeNone = 0xFFFFFFFF;
+const unsigned int kPointOctreeGridSize = 64; // Inner nodes keep at most one point per cell of a grid this many cells across.
+
+// Also the vertex layout on the GPU, points are uploaded exactly as they're read.
+struct PointOctreePoint
+{
+	glm::vec3 position;
+	uint32_t color; // RGBA8.
+	uint32_t normal; // Signed normalized 10:10:10:2, all zero if the scan didn't have normals.
+};
+
+struct PointOctreeHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nodeCount;
+	uint32_t depth; // Of the deepest node.
+	uint64_t pointCount;
+	uint64_t nodeOffset; // Into the file.
+	glm::vec3 boundsMin; // Cube around every point, the root node's.
+	float boundsSize;
+};
+
+// Each node holds an even subsample of the points in its cube that none of its ancestors took, so drawing a node and
+// all of its ancestors gives the points inside it at the node's spacing.
+struct PointOctreeNode
+{
+	glm::vec3 min;
+	float size;
+	uint64_t offset; // Into the file.
+	uint32_t pointCount;
+	float spacing; // Typical distance between points once this node is drawn, splats are sized from it.
+	uint32_t children[8]; // By octant, x + 2y + 4z. kPointOctreeNone where there are no points.
+};
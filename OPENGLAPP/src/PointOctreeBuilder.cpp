@@ -0,0 +1,407 @@
+#include "PointOctreeBuilder.h"
+
+#include "PointOctree.h"
+#include "PlyLoader.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const unsigned int kCountLevels = 5; // Points are counted on a grid 2^5 cells across to decide where the chunks go.
+	const unsigned int kCountCells = 1 << kCountLevels;
+	const uint64_t kMaxChunkPoints = 1 << 23; // About 160MB of points, the most built in memory at once.
+	const uint64_t kBufferedPoints = 1 << 24; // Shared between the chunks while sorting points into their files.
+	const size_t kMaxLeafPoints = 1 << 15; // Leaves bigger than this turn into inner nodes and pass their points down.
+	const unsigned int kMaxDepth = 24; // Leaves this deep take everything, so piles of duplicate points can't split forever.
+	const size_t kGridWords = kPointOctreeGridSize * kPointOctreeGridSize * kPointOctreeGridSize / 64;
+
+	typedef PointOctreePoint Point;
+
+	struct BuildNode
+	{
+		glm::vec3 min;
+		float size;
+		unsigned int depth;
+		std::vector<Point> points;
+		std::vector<uint64_t> occupied; // One bit per grid cell, empty while the node is still a leaf.
+		uint32_t children[8];
+	};
+
+	// A part of the tree small enough to build in memory, under one node of the count grid.
+	struct Chunk
+	{
+		uint32_t node; // In the node table.
+		uint64_t pointCount;
+		std::string path; // Temporary file its points are sorted into.
+		std::vector<Point> buffer;
+	};
+
+	BuildNode MakeNode(const glm::vec3 &min, float size, unsigned int depth)
+	{
+		BuildNode node;
+		node.min = min;
+		node.size = size;
+		node.depth = depth;
+		std::fill(std::begin(node.children), std::end(node.children), kPointOctreeNone);
+		return node;
+	}
+
+	bool IsFinite(const glm::vec3 &position)
+	{
+		return std::isfinite(position.x) && std::isfinite(position.y) && std::isfinite(position.z);
+	}
+
+	uint32_t PackColor(const glm::u8vec4 &color)
+	{
+		return (uint32_t)color.r | ((uint32_t)color.g << 8) | ((uint32_t)color.b << 16) | ((uint32_t)color.a << 24);
+	}
+
+	uint32_t PackNormal(const glm::vec3 &normal)
+	{
+		float length = glm::length(normal);
+		if (!(length > 0.0f) || !std::isfinite(length))
+			return 0;
+		glm::ivec3 packed = glm::ivec3(glm::round(normal / length * 511.0f));
+		return ((uint32_t)packed.x & 0x3FF) | (((uint32_t)packed.y & 0x3FF) << 10) | (((uint32_t)packed.z & 0x3FF) << 20);
+	}
+
+	unsigned int Octant(const BuildNode &node, const glm::vec3 &position)
+	{
+		glm::vec3 center = node.min + node.size * 0.5f;
+		return (position.x >= center.x ? 1 : 0) | (position.y >= center.y ? 2 : 0) | (position.z >= center.z ? 4 : 0);
+	}
+
+	size_t GridCell(const BuildNode &node, const glm::vec3 &position)
+	{
+		const int last = (int)kPointOctreeGridSize - 1;
+		glm::ivec3 cell = glm::clamp(glm::ivec3((position - node.min) / node.size * (float)kPointOctreeGridSize), glm::ivec3(0), glm::ivec3(last));
+		return (size_t)cell.x + kPointOctreeGridSize * ((size_t)cell.y + kPointOctreeGridSize * (size_t)cell.z);
+	}
+
+	// Inner nodes are thinned to their grid, leaves aren't, so estimate from how many points are spread across them.
+	float Spacing(const BuildNode &node)
+	{
+		float gridSpacing = node.size / (float)kPointOctreeGridSize;
+		if (!node.occupied.empty() || node.points.empty())
+			return gridSpacing;
+		return std::min(gridSpacing, node.size / std::sqrt((float)node.points.size()));
+	}
+
+	void Split(std::deque<BuildNode> &nodes, uint32_t index);
+
+	// Inner nodes take a point if its grid cell is still free and otherwise pass it on to the child it's in. Leaves
+	// take everything until they're full, then become inner nodes. Nodes live in a deque so references survive growth.
+	void Insert(std::deque<BuildNode> &nodes, uint32_t index, const Point &point)
+	{
+		while (true)
+		{
+			BuildNode &node = nodes[index];
+			if (node.occupied.empty())
+			{
+				node.points.push_back(point);
+				if (node.points.size() > kMaxLeafPoints && node.depth < kMaxDepth)
+					Split(nodes, index);
+				return;
+			}
+
+			size_t cell = GridCell(node, point.position);
+			uint64_t bit = 1ull << (cell & 63);
+			if ((node.occupied[cell >> 6] & bit) == 0)
+			{
+				node.occupied[cell >> 6] |= bit;
+				node.points.push_back(point);
+				return;
+			}
+
+			unsigned int octant = Octant(node, point.position);
+			if (node.children[octant] == kPointOctreeNone)
+			{
+				float half = node.size * 0.5f;
+				glm::vec3 offset((octant & 1) ? half : 0.0f, (octant & 2) ? half : 0.0f, (octant & 4) ? half : 0.0f);
+				node.children[octant] = (uint32_t)nodes.size();
+				nodes.push_back(MakeNode(node.min + offset, half, node.depth + 1));
+			}
+			index = node.children[octant];
+		}
+	}
+
+	void Split(std::deque<BuildNode> &nodes, uint32_t index)
+	{
+		std::vector<Point> points;
+		points.swap(nodes[index].points);
+		nodes[index].occupied.assign(kGridWords, 0);
+		for (const Point &point : points)
+			Insert(nodes, index, point);
+	}
+
+	std::vector<Point> ReadChunk(const std::string &path, uint64_t pointCount)
+	{
+		std::vector<Point> points((size_t)pointCount);
+		std::ifstream file(path, std::ios::binary);
+		file.read((char *)points.data(), (std::streamsize)(points.size() * sizeof(Point)));
+		points.resize((size_t)file.gcount() / sizeof(Point));
+		return points;
+	}
+}
+
+bool PointOctreeBuilder::Build(const char *sourcePath, const char *outputPath)
+{
+	// Bounds first. Points that aren't finite are dropped here and in every pass after.
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	uint64_t pointCount = 0;
+	bool loaded = PlyLoader::LoadPoints(sourcePath, [&](const glm::vec3 *positions, const glm::vec3 *, const glm::u8vec4 *, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!IsFinite(positions[i]))
+				continue;
+			boundsMin = glm::min(boundsMin, positions[i]);
+			boundsMax = glm::max(boundsMax, positions[i]);
+			pointCount++;
+		}
+	});
+	if (!loaded || pointCount == 0)
+	{
+		std::cout << "WARNING: " << "Couldn't load points from " << sourcePath << ", only binary PLY is supported." << std::endl;
+		return false;
+	}
+
+	// Padded a little so the far faces of the bounds don't sit exactly on the edge of the cube.
+	float size = std::max(glm::compMax(boundsMax - boundsMin) * 1.0001f, 1e-6f);
+	glm::vec3 rootMin = (boundsMin + boundsMax) * 0.5f - glm::vec3(size * 0.5f);
+
+	auto countCell = [&](const glm::vec3 &position)
+	{
+		const int last = (int)kCountCells - 1;
+		return glm::clamp(glm::ivec3((position - rootMin) / size * (float)kCountCells), glm::ivec3(0), glm::ivec3(last));
+	};
+	auto countIndex = [](const glm::ivec3 &cell)
+	{
+		return (size_t)cell.x + kCountCells * ((size_t)cell.y + kCountCells * (size_t)cell.z);
+	};
+
+	std::vector<uint64_t> counts((size_t)kCountCells * kCountCells * kCountCells, 0);
+	PlyLoader::LoadPoints(sourcePath, [&](const glm::vec3 *positions, const glm::vec3 *, const glm::u8vec4 *, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (IsFinite(positions[i]))
+				counts[countIndex(countCell(positions[i]))]++;
+		}
+	});
+
+	// Cut the tree into chunks from the top down, wherever a node's cells add up to few enough points. The nodes above
+	// the chunks come first in the table, so the root is node 0.
+	std::vector<PointOctreeNode> table;
+	std::vector<BuildNode> topNodes; // The first nodes of the table, the ones above the chunks and the chunk roots.
+	std::vector<Chunk> chunks;
+	std::vector<uint32_t> cellChunks(counts.size(), kPointOctreeNone);
+
+	std::function<uint32_t(unsigned int, const glm::ivec3 &)> partition = [&](unsigned int level, const glm::ivec3 &cell) -> uint32_t
+	{
+		int span = (int)(kCountCells >> level);
+		glm::ivec3 first = cell * span;
+		uint64_t count = 0;
+		for (int z = 0; z < span; z++)
+			for (int y = 0; y < span; y++)
+				for (int x = 0; x < span; x++)
+					count += counts[countIndex(first + glm::ivec3(x, y, z))];
+		if (count == 0)
+			return kPointOctreeNone;
+
+		uint32_t index = (uint32_t)table.size();
+		float nodeSize = size / (float)(1u << level);
+		PointOctreeNode record = {};
+		record.min = rootMin + glm::vec3(cell) * nodeSize;
+		record.size = nodeSize;
+		std::fill(std::begin(record.children), std::end(record.children), kPointOctreeNone);
+		table.push_back(record);
+		topNodes.push_back(MakeNode(record.min, nodeSize, level));
+
+		if (count <= kMaxChunkPoints || level == kCountLevels)
+		{
+			for (int z = 0; z < span; z++)
+				for (int y = 0; y < span; y++)
+					for (int x = 0; x < span; x++)
+						cellChunks[countIndex(first + glm::ivec3(x, y, z))] = (uint32_t)chunks.size();
+
+			Chunk chunk;
+			chunk.node = index;
+			chunk.pointCount = count;
+			chunk.path = std::string(outputPath) + ".chunk" + std::to_string(chunks.size());
+			chunks.push_back(std::move(chunk));
+			return index;
+		}
+
+		topNodes[index].occupied.assign(kGridWords, 0);
+		for (unsigned int octant = 0; octant < 8; octant++)
+		{
+			uint32_t child = partition(level + 1, cell * 2 + glm::ivec3(octant & 1, (octant >> 1) & 1, (octant >> 2) & 1));
+			table[index].children[octant] = child;
+			topNodes[index].children[octant] = child;
+		}
+		return index;
+	};
+	partition(0, glm::ivec3(0));
+
+	// Sort the points into their chunks' files. Buffers are flushed a slice of the shared budget at a time, and the
+	// file is only open while it's written so the number of chunks isn't limited by open file handles.
+	std::error_code error;
+	bool sorted = true;
+	size_t flushPoints = (size_t)std::max<uint64_t>(1024, kBufferedPoints / chunks.size());
+	auto flush = [&](Chunk &chunk)
+	{
+		std::ofstream file(chunk.path, std::ios::binary | std::ios::app);
+		file.write((const char *)chunk.buffer.data(), (std::streamsize)(chunk.buffer.size() * sizeof(Point)));
+		sorted = sorted && file.good();
+		chunk.buffer.clear();
+	};
+	for (Chunk &chunk : chunks) // Left over from a cook that was cut short.
+		std::filesystem::remove(chunk.path, error);
+
+	PlyLoader::LoadPoints(sourcePath, [&](const glm::vec3 *positions, const glm::vec3 *normals, const glm::u8vec4 *colors, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!IsFinite(positions[i]))
+				continue;
+
+			Point point;
+			point.position = positions[i];
+			point.color = colors != nullptr ? PackColor(colors[i]) : 0xFFFFFFFF;
+			point.normal = normals != nullptr ? PackNormal(normals[i]) : 0;
+
+			Chunk &chunk = chunks[cellChunks[countIndex(countCell(positions[i]))]];
+			chunk.buffer.push_back(point);
+			if (chunk.buffer.size() >= flushPoints)
+				flush(chunk);
+		}
+	});
+	for (Chunk &chunk : chunks)
+	{
+		if (!chunk.buffer.empty())
+			flush(chunk);
+		chunk.buffer.shrink_to_fit();
+	}
+
+	std::ofstream file(outputPath, std::ios::binary | std::ios::trunc);
+	if (!sorted || !file)
+	{
+		std::cout << "WARNING: " << "Couldn't write point cloud file " << outputPath << std::endl;
+		for (Chunk &chunk : chunks)
+			std::filesystem::remove(chunk.path, error);
+		return false;
+	}
+
+	PointOctreeHeader header = {};
+	file.write((const char *)&header, sizeof(header));
+	uint64_t position = sizeof(header);
+
+	auto writeNode = [&](uint32_t index, const BuildNode &node)
+	{
+		PointOctreeNode &record = table[index];
+		record.offset = position;
+		record.pointCount = (uint32_t)node.points.size();
+		record.spacing = Spacing(node);
+		file.write((const char *)node.points.data(), (std::streamsize)(node.points.size() * sizeof(Point)));
+		position += node.points.size() * sizeof(Point);
+		header.depth = std::max(header.depth, node.depth);
+	};
+
+	// Build each chunk's subtree. Points are shuffled first since the first to reach a grid cell keeps it, so the order
+	// decides which points make up each node's sample. Everything under the chunk root is final once it's built.
+	std::mt19937 random(0x5EED);
+	for (Chunk &chunk : chunks)
+	{
+		std::vector<Point> points = ReadChunk(chunk.path, chunk.pointCount);
+		std::filesystem::remove(chunk.path, error);
+		std::shuffle(points.begin(), points.end(), random);
+
+		std::deque<BuildNode> nodes;
+		nodes.push_back(std::move(topNodes[chunk.node]));
+		for (const Point &point : points)
+			Insert(nodes, 0, point);
+		std::vector<Point>().swap(points);
+
+		uint32_t base = (uint32_t)table.size() - 1; // Node i of the chunk goes in the table at base + i, except its root.
+		for (size_t i = 1; i < nodes.size(); i++)
+		{
+			PointOctreeNode record = {};
+			record.min = nodes[i].min;
+			record.size = nodes[i].size;
+			table.push_back(record);
+		}
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			uint32_t index = i == 0 ? chunk.node : base + (uint32_t)i;
+			for (unsigned int octant = 0; octant < 8; octant++)
+				table[index].children[octant] = nodes[i].children[octant] == kPointOctreeNone ? kPointOctreeNone : base + nodes[i].children[octant];
+			if (i > 0)
+				writeNode(index, nodes[i]);
+		}
+		topNodes[chunk.node] = std::move(nodes[0]);
+	}
+
+	// The chunk roots hold an even sample of their chunks, which is all the nodes above them need. Each of those points
+	// moves up to the highest node with its grid cell still free, or stays put. Octants come from the count grid so
+	// the walk follows the same cells the points were sorted by.
+	for (Chunk &chunk : chunks)
+	{
+		std::vector<Point> kept;
+		for (const Point &point : topNodes[chunk.node].points)
+		{
+			glm::ivec3 cell = countCell(point.position);
+			uint32_t index = 0;
+			unsigned int level = 0;
+			while (index != chunk.node)
+			{
+				BuildNode &node = topNodes[index];
+				size_t gridCell = GridCell(node, point.position);
+				uint64_t bit = 1ull << (gridCell & 63);
+				if ((node.occupied[gridCell >> 6] & bit) == 0)
+				{
+					node.occupied[gridCell >> 6] |= bit;
+					node.points.push_back(point);
+					break;
+				}
+
+				unsigned int shift = kCountLevels - 1 - level;
+				unsigned int octant = ((cell.x >> shift) & 1) | (((cell.y >> shift) & 1) << 1) | (((cell.z >> shift) & 1) << 2);
+				index = node.children[octant];
+				level++;
+			}
+			if (index == chunk.node)
+				kept.push_back(point);
+		}
+		topNodes[chunk.node].points.swap(kept);
+	}
+
+	for (uint32_t i = 0; i < (uint32_t)topNodes.size(); i++)
+		writeNode(i, topNodes[i]);
+
+	header.magic = kPointOctreeMagic;
+	header.version = kPointOctreeVersion;
+	header.nodeCount = (uint32_t)table.size();
+	header.pointCount = pointCount;
+	header.nodeOffset = position;
+	header.boundsMin = rootMin;
+	header.boundsSize = size;
+	file.write((const char *)table.data(), (std::streamsize)(table.size() * sizeof(PointOctreeNode)));
+	file.seekp(0);
+	file.write((const char *)&header, sizeof(header));
+
+	if (!file)
+	{
+		std::cout << "WARNING: " << "Failed writing point cloud file " << outputPath << std::endl;
+		return false;
+	}
+	return true;
+}
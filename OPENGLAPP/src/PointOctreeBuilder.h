@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Common.h"
+
+// Cooks a point cloud into an octree file for PointCloud to stream. Points are counted on a coarse grid, sorted into
+// chunks small enough to build in memory through temporary files next to the output, and each chunk's subtree is
+// built and written on its own before the nodes above the chunks are filled from what their roots kept. Never holds
+// more than a chunk of points at once, so it works on scans far bigger than RAM, just slowly.
+class PointOctreeBuilder
+{
+public:
+	// Returns false if the source couldn't be read (only binary PLY is supported) or the output couldn't be written.
+	static bool Build(const char *sourcePath, const char *outputPath);
+
+};
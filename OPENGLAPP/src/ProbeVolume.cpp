@@ -0,0 +1,321 @@
+#include "ProbeVolume.h"
+
+#include "Scene.h"
+#include "Instance.h"
+#include "Mesh.h"
+#include "Light.h"
+#include "Shader.h"
+#include "EnvironmentMap.h"
+#include "SamplerCache.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <unordered_set>
+
+#include <glad.h>
+
+const float ProbeVolume::kDefaultSpacing = 2.0f;
+const float ProbeVolume::kAlbedo = 0.5f;
+
+namespace
+{
+	const size_t kProbesPerTask = 4;
+	const float kInfluence = 2.0f; // Probe spacings around a changed instance that are baked again.
+	const float kRayBias = 1e-4f; // Of the volume's size, keeps rays off the surface they start from.
+
+	// L1 spherical harmonics, in the same order as the environment map's.
+	glm::vec4 EvaluateBasis(const glm::vec3 &d)
+	{
+		return glm::vec4(0.282095f, 0.488603f * d.y, 0.488603f * d.z, 0.488603f * d.x);
+	}
+
+	// Spread evenly over the sphere on a Fibonacci spiral, the same for every probe.
+	std::vector<glm::vec3> MakeRayDirections()
+	{
+		std::vector<glm::vec3> directions(ProbeVolume::kRayCount);
+		const float goldenAngle = glm::pi<float>() * (3.0f - std::sqrt(5.0f));
+		for (unsigned int i = 0; i < ProbeVolume::kRayCount; i++)
+		{
+			float y = 1.0f - 2.0f * (i + 0.5f) / ProbeVolume::kRayCount;
+			float radius = std::sqrt(std::max(1.0f - y * y, 0.0f));
+			float phi = goldenAngle * i;
+			directions[i] = glm::vec3(radius * std::cos(phi), y, radius * std::sin(phi));
+		}
+		return directions;
+	}
+
+	// The scene's lights, copied once per bake so the workers don't touch the scene.
+	struct Lighting
+	{
+		glm::vec3 sunDirection; // Towards the sun.
+		glm::vec3 sunColor;
+		std::vector<PointLight> pointLights;
+		std::vector<SpotLight> spotLights;
+		const EnvironmentMap *environment; // Null for the flat ambient colour.
+		glm::vec3 ambient;
+
+		// Only as sharp as the environment's spherical harmonics, which is as much as L1 probes can keep anyway.
+		glm::vec3 GetSky(const glm::vec3 &direction) const
+		{
+			return environment != nullptr ? environment->Evaluate(direction) : ambient;
+		}
+
+		// Light arriving at a point straight from the lights, shadowed by the triangles. Falls off as the lit
+		// shader's does.
+		glm::vec3 GetDirect(const TriangleBvh &bvh, const glm::vec3 &position, const glm::vec3 &normal) const
+		{
+			glm::vec3 light(0.0f);
+			float sunCosine = glm::dot(normal, sunDirection);
+			if (sunCosine > 0.0f && !bvh.IsOccluded(position, sunDirection, FLT_MAX))
+				light += sunColor * sunCosine;
+
+			auto addLight = [&](const Light &source, float cone, const glm::vec3 &offset)
+			{
+				float distance = glm::length(offset);
+				glm::vec3 direction = offset / std::max(distance, 1e-4f);
+				float cosine = glm::dot(normal, direction);
+				if (cosine > 0.0f && cone > 0.0f && !bvh.IsOccluded(position, direction, distance))
+					light += glm::vec3(source.color) * source.intensity * cone * cosine / (distance * distance);
+			};
+			for (const PointLight &pointLight : pointLights)
+				addLight(pointLight, 1.0f, glm::vec3(pointLight.position) - position);
+			for (const SpotLight &spotLight : spotLights)
+			{
+				glm::vec3 offset = glm::vec3(spotLight.position) - position;
+				float theta = glm::dot(glm::normalize(offset), glm::normalize(-glm::vec3(spotLight.direction)));
+				float cone = glm::clamp((theta - spotLight.outerCutoff) / (spotLight.innerCutoff - spotLight.outerCutoff), 0.0f, 1.0f);
+				addLight(spotLight, cone, offset);
+			}
+			return light;
+		}
+	};
+}
+
+ProbeVolume::~ProbeVolume()
+{
+	Release();
+}
+
+unsigned int ProbeVolume::Bake(Scene &scene, bool all)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Where every static instance is now, and the bounds either side of any move.
+	std::unordered_map<unsigned int, Placement> placements;
+	std::vector<std::pair<glm::vec3, glm::vec3>> changed;
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (Instance *instance : *scene.GetInstances())
+	{
+		Mesh *mesh = instance->GetMesh();
+		if (mesh == nullptr || instance->GetAnimator() != nullptr)
+			continue;
+		if (mesh->IsLoading()) // Read back part way through, it would be cached without the rest. Added once it's done.
+			continue;
+		const std::vector<glm::vec3> &triangles = GetMeshTriangles(mesh);
+		if (triangles.empty())
+			continue;
+
+		const glm::mat4 &transform = instance->GetTransform();
+		auto previous = m_placements.find(instance->GetId());
+		Placement placement;
+		if (previous != m_placements.end() && previous->second.meshId == mesh->GetId() && previous->second.transform == transform)
+		{
+			placement = previous->second;
+		}
+		else
+		{
+			placement = { mesh, mesh->GetId(), transform, glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+			for (const glm::vec3 &position : triangles)
+			{
+				glm::vec3 world = glm::vec3(transform * glm::vec4(position, 1.0f));
+				placement.minimum = glm::min(placement.minimum, world);
+				placement.maximum = glm::max(placement.maximum, world);
+			}
+			changed.push_back({ placement.minimum, placement.maximum });
+			if (previous != m_placements.end())
+				changed.push_back({ previous->second.minimum, previous->second.maximum });
+		}
+		minimum = glm::min(minimum, placement.minimum);
+		maximum = glm::max(maximum, placement.maximum);
+		placements[instance->GetId()] = placement;
+	}
+	for (const auto &pair : m_placements)
+	{
+		if (placements.find(pair.first) == placements.end())
+			changed.push_back({ pair.second.minimum, pair.second.maximum });
+	}
+
+	if (placements.empty())
+	{
+		Release();
+		return 0;
+	}
+	if (!all && IsBaked() && changed.empty())
+		return 0;
+
+	// The grid only moves when it has to grow, so instances moving about inside it stay incremental.
+	glm::vec3 padding(m_spacing * 0.5f);
+	minimum -= padding;
+	maximum += padding;
+	bool contained = IsBaked() && glm::all(glm::greaterThanEqual(minimum, m_minimum)) && glm::all(glm::lessThanEqual(maximum, m_maximum));
+	if (all || !contained)
+	{
+		Resize(minimum, maximum);
+		all = true;
+	}
+
+	m_placements = std::move(placements);
+	std::vector<glm::vec3> world;
+	for (const auto &pair : m_placements)
+	{
+		const Placement &placement = pair.second;
+		for (const glm::vec3 &position : GetMeshTriangles(placement.mesh))
+			world.push_back(glm::vec3(placement.transform * glm::vec4(position, 1.0f)));
+	}
+
+	// Meshes no instance uses any more are dropped, they may well have been freed.
+	std::unordered_set<unsigned int> used;
+	for (const auto &pair : m_placements)
+		used.insert(pair.second.meshId);
+	for (auto it = m_meshTriangles.begin(); it != m_meshTriangles.end();)
+		it = used.count(it->first) ? std::next(it) : m_meshTriangles.erase(it);
+	m_bvh.Build(std::move(world));
+
+	std::vector<glm::uvec3> dirty;
+	glm::vec3 step = (m_maximum - m_minimum) / glm::vec3(m_counts - 1u);
+	glm::vec3 margin(kInfluence * std::max(step.x, std::max(step.y, step.z)));
+	for (unsigned int z = 0; z < m_counts.z; z++)
+	{
+		for (unsigned int y = 0; y < m_counts.y; y++)
+		{
+			for (unsigned int x = 0; x < m_counts.x; x++)
+			{
+				glm::vec3 position = GetProbePosition(x, y, z);
+				bool nearby = all;
+				for (size_t i = 0; i < changed.size() && !nearby; i++)
+				{
+					nearby = glm::all(glm::greaterThanEqual(position, changed[i].first - margin)) &&
+						glm::all(glm::lessThanEqual(position, changed[i].second + margin));
+				}
+				if (nearby)
+					dirty.push_back(glm::uvec3(x, y, z));
+			}
+		}
+	}
+
+	Lighting lighting;
+	SunLight *sunLight = scene.GetSunLight();
+	lighting.sunDirection = glm::normalize(glm::vec3(sunLight->direction));
+	lighting.sunColor = glm::vec3(sunLight->color);
+	lighting.pointLights = *scene.GetPointLights();
+	lighting.spotLights = *scene.GetSpotLights();
+	lighting.environment = scene.GetEnvironment() != nullptr && scene.GetEnvironment()->IsLoaded() ? scene.GetEnvironment() : nullptr;
+	lighting.ambient = scene.GetAmbientLight();
+
+	static const std::vector<glm::vec3> directions = MakeRayDirections();
+	float bias = kRayBias * glm::length(m_maximum - m_minimum);
+	size_t blockSize = GetProbeCount();
+	ThreadPool::Get().ParallelFor(dirty.size(), kProbesPerTask, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const glm::uvec3 &probe = dirty[i];
+			glm::vec3 origin = GetProbePosition(probe.x, probe.y, probe.z);
+			glm::vec4 red(0.0f), green(0.0f), blue(0.0f);
+			for (const glm::vec3 &direction : directions)
+			{
+				glm::vec3 radiance;
+				TriangleBvh::Hit hit;
+				if (m_bvh.Intersect(origin, direction, FLT_MAX, hit))
+				{
+					// Surfaces are lit from whichever side the ray arrived on, with the sky as if nothing blocked it.
+					glm::vec3 normal = m_bvh.GetNormal(hit.triangle);
+					if (glm::dot(normal, direction) > 0.0f)
+						normal = -normal;
+					glm::vec3 position = origin + direction * hit.distance + normal * bias;
+					radiance = kAlbedo * (lighting.GetDirect(m_bvh, position, normal) + lighting.GetSky(normal));
+				}
+				else
+				{
+					radiance = lighting.GetSky(direction);
+				}
+
+				glm::vec4 basis = EvaluateBasis(direction);
+				red += basis * radiance.r;
+				green += basis * radiance.g;
+				blue += basis * radiance.b;
+			}
+
+			// Averaged over the sphere, then convolved with the cosine lobe so they give irradiance over pi, as the
+			// environment's do.
+			glm::vec4 scale = glm::vec4(1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f) * (4.0f * glm::pi<float>() / kRayCount);
+			size_t texel = ((size_t)probe.z * m_counts.y + probe.y) * m_counts.x + probe.x;
+			m_texels[texel] = red * scale;
+			m_texels[blockSize + texel] = green * scale;
+			m_texels[blockSize * 2 + texel] = blue * scale;
+		}
+	});
+
+	glTextureSubImage3D(m_texture, 0, 0, 0, 0, m_counts.x, m_counts.y, m_counts.z * 3, GL_RGBA, GL_FLOAT, m_texels.data());
+
+	m_lastBakedCount = (unsigned int)dirty.size();
+	m_lastBakeTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return m_lastBakedCount;
+}
+
+const std::vector<glm::vec3> &ProbeVolume::GetMeshTriangles(Mesh *mesh)
+{
+	auto it = m_meshTriangles.find(mesh->GetId());
+	if (it == m_meshTriangles.end())
+	{
+		it = m_meshTriangles.emplace(mesh->GetId(), std::vector<glm::vec3>()).first;
+		mesh->GetTriangles(it->second);
+	}
+	return it->second;
+}
+
+void ProbeVolume::Resize(const glm::vec3 &minimum, const glm::vec3 &maximum)
+{
+	m_minimum = minimum;
+	m_maximum = maximum;
+	glm::vec3 extent = maximum - minimum;
+	for (int axis = 0; axis < 3; axis++)
+		m_counts[axis] = (unsigned int)glm::clamp((int)std::ceil(extent[axis] / m_spacing) + 1, 2, (int)kMaxProbesPerAxis);
+
+	if (m_texture != 0)
+		glDeleteTextures(1, &m_texture);
+	glCreateTextures(GL_TEXTURE_3D, 1, &m_texture);
+	glTextureStorage3D(m_texture, 1, GL_RGBA16F, m_counts.x, m_counts.y, m_counts.z * 3);
+	m_texels.assign((size_t)GetProbeCount() * 3, glm::vec4(0.0f));
+}
+
+glm::vec3 ProbeVolume::GetProbePosition(unsigned int x, unsigned int y, unsigned int z) const
+{
+	return m_minimum + (m_maximum - m_minimum) * (glm::vec3(x, y, z) / glm::vec3(m_counts - 1u));
+}
+
+void ProbeVolume::Bind(aie::ShaderProgram *shader) const
+{
+	// Linear and clamped like a render target, the texture's filtering is the interpolation between probes.
+	glBindTextureUnit(kUnit, m_texture);
+	SamplerCache::Get().Bind(kUnit, SamplerState::RenderTarget());
+	shader->bindUniform("probeVolumeMin", m_minimum);
+	shader->bindUniform("probeVolumeSize", m_maximum - m_minimum);
+	shader->bindUniform("probeCounts", glm::vec3(m_counts));
+	shader->bindUniform("probeNormalBias", m_spacing * 0.25f);
+}
+
+void ProbeVolume::Release()
+{
+	if (m_texture != 0)
+		glDeleteTextures(1, &m_texture);
+	m_texture = 0;
+	m_counts = glm::uvec3(0);
+	m_texels.clear();
+	m_placements.clear();
+	m_meshTriangles.clear();
+	m_bvh.Clear();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Common.h"
+
+#include "TriangleBvh.h"
+
+#include <unordered_map>
+
+namespace aie
+{
+	class ShaderProgram;
+}
+
+class Instance;
+class Mesh;
+class Scene;
+
+// Indirect diffuse light for static scenes, baked into a grid of probes over the scene's bounds. Each probe traces
+// rays against a BVH of every static instance's triangles across the thread pool. A ray that escapes brings back the
+// sky, the environment map or the ambient colour. A ray that hits brings back the direct light and sky at the hit,
+// bounced off a grey surface. The result is kept as L1 spherical harmonics in a 3D texture the lit shader samples
+// trilinearly, the red, green and blue coefficients stacked along z.
+//
+// Baking is incremental. Only probes near an instance that's been added, moved or removed since the last bake are
+// traced again. Changing the lights, the sky or the bounds needs everything re-baked. Skinned instances move on
+// their own and are left out.
+class ProbeVolume
+{
+public:
+	static const unsigned int kMaxProbesPerAxis = 16;
+	static const unsigned int kRayCount = 128; // Per probe.
+	static const unsigned int kUnit = 14; // Texture unit, after the environment map.
+	static const float kDefaultSpacing; // World units between probes, wider if the bounds need more than the limit.
+	static const float kAlbedo; // Of every surface a ray hits.
+
+public:
+	ProbeVolume() = default;
+	~ProbeVolume();
+
+	ProbeVolume(const ProbeVolume &) = delete;
+	ProbeVolume &operator=(const ProbeVolume &) = delete;
+
+	// Bakes the probes near anything that changed since the last bake, or every probe if all is set or the grid
+	// has to change. Returns how many probes were traced, zero if nothing had changed.
+	unsigned int Bake(Scene &scene, bool all = false);
+	void Release();
+
+	// Binds the texture and the grid for the lit shader.
+	void Bind(aie::ShaderProgram *shader) const;
+
+	bool IsBaked() const { return m_texture != 0; }
+	float GetSpacing() const { return m_spacing; }
+	void SetSpacing(float spacing) { m_spacing = glm::max(spacing, 0.1f); } // Takes effect on the next full bake.
+
+	glm::uvec3 GetProbeCounts() const { return m_counts; }
+	unsigned int GetProbeCount() const { return m_counts.x * m_counts.y * m_counts.z; }
+	unsigned int GetTriangleCount() const { return m_bvh.GetTriangleCount(); }
+	unsigned int GetLastBakedCount() const { return m_lastBakedCount; }
+	float GetLastBakeTime() const { return m_lastBakeTime; } // Milliseconds.
+
+private:
+	// Where each static instance was at the last bake.
+	struct Placement
+	{
+		Mesh *mesh; // Only followed while the instance is in the scene.
+		unsigned int meshId;
+		glm::mat4 transform;
+		glm::vec3 minimum; // World space bounds.
+		glm::vec3 maximum;
+	};
+
+	const std::vector<glm::vec3> &GetMeshTriangles(Mesh *mesh);
+	void Resize(const glm::vec3 &minimum, const glm::vec3 &maximum);
+	glm::vec3 GetProbePosition(unsigned int x, unsigned int y, unsigned int z) const;
+
+private:
+	float m_spacing = kDefaultSpacing;
+	glm::vec3 m_minimum = glm::vec3(0.0f);
+	glm::vec3 m_maximum = glm::vec3(0.0f);
+	glm::uvec3 m_counts = glm::uvec3(0);
+
+	// Keyed by Instance::GetId and Mesh::GetId, so a new object at a freed one's address isn't taken for it.
+	std::unordered_map<unsigned int, Placement> m_placements;
+	std::unordered_map<unsigned int, std::vector<glm::vec3>> m_meshTriangles; // Model space, read back once per mesh.
+	TriangleBvh m_bvh; // Every static instance, as of the last bake.
+
+	std::vector<glm::vec4> m_texels; // As the texture lays them out, each texel a channel's four coefficients.
+	unsigned int m_texture = 0; // RGBA16F.
+
+	unsigned int m_lastBakedCount = 0;
+	float m_lastBakeTime = 0.0f;
+
+};
@@ -1,4 +1,5 @@
 #include "RenderTarget.h"
+#include "SamplerCache.h"
 #include "glad.h"
 #include <vector>
 
@@ -28,16 +29,12 @@ bool RenderTarget::initialise(unsigned int targetCount, unsigned int width, unsi
 	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
 
     if (use_depth_texture) {
-        glGenTextures(1, &m_depthTarget);
-        glBindTexture(GL_TEXTURE_2D, m_depthTarget);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+        // filtering comes from the sampler it's bound with
+        glCreateTextures(GL_TEXTURE_2D, 1, &m_depthTarget);
+        glTextureStorage2D(m_depthTarget, 1, GL_DEPTH_COMPONENT24, width, height);
 
         //bind texture to depth map
         glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTarget, 0);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glBindTexture(GL_TEXTURE_2D, 0);
     }
     else { // setup and bind a 24bit depth buffer as a render buffer
         glGenRenderbuffers(1, &m_rbo);
@@ -111,9 +108,10 @@ void RenderTarget::unbind() {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void RenderTarget::bindDepthTarget(unsigned int index) const {
+void RenderTarget::bindDepthTarget(unsigned int index, bool compare) const {
     glActiveTexture(GL_TEXTURE0 + index);
     glBindTexture(GL_TEXTURE_2D, m_depthTarget);
+    SamplerCache::Get().Bind(index, compare ? SamplerState::Shadow() : SamplerState::Data());
 }
 
 } // namespace aie
\ No newline at end of file
@@ -23,7 +23,8 @@ public:
 
 	unsigned int	getTargetCount() const { return m_targetCount; }
 	const Texture&	getTarget(unsigned int target) const { return m_targets[target]; }
-    void            bindDepthTarget(unsigned int index) const;
+    // read by texel, or with depth comparison for a sampler2DShadow
+    void            bindDepthTarget(unsigned int index, bool compare = false) const;
 
 protected:
 
@@ -0,0 +1,89 @@
+#include "SamplerCache.h"
+
+#include <algorithm>
+
+#include <glad.h>
+
+const float SamplerCache::kDefaultAnisotropy = 8.0f;
+
+SamplerCache &SamplerCache::Get()
+{
+	static SamplerCache cache;
+	return cache;
+}
+
+unsigned int SamplerCache::GetSampler(const SamplerState &state)
+{
+	for (const auto &sampler : m_samplers)
+	{
+		if (sampler.first == state)
+			return sampler.second;
+	}
+
+	if (m_anisotropy == 0.0f)
+		m_anisotropy = std::min(kDefaultAnisotropy, GetMaxAnisotropy());
+
+	unsigned int sampler = 0;
+	glCreateSamplers(1, &sampler);
+	switch (state.filter)
+	{
+	case SamplerState::NEAREST:
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		break;
+	case SamplerState::LINEAR:
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		break;
+	case SamplerState::TRILINEAR:
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		break;
+	}
+
+	GLint wrap = state.repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, wrap);
+
+	if (state.anisotropic && state.filter == SamplerState::TRILINEAR)
+		glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY, m_anisotropy);
+	if (state.compare)
+	{
+		glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+
+	m_samplers.emplace_back(state, sampler);
+	return sampler;
+}
+
+void SamplerCache::Bind(unsigned int unit, const SamplerState &state)
+{
+	glBindSampler(unit, GetSampler(state));
+}
+
+void SamplerCache::SetAnisotropy(float anisotropy)
+{
+	m_anisotropy = glm::clamp(anisotropy, 1.0f, GetMaxAnisotropy());
+	for (const auto &sampler : m_samplers)
+	{
+		if (sampler.first.anisotropic && sampler.first.filter == SamplerState::TRILINEAR)
+			glSamplerParameterf(sampler.second, GL_TEXTURE_MAX_ANISOTROPY, m_anisotropy);
+	}
+}
+
+float SamplerCache::GetMaxAnisotropy() const
+{
+	// Core since 4.6, where it isn't there the query leaves it alone.
+	float maxAnisotropy = 1.0f;
+	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropy);
+	return std::max(maxAnisotropy, 1.0f);
+}
+
+void SamplerCache::Release()
+{
+	for (const auto &sampler : m_samplers)
+		glDeleteSamplers(1, &sampler.second);
+	m_samplers.clear();
+}
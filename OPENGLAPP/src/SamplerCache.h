@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Common.h"
+
+// How a texture is filtered and wrapped, kept apart from the texture in a sampler object so every texture sampled the
+// same way shares one.
+struct SamplerState
+{
+	enum Filter : unsigned int
+	{
+		NEAREST,
+		LINEAR, // Bilinear, for textures with no mips worth using.
+		TRILINEAR
+	};
+
+	Filter filter = TRILINEAR;
+	bool repeat = true; // Otherwise clamped to the edge.
+	bool anisotropic = false; // Up to the cache's anisotropy, trilinear only.
+	bool compare = false; // Depth comparison for shadow maps, sampled with sampler2DShadow.
+
+	bool operator==(const SamplerState &other) const
+	{
+		return filter == other.filter && repeat == other.repeat && anisotropic == other.anisotropic && compare == other.compare;
+	}
+
+	// What each kind of texture uses.
+	static SamplerState Material() { return { TRILINEAR, true, true, false }; }
+	static SamplerState RenderTarget() { return { LINEAR, false, false, false }; }
+	static SamplerState Data() { return { NEAREST, false, false, false }; } // Fetched by texel, never filtered.
+	static SamplerState Shadow() { return { LINEAR, false, false, true }; }
+	static SamplerState Environment() { return { TRILINEAR, false, false, false }; } // Prefiltered, the mips are the blur.
+};
+
+// Every distinct sampler state as one sampler object, made the first time it's asked for and kept. Textures hold on
+// to the sampler they're drawn with and bind it alongside themselves, so nothing sets filtering on the textures. The
+// anisotropy applies to every anisotropic sampler and is changed on them in place, their handles never change.
+class SamplerCache
+{
+public:
+	static const float kDefaultAnisotropy; // Clamped to what the driver supports.
+
+public:
+	static SamplerCache &Get(); // Shared cache, created on first use.
+
+	unsigned int GetSampler(const SamplerState &state);
+	void Bind(unsigned int unit, const SamplerState &state); // Until something else is bound to the unit.
+
+	void SetAnisotropy(float anisotropy);
+	float GetAnisotropy() const { return m_anisotropy; }
+	float GetMaxAnisotropy() const; // Whatever the driver supports, 1 if it doesn't.
+	unsigned int GetSamplerCount() const { return (unsigned int)m_samplers.size(); }
+
+	void Release(); // Frees every sampler, call before the GL context goes.
+
+private:
+	std::vector<std::pair<SamplerState, unsigned int>> m_samplers; // Few enough to search.
+	float m_anisotropy = 0.0f; // Zero until the driver has been asked.
+
+};
@@ -1,8 +1,13 @@
 #include "Scene.h"
 
+#include "Application.h"
+#include "Camera.h"
 #include "Light.h"
+#include "Mesh.h"
 
 #include <iostream>
+#include <cmath>
+#include <unordered_set>
 
 #include <glad.h>
 
@@ -10,6 +15,7 @@
 
 Scene::Scene(Camera *camera, SunLight &sunLight, glm::vec3 ambientLight)
 	: m_sceneCamera(camera)
+	, m_currentCamera(camera)
 	, m_sunLight(sunLight)
 	, m_ambientLight(ambientLight)
 { 
@@ -33,6 +39,9 @@ Scene::~Scene()
 
 void Scene::Update(float dt)
 {
+	m_animation.Update(dt);
+	UpdateMeshes(); // Before choosing levels of detail, a load may have brought in more.
+	SelectLods(dt);
 }
 
 void Scene::LateUpdate(float dt)
@@ -55,6 +64,34 @@ void Scene::Draw()
 	}
 }
 
+void Scene::UpdateMeshes()
+{
+	std::unordered_set<Mesh *> updated;
+	for (auto it = m_instances.begin(); it != m_instances.end(); ++it)
+	{
+		Mesh *mesh = (*it)->GetMesh();
+		if (updated.insert(mesh).second)
+			mesh->Update();
+	}
+}
+
+void Scene::SelectLods(float dt)
+{
+	if (m_currentCamera == nullptr)
+		return;
+
+	// Same 90 degree field of view the instances draw with.
+	float windowHeight = (float)Application::GetInstance()->GetWindowHeight();
+	float pixelsPerUnit = windowHeight / (2.0f * std::tan(glm::radians(90.0f) * 0.5f));
+
+	for (auto it = m_instances.begin(); it != m_instances.end(); ++it)
+	{
+		Instance *instance = *it;
+		instance->UpdateLod(m_currentCamera->GetPosition(), pixelsPerUnit, m_lodErrorThreshold, m_lodFadeTime, dt);
+		instance->RequestTextures(m_currentCamera->GetPosition(), pixelsPerUnit);
+	}
+}
+
 void Scene::AddInstance(Instance *instance)
 {
 	if (m_instances.size() >= MAX_INSTANCES)
@@ -64,6 +101,8 @@ void Scene::AddInstance(Instance *instance)
 	}
 
 	m_instances.push_back(instance);
+	if (instance->GetAnimator())
+		m_animation.Add(instance->GetAnimator());
 }
 
 void Scene::RemoveInstance(Instance *instance)
@@ -139,6 +178,8 @@ void Scene::CheckInstanceDeletion()
 			m_instances.erase(i, m_instances.end());
 			auto j = std::remove(m_instancesToDelete.begin(), m_instancesToDelete.end(), instance);
 			m_instancesToDelete.erase(j, m_instancesToDelete.end());
+			if (instance->GetAnimator())
+				m_animation.Remove(instance->GetAnimator());
 			delete instance;
 			break;
 		}
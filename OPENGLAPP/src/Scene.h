@@ -5,11 +5,14 @@
 #include "Instance.h"
 
 #include "Light.h"
+#include "Animation.h"
 
 #define MAX_LIGHTS 16
 #define MAX_INSTANCES 128
 
 class Camera;
+class EnvironmentMap;
+class ProbeVolume;
 
 class Scene
 {
@@ -33,6 +36,10 @@ public:
 	void RemoveSpotLight(SpotLight *light);
 
 	glm::vec3 &GetAmbientLight() { return m_ambientLight; }
+	EnvironmentMap *GetEnvironment() const { return m_environment; }
+	void SetEnvironment(EnvironmentMap *environment) { m_environment = environment; } // Lights instead of the ambient colour, null to go back to it.
+	ProbeVolume *GetProbeVolume() const { return m_probeVolume; }
+	void SetProbeVolume(ProbeVolume *probeVolume) { m_probeVolume = probeVolume; } // Indirect light inside its bounds, over the ambient light.
 	SunLight *GetSunLight() { return &m_sunLight; }
 
 	std::vector<PointLight> *GetPointLights() { return &m_pointLights; }
@@ -41,10 +48,17 @@ public:
 	unsigned int &GetPointLightBufferID() { return m_pointLightSBO; }
 	unsigned int &GetSpotLightBufferID() { return m_spotLightSBO; }
 
+	// Largest error, in pixels, a simplified level of detail can show before switching to a finer one.
+	float &GetLodErrorThreshold() { return m_lodErrorThreshold; }
+	float &GetLodFadeTime() { return m_lodFadeTime; }
+
 	Camera *GetCamera() const { return m_currentCamera; }
 	void SetCamera(Camera *camera) { m_currentCamera = camera; }
 
 protected:
+	void UpdateMeshes(); // Each mesh once, however many instances share it.
+	void SelectLods(float dt);
+
 	void CheckInstanceDeletion();
 	void CheckPointLightDeletion();
 	void CheckSpotLightDeletion();
@@ -54,6 +68,8 @@ protected:
 	Camera *m_currentCamera;
 
 	glm::vec3 m_ambientLight;
+	EnvironmentMap *m_environment = nullptr; // Not owned.
+	ProbeVolume *m_probeVolume = nullptr; // Not owned.
 	SunLight &m_sunLight;
 
 	std::vector<PointLight> m_pointLights;
@@ -68,4 +84,9 @@ protected:
 	std::vector<Instance*> m_instances;
 	std::vector<Instance*> m_instancesToDelete;
 
+	AnimationSystem m_animation; // Poses every skinned instance.
+
+	float m_lodErrorThreshold = 1.0f;
+	float m_lodFadeTime = 0.25f; // Seconds, zero switches instantly.
+
 };
@@ -1,6 +1,7 @@
 #include "Shader.h"
 #include <cstdio>
 #include <cassert>
+#include <cstring>
 //#include "gl_core_4_4.h"
 #include <glad.h>
 
@@ -110,6 +111,7 @@ void ShaderProgram::attachShader(const std::shared_ptr<Shader>& shader) {
 }
 
 bool ShaderProgram::link() {
+	m_uniformCache.clear();
 	m_program = glCreateProgram();
 	for (auto& s : m_shaders)
 		if (s != nullptr)
@@ -139,6 +141,14 @@ int ShaderProgram::getUniform(const char* name) {
 	return glGetUniformLocation(m_program, name);
 }
 
+int ShaderProgram::getCachedUniform(const char* name) {
+	for (auto& cached : m_uniformCache)
+		if (std::strcmp(cached.first.c_str(), name) == 0)
+			return cached.second;
+	m_uniformCache.emplace_back(name, getUniform(name));
+	return m_uniformCache.back().second;
+}
+
 bool ShaderProgram::bindUniform(const char* name, int value) {
 	assert(m_program > 0 && "Invalid shader program");
 	int i = glGetUniformLocation(m_program, name);
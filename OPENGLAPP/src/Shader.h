@@ -7,6 +7,8 @@
 #include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace aie {
 
@@ -71,6 +73,9 @@ public:
 	unsigned int getHandle() const { return m_program; }
 
 	int getUniform(const char* name);
+	// looks the name up once and keeps the location until the program is linked again. programs only cache a
+	// handful, so they're searched in order and a hit doesn't allocate
+	int getCachedUniform(const char* name);
 
 	void bindUniform(int ID, int value);
 	void bindUniform(int ID, float value);
@@ -111,6 +116,8 @@ private:
 
 	unsigned int	m_program;
 
+	std::vector<std::pair<std::string, int>> m_uniformCache;
+
 	std::shared_ptr<Shader> m_shaders[eShaderStage::SHADER_STAGE_Count];
 
 	char*			m_lastError;
@@ -0,0 +1,372 @@
+#include "SkinnedMesh.h"
+
+#include "ThreadPool.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <climits>
+#include <filesystem>
+
+#include <glad.h>
+
+#include <assimp/scene.h>
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define SKINNING_SIMD 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	const size_t kVerticesPerTask = 1 << 14; // Don't split smaller meshes across the pool.
+
+	glm::mat4 ToMat4(const aiMatrix4x4 &m) // Row major.
+	{
+		return glm::mat4(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3, m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+	}
+}
+
+SkinnedMesh::SkinnedMesh()
+{
+	SetClusterCulling(false); // Meshlet bounds are for the bind pose.
+}
+SkinnedMesh::~SkinnedMesh()
+{
+	glDeleteBuffers(1, &m_skinVBO);
+}
+
+bool SkinnedMesh::Load(const char *filePath)
+{
+	const aiScene *scene = aiImportFile(filePath, aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenSmoothNormals | aiProcess_LimitBoneWeights);
+	if (scene == nullptr || scene->mNumMeshes == 0)
+	{
+		std::cout << "WARNING: " << "Failed to import " << filePath << ": " << aiGetErrorString() << std::endl;
+		if (scene) aiReleaseImport(scene);
+		return false;
+	}
+
+	std::vector<unsigned int> baseVertices;
+	LoadScene(scene, filePath, &baseVertices);
+	if (m_VAO == 0) // Nothing to skin.
+	{
+		aiReleaseImport(scene);
+		return false;
+	}
+
+	std::vector<int> meshJoints;
+	BuildSkeleton(scene, meshJoints);
+	LoadSkin(scene, baseVertices, meshJoints);
+	LoadClips(scene, filePath);
+	aiReleaseImport(scene);
+
+	// The bones already carry the node transforms, drawing with them as well would apply them twice.
+	for (glm::mat4 &nodeTransform : m_nodeTransforms)
+		nodeTransform = glm::mat4(1.0f);
+
+	CreateSkinBuffer();
+	return true;
+}
+
+// Every node becomes a joint, depth first so parents come before their children. Bones only reference the nodes
+// they're named after, but the nodes between them still move them.
+void SkinnedMesh::BuildSkeleton(const aiScene *scene, std::vector<int> &meshJoints)
+{
+	m_skeleton = Skeleton();
+	meshJoints.assign(scene->mNumMeshes, -1);
+
+	std::vector<std::pair<const aiNode *, int>> stack = { { scene->mRootNode, -1 } };
+	while (!stack.empty())
+	{
+		const aiNode *node = stack.back().first;
+		int parent = stack.back().second;
+		stack.pop_back();
+		if (node == nullptr)
+			continue;
+
+		aiVector3D scale, position;
+		aiQuaternion rotation;
+		node->mTransformation.Decompose(scale, rotation, position);
+
+		int joint = (int)m_skeleton.parents.size();
+		m_skeleton.names.push_back(node->mName.C_Str());
+		m_skeleton.parents.push_back(parent);
+		m_skeleton.bindTranslations.push_back(glm::vec3(position.x, position.y, position.z));
+		m_skeleton.bindRotations.push_back(glm::quat(rotation.w, rotation.x, rotation.y, rotation.z));
+		m_skeleton.bindScales.push_back(glm::vec3(scale.x, scale.y, scale.z));
+
+		for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		{
+			unsigned int mesh = node->mMeshes[i];
+			if (mesh < scene->mNumMeshes && meshJoints[mesh] < 0) // Meshes drawn by several nodes follow the first.
+				meshJoints[mesh] = joint;
+		}
+
+		for (unsigned int i = node->mNumChildren; i > 0; i--) // Reversed so children come off the stack in order.
+			stack.push_back({ node->mChildren[i - 1], joint });
+	}
+}
+
+void SkinnedMesh::LoadSkin(const aiScene *scene, const std::vector<unsigned int> &baseVertices, const std::vector<int> &meshJoints)
+{
+	std::unordered_map<std::string, unsigned int> jointsByName, bonesByName;
+	for (unsigned int i = 0; i < m_skeleton.GetJointCount(); i++)
+		jointsByName.emplace(m_skeleton.names[i], i);
+
+	m_skinWeights.assign(m_vertexCapacity, SkinWeights());
+	for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+	{
+		const aiMesh *mesh = scene->mMeshes[m];
+		if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+			continue;
+
+		SkinWeights *skin = m_skinWeights.data() + baseVertices[m];
+		for (unsigned int b = 0; b < mesh->mNumBones; b++)
+		{
+			const aiBone *source = mesh->mBones[b];
+			auto bone = bonesByName.find(source->mName.C_Str());
+			if (bone == bonesByName.end())
+			{
+				auto joint = jointsByName.find(source->mName.C_Str());
+				if (joint == jointsByName.end())
+				{
+					std::cout << "WARNING: " << "Bone " << source->mName.C_Str() << " has no node, skipping it." << std::endl;
+					continue;
+				}
+				bone = bonesByName.emplace(source->mName.C_Str(), m_skeleton.GetBoneCount()).first;
+				m_skeleton.boneJoints.push_back(joint->second);
+				m_skeleton.inverseBindMatrices.push_back(ToMat4(source->mOffsetMatrix));
+			}
+
+			for (unsigned int w = 0; w < source->mNumWeights; w++)
+			{
+				const aiVertexWeight &weight = source->mWeights[w];
+				if (weight.mVertexId >= mesh->mNumVertices || weight.mWeight <= 0.0f)
+					continue;
+
+				// Fill the first free influence, or replace the lightest if they're taken. LimitBoneWeights should mean
+				// they never are.
+				SkinWeights &vertex = skin[weight.mVertexId];
+				unsigned int slot = 0;
+				for (unsigned int i = 1; i < kMaxInfluences; i++)
+				{
+					if (vertex.weights[i] < vertex.weights[slot])
+						slot = i;
+				}
+				if (weight.mWeight > vertex.weights[slot])
+				{
+					vertex.bones[slot] = (uint16_t)bone->second;
+					vertex.weights[slot] = weight.mWeight;
+				}
+			}
+		}
+
+		// Anything left unweighted follows the node the mesh hangs off.
+		unsigned int rigidBone = UINT_MAX;
+		for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+		{
+			SkinWeights &vertex = skin[v];
+			float total = vertex.weights[0] + vertex.weights[1] + vertex.weights[2] + vertex.weights[3];
+			if (total > 0.0f)
+			{
+				for (unsigned int i = 0; i < kMaxInfluences; i++)
+					vertex.weights[i] /= total;
+				continue;
+			}
+
+			if (rigidBone == UINT_MAX)
+				rigidBone = AddRigidBone(meshJoints[m] >= 0 ? (unsigned int)meshJoints[m] : 0);
+			vertex.bones[0] = (uint16_t)rigidBone;
+			vertex.weights[0] = 1.0f;
+		}
+	}
+}
+
+// A bone that moves vertices with a joint without any offset, for the parts of a model that aren't skinned.
+unsigned int SkinnedMesh::AddRigidBone(unsigned int joint)
+{
+	for (unsigned int i = 0; i < m_skeleton.GetBoneCount(); i++)
+	{
+		if (m_skeleton.boneJoints[i] == joint && m_skeleton.inverseBindMatrices[i] == glm::mat4(1.0f))
+			return i;
+	}
+
+	m_skeleton.boneJoints.push_back(joint);
+	m_skeleton.inverseBindMatrices.push_back(glm::mat4(1.0f));
+	return m_skeleton.GetBoneCount() - 1;
+}
+
+// Key times are converted from ticks to seconds, then each clip is compressed.
+void SkinnedMesh::LoadClips(const aiScene *scene, const char *filePath)
+{
+	m_clips.clear();
+	if (scene->mNumAnimations == 0)
+		return;
+
+	CompressedClip::Settings settings;
+	std::string cachePath = std::string(filePath) + ".aclip";
+	std::error_code error;
+	bool upToDate = std::filesystem::exists(cachePath, error) &&
+		std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(filePath, error);
+	if (upToDate && CompressedClip::Read(cachePath.c_str(), m_clips, m_skeleton.GetJointCount(), settings))
+		return;
+
+	for (unsigned int a = 0; a < scene->mNumAnimations; a++)
+	{
+		const aiAnimation *source = scene->mAnimations[a];
+		double ticksPerSecond = source->mTicksPerSecond > 0.0 ? source->mTicksPerSecond : 25.0; // Assimp's default.
+
+		AnimationClip clip;
+		clip.name = source->mName.length > 0 ? source->mName.C_Str() : "Clip " + std::to_string(a);
+		clip.duration = (float)(source->mDuration / ticksPerSecond);
+
+		for (unsigned int c = 0; c < source->mNumChannels; c++)
+		{
+			const aiNodeAnim *channel = source->mChannels[c];
+			int joint = m_skeleton.FindJoint(channel->mNodeName.C_Str());
+			if (joint < 0)
+				continue;
+
+			AnimationTrack track;
+			track.joint = (unsigned int)joint;
+			for (unsigned int k = 0; k < channel->mNumPositionKeys; k++)
+			{
+				const aiVectorKey &key = channel->mPositionKeys[k];
+				track.translationTimes.push_back((float)(key.mTime / ticksPerSecond));
+				track.translations.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+			for (unsigned int k = 0; k < channel->mNumRotationKeys; k++)
+			{
+				const aiQuatKey &key = channel->mRotationKeys[k];
+				track.rotationTimes.push_back((float)(key.mTime / ticksPerSecond));
+				track.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+			for (unsigned int k = 0; k < channel->mNumScalingKeys; k++)
+			{
+				const aiVectorKey &key = channel->mScalingKeys[k];
+				track.scaleTimes.push_back((float)(key.mTime / ticksPerSecond));
+				track.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+			}
+			clip.tracks.push_back(std::move(track));
+		}
+		m_clips.push_back(CompressedClip::Compress(clip, m_skeleton, settings));
+	}
+
+	CompressedClip::Write(cachePath.c_str(), m_clips, m_skeleton.GetJointCount(), settings);
+}
+
+void SkinnedMesh::CreateSkinBuffer()
+{
+	glBindVertexArray(m_VAO);
+	glGenBuffers(1, &m_skinVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_skinVBO);
+	glBufferData(GL_ARRAY_BUFFER, m_skinWeights.size() * sizeof(SkinWeights), m_skinWeights.data(), GL_STATIC_DRAW);
+
+	glVertexAttribIPointer(4, 4, GL_UNSIGNED_SHORT, sizeof(SkinWeights), (void*)0); // Setup bone indices attribute for shader.
+	glEnableVertexAttribArray(4);
+
+	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(SkinWeights), (void*)8); // Setup bone weights attribute for shader.
+	glEnableVertexAttribArray(5);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+const std::vector<Mesh::Vertex> &SkinnedMesh::GetBindVertices()
+{
+	// Only valid until the CPU path skins over the buffer, so it's read before that ever happens.
+	if (m_bindVertices.empty() && !m_skinWeights.empty())
+	{
+		FinishUpload(true);
+		m_bindVertices.resize(m_skinWeights.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, m_VBO);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr)m_bindVertices.size() * sizeof(Vertex), m_bindVertices.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	return m_bindVertices;
+}
+
+void SkinnedMesh::Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform)
+{
+	if (!FinishUpload(false))
+		return;
+
+	unsigned int vertexCount = (unsigned int)m_skinWeights.size();
+	if (!m_gpuSkinning && m_pose != nullptr && m_pose->GetPalette() != nullptr && vertexCount > 0)
+	{
+		// Instances sharing the mesh each upload their own pose just before they draw.
+		const std::vector<Vertex> &bindVertices = GetBindVertices();
+		m_skinnedVertices.resize(vertexCount);
+		const glm::mat4 *palette = m_pose->GetPalette();
+		ThreadPool::Get().ParallelFor(vertexCount, kVerticesPerTask, [&](size_t begin, size_t end)
+		{
+			SkinVertices(bindVertices.data() + begin, m_skinWeights.data() + begin, (unsigned int)(end - begin), palette, m_skinnedVertices.data() + begin);
+		});
+		UpdateVertices(0, vertexCount, m_skinnedVertices.data());
+		m_verticesSkinned = true;
+	}
+	else if (m_gpuSkinning && m_verticesSkinned)
+	{
+		UpdateVertices(0, vertexCount, m_bindVertices.data());
+		m_verticesSkinned = false;
+	}
+	m_pose = nullptr;
+
+	Mesh::Render(shader, projectionView, transform);
+}
+
+void SkinnedMesh::SkinVertices(const Vertex *source, const SkinWeights *skin, unsigned int vertexCount, const glm::mat4 *palette, Vertex *destination)
+{
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		const Vertex &in = source[v];
+		const SkinWeights &weights = skin[v];
+		Vertex &out = destination[v];
+		out.texCoord = in.texCoord;
+
+#if SKINNING_SIMD
+		// Blend the bone matrices a column at a time.
+		__m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+		for (unsigned int i = 0; i < kMaxInfluences; i++)
+		{
+			if (weights.weights[i] == 0.0f)
+				continue;
+			const float *m = &palette[weights.bones[i]][0][0];
+			__m128 w = _mm_set1_ps(weights.weights[i]);
+			c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+			c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+			c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+			c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+		}
+
+		__m128 position = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in.position.x)), _mm_mul_ps(c1, _mm_set1_ps(in.position.y))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(in.position.z)), _mm_mul_ps(c3, _mm_set1_ps(in.position.w))));
+		__m128 normal = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in.normal.x)), _mm_mul_ps(c1, _mm_set1_ps(in.normal.y))),
+			_mm_mul_ps(c2, _mm_set1_ps(in.normal.z)));
+		__m128 tangent = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in.tangent.x)), _mm_mul_ps(c1, _mm_set1_ps(in.tangent.y))),
+			_mm_mul_ps(c2, _mm_set1_ps(in.tangent.z)));
+
+		float occlusion = in.normal.w, handedness = in.tangent.w; // Read before the stores in case source and destination are the same.
+		_mm_storeu_ps(&out.position.x, position);
+		_mm_storeu_ps(&out.normal.x, normal);
+		out.normal.w = occlusion;
+		_mm_storeu_ps(&out.tangent.x, tangent);
+		out.tangent.w = handedness;
+#else
+		glm::mat4 blended(0.0f);
+		for (unsigned int i = 0; i < kMaxInfluences; i++)
+		{
+			if (weights.weights[i] != 0.0f)
+				blended += palette[weights.bones[i]] * weights.weights[i];
+		}
+
+		out.position = blended * in.position;
+		out.normal = glm::vec4(glm::vec3(blended * glm::vec4(glm::vec3(in.normal), 0.0f)), in.normal.w);
+		out.tangent = glm::vec4(glm::vec3(blended * glm::vec4(glm::vec3(in.tangent), 0.0f)), in.tangent.w);
+#endif
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+#include "Animation.h"
+#include "CompressedClip.h"
+
+#include <cstdint>
+
+// A model skinned to a skeleton, with the animations imported alongside it. Each vertex has up to four bones and
+// weights in a second vertex buffer, which the skinned shader blends from the palette an Animator left in the scene's
+// AnimationSystem. With GPU skinning off the vertices are skinned on the CPU instead and uploaded before each draw.
+class SkinnedMesh : public Mesh
+{
+public:
+	static const unsigned int kMaxInfluences = 4; // Bones per vertex.
+
+	struct SkinWeights
+	{
+		uint16_t bones[kMaxInfluences];
+		float weights[kMaxInfluences]; // Sum to one, unused influences are zero.
+	};
+
+public:
+	SkinnedMesh();
+	virtual ~SkinnedMesh();
+
+	// Imports anything assimp reads along with its bones and animations. Parts that aren't skinned move rigidly with
+	// the node they hang off. The clips are compressed and cooked next to the file (.aclip), later loads read them
+	// from there unless the file is newer. Returns false if the file couldn't be imported.
+	bool Load(const char *filePath);
+
+	const Skeleton &GetSkeleton() const { return m_skeleton; }
+	const std::vector<CompressedClip> &GetClips() const { return m_clips; }
+	const std::vector<SkinWeights> &GetSkinWeights() const { return m_skinWeights; } // One per vertex.
+	const std::vector<Vertex> &GetBindVertices(); // Read back from the vertex buffer the first time it's asked for.
+
+	void SetGpuSkinning(bool enabled) { m_gpuSkinning = enabled; }
+	bool IsGpuSkinning() const { return m_gpuSkinning; }
+	void SetPose(const Animator *animator) { m_pose = animator; } // For the next Render, Animator::Bind sets it.
+
+	virtual void Render(aie::ShaderProgram *shader, const glm::mat4 &projectionView, const glm::mat4 &transform) override;
+
+	// Blends each vertex's position, normal and tangent by its bones. Four matrices at a time with SSE where it's there.
+	static void SkinVertices(const Vertex *source, const SkinWeights *skin, unsigned int vertexCount, const glm::mat4 *palette, Vertex *destination);
+
+private:
+	void BuildSkeleton(const aiScene *scene, std::vector<int> &meshJoints);
+	void LoadSkin(const aiScene *scene, const std::vector<unsigned int> &baseVertices, const std::vector<int> &meshJoints);
+	void LoadClips(const aiScene *scene, const char *filePath);
+	unsigned int AddRigidBone(unsigned int joint);
+	void CreateSkinBuffer();
+
+private:
+	Skeleton m_skeleton;
+	std::vector<CompressedClip> m_clips;
+
+	std::vector<SkinWeights> m_skinWeights;
+	unsigned int m_skinVBO = 0;
+	bool m_gpuSkinning = true;
+	const Animator *m_pose = nullptr;
+
+	// CPU skinning. The bind pose is put back when GPU skinning is turned on.
+	std::vector<Vertex> m_bindVertices;
+	std::vector<Vertex> m_skinnedVertices;
+	bool m_verticesSkinned = false; // The vertex buffer holds a skinned pose rather than the bind pose.
+
+};
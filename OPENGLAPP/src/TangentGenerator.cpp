@@ -0,0 +1,225 @@
+#include "TangentGenerator.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TANGENT_SIMD 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const size_t kTrianglesPerTask = 1 << 14; // Don't split meshes smaller than this.
+	const size_t kAccumulatorBudget = 256 << 20; // Bytes of per-thread sums we're happy to allocate.
+	const float kMinUVArea = 1e-12f; // Triangles with less UV area than this don't have a usable tangent.
+
+	// Running totals per vertex, one array of these per thread.
+	struct TangentSums
+	{
+		glm::vec3 tangent;
+		glm::vec3 bitangent;
+	};
+
+	// Tangent and bitangent of a batch of triangles, stored across so the SSE path can write them straight out.
+	struct FaceBasis
+	{
+		float sx[4], sy[4], sz[4];
+		float tx[4], ty[4], tz[4];
+	};
+
+	void ComputeBasis(const Mesh::Vertex *vertices, const unsigned int *triangle, FaceBasis &basis, int lane)
+	{
+		const Mesh::Vertex &v0 = vertices[triangle[0]];
+		const Mesh::Vertex &v1 = vertices[triangle[1]];
+		const Mesh::Vertex &v2 = vertices[triangle[2]];
+
+		glm::vec3 e1 = glm::vec3(v1.position - v0.position);
+		glm::vec3 e2 = glm::vec3(v2.position - v0.position);
+		float s1 = v1.texCoord.x - v0.texCoord.x;
+		float s2 = v2.texCoord.x - v0.texCoord.x;
+		float t1 = v1.texCoord.y - v0.texCoord.y;
+		float t2 = v2.texCoord.y - v0.texCoord.y;
+
+		float det = s1 * t2 - s2 * t1;
+		float r = (std::fabs(det) > kMinUVArea) ? 1.0f / det : 0.0f;
+		glm::vec3 sdir = (t2 * e1 - t1 * e2) * r;
+		glm::vec3 tdir = (s1 * e2 - s2 * e1) * r;
+
+		basis.sx[lane] = sdir.x; basis.sy[lane] = sdir.y; basis.sz[lane] = sdir.z;
+		basis.tx[lane] = tdir.x; basis.ty[lane] = tdir.y; basis.tz[lane] = tdir.z;
+	}
+
+#if TANGENT_SIMD
+	// Same as ComputeBasis for four triangles at once.
+	void ComputeBasis4(const Mesh::Vertex *vertices, const unsigned int *triangles, FaceBasis &basis)
+	{
+		const Mesh::Vertex *c[4][3];
+		for (int i = 0; i < 4; i++)
+		{
+			c[i][0] = &vertices[triangles[i * 3 + 0]];
+			c[i][1] = &vertices[triangles[i * 3 + 1]];
+			c[i][2] = &vertices[triangles[i * 3 + 2]];
+		}
+
+#define GATHER(corner, member) _mm_setr_ps(c[0][corner]->member, c[1][corner]->member, c[2][corner]->member, c[3][corner]->member)
+		__m128 p0x = GATHER(0, position.x), p0y = GATHER(0, position.y), p0z = GATHER(0, position.z);
+		__m128 e1x = _mm_sub_ps(GATHER(1, position.x), p0x);
+		__m128 e1y = _mm_sub_ps(GATHER(1, position.y), p0y);
+		__m128 e1z = _mm_sub_ps(GATHER(1, position.z), p0z);
+		__m128 e2x = _mm_sub_ps(GATHER(2, position.x), p0x);
+		__m128 e2y = _mm_sub_ps(GATHER(2, position.y), p0y);
+		__m128 e2z = _mm_sub_ps(GATHER(2, position.z), p0z);
+
+		__m128 u0 = GATHER(0, texCoord.x), w0 = GATHER(0, texCoord.y);
+		__m128 s1 = _mm_sub_ps(GATHER(1, texCoord.x), u0);
+		__m128 s2 = _mm_sub_ps(GATHER(2, texCoord.x), u0);
+		__m128 t1 = _mm_sub_ps(GATHER(1, texCoord.y), w0);
+		__m128 t2 = _mm_sub_ps(GATHER(2, texCoord.y), w0);
+#undef GATHER
+
+		// r = 1 / det, or zero where the UVs are degenerate.
+		__m128 det = _mm_sub_ps(_mm_mul_ps(s1, t2), _mm_mul_ps(s2, t1));
+		__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+		__m128 usable = _mm_cmpgt_ps(absDet, _mm_set1_ps(kMinUVArea));
+		__m128 r = _mm_and_ps(usable, _mm_div_ps(_mm_set1_ps(1.0f), det));
+
+		_mm_storeu_ps(basis.sx, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2, e1x), _mm_mul_ps(t1, e2x)), r));
+		_mm_storeu_ps(basis.sy, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2, e1y), _mm_mul_ps(t1, e2y)), r));
+		_mm_storeu_ps(basis.sz, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(t2, e1z), _mm_mul_ps(t1, e2z)), r));
+		_mm_storeu_ps(basis.tx, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(s1, e2x), _mm_mul_ps(s2, e1x)), r));
+		_mm_storeu_ps(basis.ty, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(s1, e2y), _mm_mul_ps(s2, e1y)), r));
+		_mm_storeu_ps(basis.tz, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(s1, e2z), _mm_mul_ps(s2, e1z)), r));
+	}
+#endif
+
+	inline glm::vec3 ProjectOntoPlane(const glm::vec3 &v, const glm::vec3 &normal)
+	{
+		return v - normal * glm::dot(normal, v);
+	}
+
+	inline bool SafeNormalize(glm::vec3 &v)
+	{
+		float lengthSquared = glm::dot(v, v);
+		if (lengthSquared <= 0.0f)
+			return false;
+		v *= 1.0f / std::sqrt(lengthSquared);
+		return true;
+	}
+
+	// Adds one triangle's basis to its three corners.
+	void AccumulateTriangle(Mesh::TangentMode mode, const Mesh::Vertex *vertices, const unsigned int *triangle, const FaceBasis &basis, int lane, TangentSums *sums)
+	{
+		glm::vec3 sdir(basis.sx[lane], basis.sy[lane], basis.sz[lane]);
+		glm::vec3 tdir(basis.tx[lane], basis.ty[lane], basis.tz[lane]);
+		if (sdir == glm::vec3(0.0f) && tdir == glm::vec3(0.0f))
+			return;
+
+		if (mode == Mesh::TANGENT_FAST)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				sums[triangle[i]].tangent += sdir;
+				sums[triangle[i]].bitangent += tdir;
+			}
+			return;
+		}
+
+		// Angle weighted: the face basis is normalized, projected into each corner's tangent plane and
+		// weighted by the corner angle, so the result doesn't depend on how the surface was triangulated.
+		SafeNormalize(sdir);
+		SafeNormalize(tdir);
+		for (int i = 0; i < 3; i++)
+		{
+			const Mesh::Vertex &corner = vertices[triangle[i]];
+			glm::vec3 normal = glm::vec3(corner.normal);
+			if (!SafeNormalize(normal))
+				continue;
+
+			glm::vec3 tangent = ProjectOntoPlane(sdir, normal);
+			glm::vec3 bitangent = ProjectOntoPlane(tdir, normal);
+			glm::vec3 edge1 = ProjectOntoPlane(glm::vec3(vertices[triangle[(i + 1) % 3]].position - corner.position), normal);
+			glm::vec3 edge2 = ProjectOntoPlane(glm::vec3(vertices[triangle[(i + 2) % 3]].position - corner.position), normal);
+			if (!SafeNormalize(tangent) || !SafeNormalize(edge1) || !SafeNormalize(edge2))
+				continue;
+			SafeNormalize(bitangent);
+
+			float angle = std::acos(glm::clamp(glm::dot(edge1, edge2), -1.0f, 1.0f));
+			sums[triangle[i]].tangent += tangent * angle;
+			sums[triangle[i]].bitangent += bitangent * angle;
+		}
+	}
+
+	void AccumulateRange(Mesh::TangentMode mode, const Mesh::Vertex *vertices, const unsigned int *indices, size_t firstTriangle, size_t lastTriangle, TangentSums *sums)
+	{
+		FaceBasis basis;
+		size_t triangle = firstTriangle;
+#if TANGENT_SIMD
+		for (; triangle + 4 <= lastTriangle; triangle += 4)
+		{
+			const unsigned int *batch = indices + triangle * 3;
+			ComputeBasis4(vertices, batch, basis);
+			for (int lane = 0; lane < 4; lane++)
+				AccumulateTriangle(mode, vertices, batch + lane * 3, basis, lane, sums);
+		}
+#endif
+		for (; triangle < lastTriangle; triangle++)
+		{
+			ComputeBasis(vertices, indices + triangle * 3, basis, 0);
+			AccumulateTriangle(mode, vertices, indices + triangle * 3, basis, 0, sums);
+		}
+	}
+}
+
+void TangentGenerator::Generate(Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount, Mesh::TangentMode mode)
+{
+	size_t triangleCount = indexCount / 3;
+	if (vertexCount == 0 || triangleCount == 0)
+		return;
+
+	// One set of sums per range of triangles, as many as there are threads to run them unless that's too much memory.
+	ThreadPool &pool = ThreadPool::Get();
+	size_t rangeCount = std::min<size_t>(pool.GetThreadCount() + 1, (triangleCount + kTrianglesPerTask - 1) / kTrianglesPerTask);
+	rangeCount = std::min<size_t>(rangeCount, kAccumulatorBudget / ((size_t)vertexCount * sizeof(TangentSums)));
+	rangeCount = std::max<size_t>(rangeCount, 1);
+
+	std::vector<std::vector<TangentSums>> sums(rangeCount);
+	pool.ParallelFor(rangeCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			sums[i].assign(vertexCount, TangentSums{ glm::vec3(0.0f), glm::vec3(0.0f) });
+			AccumulateRange(mode, vertices, indices, (triangleCount * i) / rangeCount, (triangleCount * (i + 1)) / rangeCount, sums[i].data());
+		}
+	});
+
+	// Sum the ranges and orthonormalize against the normal.
+	pool.ParallelFor(vertexCount, 1 << 16, [&](size_t begin, size_t end)
+	{
+		for (size_t v = begin; v < end; v++)
+		{
+			TangentSums total = sums[0][v];
+			for (size_t i = 1; i < rangeCount; i++)
+			{
+				total.tangent += sums[i][v].tangent;
+				total.bitangent += sums[i][v].bitangent;
+			}
+
+			glm::vec3 normal = glm::vec3(vertices[v].normal);
+			glm::vec3 tangent = ProjectOntoPlane(total.tangent, normal);
+			if (!SafeNormalize(tangent)) // No usable UVs, any direction in the tangent plane will do.
+			{
+				glm::vec3 axis = (std::fabs(normal.x) < 0.9f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+				tangent = glm::cross(normal, axis);
+				if (!SafeNormalize(tangent))
+					tangent = glm::vec3(1, 0, 0);
+			}
+
+			// Texture v is flipped on import, so the bitangent sign is flipped to match.
+			float handedness = (glm::dot(glm::cross(normal, tangent), total.bitangent) < 0.0f) ? 1.0f : -1.0f;
+			vertices[v].tangent = glm::vec4(tangent, handedness);
+		}
+	});
+}
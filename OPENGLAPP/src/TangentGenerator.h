@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Mesh.h"
+
+// Per-vertex tangents from positions, normals and texture coordinates. Triangles are split across the thread pool,
+// each range accumulating into its own arrays which are summed afterwards, and the per-triangle basis is worked out
+// four triangles at a time with SSE.
+class TangentGenerator
+{
+public:
+	// Writes tangent.xyz and the bitangent sign in tangent.w (the lit shaders use cross(normal, tangent) * w).
+	static void Generate(Mesh::Vertex *vertices, unsigned int vertexCount, const unsigned int *indices, size_t indexCount, Mesh::TangentMode mode = Mesh::TANGENT_FAST);
+
+};
@@ -1,18 +1,29 @@
 #include "glad.h"
 #include "Texture.h"
+#include "TextureCache.h"
+#include "SamplerCache.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include <string>
+#include <atomic>
+
 namespace aie {
 
+static unsigned int nextId() {
+	static std::atomic<unsigned int> id(1);
+	return id++;
+}
+
 Texture::Texture() 
 	: m_filename("none"),
 	m_width(0),
 	m_height(0),
 	m_glHandle(0),
 	m_format(0),
-	m_loadedPixels(nullptr) {
+	m_sampler(0),
+	m_id(nextId()) {
 }
 
 Texture::Texture(const char * filename)
@@ -21,7 +32,8 @@ Texture::Texture(const char * filename)
 	m_height(0),
 	m_glHandle(0),
 	m_format(0),
-	m_loadedPixels(nullptr) {
+	m_sampler(0),
+	m_id(nextId()) {
 
 	load(filename);
 }
@@ -30,8 +42,10 @@ Texture::Texture(unsigned int width, unsigned int height, Format format, unsigne
 	: m_filename("none"),
 	m_width(width),
 	m_height(height),
+	m_glHandle(0),
 	m_format(format),
-	m_loadedPixels(nullptr) {
+	m_sampler(0),
+	m_id(nextId()) {
 
 	create(width, height, format, pixels);
 }
@@ -39,11 +53,14 @@ Texture::Texture(unsigned int width, unsigned int height, Format format, unsigne
 Texture::~Texture() {
 	if (m_glHandle != 0)
 		glDeleteTextures(1, &m_glHandle);
-	if (m_loadedPixels != nullptr)
-		stbi_image_free(m_loadedPixels);
 }
 
-bool Texture::load(const char* filename) {
+bool Texture::load(const char* filename, Usage usage) {
+
+	std::string extension(filename);
+	extension = extension.substr(extension.find_last_of('.') + 1);
+	if (extension == "ktx" || extension == "KTX")
+		return loadKTX(filename);
 
 	if (m_glHandle != 0) {
 		glDeleteTextures(1, &m_glHandle);
@@ -53,47 +70,76 @@ bool Texture::load(const char* filename) {
 		m_filename = "none";
 	}
 
-	int x = 0, y = 0, comp = 0;
-	m_loadedPixels = stbi_load(filename, &x, &y, &comp, STBI_default);
-
-	if (m_loadedPixels != nullptr) {
-		glGenTextures(1, &m_glHandle);
-		glBindTexture(GL_TEXTURE_2D, m_glHandle);
-		switch (comp) {
-		case STBI_grey:
-			m_format = RED;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, x, y,
-						 0, GL_RED, GL_UNSIGNED_BYTE, m_loadedPixels);
-			break;
-		case STBI_grey_alpha:
-			m_format = RG;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, x, y,
-						 0, GL_RG, GL_UNSIGNED_BYTE, m_loadedPixels);
-			break;
-		case STBI_rgb:
-			m_format = RGB;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, x, y,
-						 0, GL_RGB, GL_UNSIGNED_BYTE, m_loadedPixels);
-			break;
-		case STBI_rgb_alpha:
-			m_format = RGBA;
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, x, y,
-						 0, GL_RGBA, GL_UNSIGNED_BYTE, m_loadedPixels);
-			break;
-		default:	break;
-		};
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		m_width = (unsigned int)x;
-		m_height = (unsigned int)y;
+	// compressed and cooked the first time, read straight back after that
+	TextureImage image;
+	if (TextureCache::Load(filename, usage, image) && upload(image)) {
 		m_filename = filename;
 		return true;
 	}
 	return false;
 }
 
+bool Texture::loadFromMemory(const unsigned char* data, size_t size, const char* name, Usage usage) {
+
+	if (m_glHandle != 0) {
+		glDeleteTextures(1, &m_glHandle);
+		m_glHandle = 0;
+		m_width = 0;
+		m_height = 0;
+		m_filename = "none";
+	}
+
+	int x = 0, y = 0, comp = 0;
+	unsigned char* pixels = stbi_load_from_memory(data, (int)size, &x, &y, &comp, STBI_default);
+	if (pixels == nullptr)
+		return false;
+
+	// not cached, but the mips are still built up front rather than by the driver. nothing is kept on the CPU
+	TextureImage image;
+	TextureCache::FromPixels(pixels, (unsigned int)x, (unsigned int)y, (unsigned int)comp, usage, image);
+	stbi_image_free(pixels);
+	if (upload(image)) {
+		m_filename = name;
+		return true;
+	}
+	return false;
+}
+
+bool Texture::loadKTX(const char* filename) {
+
+	if (m_glHandle != 0) {
+		glDeleteTextures(1, &m_glHandle);
+		m_glHandle = 0;
+		m_width = 0;
+		m_height = 0;
+		m_filename = "none";
+	}
+
+	TextureImage image;
+	if (!TextureCache::Read(filename, image) || !upload(image))
+		return false;
+	m_filename = filename;
+	return true;
+}
+
+bool Texture::upload(const TextureImage& image) {
+
+	glGenTextures(1, &m_glHandle);
+	glBindTexture(GL_TEXTURE_2D, m_glHandle);
+	TextureCache::Upload(image);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	switch (image.baseFormat) {
+	case GL_RED:	m_format = RED;		break;
+	case GL_RG:		m_format = RG;		break;
+	case GL_RGB:	m_format = RGB;		break;
+	default:		m_format = RGBA;	break;
+	};
+	m_width = image.levels[0].width;
+	m_height = image.levels[0].height;
+	return true;
+}
+
 void Texture::create(unsigned int width, unsigned int height, Format format, unsigned char* pixels) {
 
 	if (m_glHandle != 0) {
@@ -102,40 +148,41 @@ void Texture::create(unsigned int width, unsigned int height, Format format, uns
 		m_filename = "none";
 	}
 
+	// given pixels, it gets a full mip chain like anything loaded; format is also the number of components
+	if (pixels != nullptr) {
+		TextureImage image;
+		TextureCache::FromPixels(pixels, width, height, format, COLOUR, image);
+		upload(image);
+		return;
+	}
+
+	// otherwise it's a render target, only ever drawn into and read back at its own size
+	static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
 	m_width = width;
 	m_height = height;
 	m_format = format;
+	m_sampler = SamplerCache::Get().GetSampler(SamplerState::RenderTarget());
 
-	glGenTextures(1, &m_glHandle);
-	glBindTexture(GL_TEXTURE_2D, m_glHandle);
+	glCreateTextures(GL_TEXTURE_2D, 1, &m_glHandle);
+	glTextureStorage2D(m_glHandle, 1, internalFormats[(format >= RED && format <= RGBA ? format : RGBA) - 1], m_width, m_height);
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	switch (m_format) {
-	case RED:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, m_width, m_height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
-		break;
-	case RG:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG, m_width, m_height, 0, GL_RG, GL_UNSIGNED_BYTE, pixels);
-		break;
-	case RGB:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-		break;
-	case RGBA:
-	default:
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-	};
+void Texture::adopt(unsigned int handle, unsigned int width, unsigned int height, Format format, const char* filename) {
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (m_glHandle != 0)
+		glDeleteTextures(1, &m_glHandle);
+
+	m_glHandle = handle;
+	m_width = width;
+	m_height = height;
+	m_format = format;
+	m_filename = filename;
 }
 
 void Texture::bind(unsigned int slot) const {
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(GL_TEXTURE_2D, m_glHandle);
+	glBindSampler(slot, m_sampler != 0 ? m_sampler : SamplerCache::Get().GetSampler(SamplerState::Material()));
 }
 
 } // namespace aie
\ No newline at end of file
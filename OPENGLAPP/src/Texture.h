@@ -2,6 +2,8 @@
 
 #include <string>
 
+struct TextureImage;
+
 namespace aie {
 
 // a class for wrapping up an opengl texture image
@@ -15,39 +17,66 @@ public:
 		RGBA
 	};
 
+	// what the texels hold, which decides how a loaded image is compressed
+	enum Usage : unsigned int {
+		COLOUR,
+		NORMAL_MAP,	// tangent space, only x and y are kept and the shader rebuilds z
+		LINEAR		// values rather than colours, e.g. specular, so nothing is treated as sRGB
+	};
+
 	Texture();
 	Texture(const char* filename);
 	Texture(unsigned int width, unsigned int height, Format format, unsigned char* pixels = nullptr);
 	virtual ~Texture();
 
-	// load a jpg, bmp, png or tga
-	bool load(const char* filename);
+	// load a jpg, bmp, png or tga, block compressed with its mips through the texture cache, or a .ktx container
+	bool load(const char* filename, Usage usage = COLOUR);
+
+	// load a jpg, bmp, png or tga that is already in memory, e.g. an image embedded in a .glb
+	bool loadFromMemory(const unsigned char* data, size_t size, const char* name = "memory", Usage usage = COLOUR);
+
+	// load a version 1 .ktx container, uncompressed or block compressed, with its mips
+	bool loadKTX(const char* filename);
 
-	// creates a texture that can be filled in with pixels
+	// creates a texture from pixels, with mips, or an empty one to render into
 	void create(unsigned int width, unsigned int height, Format format, unsigned char* pixels = nullptr);
 
+	// takes over a texture that was filled in elsewhere, e.g. streamed in by the TextureStreamer or given more or fewer
+	// mips by the TextureResidency, freeing the one it had
+	void adopt(unsigned int handle, unsigned int width, unsigned int height, Format format, const char* filename);
+
 	// returns the filename or "none" if not loaded from a file
 	const std::string& getFilename() const { return m_filename; }
 
-	// binds the texture to the specified slot
+	// binds the texture to the specified slot, along with its sampler
 	void bind(unsigned int slot) const;
 
+	// the sampler object it's drawn with, from the SamplerCache. zero is the cache's material sampler, trilinear and
+	// anisotropic, which anything loaded from a file starts with
+	void setSampler(unsigned int sampler) { m_sampler = sampler; }
+	unsigned int getSampler() const { return m_sampler; }
+
 	// returns the opengl texture handle
 	unsigned int getHandle() const { return m_glHandle; }
 
+	// never reused by another texture, unlike its address or its handle
+	unsigned int getId() const { return m_id; }
+
 	unsigned int getWidth() const { return m_width; }
 	unsigned int getHeight() const { return m_height; }
 	unsigned int getFormat() const { return m_format; }
-	const unsigned char* getPixels() const { return m_loadedPixels; }
 
 protected:
 
+	bool upload(const TextureImage& image);
+
 	std::string		m_filename;
 	unsigned int	m_width;
 	unsigned int	m_height;
 	unsigned int	m_glHandle;
 	unsigned int	m_format;
-	unsigned char*	m_loadedPixels;
+	unsigned int	m_sampler;
+	unsigned int	m_id;
 };
 
 } // namespace aie
\ No newline at end of file
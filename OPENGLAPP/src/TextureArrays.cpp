@@ -0,0 +1,204 @@
+#include "TextureArrays.h"
+
+#include "Texture.h"
+#include "SamplerCache.h"
+#include "TextureResidency.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glad.h>
+
+namespace
+{
+	const unsigned int kInitialCapacity = 4; // Layers.
+}
+
+TextureArrays &TextureArrays::Get()
+{
+	static TextureArrays arrays;
+	return arrays;
+}
+
+int TextureArrays::Find(const aie::Texture *texture)
+{
+	// Anything else would have no one to free its layer.
+	if (texture == nullptr || texture->getHandle() == 0 || !TextureResidency::Get().IsTracked(texture))
+		return kNotPacked;
+
+	auto it = m_packed.find(texture->getId());
+	if (it != m_packed.end() && it->second.width == texture->getWidth() && it->second.height == texture->getHeight())
+	{
+		// Ones that couldn't be packed are tried again if their handle changes, they may have all their mips now.
+		if (it->second.location != kNotPacked || it->second.handle == texture->getHandle())
+			return it->second.location;
+	}
+	if (it != m_packed.end()) // Reloaded at another size.
+	{
+		TextureResidency::Get().RemovePacked(texture);
+		Remove(texture->getId());
+	}
+
+	int location = Pack(*texture);
+	m_packed[texture->getId()] = { location, texture->getHandle(), texture->getWidth(), texture->getHeight() };
+	if (location != kNotPacked)
+		TextureResidency::Get().AddPacked(texture);
+	return location;
+}
+
+void TextureArrays::Remove(unsigned int textureId)
+{
+	auto it = m_packed.find(textureId);
+	if (it == m_packed.end())
+		return;
+
+	int location = it->second.location;
+	m_packed.erase(it);
+	if (location != kNotPacked)
+		m_arrays[location >> 16].freeLayers.push_back((unsigned int)(location & 0xFFFF));
+}
+
+int TextureArrays::Pack(const aie::Texture &texture)
+{
+	unsigned int width = texture.getWidth(), height = texture.getHeight(), handle = texture.getHandle();
+	if (width == 0 || height == 0 || std::max(width, height) > kMaxSize)
+		return kNotPacked;
+
+	// Only with every level there, or the layer would be missing some.
+	GLint levelCount = 0, baseWidth = 0, internalFormat = 0, compressed = 0;
+	glGetTextureParameteriv(handle, GL_TEXTURE_IMMUTABLE_LEVELS, &levelCount);
+	glGetTextureLevelParameteriv(handle, 0, GL_TEXTURE_WIDTH, &baseWidth);
+	glGetTextureLevelParameteriv(handle, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTextureLevelParameteriv(handle, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	if (levelCount != (GLint)std::log2(std::max(width, height)) + 1 || baseWidth != (GLint)width)
+		return kNotPacked;
+
+	int index = -1;
+	for (size_t i = 0; i < m_arrays.size() && index < 0; i++)
+	{
+		const Array &array = m_arrays[i];
+		if (array.internalFormat == (unsigned int)internalFormat && array.width == width && array.height == height &&
+			(array.layerCount < kMaxLayers || !array.freeLayers.empty()))
+			index = (int)i;
+	}
+	if (index < 0)
+	{
+		if (m_arrays.size() >= kMaxArrays)
+		{
+			if (!m_warnedFull)
+				std::cout << "WARNING: " << "Texture arrays are full, " << texture.getFilename() << " and any more new formats or sizes are bound on their own." << std::endl;
+			m_warnedFull = true;
+			return kNotPacked;
+		}
+
+		Array array;
+		array.internalFormat = (unsigned int)internalFormat;
+		array.width = width;
+		array.height = height;
+		array.levelCount = (unsigned int)levelCount;
+
+		GLint bits = 0;
+		if (!compressed)
+		{
+			const GLenum channels[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+			for (GLenum channel : channels)
+			{
+				GLint size = 0;
+				glGetTextureLevelParameteriv(handle, 0, channel, &size);
+				bits += size;
+			}
+		}
+		for (unsigned int level = 0; level < array.levelCount; level++)
+		{
+			GLint size = 0;
+			if (compressed)
+				glGetTextureLevelParameteriv(handle, (GLint)level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			else
+				size = (GLint)((size_t)std::max(width >> level, 1u) * std::max(height >> level, 1u) * bits / 8);
+			array.layerSize += (size_t)size;
+		}
+
+		index = (int)m_arrays.size();
+		m_arrays.push_back(array);
+	}
+
+	Array &array = m_arrays[index];
+	unsigned int layer = 0;
+	if (!array.freeLayers.empty())
+	{
+		layer = array.freeLayers.back();
+		array.freeLayers.pop_back();
+	}
+	else if (array.layerCount < array.capacity || Grow(array))
+	{
+		layer = array.layerCount++;
+	}
+	else
+	{
+		return kNotPacked;
+	}
+
+	for (unsigned int level = 0; level < array.levelCount; level++)
+	{
+		glCopyImageSubData(handle, GL_TEXTURE_2D, level, 0, 0, 0, array.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+			std::max(width >> level, 1u), std::max(height >> level, 1u), 1);
+	}
+	return index << 16 | (int)layer;
+}
+
+bool TextureArrays::Grow(Array &array)
+{
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	unsigned int capacity = std::min(std::max(array.capacity * 2, kInitialCapacity), std::min(kMaxLayers, (unsigned int)maxLayers));
+	if (capacity <= array.capacity)
+		return false;
+
+	unsigned int handle = 0;
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &handle);
+	glTextureStorage3D(handle, array.levelCount, array.internalFormat, array.width, array.height, capacity);
+
+	// Layers already packed move across on the GPU.
+	for (unsigned int level = 0; level < array.levelCount && array.layerCount > 0; level++)
+	{
+		glCopyImageSubData(array.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+			std::max(array.width >> level, 1u), std::max(array.height >> level, 1u), array.layerCount);
+	}
+	glDeleteTextures(1, &array.handle);
+	array.handle = handle;
+	array.capacity = capacity;
+	m_bindingsDirty = true;
+	return true;
+}
+
+void TextureArrays::Bind()
+{
+	if (!m_bindingsDirty)
+		return;
+	// Sampled like any other material map.
+	unsigned int sampler = SamplerCache::Get().GetSampler(SamplerState::Material());
+	for (size_t i = 0; i < m_arrays.size(); i++)
+	{
+		glBindTextureUnit(kFirstUnit + (unsigned int)i, m_arrays[i].handle);
+		glBindSampler(kFirstUnit + (unsigned int)i, sampler);
+	}
+	m_bindingsDirty = false;
+}
+
+size_t TextureArrays::GetSize() const
+{
+	size_t size = 0;
+	for (const Array &array : m_arrays)
+		size += array.layerSize * array.capacity;
+	return size;
+}
+
+void TextureArrays::Release()
+{
+	for (Array &array : m_arrays)
+		glDeleteTextures(1, &array.handle);
+	m_arrays.clear();
+	m_packed.clear();
+	m_bindingsDirty = true;
+	m_warnedFull = false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Common.h"
+
+#include <unordered_map>
+
+namespace aie
+{
+	class Texture;
+}
+
+// Small material textures copied into layers of shared GL_TEXTURE_2D_ARRAYs, one array for each format and size, so
+// materials can switch maps by index instead of by binding. Every array is bound once to its own unit and the lit
+// shaders pick the array and layer out of the material buffer. Only textures the TextureResidency tracks are packed,
+// the first time they're asked for with all their mips resident. The layer counts against its video budget, and it
+// hands the layer back when the texture is freed or gives up detail, so the layer can be reused. Arrays aren't used
+// for textures with more than kMaxSize texels on a side, or once kMaxArrays are full.
+class TextureArrays
+{
+public:
+	static const unsigned int kMaxSize = 512; // Texels.
+	static const unsigned int kMaxArrays = 8; // materialArrays in the lit shaders.
+	static const unsigned int kFirstUnit = 5; // Texture units, after the vertex animation textures.
+	static const unsigned int kMaxLayers = 256; // Per array.
+	static const int kNotPacked = -1;
+
+public:
+	static TextureArrays &Get(); // Shared arrays, created on first use.
+
+	// Where the texture's packed, as (array << 16 | layer), packing it if it can be. kNotPacked if it isn't.
+	int Find(const aie::Texture *texture);
+	void Remove(unsigned int textureId); // Frees the texture's layer for the next texture to use.
+	void Bind(); // Binds every array to its unit, only does anything after an array has been made or grown.
+
+	void Release(); // Frees every array, call before the GL context goes.
+
+	unsigned int GetArrayCount() const { return (unsigned int)m_arrays.size(); }
+	unsigned int GetPackedCount() const { return (unsigned int)m_packed.size(); }
+	size_t GetSize() const; // Bytes of texture memory, every layer allocated.
+
+private:
+	struct Array
+	{
+		unsigned int handle = 0;
+		unsigned int internalFormat = 0;
+		unsigned int width = 0;
+		unsigned int height = 0;
+		unsigned int levelCount = 0;
+		unsigned int layerCount = 0; // Used at some point, some may have been freed since.
+		unsigned int capacity = 0; // Layers allocated.
+		std::vector<unsigned int> freeLayers; // Below layerCount, freed by Remove.
+		size_t layerSize = 0; // Bytes, every level.
+	};
+
+	struct Packed
+	{
+		int location; // Or kNotPacked if it couldn't be.
+		unsigned int handle; // The texture's when it was packed, or last couldn't be.
+		unsigned int width;
+		unsigned int height;
+	};
+
+private:
+	int Pack(const aie::Texture &texture);
+	bool Grow(Array &array);
+
+private:
+	std::vector<Array> m_arrays;
+	std::unordered_map<unsigned int, Packed> m_packed; // By texture id.
+	bool m_bindingsDirty = true;
+	bool m_warnedFull = false;
+
+};
@@ -0,0 +1,394 @@
+#include "TextureCache.h"
+
+#include "ThreadPool.h"
+
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+
+#include <glad.h>
+#include <stb_image.h>
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize.h>
+
+namespace
+{
+	const unsigned int kCompressedRgbBc1 = 0x83F0; // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	const unsigned int kCompressedRgbaBc3 = 0x83F3; // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	const size_t kBlockRowsPerTask = 16;
+
+	// Bumped whenever cooking changes, so caches written before are cooked again.
+	const unsigned int kCacheVersion = 2;
+	const char kCacheVersionKey[] = "aie.textureCacheVersion";
+
+	// Version 1 header, see https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html
+	const unsigned char kIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const uint32_t kEndianness = 0x04030201;
+	struct KtxHeader
+	{
+		uint32_t endianness;
+		uint32_t glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat;
+		uint32_t pixelWidth, pixelHeight, pixelDepth;
+		uint32_t numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	// stb_dxt fills its tables on first use without a lock, so that's done once before any threads get to it.
+	void InitCompressor()
+	{
+		static bool initialised = []()
+		{
+			unsigned char block[64] = {}, compressed[16];
+			stb_compress_dxt_block(compressed, block, 0, STB_DXT_NORMAL);
+			return true;
+		}();
+		(void)initialised;
+	}
+
+	// Filtering shortens normals that don't agree, which would flatten the lighting at a distance.
+	void Renormalise(std::vector<unsigned char> &pixels, unsigned int components)
+	{
+		for (size_t i = 0; i + components <= pixels.size(); i += components)
+		{
+			glm::vec3 normal = glm::vec3(pixels[i], pixels[i + 1], pixels[i + 2]) / 255.0f * 2.0f - 1.0f;
+			float length = glm::length(normal);
+			normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+			for (unsigned int c = 0; c < 3; c++)
+				pixels[i + c] = (unsigned char)std::lround((normal[c] * 0.5f + 0.5f) * 255.0f);
+		}
+	}
+
+	// Immutable storage needs a sized format, containers written by other tools don't always have one.
+	unsigned int GetStorageFormat(unsigned int internalFormat)
+	{
+		switch (internalFormat)
+		{
+		case GL_RED: return GL_R8;
+		case GL_RG: return GL_RG8;
+		case GL_RGB: return GL_RGB8;
+		case GL_RGBA: return GL_RGBA8;
+		case GL_SRGB: return GL_SRGB8;
+		case GL_SRGB_ALPHA: return GL_SRGB8_ALPHA8;
+		default: return internalFormat;
+		}
+	}
+
+	// One RGBA level to blocks. Blocks past the edge repeat the last row and column.
+	void CompressLevel(const std::vector<unsigned char> &rgba, unsigned int width, unsigned int height, unsigned int internalFormat, std::vector<unsigned char> &data)
+	{
+		unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+		size_t blockBytes = internalFormat == kCompressedRgbBc1 ? 8 : 16;
+		data.resize((size_t)blocksWide * blocksHigh * blockBytes);
+
+		ThreadPool::Get().ParallelFor(blocksHigh, kBlockRowsPerTask, [&](size_t begin, size_t end)
+		{
+			unsigned char block[64];
+			for (size_t by = begin; by < end; by++)
+			{
+				for (unsigned int bx = 0; bx < blocksWide; bx++)
+				{
+					for (unsigned int i = 0; i < 16; i++)
+					{
+						unsigned int x = std::min(bx * 4 + (i & 3), width - 1);
+						unsigned int y = std::min((unsigned int)by * 4 + (i >> 2), height - 1);
+						std::memcpy(block + i * 4, rgba.data() + ((size_t)y * width + x) * 4, 4);
+					}
+
+					unsigned char *destination = data.data() + (by * blocksWide + bx) * blockBytes;
+					if (internalFormat == GL_COMPRESSED_RG_RGTC2)
+					{
+						// Two single channel blocks, which are laid out just like BC3's alpha.
+						unsigned char channel[64];
+						for (unsigned int c = 0; c < 2; c++)
+						{
+							for (unsigned int i = 0; i < 16; i++)
+								channel[i * 4 + 3] = block[i * 4 + c];
+							stb__CompressAlphaBlock(destination + c * 8, channel, STB_DXT_HIGHQUAL);
+						}
+					}
+					else
+					{
+						stb_compress_dxt_block(destination, block, internalFormat == kCompressedRgbaBc3, STB_DXT_HIGHQUAL);
+					}
+				}
+			}
+		});
+	}
+}
+
+size_t TextureImage::GetSize() const
+{
+	size_t size = 0;
+	for (const Level &level : levels)
+		size += level.data.size();
+	return size;
+}
+
+std::string TextureCache::GetCachePath(const std::string &filePath, aie::Texture::Usage usage)
+{
+	switch (usage)
+	{
+	case aie::Texture::NORMAL_MAP: return filePath + ".normal.ktx";
+	case aie::Texture::LINEAR: return filePath + ".linear.ktx";
+	default: return filePath + ".ktx";
+	}
+}
+
+bool TextureCache::Load(const std::string &filePath, aie::Texture::Usage usage, TextureImage &image)
+{
+	std::string cachePath = GetCachePath(filePath, usage);
+	std::error_code error;
+	bool upToDate = std::filesystem::exists(cachePath, error) &&
+		std::filesystem::last_write_time(cachePath, error) >= std::filesystem::last_write_time(filePath, error);
+	if (upToDate && Read(cachePath.c_str(), image) && image.cacheVersion == kCacheVersion)
+		return true;
+
+	int width = 0, height = 0, components = 0;
+	unsigned char *pixels = stbi_load(filePath.c_str(), &width, &height, &components, STBI_default);
+	if (pixels == nullptr)
+		return false;
+	Compress(pixels, (unsigned int)width, (unsigned int)height, (unsigned int)components, usage, image);
+	stbi_image_free(pixels);
+
+	Write(cachePath.c_str(), image);
+	return true;
+}
+
+void TextureCache::Compress(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, TextureImage &image)
+{
+	InitCompressor();
+
+	// Everything goes to RGBA first, grey is spread across the colour channels as the uncompressed upload would show it.
+	std::vector<unsigned char> rgba((size_t)width * height * 4);
+	bool hasAlpha = false;
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		const unsigned char *source = pixels + i * components;
+		unsigned char *destination = rgba.data() + i * 4;
+		bool grey = components < 3;
+		destination[0] = source[0];
+		destination[1] = grey ? source[0] : source[1];
+		destination[2] = grey ? source[0] : source[2];
+		destination[3] = (components == 2 || components == 4) ? source[components - 1] : 255;
+		hasAlpha |= destination[3] != 255;
+	}
+
+	if (usage == aie::Texture::NORMAL_MAP)
+	{
+		image.internalFormat = GL_COMPRESSED_RG_RGTC2;
+		image.baseFormat = GL_RG;
+	}
+	else
+	{
+		image.internalFormat = hasAlpha ? kCompressedRgbaBc3 : kCompressedRgbBc1;
+		image.baseFormat = hasAlpha ? GL_RGBA : GL_RGB;
+	}
+	image.format = 0;
+	image.type = 0;
+	image.generateMips = false;
+
+	GenerateMips(rgba.data(), width, height, 4, usage, image.levels);
+	for (TextureImage::Level &level : image.levels)
+	{
+		std::vector<unsigned char> compressed;
+		CompressLevel(level.data, level.width, level.height, image.internalFormat, compressed);
+		level.data.swap(compressed);
+	}
+}
+
+void TextureCache::FromPixels(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, TextureImage &image)
+{
+	static const unsigned int formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	static const unsigned int internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+	image.internalFormat = internalFormats[components - 1];
+	image.baseFormat = formats[components - 1];
+	image.format = formats[components - 1];
+	image.type = GL_UNSIGNED_BYTE;
+	image.generateMips = false;
+
+	GenerateMips(pixels, width, height, components, usage, image.levels);
+	for (TextureImage::Level &level : image.levels)
+	{
+		size_t rowBytes = (size_t)level.width * components;
+		size_t paddedBytes = (rowBytes + 3) & ~(size_t)3;
+		if (rowBytes == paddedBytes)
+			continue;
+
+		std::vector<unsigned char> padded(paddedBytes * level.height, 0);
+		for (unsigned int y = 0; y < level.height; y++)
+			std::memcpy(padded.data() + y * paddedBytes, level.data.data() + y * rowBytes, rowBytes);
+		level.data.swap(padded);
+	}
+}
+
+void TextureCache::GenerateMips(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, std::vector<TextureImage::Level> &levels)
+{
+	levels.clear();
+	for (unsigned int w = width, h = height;; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+	{
+		levels.push_back({ w, h, {} });
+		if (w == 1 && h == 1)
+			break;
+	}
+	levels[0].data.assign(pixels, pixels + (size_t)width * height * components);
+
+	// Textures tile, so the filter wraps around the edges. Only colour is sRGB with alpha as coverage, normals and
+	// other values are filtered as they are, each channel on its own.
+	bool normalMap = usage == aie::Texture::NORMAL_MAP;
+	bool colour = usage == aie::Texture::COLOUR;
+	int alphaChannel = (components == 2 || components == 4) && colour ? (int)components - 1 : STBIR_ALPHA_CHANNEL_NONE;
+	stbir_colorspace colourSpace = colour ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR;
+	ThreadPool::Get().ParallelFor(levels.size() - 1, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin + 1; i <= end; i++)
+		{
+			TextureImage::Level &level = levels[i];
+			level.data.resize((size_t)level.width * level.height * components);
+			stbir_resize_uint8_generic(pixels, (int)width, (int)height, 0, level.data.data(), (int)level.width, (int)level.height, 0,
+				(int)components, alphaChannel, 0, STBIR_EDGE_WRAP, STBIR_FILTER_DEFAULT, colourSpace, nullptr);
+			if (normalMap && components >= 3)
+				Renormalise(level.data, components);
+		}
+	});
+}
+
+bool TextureCache::Read(const char *filePath, TextureImage &image)
+{
+	std::ifstream file(filePath, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<unsigned char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	KtxHeader header;
+	if (contents.size() < sizeof(kIdentifier) + sizeof(KtxHeader) ||
+		std::memcmp(contents.data(), kIdentifier, sizeof(kIdentifier)) != 0)
+		return false;
+	std::memcpy(&header, contents.data() + sizeof(kIdentifier), sizeof(KtxHeader));
+
+	// Only little endian 2D textures, which is what every tool writes by default.
+	if (header.endianness != kEndianness || header.pixelDepth > 1 || header.numberOfFaces != 1 || header.numberOfArrayElements > 1)
+		return false;
+
+	image.internalFormat = header.glInternalFormat;
+	image.baseFormat = header.glBaseInternalFormat;
+	image.format = header.glFormat;
+	image.type = header.glType;
+	image.generateMips = header.numberOfMipmapLevels == 0 && header.glType != 0;
+	image.cacheVersion = 0;
+	image.levels.clear();
+
+	// Each pair is its size, then the key and value, null separated, padded to 4 bytes.
+	size_t offset = sizeof(kIdentifier) + sizeof(KtxHeader);
+	size_t keyValueEnd = std::min(contents.size(), offset + header.bytesOfKeyValueData);
+	while (offset + 4 <= keyValueEnd)
+	{
+		uint32_t pairSize = 0;
+		std::memcpy(&pairSize, contents.data() + offset, 4);
+		offset += 4;
+		if (pairSize > keyValueEnd - offset)
+			break;
+		const char *pair = (const char *)contents.data() + offset;
+		if (pairSize > sizeof(kCacheVersionKey) && std::memcmp(pair, kCacheVersionKey, sizeof(kCacheVersionKey)) == 0)
+			image.cacheVersion = (unsigned int)std::atoi(std::string(pair + sizeof(kCacheVersionKey), pairSize - sizeof(kCacheVersionKey)).c_str());
+		offset += (pairSize + 3) & ~3u;
+	}
+
+	offset = sizeof(kIdentifier) + sizeof(KtxHeader) + header.bytesOfKeyValueData;
+	unsigned int levels = header.numberOfMipmapLevels == 0 ? 1 : header.numberOfMipmapLevels;
+	for (unsigned int level = 0; level < levels; level++)
+	{
+		uint32_t imageSize = 0;
+		if (offset + 4 > contents.size())
+			break;
+		std::memcpy(&imageSize, contents.data() + offset, 4);
+		offset += 4;
+		if (offset + imageSize > contents.size())
+			break;
+
+		TextureImage::Level mip;
+		mip.width = std::max(1u, header.pixelWidth >> level);
+		mip.height = std::max(1u, header.pixelHeight >> level);
+		mip.data.assign(contents.begin() + offset, contents.begin() + offset + imageSize);
+		image.levels.push_back(std::move(mip));
+
+		offset += (imageSize + 3) & ~3u; // Mip padding.
+	}
+	return !image.levels.empty();
+}
+
+bool TextureCache::Write(const char *filePath, const TextureImage &image)
+{
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file || image.levels.empty())
+	{
+		std::cout << "WARNING: " << "Couldn't write texture cache " << filePath << std::endl;
+		return false;
+	}
+
+	KtxHeader header = {};
+	header.endianness = kEndianness;
+	header.glType = image.type;
+	header.glTypeSize = 1;
+	header.glFormat = image.format;
+	header.glInternalFormat = image.internalFormat;
+	header.glBaseInternalFormat = image.baseFormat;
+	header.pixelWidth = image.levels[0].width;
+	header.pixelHeight = image.levels[0].height;
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = image.generateMips ? 0 : (uint32_t)image.levels.size();
+
+	static const unsigned char padding[3] = {};
+	std::string version = std::to_string(kCacheVersion);
+	uint32_t pairSize = (uint32_t)(sizeof(kCacheVersionKey) + version.size() + 1);
+	header.bytesOfKeyValueData = 4 + ((pairSize + 3) & ~3u);
+
+	file.write((const char *)kIdentifier, sizeof(kIdentifier));
+	file.write((const char *)&header, sizeof(header));
+	file.write((const char *)&pairSize, 4);
+	file.write(kCacheVersionKey, sizeof(kCacheVersionKey));
+	file.write(version.c_str(), version.size() + 1);
+	file.write((const char *)padding, ((pairSize + 3) & ~3u) - pairSize);
+
+	for (const TextureImage::Level &level : image.levels)
+	{
+		uint32_t imageSize = (uint32_t)level.data.size();
+		file.write((const char *)&imageSize, 4);
+		file.write((const char *)level.data.data(), level.data.size());
+		file.write((const char *)padding, ((imageSize + 3) & ~3u) - imageSize);
+	}
+	return (bool)file;
+}
+
+void TextureCache::Allocate(const TextureImage &image)
+{
+	// Only containers from elsewhere leave their mips to the driver, they get the whole chain down to 1x1.
+	const TextureImage::Level &base = image.levels[0];
+	GLsizei levelCount = (GLsizei)image.levels.size();
+	if (image.generateMips)
+		levelCount = (GLsizei)std::log2(std::max(base.width, base.height)) + 1;
+
+	glTexStorage2D(GL_TEXTURE_2D, levelCount, GetStorageFormat(image.internalFormat), base.width, base.height);
+}
+
+void TextureCache::Upload(const TextureImage &image)
+{
+	Allocate(image);
+	for (size_t i = 0; i < image.levels.size(); i++)
+	{
+		const TextureImage::Level &level = image.levels[i];
+		if (image.IsCompressed())
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, (GLint)i, 0, 0, level.width, level.height, image.internalFormat, (GLsizei)level.data.size(), level.data.data());
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, (GLint)i, 0, 0, level.width, level.height, image.format, image.type, level.data.data());
+	}
+
+	if (image.generateMips)
+		glGenerateMipmap(GL_TEXTURE_2D);
+}
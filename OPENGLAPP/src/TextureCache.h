@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Texture.h"
+
+// A texture as the GPU takes it, every mip level ready to upload.
+struct TextureImage
+{
+	struct Level
+	{
+		unsigned int width;
+		unsigned int height;
+		std::vector<unsigned char> data;
+	};
+
+	unsigned int internalFormat = 0; // GL enums.
+	unsigned int baseFormat = 0; // GL_RED, GL_RG, GL_RGB or GL_RGBA.
+	unsigned int format = 0; // Zero for block compressed formats, like type.
+	unsigned int type = 0;
+	std::vector<Level> levels; // Full size first.
+	bool generateMips = false; // Only the first level was stored, the driver builds the rest.
+	unsigned int cacheVersion = 0; // Of the TextureCache that cooked it, zero if it came from elsewhere.
+
+	bool IsCompressed() const { return type == 0; }
+	size_t GetSize() const; // Bytes, every level.
+};
+
+// Images cooked for the GPU next to their source file (.ktx, .normal.ktx for normal maps), with every mip level block
+// compressed: BC1 for opaque colour, BC3 where there's alpha and BC5 for normal maps, which only keep x and y. Later
+// loads read them from there unless the image is newer, skipping decoding, mip generation and compression. The files
+// are plain version 1 KTX, so other tools read them too.
+class TextureCache
+{
+public:
+	static std::string GetCachePath(const std::string &filePath, aie::Texture::Usage usage);
+
+	// Reads the cooked copy, or decodes the image, compresses it and cooks it for next time. Thread safe.
+	static bool Load(const std::string &filePath, aie::Texture::Usage usage, TextureImage &image);
+
+	// Builds the mip chain and compresses every level across the thread pool.
+	static void Compress(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, TextureImage &image);
+	// Builds the mip chain but leaves it uncompressed, for images that aren't cached. Rows are padded to 4 bytes as
+	// they are in KTX, which is also GL's default unpack alignment.
+	static void FromPixels(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, TextureImage &image);
+
+	// Every level down to 1x1, filtered straight from the full size image so the levels are built in parallel across
+	// the thread pool. Colour is filtered in linear light rather than on its sRGB values, which would darken each
+	// level, linear maps are filtered on their values as they are and normal maps are renormalised after filtering.
+	// Rows are tightly packed.
+	static void GenerateMips(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int components, aie::Texture::Usage usage, std::vector<TextureImage::Level> &levels);
+
+	static bool Read(const char *filePath, TextureImage &image); // Any 2D version 1 KTX, compressed or not.
+	static bool Write(const char *filePath, const TextureImage &image);
+
+	// Gives the texture bound to GL_TEXTURE_2D immutable storage for every level. Filtering is left to the sampler
+	// it's drawn with. Main or upload thread, as is Upload.
+	static void Allocate(const TextureImage &image);
+	static void Upload(const TextureImage &image); // Allocates the storage and fills in every level.
+};
@@ -0,0 +1,348 @@
+#include "TextureResidency.h"
+
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "TextureArrays.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <cmath>
+
+#include <glad.h>
+
+TextureResidency &TextureResidency::Get()
+{
+	static TextureResidency residency;
+	return residency;
+}
+
+void TextureResidency::Track(const std::shared_ptr<aie::Texture> &texture, const std::string &cachePath)
+{
+	// A texture freed since the last update may have left its entry at the same address.
+	auto it = m_entries.find(texture.get());
+	if (it != m_entries.end())
+		Forget(it->second);
+
+	Entry entry;
+	entry.texture = texture;
+	entry.textureId = texture->getId();
+	entry.cachePath = cachePath;
+	m_entries[texture.get()] = std::move(entry);
+}
+
+bool TextureResidency::IsTracked(const aie::Texture *texture) const
+{
+	auto it = m_entries.find(texture);
+	return it != m_entries.end() && it->second.textureId == texture->getId() && it->second.levelCount > 0;
+}
+
+void TextureResidency::AddPacked(const aie::Texture *texture)
+{
+	auto it = m_entries.find(texture);
+	if (it == m_entries.end() || it->second.textureId != texture->getId() || it->second.packed)
+		return;
+	it->second.packed = true;
+	m_videoBytes += GetVideoBytes(it->second, 0);
+}
+
+void TextureResidency::RemovePacked(const aie::Texture *texture)
+{
+	auto it = m_entries.find(texture);
+	if (it != m_entries.end() && it->second.textureId == texture->getId())
+		Unpack(it->second);
+}
+
+void TextureResidency::Unpack(Entry &entry)
+{
+	if (!entry.packed)
+		return;
+	TextureArrays::Get().Remove(entry.textureId);
+	m_videoBytes -= GetVideoBytes(entry, 0);
+	entry.packed = false;
+}
+
+void TextureResidency::Forget(Entry &entry)
+{
+	Unpack(entry);
+	TextureArrays::Get().Remove(entry.textureId); // Drops any note of it not fitting, too.
+	if (entry.levelCount > 0)
+		m_videoBytes -= GetVideoBytes(entry, entry.residentLevel);
+	if (entry.levels)
+		m_systemBytes -= entry.levels->GetSize();
+}
+
+void TextureResidency::Request(const aie::Texture *texture, float pixels)
+{
+	auto it = m_entries.find(texture);
+	if (it == m_entries.end() || it->second.levelCount == 0)
+		return;
+
+	// A level is worth having until it has fewer texels across than the pixels it covers.
+	Entry &entry = it->second;
+	float size = (float)std::max(texture->getWidth(), texture->getHeight());
+	int level = (int)std::floor(std::log2(size / std::max(pixels, 1.0f)));
+	unsigned int wanted = (unsigned int)glm::clamp(level, 0, (int)entry.minLevel);
+	entry.wantedLevel = entry.lastRequested == m_frame ? std::min(entry.wantedLevel, wanted) : wanted;
+	entry.lastRequested = m_frame;
+}
+
+bool TextureResidency::Initialise(Entry &entry, const aie::Texture &texture)
+{
+	// Without its cache file, levels evicted from it could never come back.
+	std::error_code error;
+	if (!std::filesystem::exists(entry.cachePath, error))
+		return false;
+
+	unsigned int handle = texture.getHandle();
+	GLint levelCount = 0, internalFormat = 0, compressed = 0;
+	glGetTextureParameteriv(handle, GL_TEXTURE_IMMUTABLE_LEVELS, &levelCount);
+	if (levelCount <= 0)
+		return false;
+	glGetTextureLevelParameteriv(handle, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTextureLevelParameteriv(handle, 0, GL_TEXTURE_COMPRESSED, &compressed);
+
+	GLint bits = 0;
+	if (!compressed)
+	{
+		const GLenum channels[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+		for (GLenum channel : channels)
+		{
+			GLint size = 0;
+			glGetTextureLevelParameteriv(handle, 0, channel, &size);
+			bits += size;
+		}
+	}
+
+	entry.levelCount = (unsigned int)levelCount;
+	entry.internalFormat = (unsigned int)internalFormat;
+	entry.levelBytes.resize(entry.levelCount);
+	entry.minLevel = entry.levelCount - 1;
+	for (unsigned int level = 0; level < entry.levelCount; level++)
+	{
+		unsigned int width = std::max(texture.getWidth() >> level, 1u);
+		unsigned int height = std::max(texture.getHeight() >> level, 1u);
+		GLint size = 0;
+		if (compressed)
+			glGetTextureLevelParameteriv(handle, (GLint)level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+		entry.levelBytes[level] = compressed ? (size_t)size : (size_t)width * height * bits / 8;
+		if (std::max(width, height) <= kMinResidentSize)
+			entry.minLevel = std::min(entry.minLevel, level);
+	}
+
+	// Everything's been uploaded to start with.
+	entry.residentLevel = 0;
+	entry.wantedLevel = entry.levelCount;
+	m_videoBytes += GetVideoBytes(entry, 0);
+	return true;
+}
+
+size_t TextureResidency::GetVideoBytes(const Entry &entry, unsigned int level) const
+{
+	size_t bytes = 0;
+	for (unsigned int i = level; i < entry.levelCount; i++)
+		bytes += entry.levelBytes[i];
+	return bytes;
+}
+
+void TextureResidency::Update()
+{
+	for (auto it = m_entries.begin(); it != m_entries.end();)
+	{
+		Entry &entry = it->second;
+		std::shared_ptr<aie::Texture> texture = entry.texture.lock();
+		bool keep = texture != nullptr;
+		if (keep && entry.levelCount == 0 && texture->getHandle() != 0)
+			keep = Initialise(entry, *texture);
+
+		if (keep && entry.loading.valid() && entry.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			entry.levels = entry.loading.get();
+			if (entry.levels == nullptr || entry.levels->levels.size() != entry.levelCount)
+			{
+				// It keeps what it has, but nothing finer can be restored.
+				std::cout << "WARNING: " << "Couldn't read texture levels from " << entry.cachePath << std::endl;
+				entry.levels = nullptr;
+				keep = false;
+			}
+			else
+			{
+				m_systemBytes += entry.levels->GetSize();
+				entry.lastRead = m_frame;
+			}
+		}
+
+		if (keep)
+		{
+			++it;
+			continue;
+		}
+		Forget(entry);
+		it = m_entries.erase(it);
+	}
+
+	// Restore whatever's furthest from the detail it was asked for first.
+	std::vector<Entry *> wanting;
+	for (auto &pair : m_entries)
+	{
+		Entry &entry = pair.second;
+		if (entry.levelCount > 0 && entry.lastRequested == m_frame && entry.wantedLevel < entry.residentLevel)
+			wanting.push_back(&entry);
+	}
+	std::sort(wanting.begin(), wanting.end(), [](const Entry *a, const Entry *b)
+	{
+		return a->residentLevel - a->wantedLevel > b->residentLevel - b->wantedLevel;
+	});
+
+	size_t uploaded = 0;
+	for (Entry *entry : wanting)
+	{
+		if (uploaded >= kDefaultUploadBudget)
+			break;
+		if (entry->levels == nullptr)
+		{
+			if (!entry->loading.valid())
+			{
+				entry->loading = ThreadPool::Get().Submit([cachePath = entry->cachePath]() -> std::shared_ptr<const TextureImage>
+				{
+					std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>();
+					if (!TextureCache::Read(cachePath.c_str(), *image))
+						return nullptr;
+					return image;
+				});
+			}
+			continue;
+		}
+
+		// The finest level that fits once everything that can make room has.
+		unsigned int level = entry->wantedLevel;
+		size_t resident = GetVideoBytes(*entry, entry->residentLevel);
+		while (level < entry->residentLevel && !EvictFor(GetVideoBytes(*entry, level) - resident, entry))
+			level++;
+		if (level < entry->residentLevel)
+		{
+			uploaded += GetVideoBytes(*entry, level) - resident;
+			Resize(*entry, level);
+			entry->lastRead = m_frame;
+		}
+	}
+
+	// The budget may have been lowered.
+	EvictFor(0, nullptr);
+
+	while (m_systemBytes > m_systemBudget)
+	{
+		Entry *oldest = nullptr;
+		for (auto &pair : m_entries)
+		{
+			Entry &entry = pair.second;
+			if (entry.levels && (oldest == nullptr || entry.lastRead < oldest->lastRead))
+				oldest = &entry;
+		}
+		if (oldest == nullptr)
+			break;
+		m_systemBytes -= oldest->levels->GetSize();
+		oldest->levels = nullptr;
+	}
+
+	m_frame++;
+}
+
+bool TextureResidency::EvictFor(size_t bytes, const Entry *keep)
+{
+	while (m_videoBytes + bytes > m_videoBudget)
+	{
+		// Textures nobody asked for this frame go down to their coarsest level, least recently asked for first. Only
+		// then do those that were asked for give up detail, and never past what they asked for.
+		Entry *victim = nullptr;
+		bool victimRequested = true;
+		for (auto &pair : m_entries)
+		{
+			Entry &entry = pair.second;
+			if (&entry == keep || entry.levelCount == 0)
+				continue;
+			bool requested = entry.lastRequested == m_frame;
+			if (entry.residentLevel >= (requested ? entry.wantedLevel : entry.minLevel))
+				continue;
+
+			if (victim == nullptr || (victimRequested && !requested) || (!requested && entry.lastRequested < victim->lastRequested))
+			{
+				victim = &entry;
+				victimRequested = requested;
+			}
+		}
+		if (victim == nullptr)
+			return false;
+		Resize(*victim, victimRequested ? victim->wantedLevel : victim->minLevel);
+	}
+	return true;
+}
+
+void TextureResidency::Resize(Entry &entry, unsigned int level)
+{
+	std::shared_ptr<aie::Texture> texture = entry.texture.lock();
+	if (!texture)
+		return;
+	if (level > entry.residentLevel) // The layer has every level, it goes with the detail.
+		Unpack(entry);
+
+	unsigned int width = texture->getWidth(), height = texture->getHeight();
+	unsigned int handle = 0;
+	glCreateTextures(GL_TEXTURE_2D, 1, &handle);
+	glTextureStorage2D(handle, entry.levelCount - level, entry.internalFormat, std::max(width >> level, 1u), std::max(height >> level, 1u));
+
+	// Levels already resident are copied across on the GPU, only finer ones come from system memory.
+	for (unsigned int i = level; i < entry.levelCount; i++)
+	{
+		GLsizei levelWidth = std::max(width >> i, 1u), levelHeight = std::max(height >> i, 1u);
+		if (i >= entry.residentLevel)
+		{
+			glCopyImageSubData(texture->getHandle(), GL_TEXTURE_2D, i - entry.residentLevel, 0, 0, 0,
+				handle, GL_TEXTURE_2D, i - level, 0, 0, 0, levelWidth, levelHeight, 1);
+			continue;
+		}
+
+		const TextureImage &image = *entry.levels;
+		const TextureImage::Level &source = image.levels[i];
+		if (image.IsCompressed())
+			glCompressedTextureSubImage2D(handle, i - level, 0, 0, levelWidth, levelHeight, image.internalFormat, (GLsizei)source.data.size(), source.data.data());
+		else
+			glTextureSubImage2D(handle, i - level, 0, 0, levelWidth, levelHeight, image.format, image.type, source.data.data());
+	}
+
+	m_videoBytes = m_videoBytes - GetVideoBytes(entry, entry.residentLevel) + GetVideoBytes(entry, level);
+	entry.residentLevel = level;
+
+	// Keeps its full size, it's still the same texture to everything using it.
+	std::string filename = texture->getFilename();
+	texture->adopt(handle, width, height, (aie::Texture::Format)texture->getFormat(), filename.c_str());
+}
+
+void TextureResidency::GetStats(std::vector<Stats> &stats) const
+{
+	stats.clear();
+	for (const auto &pair : m_entries)
+	{
+		const Entry &entry = pair.second;
+		std::shared_ptr<aie::Texture> texture = entry.texture.lock();
+		if (!texture || entry.levelCount == 0)
+			continue;
+
+		Stats stat;
+		stat.filePath = texture->getFilename();
+		stat.levelCount = entry.levelCount;
+		stat.residentLevel = entry.residentLevel;
+		stat.wantedLevel = entry.lastRequested + 1 >= m_frame ? entry.wantedLevel : entry.levelCount;
+		stat.videoBytes = GetVideoBytes(entry, entry.residentLevel) + (entry.packed ? GetVideoBytes(entry, 0) : 0);
+		stat.inSystemMemory = entry.levels != nullptr;
+		stat.loading = entry.loading.valid();
+		stats.push_back(std::move(stat));
+	}
+}
+
+void TextureResidency::Release()
+{
+	// Reads still running finish into futures nobody reads.
+	m_entries.clear();
+	m_videoBytes = 0;
+	m_systemBytes = 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Common.h"
+
+#include "TextureCache.h"
+
+#include <memory>
+#include <future>
+#include <unordered_map>
+
+namespace aie
+{
+	class Texture;
+}
+
+// Keeps only as many mip levels of each cached texture in video memory as the screen asks for, within a budget. The
+// instances using a texture say each frame how many pixels across they cover, which picks the finest level worth
+// having. Over budget, textures nobody asked for lately give up their fine levels first, least recently used first,
+// then textures with more detail than they were asked for. Evicted levels come back from the texture cache, read on
+// the thread pool, and what was read is kept in system memory within a second budget, least recently used going
+// first, so nothing is held on the CPU once there's no room. Resizing a texture replaces its handle, the levels it
+// already had are copied across on the GPU. A texture packed into the TextureArrays has its layer counted against the
+// video budget too, and the layer is freed along with its fine levels when it's evicted. Main thread only.
+class TextureResidency
+{
+public:
+	static const size_t kDefaultVideoBudget = 256 * 1024 * 1024; // Bytes.
+	static const size_t kDefaultSystemBudget = 64 * 1024 * 1024;
+	static const size_t kDefaultUploadBudget = 8 * 1024 * 1024; // Bytes of restored levels per frame.
+	static const unsigned int kMinResidentSize = 64; // Texels, levels this size and smaller are never evicted.
+
+	// What the panel shows about each texture.
+	struct Stats
+	{
+		std::string filePath;
+		unsigned int levelCount;
+		unsigned int residentLevel; // Finest level in video memory.
+		unsigned int wantedLevel; // Finest level asked for last frame, levelCount if nothing did.
+		size_t videoBytes;
+		bool inSystemMemory;
+		bool loading;
+	};
+
+public:
+	static TextureResidency &Get(); // Shared manager, created on first use.
+
+	// Manages a texture whose every level is in the texture cache file given, once it's first resident.
+	void Track(const std::shared_ptr<aie::Texture> &texture, const std::string &cachePath);
+	// How many pixels across the texture covers on screen this frame. Textures that aren't tracked are ignored.
+	void Request(const aie::Texture *texture, float pixels);
+	bool IsTracked(const aie::Texture *texture) const; // And resident, so its levels are known.
+
+	// The TextureArrays copied every level of the texture into a layer, or should free the layer again.
+	void AddPacked(const aie::Texture *texture);
+	void RemovePacked(const aie::Texture *texture);
+
+	void Update(); // Once a frame after the requests, evicts and restores levels.
+	void Release(); // Stops tracking everything, call before the GL context goes.
+
+	void SetVideoBudget(size_t bytes) { m_videoBudget = bytes; }
+	size_t GetVideoBudget() const { return m_videoBudget; }
+	void SetSystemBudget(size_t bytes) { m_systemBudget = bytes; }
+	size_t GetSystemBudget() const { return m_systemBudget; }
+	size_t GetVideoBytes() const { return m_videoBytes; } // Tracked textures only.
+	size_t GetSystemBytes() const { return m_systemBytes; }
+	unsigned int GetTrackedCount() const { return (unsigned int)m_entries.size(); }
+	void GetStats(std::vector<Stats> &stats) const;
+
+private:
+	struct Entry
+	{
+		std::weak_ptr<aie::Texture> texture;
+		unsigned int textureId = 0; // For freeing its layer once the texture's gone.
+		std::string cachePath;
+		unsigned int levelCount = 0; // Zero until the texture is first resident.
+		unsigned int minLevel = 0; // Coarsest level that can be evicted down to.
+		unsigned int residentLevel = 0;
+		unsigned int wantedLevel = 0;
+		unsigned int internalFormat = 0;
+		std::vector<size_t> levelBytes;
+		uint64_t lastRequested = 0; // Frame.
+		bool packed = false; // Into the TextureArrays, every level.
+
+		std::shared_ptr<const TextureImage> levels; // Every level, null unless it's in system memory.
+		uint64_t lastRead = 0; // Frame, for evicting from system memory.
+		std::future<std::shared_ptr<const TextureImage>> loading;
+	};
+
+private:
+	bool Initialise(Entry &entry, const aie::Texture &texture);
+	size_t GetVideoBytes(const Entry &entry, unsigned int level) const; // Resident from that level down.
+	void Unpack(Entry &entry);
+	void Forget(Entry &entry); // Takes what it holds off the budgets, before it's erased.
+	void Resize(Entry &entry, unsigned int level);
+	bool EvictFor(size_t bytes, const Entry *keep); // Until the bytes fit, false if they can't.
+
+private:
+	std::unordered_map<const aie::Texture *, Entry> m_entries;
+	uint64_t m_frame = 1;
+
+	size_t m_videoBudget = kDefaultVideoBudget;
+	size_t m_systemBudget = kDefaultSystemBudget;
+	size_t m_videoBytes = 0;
+	size_t m_systemBytes = 0;
+
+};
@@ -0,0 +1,295 @@
+#include "TextureStreamer.h"
+
+#include "Texture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <glad.h>
+
+namespace
+{
+	const size_t kBandAlignment = 16; // Bytes, where each band starts in the unpack buffer.
+
+	// How a level splits into rows for streaming, texel rows or rows of 4x4 blocks.
+	unsigned int GetRowCount(const TextureImage &image, const TextureImage::Level &level)
+	{
+		return image.IsCompressed() ? (level.height + 3) / 4 : level.height;
+	}
+	size_t GetRowBytes(const TextureImage &image, const TextureImage::Level &level)
+	{
+		return level.data.size() / GetRowCount(image, level);
+	}
+
+	aie::Texture::Format GetFormat(unsigned int baseFormat)
+	{
+		switch (baseFormat)
+		{
+		case GL_RED: return aie::Texture::RED;
+		case GL_RG: return aie::Texture::RG;
+		case GL_RGB: return aie::Texture::RGB;
+		default: return aie::Texture::RGBA;
+		}
+	}
+}
+
+TextureStreamer &TextureStreamer::Get()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+
+void TextureStreamer::Request(const std::shared_ptr<aie::Texture> &texture, const std::string &filePath, aie::Texture::Usage usage)
+{
+	Decode decode;
+	decode.texture = texture;
+	decode.filePath = filePath;
+	decode.image = ThreadPool::Get().Submit([filePath, usage]() -> std::shared_ptr<const TextureImage>
+	{
+		std::shared_ptr<TextureImage> image = std::make_shared<TextureImage>();
+		if (!TextureCache::Load(filePath, usage, *image))
+			return nullptr;
+		return image;
+	});
+	m_decodes.push_back(std::move(decode));
+}
+
+void TextureStreamer::FinishDecodes()
+{
+	for (size_t i = 0; i < m_decodes.size();)
+	{
+		if (m_decodes[i].image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			i++;
+			continue;
+		}
+
+		Decode decode = std::move(m_decodes[i]);
+		m_decodes[i] = std::move(m_decodes.back());
+		m_decodes.pop_back();
+
+		std::shared_ptr<const TextureImage> image = decode.image.get();
+		if (decode.texture.expired())
+			continue;
+		if (image == nullptr)
+		{
+			std::cout << "WARNING: " << "Couldn't load texture " << decode.filePath << std::endl;
+			continue;
+		}
+
+		Upload upload;
+		upload.texture = decode.texture;
+		upload.filePath = std::move(decode.filePath);
+		upload.image = std::move(image);
+		if (!UploadThread::Get().IsRunning())
+		{
+			m_uploads.push_back(std::move(upload));
+			continue;
+		}
+
+		// Every level in one go, it's off the render thread so there's no budget to keep to. The upload holds on to
+		// the image until it has run.
+		glCreateTextures(GL_TEXTURE_2D, 1, &upload.handle);
+		upload.ticket = UploadThread::Get().Submit([image = upload.image, handle = upload.handle]()
+		{
+			glBindTexture(GL_TEXTURE_2D, handle);
+			TextureCache::Upload(*image);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		});
+		m_threadedUploads.push_back(std::move(upload));
+	}
+}
+
+void TextureStreamer::Update()
+{
+	m_uploadedBytes = 0;
+	FinishDecodes();
+
+	for (size_t i = 0; i < m_threadedUploads.size();)
+	{
+		if (!UploadThread::IsResident(m_threadedUploads[i].ticket))
+		{
+			i++;
+			continue;
+		}
+		m_uploadedBytes += m_threadedUploads[i].image->GetSize();
+		Finish(m_threadedUploads[i]);
+		m_threadedUploads.erase(m_threadedUploads.begin() + i);
+	}
+
+	// Nobody wants these any more.
+	for (size_t i = 0; i < m_uploads.size();)
+	{
+		if (!m_uploads[i].texture.expired())
+		{
+			i++;
+			continue;
+		}
+		glDeleteTextures(1, &m_uploads[i].handle);
+		m_uploads.erase(m_uploads.begin() + i);
+	}
+	if (m_uploads.empty())
+		return;
+
+	// Storage for anything new, the bands are copied into it.
+	for (Upload &upload : m_uploads)
+	{
+		if (upload.handle == 0)
+			Allocate(upload);
+	}
+
+	// A band is at least a row, however tight the budget, so every texture gets there eventually.
+	const Upload &first = m_uploads.front();
+	size_t size = std::max(m_budget, GetRowBytes(*first.image, first.image->levels[first.level]));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer);
+	if (m_pixelBuffer == 0 || size > m_pixelBufferSize)
+	{
+		glDeleteBuffers(1, &m_pixelBuffer);
+		glGenBuffers(1, &m_pixelBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer);
+		m_pixelBufferSize = size;
+	}
+
+	// Orphaned each frame, so filling it never waits on the driver still copying out of last frame's.
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)m_pixelBufferSize, nullptr, GL_STREAM_DRAW);
+	unsigned char *staging = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)m_pixelBufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (staging == nullptr)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	// Copy this frame's bands in first, the copies to the textures can't start until the buffer is unmapped.
+	struct Band
+	{
+		size_t upload;
+		unsigned int level;
+		unsigned int firstRow;
+		unsigned int rowCount;
+		size_t offset;
+	};
+	std::vector<Band> bands;
+	size_t offset = 0;
+	bool outOfBudget = false;
+	for (size_t i = 0; i < m_uploads.size() && !outOfBudget; i++)
+	{
+		Upload &upload = m_uploads[i];
+		const TextureImage &image = *upload.image;
+		while (upload.level < image.levels.size())
+		{
+			const TextureImage::Level &level = image.levels[upload.level];
+			size_t rowBytes = GetRowBytes(image, level);
+			unsigned int rows = GetRowCount(image, level);
+			size_t available = offset < m_budget ? m_budget - offset : 0;
+			if (bands.empty())
+				available = std::max(available, rowBytes); // The buffer was sized to fit.
+			unsigned int rowCount = std::min(rows - upload.nextRow, (unsigned int)(available / rowBytes));
+			if (rowCount == 0)
+			{
+				outOfBudget = true;
+				break;
+			}
+
+			std::memcpy(staging + offset, level.data.data() + upload.nextRow * rowBytes, rowCount * rowBytes);
+			bands.push_back({ i, upload.level, upload.nextRow, rowCount, offset });
+			offset = (offset + rowCount * rowBytes + kBandAlignment - 1) & ~(kBandAlignment - 1);
+			m_uploadedBytes += rowCount * rowBytes;
+
+			upload.nextRow += rowCount;
+			if (upload.nextRow < rows)
+			{
+				outOfBudget = true; // Part way through a level.
+				break;
+			}
+			upload.level++;
+			upload.nextRow = 0;
+		}
+	}
+
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+	{
+		// The buffer's contents were lost, send the same rows again next frame. Each upload's first band is where it was.
+		for (size_t i = bands.size(); i-- > 0;)
+		{
+			m_uploads[bands[i].upload].level = bands[i].level;
+			m_uploads[bands[i].upload].nextRow = bands[i].firstRow;
+		}
+		m_uploadedBytes = 0;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	for (const Band &band : bands)
+	{
+		const Upload &upload = m_uploads[band.upload];
+		const TextureImage &image = *upload.image;
+		const TextureImage::Level &level = image.levels[band.level];
+		glBindTexture(GL_TEXTURE_2D, upload.handle);
+		if (image.IsCompressed())
+		{
+			unsigned int y = band.firstRow * 4;
+			unsigned int height = std::min(band.rowCount * 4, level.height - y);
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, band.level, 0, y, level.width, height, image.internalFormat,
+				(GLsizei)(band.rowCount * GetRowBytes(image, level)), (const void *)band.offset);
+		}
+		else
+		{
+			glTexSubImage2D(GL_TEXTURE_2D, band.level, 0, band.firstRow, level.width, band.rowCount, image.format, image.type, (const void *)band.offset);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// Completed uploads are always at the front, they're streamed in order.
+	size_t finished = 0;
+	while (finished < m_uploads.size() && m_uploads[finished].level >= m_uploads[finished].image->levels.size())
+		Finish(m_uploads[finished++]);
+	m_uploads.erase(m_uploads.begin(), m_uploads.begin() + finished);
+}
+
+void TextureStreamer::Allocate(Upload &upload)
+{
+	glGenTextures(1, &upload.handle);
+	glBindTexture(GL_TEXTURE_2D, upload.handle);
+	TextureCache::Allocate(*upload.image);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TextureStreamer::Finish(Upload &upload)
+{
+	if (upload.ticket == nullptr && upload.image->generateMips) // The upload thread has already done this.
+	{
+		glBindTexture(GL_TEXTURE_2D, upload.handle);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Only now does the texture have a handle, so it's drawn with in one piece or not at all.
+	std::shared_ptr<aie::Texture> texture = upload.texture.lock();
+	const TextureImage::Level &level = upload.image->levels[0];
+	if (texture)
+		texture->adopt(upload.handle, level.width, level.height, GetFormat(upload.image->baseFormat), upload.filePath.c_str());
+	else
+		glDeleteTextures(1, &upload.handle);
+	upload.handle = 0;
+}
+
+void TextureStreamer::Release()
+{
+	// Loads still running finish into futures nobody reads, which free their images.
+	m_decodes.clear();
+	for (Upload &upload : m_uploads)
+		glDeleteTextures(1, &upload.handle);
+	m_uploads.clear();
+	for (Upload &upload : m_threadedUploads)
+	{
+		UploadThread::Wait(upload.ticket);
+		glDeleteTextures(1, &upload.handle);
+	}
+	m_threadedUploads.clear();
+
+	glDeleteBuffers(1, &m_pixelBuffer);
+	m_pixelBuffer = 0;
+	m_pixelBufferSize = 0;
+}
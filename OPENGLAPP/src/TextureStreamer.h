@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Common.h"
+
+#include "Texture.h"
+#include "UploadThread.h"
+#include "TextureCache.h"
+
+#include <memory>
+#include <future>
+
+// Loads image files without stalling the frame. They're read from the texture cache, or decoded and compressed into
+// it, on the thread pool and handed to the upload thread, or, if that isn't running, Update streams each level to the
+// GPU through a pixel unpack buffer a band of rows at a time, no more than the byte budget each frame. A texture keeps
+// a zero handle until all of it is resident, so whoever draws with it binds a placeholder until then. Main thread
+// only, apart from the decoding and uploading.
+class TextureStreamer
+{
+public:
+	static const size_t kDefaultBudget = 8 * 1024 * 1024; // Bytes uploaded per frame.
+
+public:
+	static TextureStreamer &Get(); // Shared streamer, created on first use.
+
+	// Fills in the texture once the file is decoded and uploaded. Dropping the last handle to it cancels the load.
+	void Request(const std::shared_ptr<aie::Texture> &texture, const std::string &filePath, aie::Texture::Usage usage = aie::Texture::COLOUR);
+
+	void Update(); // Once a frame, finishes decodes and spends the budget on uploads.
+	void Release(); // Abandons whatever's in flight and frees the unpack buffer, call before the GL context goes.
+
+	void SetByteBudget(size_t bytes) { m_budget = std::max<size_t>(bytes, 1); } // Only without the upload thread.
+	size_t GetByteBudget() const { return m_budget; }
+	unsigned int GetPendingCount() const { return (unsigned int)(m_decodes.size() + m_uploads.size() + m_threadedUploads.size()); } // Decoding or uploading.
+	size_t GetUploadedBytes() const { return m_uploadedBytes; } // Last frame.
+
+private:
+	struct Decode
+	{
+		std::weak_ptr<aie::Texture> texture;
+		std::string filePath;
+		std::future<std::shared_ptr<const TextureImage>> image; // Null if the file couldn't be loaded.
+	};
+
+	struct Upload
+	{
+		std::weak_ptr<aie::Texture> texture;
+		std::string filePath;
+		std::shared_ptr<const TextureImage> image;
+		unsigned int handle = 0; // Created with its storage before the first band.
+		unsigned int level = 0; // Being streamed.
+		unsigned int nextRow = 0; // Of blocks, for compressed formats.
+		UploadThread::Ticket ticket; // Null unless it was handed to the upload thread.
+	};
+
+private:
+	void FinishDecodes();
+	void Allocate(Upload &upload);
+	void Finish(Upload &upload);
+
+private:
+	std::vector<Decode> m_decodes;
+	std::vector<Upload> m_uploads; // In the order they finished decoding, which is the order they're uploaded in.
+	std::vector<Upload> m_threadedUploads; // With the upload thread, waiting to be resident.
+
+	unsigned int m_pixelBuffer = 0;
+	size_t m_pixelBufferSize = 0;
+	size_t m_budget = kDefaultBudget;
+	size_t m_uploadedBytes = 0;
+
+};
@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1; // Leave one for the main thread.
+	}
+
+	m_workers.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; i++)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	for (std::thread &worker : m_workers)
+		worker.join();
+}
+
+ThreadPool &ThreadPool::Get()
+{
+	static ThreadPool s_pool;
+	return s_pool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+	}
+	m_condition.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+			if (m_stopping && m_tasks.empty())
+				return;
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)> &function)
+{
+	if (count == 0)
+		return;
+
+	grainSize = std::max<size_t>(grainSize, 1);
+	size_t rangeCount = (count + grainSize - 1) / grainSize;
+	if (rangeCount == 1) // Not worth waking anyone up.
+	{
+		function(0, count);
+		return;
+	}
+
+	// Ranges are claimed from a shared counter so whoever is free picks up the next one.
+	struct SharedState
+	{
+		std::atomic<size_t> next { 0 };
+		std::atomic<size_t> done { 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto state = std::make_shared<SharedState>();
+
+	auto runRanges = [state, count, grainSize, rangeCount, &function]()
+	{
+		size_t range;
+		while ((range = state->next.fetch_add(1)) < rangeCount)
+		{
+			size_t begin = range * grainSize;
+			size_t end = std::min(begin + grainSize, count);
+			function(begin, end);
+
+			if (state->done.fetch_add(1) + 1 == rangeCount)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->finished.notify_all();
+			}
+		}
+	};
+
+	size_t helperCount = std::min<size_t>(rangeCount - 1, m_workers.size());
+	for (size_t i = 0; i < helperCount; i++)
+		Enqueue(runRanges);
+
+	runRanges();
+
+	// Helpers that start after every range is claimed return straight away, so only wait on ranges in flight.
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state, rangeCount]() { return state->done.load() == rangeCount; });
+}
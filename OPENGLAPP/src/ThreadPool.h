@@ -0,0 +1,53 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <deque>
+#include <vector>
+
+// Fixed pool of worker threads shared by the loaders and bakers.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int threadCount = 0); // Zero uses every hardware thread but one.
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	static ThreadPool &Get(); // Shared pool, created on first use.
+
+	unsigned int GetThreadCount() const { return (unsigned int)m_workers.size(); }
+
+	// Queue a task, the returned future holds its result.
+	template<typename Function>
+	auto Submit(Function &&task) -> std::future<decltype(task())>
+	{
+		using Result = decltype(task());
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(task));
+		std::future<Result> future = packaged->get_future();
+		Enqueue([packaged]() { (*packaged)(); });
+		return future;
+	}
+
+	// Splits [0, count) into ranges of at least grainSize and runs them across the pool, the calling thread helps out.
+	// Safe to call from inside a worker since the caller never waits on a range nobody has picked up.
+	void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t begin, size_t end)> &function);
+
+private:
+	void Enqueue(std::function<void()> task);
+	void WorkerLoop();
+
+private:
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_tasks;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stopping = false;
+
+};
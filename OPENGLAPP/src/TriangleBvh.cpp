@@ -0,0 +1,262 @@
+#include "TriangleBvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	struct Bounds
+	{
+		glm::vec3 minimum = glm::vec3(FLT_MAX);
+		glm::vec3 maximum = glm::vec3(-FLT_MAX);
+
+		void Grow(const glm::vec3 &point)
+		{
+			minimum = glm::min(minimum, point);
+			maximum = glm::max(maximum, point);
+		}
+
+		void Grow(const Bounds &other)
+		{
+			minimum = glm::min(minimum, other.minimum);
+			maximum = glm::max(maximum, other.maximum);
+		}
+
+		float GetArea() const // Half the surface area, the SAH only compares them.
+		{
+			if (minimum.x > maximum.x)
+				return 0.0f;
+			glm::vec3 extent = maximum - minimum;
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	};
+
+	// Slab test, entry is where the ray enters the box, clamped to the origin.
+	bool IntersectBox(const glm::vec3 &origin, const glm::vec3 &inverseDirection, const glm::vec3 &minimum, const glm::vec3 &maximum,
+		float maxDistance, float &entry)
+	{
+		glm::vec3 t0 = (minimum - origin) * inverseDirection;
+		glm::vec3 t1 = (maximum - origin) * inverseDirection;
+		glm::vec3 nearest = glm::min(t0, t1), farthest = glm::max(t0, t1);
+		entry = std::max(std::max(nearest.x, nearest.y), std::max(nearest.z, 0.0f));
+		float exit = std::min(std::min(farthest.x, farthest.y), std::min(farthest.z, maxDistance));
+		return entry <= exit;
+	}
+
+	// Moller-Trumbore, hits from either side.
+	bool IntersectTriangle(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 *corners, float &distance)
+	{
+		glm::vec3 edge1 = corners[1] - corners[0], edge2 = corners[2] - corners[0];
+		glm::vec3 p = glm::cross(direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::fabs(determinant) < 1e-12f)
+			return false;
+
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = origin - corners[0];
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		distance = glm::dot(edge2, q) * inverse;
+		return distance > 0.0f;
+	}
+}
+
+void TriangleBvh::Build(std::vector<glm::vec3> &&positions)
+{
+	m_nodes.clear();
+	unsigned int triangleCount = (unsigned int)(positions.size() / 3);
+	if (triangleCount == 0)
+	{
+		m_positions.clear();
+		return;
+	}
+
+	std::vector<Bounds> bounds(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	std::vector<unsigned int> order(triangleCount);
+	for (unsigned int i = 0; i < triangleCount; i++)
+	{
+		for (unsigned int corner = 0; corner < 3; corner++)
+			bounds[i].Grow(positions[i * 3 + corner]);
+		centroids[i] = (bounds[i].minimum + bounds[i].maximum) * 0.5f;
+		order[i] = i;
+	}
+
+	m_nodes.reserve((size_t)triangleCount * 2);
+	m_nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), triangleCount });
+	std::vector<std::pair<unsigned int, unsigned int>> pending = { { 0u, 0u } }; // Node and its depth.
+	while (!pending.empty())
+	{
+		unsigned int index = pending.back().first, depth = pending.back().second;
+		pending.pop_back();
+		unsigned int first = m_nodes[index].first, count = m_nodes[index].count;
+
+		Bounds nodeBounds, centroidBounds;
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			nodeBounds.Grow(bounds[order[i]]);
+			centroidBounds.Grow(centroids[order[i]]);
+		}
+		m_nodes[index].minimum = nodeBounds.minimum;
+		m_nodes[index].maximum = nodeBounds.maximum;
+		if (count <= kMaxLeafTriangles || depth >= kMaxDepth)
+			continue;
+
+		// The cheapest split between bins of centroids along any axis, if it's any cheaper than leaving a leaf.
+		int bestAxis = -1;
+		unsigned int bestSplit = 0;
+		float bestCost = nodeBounds.GetArea() * count;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float lowest = centroidBounds.minimum[axis], extent = centroidBounds.maximum[axis] - lowest;
+			if (extent <= 0.0f)
+				continue;
+
+			Bounds bins[kBinCount];
+			unsigned int binCounts[kBinCount] = {};
+			float scale = kBinCount / extent;
+			for (unsigned int i = first; i < first + count; i++)
+			{
+				unsigned int bin = std::min((unsigned int)((centroids[order[i]][axis] - lowest) * scale), kBinCount - 1);
+				bins[bin].Grow(bounds[order[i]]);
+				binCounts[bin]++;
+			}
+
+			float rightCosts[kBinCount] = {};
+			Bounds right;
+			unsigned int rightCount = 0;
+			for (unsigned int bin = kBinCount - 1; bin > 0; bin--)
+			{
+				right.Grow(bins[bin]);
+				rightCount += binCounts[bin];
+				rightCosts[bin] = right.GetArea() * rightCount;
+			}
+
+			Bounds left;
+			unsigned int leftCount = 0;
+			for (unsigned int bin = 0; bin + 1 < kBinCount; bin++)
+			{
+				left.Grow(bins[bin]);
+				leftCount += binCounts[bin];
+				float cost = left.GetArea() * leftCount + rightCosts[bin + 1];
+				if (leftCount > 0 && leftCount < count && cost < bestCost)
+				{
+					bestAxis = axis;
+					bestSplit = bin + 1;
+					bestCost = cost;
+				}
+			}
+		}
+		if (bestAxis < 0)
+			continue;
+
+		float lowest = centroidBounds.minimum[bestAxis];
+		float scale = kBinCount / (centroidBounds.maximum[bestAxis] - lowest);
+		auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](unsigned int triangle)
+		{
+			return std::min((unsigned int)((centroids[triangle][bestAxis] - lowest) * scale), kBinCount - 1) < bestSplit;
+		});
+		unsigned int leftCount = (unsigned int)(middle - (order.begin() + first));
+
+		unsigned int left = (unsigned int)m_nodes.size();
+		m_nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), leftCount });
+		m_nodes.push_back({ glm::vec3(0.0f), first + leftCount, glm::vec3(0.0f), count - leftCount });
+		m_nodes[index].first = left;
+		m_nodes[index].count = 0;
+		pending.push_back({ left, depth + 1 });
+		pending.push_back({ left + 1, depth + 1 });
+	}
+
+	// Leaves' triangles end up next to each other.
+	m_positions.resize((size_t)triangleCount * 3);
+	for (unsigned int i = 0; i < triangleCount; i++)
+	{
+		for (unsigned int corner = 0; corner < 3; corner++)
+			m_positions[i * 3 + corner] = positions[order[i] * 3 + corner];
+	}
+	positions.clear();
+}
+
+void TriangleBvh::Clear()
+{
+	m_nodes.clear();
+	m_positions.clear();
+}
+
+bool TriangleBvh::Intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const
+{
+	return Trace<false>(origin, direction, maxDistance, hit);
+}
+
+bool TriangleBvh::IsOccluded(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const
+{
+	Hit hit;
+	return Trace<true>(origin, direction, maxDistance, hit);
+}
+
+glm::vec3 TriangleBvh::GetNormal(unsigned int triangle) const
+{
+	const glm::vec3 *corners = &m_positions[(size_t)triangle * 3];
+	glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+	float length = glm::length(normal);
+	return length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+template<bool AnyHit>
+bool TriangleBvh::Trace(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const
+{
+	float entry = 0.0f;
+	glm::vec3 inverseDirection = 1.0f / direction;
+	if (m_nodes.empty() || !IntersectBox(origin, inverseDirection, m_nodes[0].minimum, m_nodes[0].maximum, maxDistance, entry))
+		return false;
+
+	hit.distance = maxDistance;
+	bool found = false;
+	unsigned int stack[kMaxDepth + 2];
+	unsigned int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node &node = m_nodes[stack[--stackSize]];
+		if (node.count > 0)
+		{
+			for (unsigned int triangle = node.first; triangle < node.first + node.count; triangle++)
+			{
+				float distance = 0.0f;
+				if (IntersectTriangle(origin, direction, &m_positions[(size_t)triangle * 3], distance) && distance < hit.distance)
+				{
+					hit.distance = distance;
+					hit.triangle = triangle;
+					found = true;
+					if (AnyHit)
+						return true;
+				}
+			}
+			continue;
+		}
+
+		// The nearer child goes on the stack last so it's visited first, and shortens the ray for the other.
+		const Node &left = m_nodes[node.first], &right = m_nodes[node.first + 1];
+		float leftEntry = 0.0f, rightEntry = 0.0f;
+		bool hitLeft = IntersectBox(origin, inverseDirection, left.minimum, left.maximum, hit.distance, leftEntry);
+		bool hitRight = IntersectBox(origin, inverseDirection, right.minimum, right.maximum, hit.distance, rightEntry);
+		if (hitLeft && hitRight)
+		{
+			bool leftFirst = leftEntry <= rightEntry;
+			stack[stackSize++] = leftFirst ? node.first + 1 : node.first;
+			stack[stackSize++] = leftFirst ? node.first : node.first + 1;
+		}
+		else if (hitLeft || hitRight)
+		{
+			stack[stackSize++] = hitLeft ? node.first : node.first + 1;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Common.h"
+
+// Bounding volume hierarchy over a triangle soup, for tracing rays on the CPU. Built with binned SAH splits into one
+// array of nodes, each node's children next to each other. Read only once built, so any number of threads can trace
+// against it at once.
+class TriangleBvh
+{
+public:
+	static const unsigned int kMaxLeafTriangles = 4;
+	static const unsigned int kBinCount = 12; // Split candidates per axis.
+	static const unsigned int kMaxDepth = 60; // Nodes any deeper are left as leaves, so tracing never needs more stack.
+
+	struct Hit
+	{
+		float distance;
+		unsigned int triangle; // In the order the tree keeps them, for GetNormal.
+	};
+
+public:
+	// positions holds three corners per triangle, the tree keeps them in its own order.
+	void Build(std::vector<glm::vec3> &&positions);
+	void Clear();
+
+	// Nearest triangle the ray hits from either side within maxDistance. direction doesn't need to be normalised,
+	// distances are in multiples of it.
+	bool Intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const;
+	bool IsOccluded(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const; // Any hit at all.
+
+	glm::vec3 GetNormal(unsigned int triangle) const; // Normalised, wound anticlockwise.
+	unsigned int GetTriangleCount() const { return (unsigned int)(m_positions.size() / 3); }
+	unsigned int GetNodeCount() const { return (unsigned int)m_nodes.size(); }
+
+private:
+	struct Node
+	{
+		glm::vec3 minimum;
+		unsigned int first; // First triangle of a leaf, or the left child, the right child follows it.
+		glm::vec3 maximum;
+		unsigned int count; // Triangles in a leaf, zero for the rest.
+	};
+
+private:
+	template<bool AnyHit>
+	bool Trace(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const;
+
+private:
+	std::vector<Node> m_nodes;
+	std::vector<glm::vec3> m_positions;
+
+};
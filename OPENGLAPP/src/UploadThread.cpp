@@ -0,0 +1,147 @@
+#include "UploadThread.h"
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <glad.h>
+
+UploadThread &UploadThread::Get()
+{
+	static UploadThread uploader;
+	return uploader;
+}
+
+UploadThread::~UploadThread()
+{
+	// Only if the application bailed out without stopping it, GLFW is gone by now so the window is left alone.
+	if (m_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_condition.notify_all();
+		m_thread.join();
+	}
+}
+
+bool UploadThread::Start(GLFWwindow *sharedWindow)
+{
+	if (m_window != nullptr)
+		return true;
+
+	// The context version hints are still the ones the window was made with, which sharing needs anyway.
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	m_window = glfwCreateWindow(1, 1, "Upload", nullptr, sharedWindow);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (m_window == nullptr)
+	{
+		std::cout << "WARNING: " << "Couldn't create a shared context for uploads, they'll block the frame instead." << std::endl;
+		return false;
+	}
+
+	m_stopping = false;
+	m_thread = std::thread(&UploadThread::Loop, this);
+	return true;
+}
+
+void UploadThread::Stop()
+{
+	if (m_window == nullptr)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+
+	glfwDestroyWindow(m_window);
+	m_window = nullptr;
+}
+
+UploadThread::Ticket UploadThread::Submit(std::function<void()> work)
+{
+	Ticket ticket = std::make_shared<Upload>();
+	ticket->work = std::move(work);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.push_back(ticket);
+	}
+	m_condition.notify_one();
+	return ticket;
+}
+
+void UploadThread::Loop()
+{
+	glfwMakeContextCurrent(m_window);
+
+	while (true)
+	{
+		Ticket ticket;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+			if (m_queue.empty()) // Only once stopping, whatever's queued still goes up first.
+				break;
+			ticket = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		ticket->work();
+		ticket->work = nullptr;
+
+		// Flushed so the fence actually reaches the GPU, otherwise the render thread could wait on it forever.
+		ticket->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			ticket->issued = true;
+		}
+		m_issued.notify_all();
+	}
+
+	glfwMakeContextCurrent(nullptr);
+}
+
+bool UploadThread::IsResident(const Ticket &ticket)
+{
+	if (ticket->resident)
+		return true;
+	if (!ticket->issued)
+		return false;
+
+	GLenum status = glClientWaitSync((GLsync)ticket->fence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+
+	glDeleteSync((GLsync)ticket->fence);
+	ticket->fence = nullptr;
+	ticket->resident = true;
+	return true;
+}
+
+void UploadThread::Wait(const Ticket &ticket)
+{
+	if (ticket->resident)
+		return;
+
+	UploadThread &uploader = Get();
+	{
+		std::unique_lock<std::mutex> lock(uploader.m_mutex);
+		uploader.m_issued.wait(lock, [&ticket]() { return ticket->issued.load(); });
+	}
+
+	const GLuint64 timeout = 100000000; // Nanoseconds, just so it isn't one endless call.
+	while (glClientWaitSync((GLsync)ticket->fence, 0, timeout) == GL_TIMEOUT_EXPIRED)
+		;
+	glDeleteSync((GLsync)ticket->fence);
+	ticket->fence = nullptr;
+	ticket->resident = true;
+}
+
+unsigned int UploadThread::GetQueuedCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return (unsigned int)m_queue.size();
+}
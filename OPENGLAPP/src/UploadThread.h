@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Common.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <deque>
+
+struct GLFWwindow;
+
+// A thread with its own GL context, shared with the window's, that buffer and texture uploads are handed to so the
+// driver's copies never hold up a frame. Each upload is fenced once it's issued, and only counts as resident when the
+// render thread sees that fence signalled, so nothing is drawn from a half filled object. Vertex arrays aren't shared
+// between contexts, whoever submits makes those on the render thread.
+class UploadThread
+{
+public:
+	struct Upload
+	{
+		std::function<void()> work; // Cleared once it has run, so whatever it captured is freed on the loader thread.
+		std::atomic<bool> issued { false };
+		void *fence = nullptr; // GLsync, made once the work is issued.
+		bool resident = false; // Render thread only.
+	};
+	using Ticket = std::shared_ptr<Upload>;
+
+public:
+	~UploadThread();
+
+	static UploadThread &Get(); // Shared loader, created on first use.
+
+	// Makes a hidden window sharing the given one's context and starts the thread. If that fails, nothing is submitted
+	// and everyone uploads in place as before.
+	bool Start(GLFWwindow *sharedWindow);
+	void Stop(); // Finishes what's queued and destroys the context, call before the window goes.
+	bool IsRunning() const { return m_window != nullptr; }
+
+	// Anything thread safe can submit. work runs on the loader thread with its context current.
+	Ticket Submit(std::function<void()> work);
+
+	// Render thread only. IsResident never blocks, Wait does until the upload is resident.
+	static bool IsResident(const Ticket &ticket);
+	static void Wait(const Ticket &ticket);
+
+	unsigned int GetQueuedCount(); // Submitted but not issued yet.
+
+private:
+	void Loop();
+
+private:
+	GLFWwindow *m_window = nullptr;
+	std::thread m_thread;
+	std::deque<Ticket> m_queue;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition; // Work queued, or stopping.
+	std::condition_variable m_issued; // An upload has been issued, for Wait.
+	bool m_stopping = false;
+
+};
@@ -0,0 +1,139 @@
+#include "VertexAnimationTexture.h"
+
+#include "SkinnedMesh.h"
+#include "Animation.h"
+#include "Shader.h"
+#include "ThreadPool.h"
+#include "SamplerCache.h"
+
+#include <cmath>
+
+#include <glad.h>
+
+VertexAnimationTexture::VertexAnimationTexture()
+{ }
+VertexAnimationTexture::~VertexAnimationTexture()
+{
+	Release();
+}
+
+void VertexAnimationTexture::Release()
+{
+	glDeleteTextures(1, &m_positionTexture);
+	glDeleteTextures(1, &m_normalTexture);
+	glDeleteBuffers(1, &m_clipBuffer);
+	m_positionTexture = m_normalTexture = m_clipBuffer = 0;
+	m_clips.clear();
+	m_vertexCount = m_frameCount = m_height = 0;
+}
+
+bool VertexAnimationTexture::Bake(SkinnedMesh &mesh, float frameRate)
+{
+	Release();
+
+	const std::vector<CompressedClip> &sourceClips = mesh.GetClips();
+	const std::vector<Mesh::Vertex> &bindVertices = mesh.GetBindVertices();
+	const std::vector<SkinnedMesh::SkinWeights> &skinWeights = mesh.GetSkinWeights();
+	unsigned int vertexCount = (unsigned int)skinWeights.size();
+	if (sourceClips.empty() || vertexCount == 0 || bindVertices.size() != vertexCount)
+	{
+		std::cout << "WARNING: " << "Nothing to bake, the mesh has no clips." << std::endl;
+		return false;
+	}
+
+	// Each clip gets whole frames at close to the rate asked for. It loops, so the frame at its end is its first.
+	struct Frame
+	{
+		int clip;
+		float time;
+	};
+	std::vector<Frame> frames;
+	for (int c = 0; c < (int)sourceClips.size(); c++)
+	{
+		float duration = sourceClips[c].GetDuration();
+		int frameCount = std::max(1, (int)std::ceil(duration * frameRate));
+		m_clips.push_back({ (int)frames.size(), frameCount, duration > 0.0f ? frameCount / duration : 0.0f, duration });
+		for (int f = 0; f < frameCount; f++)
+			frames.push_back({ c, duration > 0.0f ? f * duration / frameCount : 0.0f });
+	}
+
+	uint64_t texels = (uint64_t)frames.size() * vertexCount;
+	uint64_t height = (texels + kWidth - 1) / kWidth;
+	int maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (height > (uint64_t)maxSize)
+	{
+		std::cout << "WARNING: " << "Baked animation needs " << height << " rows, more than the " << maxSize << " a texture can have." << std::endl;
+		m_clips.clear();
+		return false;
+	}
+
+	std::vector<glm::vec4> positions((size_t)height * kWidth, glm::vec4(0.0f));
+	std::vector<glm::vec4> normals((size_t)height * kWidth, glm::vec4(0.0f));
+	unsigned int boneCount = mesh.GetSkeleton().GetBoneCount();
+	ThreadPool::Get().ParallelFor(frames.size(), 1, [&](size_t begin, size_t end)
+	{
+		// Each task poses its own animator, they only share the mesh, which is only read.
+		Animator animator(&mesh);
+		animator.GetPaused() = true;
+		std::vector<glm::mat4> palette(boneCount);
+		std::vector<Mesh::Vertex> skinned(vertexCount);
+		for (size_t f = begin; f < end; f++)
+		{
+			if (animator.GetClip() != frames[f].clip)
+				animator.SetClip(frames[f].clip);
+			animator.GetTime() = frames[f].time;
+			animator.Evaluate(0.0f, palette.data());
+			SkinnedMesh::SkinVertices(bindVertices.data(), skinWeights.data(), vertexCount, palette.data(), skinned.data());
+
+			glm::vec4 *position = positions.data() + f * vertexCount;
+			glm::vec4 *normal = normals.data() + f * vertexCount;
+			for (unsigned int v = 0; v < vertexCount; v++)
+			{
+				position[v] = glm::vec4(glm::vec3(skinned[v].position), 1.0f);
+				glm::vec3 n = glm::vec3(skinned[v].normal);
+				float length = glm::length(n);
+				normal[v] = glm::vec4(length > 0.0f ? n / length : n, 0.0f);
+			}
+		}
+	});
+
+	// Fetched by index, never filtered, so there's one level and the Data sampler.
+	auto createTexture = [this](unsigned int &texture, GLenum internalFormat, const std::vector<glm::vec4> &texels)
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+		glTextureStorage2D(texture, 1, internalFormat, kWidth, (GLsizei)m_height);
+		glTextureSubImage2D(texture, 0, 0, 0, kWidth, (GLsizei)m_height, GL_RGBA, GL_FLOAT, texels.data());
+	};
+	m_vertexCount = vertexCount;
+	m_frameCount = (unsigned int)frames.size();
+	m_height = (unsigned int)height;
+	createTexture(m_positionTexture, GL_RGBA32F, positions);
+	createTexture(m_normalTexture, GL_RGBA16F, normals);
+
+	glGenBuffers(1, &m_clipBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_clipBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(m_clips.size() * sizeof(Clip)), m_clips.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return true;
+}
+
+void VertexAnimationTexture::Bind(aie::ShaderProgram *shader) const
+{
+	glActiveTexture(GL_TEXTURE0 + kPositionUnit);
+	glBindTexture(GL_TEXTURE_2D, m_positionTexture);
+	glActiveTexture(GL_TEXTURE0 + kNormalUnit);
+	glBindTexture(GL_TEXTURE_2D, m_normalTexture);
+	glActiveTexture(GL_TEXTURE0);
+	SamplerCache::Get().Bind(kPositionUnit, SamplerState::Data());
+	SamplerCache::Get().Bind(kNormalUnit, SamplerState::Data());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kClipBinding, m_clipBuffer);
+
+	if (shader->getUniform("vatVertexCount") >= 0)
+		shader->bindUniform("vatVertexCount", (int)m_vertexCount);
+}
+
+size_t VertexAnimationTexture::GetSize() const
+{
+	return (size_t)m_height * kWidth * (16 + 8); // RGBA32F positions and RGBA16F normals.
+}
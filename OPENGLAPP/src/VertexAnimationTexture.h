@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Common.h"
+
+namespace aie
+{
+	class ShaderProgram;
+}
+
+class SkinnedMesh;
+
+// A skinned mesh's clips baked into textures, the skinned position and normal of every vertex in every frame, so a
+// vertex shader can play them back without a skeleton. Frames follow each other a vertex per texel, wrapping onto a
+// new row every kWidth texels, so a vertex's texel in a frame is just (frame * vertexCount + vertex).
+class VertexAnimationTexture
+{
+public:
+	static const unsigned int kWidth = 4096; // Texels per row.
+	static const unsigned int kPositionUnit = 3; // Texture units, after the material maps.
+	static const unsigned int kNormalUnit = 4;
+	static const unsigned int kClipBinding = 4; // VatClipSBO in the crowd shader.
+
+	// Where a clip's frames are, as VatClipSBO lays it out.
+	struct Clip
+	{
+		int firstFrame;
+		int frameCount;
+		float frameRate; // Adjusted so the frames divide the clip exactly and it loops cleanly.
+		float duration; // Seconds.
+	};
+
+public:
+	VertexAnimationTexture();
+	~VertexAnimationTexture();
+
+	VertexAnimationTexture(const VertexAnimationTexture &) = delete;
+	VertexAnimationTexture &operator=(const VertexAnimationTexture &) = delete;
+
+	// Poses the mesh at each frame of every clip across the thread pool and uploads the result. Returns false if the
+	// mesh has no clips or the frames don't fit in the largest texture the driver allows.
+	bool Bake(SkinnedMesh &mesh, float frameRate = 30.0f);
+
+	// Binds the textures, clip table and vertex count for the crowd shader.
+	void Bind(aie::ShaderProgram *shader) const;
+
+	unsigned int GetVertexCount() const { return m_vertexCount; }
+	unsigned int GetFrameCount() const { return m_frameCount; }
+	const std::vector<Clip> &GetClips() const { return m_clips; }
+	size_t GetSize() const; // Bytes of texture memory.
+
+private:
+	void Release();
+
+private:
+	std::vector<Clip> m_clips;
+	unsigned int m_vertexCount = 0;
+	unsigned int m_frameCount = 0; // Every clip.
+	unsigned int m_height = 0; // Rows in both textures.
+
+	unsigned int m_positionTexture = 0; // RGBA32F.
+	unsigned int m_normalTexture = 0; // RGBA16F.
+	unsigned int m_clipBuffer = 0;
+
+};
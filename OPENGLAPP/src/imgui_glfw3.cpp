@@ -69,6 +69,10 @@ void ImGui_RenderDrawLists(ImDrawData* draw_data) {
         return;
     draw_data->ScaleClipRects(io.DisplayFramebufferScale);
 
+    // The font texture's own filtering rather than whatever sampler the scene left on the unit
+    GLint last_sampler; glGetIntegerv(GL_SAMPLER_BINDING, &last_sampler);
+    glBindSampler(0, 0);
+
     // Setup viewport, orthographic projection matrix
     glViewport(0, 0, (GLsizei)fb_width, (GLsizei)fb_height);
     const float ortho_projection[4][4] = {
@@ -107,6 +111,7 @@ void ImGui_RenderDrawLists(ImDrawData* draw_data) {
     // Restore modified GL state
     glUseProgram(last_program);
     glBindTexture(GL_TEXTURE_2D, last_texture);
+    glBindSampler(0, last_sampler);
     glBindVertexArray(last_vertex_array);
     glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, last_element_array_buffer);
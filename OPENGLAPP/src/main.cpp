@@ -15,12 +15,29 @@ using aie::Gizmos;
 #include "Texture.h"
 #include "Shader.h"
 #include "Mesh.h"
+#include "AssetManager.h"
+#include "TextureStreamer.h"
+#include "TextureResidency.h"
+#include "TextureArrays.h"
+#include "SamplerCache.h"
+#include "EnvironmentMap.h"
+#include "ProbeVolume.h"
+#include "UploadThread.h"
+#include "ClusterMesh.h"
+#include "PointCloud.h"
+#include "SkinnedMesh.h"
+#include "CrowdMesh.h"
+#include "Animation.h"
 #include "Instance.h"
 #include "Scene.h"
 #include "Camera.h"
 #include "Light.h"
 #include "ParticleSystem.h"
 
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+
 // TODO: Solar system could be it's own class, takes up a lot of space. Whole file could generally be a lot cleaner.
 
 // TODO: Shadow rendering.
@@ -82,6 +99,22 @@ protected:
 			return false;
 		}
 
+		m_skinnedShader.loadShader(aie::eShaderStage::VERTEX, "./res/shaders/skinned.vert");
+		m_skinnedShader.loadShader(aie::eShaderStage::FRAGMENT, "./res/shaders/pbr.frag");
+		if (m_skinnedShader.link() == false)
+		{
+			std::cout << "Error whilst linking shader program: " << m_skinnedShader.getLastError() << std::endl;
+			return false;
+		}
+
+		m_crowdShader.loadShader(aie::eShaderStage::VERTEX, "./res/shaders/crowd.vert");
+		m_crowdShader.loadShader(aie::eShaderStage::FRAGMENT, "./res/shaders/pbr.frag");
+		if (m_crowdShader.link() == false)
+		{
+			std::cout << "Error whilst linking shader program: " << m_crowdShader.getLastError() << std::endl;
+			return false;
+		}
+
 		m_textureShader.loadShader(aie::eShaderStage::VERTEX, "./res/shaders/texture.vert");
 		m_textureShader.loadShader(aie::eShaderStage::FRAGMENT, "./res/shaders/texture.frag");
 		if (m_textureShader.link() == false)
@@ -98,6 +131,14 @@ protected:
 			return false;
 		}
 
+		m_pointShader.loadShader(aie::eShaderStage::VERTEX, "./res/shaders/point.vert");
+		m_pointShader.loadShader(aie::eShaderStage::FRAGMENT, "./res/shaders/point.frag");
+		if (m_pointShader.link() == false)
+		{
+			std::cout << "Error whilst linking shader program: " << m_pointShader.getLastError() << std::endl;
+			return false;
+		}
+
 		// Create and initialize render objects.
 		m_fullscreenMesh.InitializeFullscreenQuad(); // For post processing, unused.
 
@@ -119,6 +160,10 @@ protected:
 		m_sunLight.color = { 1.5f, 1.5f, 1.5f, 1.0f };
 		m_scene = new Scene(&m_camera, m_sunLight, { 0.25f, 0.25f, 0.25f });
 
+		// Lit by the environment if there is one, otherwise by the flat ambient colour.
+		if (m_environment.Load("./res/textures/environment.hdr"))
+			m_scene->SetEnvironment(&m_environment);
+
 		for (int i = -4; i <= 4; i++)
 		{
 			m_scene->AddInstance(new Instance(glm::translate(glm::mat4(1.0f), { i * 2.5f, 0.0f, 0.0f }), &m_spearMesh, &m_shader));
@@ -156,6 +201,9 @@ protected:
 	{
 		delete m_emitter; m_emitter = nullptr;
 		delete m_scene; m_scene = nullptr;
+		m_environment.Release();
+		m_probeVolume.Release();
+		AssetManager::Get().Release();
 
 		aie::ImGui_Shutdown();
 
@@ -196,7 +244,11 @@ protected:
 
 		m_emitter->Update(dt, m_camera.GetViewMatrixFromQuaternion());
 
+		TextureStreamer::Get().Update();
 		m_scene->Update(dt);
+		TextureResidency::Get().Update(); // After the scene's asked for the detail it needs.
+		if (m_bakeProbeChanges && m_probeVolume.IsBaked())
+			m_probeVolume.Bake(*m_scene); // Only near whatever moved, if anything did.
 			
 		#pragma region IMGUI_WINDOWS
 		// ImGui light settings window.
@@ -206,6 +258,12 @@ protected:
 
 		glm::vec3 &ambientLight = m_scene->GetAmbientLight();
 		ImGui::DragFloat3("Ambient Light Colour", &ambientLight[0], 0.1f);
+		if (m_environment.IsLoaded())
+		{
+			bool useEnvironment = m_scene->GetEnvironment() != nullptr;
+			if (ImGui::Checkbox("Image Based Lighting", &useEnvironment))
+				m_scene->SetEnvironment(useEnvironment ? &m_environment : nullptr);
+		}
 
 		ImGui::DragFloat3("Sunlight Direction", &m_sunLight.direction[0], 0.1f, -1.0f, 1.0f);
 		ImGui::DragFloat3("Sunlight Colour", &m_sunLight.color[0], 0.1f);
@@ -316,11 +374,8 @@ protected:
 			if (ImGui::Button("Add"))
 			{
 				Mesh::PrimitiveID selectedType = (Mesh::PrimitiveID)e;
-				// TODO: need to eventually delete this mesh along with the instance, 
-				// can't use a stack allocated mesh since it pretty much immediately goes out of scope and gets deleted causing a crash.
-				// could also have preallocated meshes that these reuse.
-				Mesh *mesh = new Mesh();
-				mesh->InitializePrimitive(selectedType);
+				// Every primitive of a type shares one mesh, freed with the last instance using it.
+				std::shared_ptr<Mesh> mesh = AssetManager::Get().GetPrimitive(selectedType);
 				mesh->LoadMaterial("./res/models/stanford/Dragon.mtl");
 				m_scene->AddInstance(new Instance(glm::mat4(1.0f), mesh, &m_textureShader));
 
@@ -334,8 +389,234 @@ protected:
 			ImGui::EndPopup();
 		}
 
+		ImGui::SameLine();
+		if (ImGui::Button("Add Scan"))
+			ImGui::OpenPopup("Scan_Add");
+
+		if (ImGui::BeginPopup("Scan_Add"))
+		{
+			// Streamed from a cluster DAG, the first load of a scan cooks it which can take a while.
+			static char scanPath[256] = "./res/models/stanford/Lucy.ply";
+			ImGui::InputText("Path", scanPath, sizeof(scanPath));
+
+			if (ImGui::Button("Add"))
+			{
+				std::shared_ptr<ClusterMesh> mesh = std::make_shared<ClusterMesh>();
+				if (mesh->Load(scanPath))
+				{
+					std::string materialPath = std::string(scanPath).substr(0, std::string(scanPath).find_last_of('.')) + ".mtl";
+					mesh->LoadMaterial(materialPath.c_str());
+					m_scene->AddInstance(new Instance(glm::mat4(1.0f), mesh, &m_shader));
+				}
+				ImGui::CloseCurrentPopup();
+			}
+
+			if (ImGui::Button("Cancel"))
+				ImGui::CloseCurrentPopup();
+
+			ImGui::EndPopup();
+		}
+
+		ImGui::SameLine();
+		if (ImGui::Button("Add Point Cloud"))
+			ImGui::OpenPopup("PointCloud_Add");
+
+		if (ImGui::BeginPopup("PointCloud_Add"))
+		{
+			// Streamed from an octree, the first load of a cloud cooks it which can take a while.
+			static char cloudPath[256] = "./res/models/stanford/Lucy.ply";
+			ImGui::InputText("Path", cloudPath, sizeof(cloudPath));
+
+			if (ImGui::Button("Add"))
+			{
+				std::shared_ptr<PointCloud> cloud = std::make_shared<PointCloud>();
+				if (cloud->Load(cloudPath))
+					m_scene->AddInstance(new Instance(glm::mat4(1.0f), cloud, &m_pointShader));
+				ImGui::CloseCurrentPopup();
+			}
+
+			if (ImGui::Button("Cancel"))
+				ImGui::CloseCurrentPopup();
+
+			ImGui::EndPopup();
+		}
+
+		ImGui::SameLine();
+		if (ImGui::Button("Add Model"))
+			ImGui::OpenPopup("Model_Add");
+
+		if (ImGui::BeginPopup("Model_Add"))
+		{
+			// Progressive loads show a coarse version straight away and refine it as the rest streams in.
+			static char modelPath[256] = "./res/models/stanford/Dragon.obj";
+			static bool progressive = true;
+			ImGui::InputText("Path", modelPath, sizeof(modelPath));
+			ImGui::Checkbox("Progressive", &progressive);
+
+			if (ImGui::Button("Add"))
+			{
+				AssetManager::MeshOptions options;
+				options.progressive = progressive;
+				std::shared_ptr<Mesh> mesh = AssetManager::Get().GetMesh(modelPath, options);
+				std::string materialPath = std::string(modelPath).substr(0, std::string(modelPath).find_last_of('.')) + ".mtl";
+				std::error_code error;
+				if (std::filesystem::exists(materialPath, error)) // glTF and assimp models bring their own materials.
+					mesh->LoadMaterial(materialPath.c_str());
+				m_scene->AddInstance(new Instance(glm::mat4(1.0f), mesh, &m_shader));
+				ImGui::CloseCurrentPopup();
+			}
+
+			if (ImGui::Button("Cancel"))
+				ImGui::CloseCurrentPopup();
+
+			ImGui::EndPopup();
+		}
+
+		ImGui::SameLine();
+		if (ImGui::Button("Add Animated Model"))
+			ImGui::OpenPopup("Animated_Add");
+
+		if (ImGui::BeginPopup("Animated_Add"))
+		{
+			// Anything assimp reads with bones, each instance plays its own clip.
+			static char animatedPath[256] = "./res/models/character.fbx";
+			ImGui::InputText("Path", animatedPath, sizeof(animatedPath));
+
+			if (ImGui::Button("Add"))
+			{
+				std::shared_ptr<SkinnedMesh> mesh = std::make_shared<SkinnedMesh>();
+				if (mesh->Load(animatedPath))
+					m_scene->AddInstance(new Instance(glm::mat4(1.0f), mesh, &m_skinnedShader));
+				ImGui::CloseCurrentPopup();
+			}
+
+			if (ImGui::Button("Cancel"))
+				ImGui::CloseCurrentPopup();
+
+			ImGui::EndPopup();
+		}
+
+		ImGui::SameLine();
+		if (ImGui::Button("Add Crowd"))
+			ImGui::OpenPopup("Crowd_Add");
+
+		if (ImGui::BeginPopup("Crowd_Add"))
+		{
+			// One animated model baked once and drawn as a grid of agents, each on a random clip, phase and pace.
+			static char crowdPath[256] = "./res/models/character.fbx";
+			static int crowdCount = 1000;
+			static float crowdSpacing = 2.0f;
+			ImGui::InputText("Path", crowdPath, sizeof(crowdPath));
+			ImGui::DragInt("Agents", &crowdCount, 10.0f, 1, 100000);
+			ImGui::DragFloat("Spacing", &crowdSpacing, 0.1f, 0.1f, 100.0f);
+
+			if (ImGui::Button("Add"))
+			{
+				std::shared_ptr<SkinnedMesh> source = std::make_shared<SkinnedMesh>();
+				std::shared_ptr<CrowdMesh> crowd = std::make_shared<CrowdMesh>();
+				if (source->Load(crowdPath) && crowd->Load(source))
+				{
+					int clipCount = (int)source->GetClips().size();
+					int columns = (int)std::ceil(std::sqrt((float)crowdCount));
+					for (int i = 0; i < crowdCount; i++)
+					{
+						glm::vec3 position = glm::vec3((i % columns) - columns * 0.5f, 0.0f, (i / columns) - columns * 0.5f) * crowdSpacing;
+						glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), position), glm::radians((float)(rand() % 360)), glm::vec3(0, 1, 0));
+						crowd->AddAgent(transform, rand() % clipCount, (float)(rand() % 1000) / 100.0f, 0.8f + (float)(rand() % 5) / 10.0f);
+					}
+					m_scene->AddInstance(new Instance(glm::mat4(1.0f), crowd, &m_crowdShader));
+				}
+				ImGui::CloseCurrentPopup();
+			}
+
+			if (ImGui::Button("Cancel"))
+				ImGui::CloseCurrentPopup();
+
+			ImGui::EndPopup();
+		}
+
+		if (ImGui::CollapsingHeader("Probe Volume"))
+		{
+			float spacing = m_probeVolume.GetSpacing();
+			if (ImGui::DragFloat("Spacing", &spacing, 0.1f, 0.1f, 100.0f))
+				m_probeVolume.SetSpacing(spacing);
+			if (ImGui::Button("Bake All"))
+			{
+				m_probeVolume.Bake(*m_scene, true);
+				m_scene->SetProbeVolume(&m_probeVolume);
+			}
+			ImGui::SameLine();
+			ImGui::Checkbox("Bake Changes", &m_bakeProbeChanges);
+
+			if (m_probeVolume.IsBaked())
+			{
+				bool useProbes = m_scene->GetProbeVolume() != nullptr;
+				if (ImGui::Checkbox("Use Probes", &useProbes))
+					m_scene->SetProbeVolume(useProbes ? &m_probeVolume : nullptr);
+				glm::uvec3 counts = m_probeVolume.GetProbeCounts();
+				ImGui::Text("%u x %u x %u probes, %u triangles", counts.x, counts.y, counts.z, m_probeVolume.GetTriangleCount());
+				ImGui::Text("Last bake: %u probes in %.1f ms", m_probeVolume.GetLastBakedCount(), m_probeVolume.GetLastBakeTime());
+			}
+		}
+
+		if (ImGui::CollapsingHeader("Texture Streaming"))
+		{
+			TextureStreamer &streamer = TextureStreamer::Get();
+			int budget = (int)(streamer.GetByteBudget() / 1024);
+			if (ImGui::DragInt("Budget (KB/frame)", &budget, 64.0f, 64, 256 * 1024))
+				streamer.SetByteBudget((size_t)budget * 1024);
+			ImGui::Text("Pending: %u, %.1f KB last frame", streamer.GetPendingCount(), streamer.GetUploadedBytes() / 1024.0f);
+			if (UploadThread::Get().IsRunning())
+				ImGui::Text("Upload thread: %u queued", UploadThread::Get().GetQueuedCount());
+
+			SamplerCache &samplers = SamplerCache::Get();
+			float anisotropy = samplers.GetAnisotropy();
+			if (ImGui::SliderFloat("Anisotropy", &anisotropy, 1.0f, samplers.GetMaxAnisotropy(), "%.0fx"))
+				samplers.SetAnisotropy(anisotropy);
+			ImGui::Text("Samplers: %u", samplers.GetSamplerCount());
+		}
+
+		if (ImGui::CollapsingHeader("Texture Residency"))
+		{
+			TextureResidency &residency = TextureResidency::Get();
+			const float megabyte = 1024.0f * 1024.0f;
+			int videoBudget = (int)(residency.GetVideoBudget() / (1024 * 1024));
+			if (ImGui::DragInt("Video Budget (MB)", &videoBudget, 1.0f, 1, 8192))
+				residency.SetVideoBudget((size_t)videoBudget * 1024 * 1024);
+			int systemBudget = (int)(residency.GetSystemBudget() / (1024 * 1024));
+			if (ImGui::DragInt("System Budget (MB)", &systemBudget, 1.0f, 0, 8192))
+				residency.SetSystemBudget((size_t)systemBudget * 1024 * 1024);
+
+			char overlay[64];
+			snprintf(overlay, sizeof(overlay), "%.1f / %.0f MB", residency.GetVideoBytes() / megabyte, videoBudget * 1.0f);
+			ImGui::ProgressBar(std::min(residency.GetVideoBytes() / (videoBudget * megabyte), 1.0f), ImVec2(-1, 0), overlay);
+			snprintf(overlay, sizeof(overlay), "%.1f / %.0f MB", residency.GetSystemBytes() / megabyte, systemBudget * 1.0f);
+			ImGui::ProgressBar(systemBudget > 0 ? std::min(residency.GetSystemBytes() / (systemBudget * megabyte), 1.0f) : 0.0f, ImVec2(-1, 0), overlay);
+
+			TextureArrays &arrays = TextureArrays::Get();
+			ImGui::Text("Texture arrays: %u, %u maps packed, %.1f MB", arrays.GetArrayCount(), arrays.GetPackedCount(), arrays.GetSize() / megabyte);
+
+			static std::vector<TextureResidency::Stats> stats;
+			residency.GetStats(stats);
+			if (ImGui::TreeNode("Textures", "Textures (%u)", residency.GetTrackedCount()))
+			{
+				for (const TextureResidency::Stats &stat : stats)
+				{
+					ImGui::Text("%s", std::filesystem::path(stat.filePath).filename().string().c_str());
+					ImGui::SameLine();
+					if (stat.wantedLevel < stat.levelCount)
+						ImGui::TextDisabled("mip %u/%u, wants %u, %.2f MB%s%s", stat.residentLevel, stat.levelCount, stat.wantedLevel, stat.videoBytes / megabyte, stat.inSystemMemory ? ", in RAM" : "", stat.loading ? ", reading" : "");
+					else
+						ImGui::TextDisabled("mip %u/%u, unseen, %.2f MB%s%s", stat.residentLevel, stat.levelCount, stat.videoBytes / megabyte, stat.inSystemMemory ? ", in RAM" : "", stat.loading ? ", reading" : "");
+				}
+				ImGui::TreePop();
+			}
+		}
+
 		if (ImGui::CollapsingHeader("Instances in Scene"))
 		{
+			ImGui::DragFloat("LOD Error (px)", &m_scene->GetLodErrorThreshold(), 0.1f, 0.0f, 64.0f);
+			ImGui::DragFloat("LOD Fade Time", &m_scene->GetLodFadeTime(), 0.01f, 0.0f, 2.0f);
 			ImGui::Separator();
 			ImGui::Indent();
 			for (int i = 0; i < m_scene->GetNumInstances(); i++)
@@ -354,6 +635,56 @@ protected:
 					ImGui::DragFloat3("Position", &position[0], 0.1f);
 					ImGui::DragFloat3("Rotation", &rotation[0], 0.1f);
 					ImGui::DragFloat3("Scale", &scale[0], 0.1f);
+					if (instance->GetMesh()->IsLoading())
+						ImGui::Text("Loading...");
+					if (instance->GetMesh()->GetLodCount() > 1)
+						ImGui::Text("LOD: %u / %u", instance->GetLod(), instance->GetMesh()->GetLodCount() - 1);
+					if (ClusterMesh *clusterMesh = dynamic_cast<ClusterMesh *>(instance->GetMesh()))
+					{
+						ImGui::Text("Triangles: %llu / %llu", (unsigned long long)clusterMesh->GetDrawnTriangleCount(), (unsigned long long)clusterMesh->GetFullTriangleCount());
+						ImGui::Text("Pages: %u / %u resident", clusterMesh->GetResidentPageCount(), clusterMesh->GetPageCount());
+					}
+					if (PointCloud *pointCloud = dynamic_cast<PointCloud *>(instance->GetMesh()))
+					{
+						int pointBudget = (int)pointCloud->GetPointBudget();
+						if (ImGui::DragInt("Point Budget", &pointBudget, 10000.0f, 100000, 50000000))
+							pointCloud->SetPointBudget((unsigned int)pointBudget);
+						ImGui::DragFloat("Point Size", &pointCloud->GetPointSize(), 0.01f, 0.1f, 4.0f);
+						ImGui::Text("Points: %llu / %llu", (unsigned long long)pointCloud->GetDrawnPointCount(), (unsigned long long)pointCloud->GetPointCount());
+						ImGui::Text("Nodes: %u drawn, %u / %u resident", pointCloud->GetDrawnNodeCount(), pointCloud->GetResidentNodeCount(), pointCloud->GetNodeCount());
+					}
+					if (CrowdMesh *crowdMesh = dynamic_cast<CrowdMesh *>(instance->GetMesh()))
+					{
+						const VertexAnimationTexture &animationTexture = crowdMesh->GetAnimationTexture();
+						ImGui::Text("Agents: %u in %u draw calls", crowdMesh->GetAgentCount(), crowdMesh->GetDrawCallCount());
+						ImGui::Text("Baked: %u frames, %.1f MB", animationTexture.GetFrameCount(), animationTexture.GetSize() / (1024.0f * 1024.0f));
+					}
+					if (Animator *animator = instance->GetAnimator())
+					{
+						SkinnedMesh *skinnedMesh = animator->GetMesh();
+						const std::vector<CompressedClip> &clips = skinnedMesh->GetClips();
+						int clip = animator->GetClip();
+						auto clipName = [](void *data, int index, const char **text)
+						{
+							*text = (*(const std::vector<CompressedClip> *)data)[index].GetName().c_str();
+							return true;
+						};
+						if (ImGui::Combo("Clip", &clip, clipName, (void *)&clips, (int)clips.size()))
+							animator->SetClip(clip);
+						if (clip >= 0)
+						{
+							ImGui::SliderFloat("Time", &animator->GetTime(), 0.0f, clips[clip].GetDuration());
+							ImGui::Text("Clip: %u tracks, %.1f KB", clips[clip].GetTrackCount(), clips[clip].GetSize() / 1024.0f);
+						}
+						ImGui::DragFloat("Speed", &animator->GetSpeed(), 0.01f, -4.0f, 4.0f);
+						ImGui::Checkbox("Loop", &animator->GetLooping());
+						ImGui::SameLine();
+						ImGui::Checkbox("Pause", &animator->GetPaused());
+						bool gpuSkinning = skinnedMesh->IsGpuSkinning();
+						if (ImGui::Checkbox("GPU Skinning", &gpuSkinning)) // Shared by every instance of the mesh.
+							skinnedMesh->SetGpuSkinning(gpuSkinning);
+						ImGui::Text("Bones: %u", animator->GetBoneCount());
+					}
 					if (ImGui::Button("Delete Instance"))
 					{
 						m_scene->RemoveInstance(instance);
@@ -565,8 +896,7 @@ protected:
 			m_textureShader.bindUniform("mvp", pv * m_quadTransform);
 			m_textureShader.bindUniform("view", m_camera.GetViewMatrixFromQuaternion());
 			m_textureShader.bindUniform("model", m_quadTransform);
-			m_renderTarget.getTarget(0).bind(8);
-			m_textureShader.bindUniform("diffuseTex", 8);
+			m_renderTarget.getTarget(0).bind(0); // The unit diffuseTex is bound to in the shader.
 			m_quadMesh.Draw();
 
 			// Draw Particle Emitter.
@@ -633,8 +963,11 @@ private:
 
 	aie::ShaderProgram m_postProcessShader;
 	aie::ShaderProgram m_shader;
+	aie::ShaderProgram m_skinnedShader;
+	aie::ShaderProgram m_crowdShader;
 	aie::ShaderProgram m_textureShader;
 	aie::ShaderProgram m_particleShader;
+	aie::ShaderProgram m_pointShader;
 
 	glm::mat4 m_quadTransform;
 	glm::mat4 m_spearTransform;
@@ -648,6 +981,9 @@ private:
 	ParticleEmitter *m_emitter;
 
 	Scene *m_scene;
+	EnvironmentMap m_environment;
+	ProbeVolume m_probeVolume;
+	bool m_bakeProbeChanges = true;
 
 	SunLight m_sunLight;
 